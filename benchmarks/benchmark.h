@@ -0,0 +1,28 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <chrono>
+
+// Timings of the benchmarks target: BENCHMARK(name) registers a function that prints
+// its results and returns the exit code. `benchmarks name [arguments]` runs one with
+// the arguments after its name, `benchmarks` all of them with their defaults.
+
+typedef int (*BenchmarkFunc)(int argc, char** argv);
+
+struct BenchmarkRegistration {
+    BenchmarkRegistration(const char* name, BenchmarkFunc func);
+};
+
+#define BENCHMARK(name)                                                              \
+    static int benchmark_##name(int argc, char** argv);                              \
+    static const BenchmarkRegistration s_##name##Benchmark(#name, benchmark_##name); \
+    static int benchmark_##name(int argc, char** argv)
+
+typedef std::chrono::steady_clock BenchmarkClock;
+
+inline double getElapsedMs(BenchmarkClock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(BenchmarkClock::now() - start).count();
+}
+
+#endif // BENCHMARK_H
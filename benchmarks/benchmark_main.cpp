@@ -0,0 +1,37 @@
+#include "benchmark.h"
+
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+static std::vector<std::pair<const char*, BenchmarkFunc>>& getBenchmarks()
+{
+    static std::vector<std::pair<const char*, BenchmarkFunc>> benchmarks; // filled before main() by BENCHMARK()
+    return benchmarks;
+}
+
+BenchmarkRegistration::BenchmarkRegistration(const char* name, BenchmarkFunc func)
+{
+    getBenchmarks().emplace_back(name, func);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1) {
+        for (const auto& [name, func] : getBenchmarks())
+            if (!strcmp(argv[1], name))
+                return func(argc - 2, argv + 2);
+        std::cout << "no benchmark " << argv[1] << ", one of:";
+        for (const auto& benchmark : getBenchmarks())
+            std::cout << " " << benchmark.first;
+        std::cout << std::endl;
+        return 1;
+    }
+    int result = 0;
+    for (const auto& [name, func] : getBenchmarks()) {
+        std::cout << name << ":" << std::endl;
+        result |= func(0, argv + 1);
+    }
+    return result;
+}
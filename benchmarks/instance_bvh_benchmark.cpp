@@ -0,0 +1,63 @@
+#include "benchmark.h"
+#include "camera.h"
+#include "instance_bvh.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+// build, refit and query rates over a crowd like the demo's: `bvh [instances]`
+BENCHMARK(bvh)
+{
+    const uint32_t numInstances = argc > 0 ? std::max(atoi(argv[0]), 1) : 10000;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+    auto diskRand = [&](float radius) {
+        glm::vec2 p;
+        do
+            p = glm::vec2(uniform(rng), uniform(rng));
+        while (glm::dot(p, p) > 1.f);
+        return p * radius;
+    };
+    std::vector<glm::vec4> spheres(numInstances);
+    for (glm::vec4& sphere : spheres)
+        sphere = glm::vec4(diskRand(8.f), -3.5f, 0.15f);
+    Camera camera;
+
+    InstanceBVH bvh;
+    auto start = BenchmarkClock::now();
+    bvh.build(spheres);
+    const double buildMs = getElapsedMs(start);
+
+    start = BenchmarkClock::now();
+    bvh.refit(spheres);
+    const double refitMs = getElapsedMs(start);
+
+    const int numRays = 100000;
+    std::vector<glm::vec3> targets(numRays);
+    for (auto& target : targets)
+        target = glm::vec3(diskRand(8.f), -3.5f);
+    uint32_t numHits = 0;
+    start = BenchmarkClock::now();
+    for (const auto& target : targets) {
+        InstanceBVH::RayHit hit;
+        numHits += bvh.rayCast(camera.getPos(), glm::normalize(target - camera.getPos()), hit);
+    }
+    const double raysMs = getElapsedMs(start);
+
+    const int numQueries = 1000;
+    std::vector<uint32_t> visible;
+    start = BenchmarkClock::now();
+    for (int i = 0; i < numQueries; ++i) {
+        visible.clear();
+        bvh.queryFrustum(camera.getProjection() * camera.getView(), visible);
+    }
+    const double queriesMs = getElapsedMs(start);
+
+    std::cout << "BVH over " << bvh.getNumInstances() << " instances, " << bvh.getNumNodes() << " nodes: build "
+              << buildMs << " ms, refit " << refitMs << " ms, " << numRays / raysMs * 1e-3 << " Mrays/s ("
+              << numHits << " hits), " << numQueries / queriesMs * 1e3 << " frustum queries/s ("
+              << visible.size() << " visible)" << std::endl;
+    return 0;
+}
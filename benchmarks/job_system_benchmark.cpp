@@ -0,0 +1,60 @@
+#include "benchmark.h"
+#include "camera.h"
+#include "instance_bvh.h"
+#include "job_system.h"
+#include "meshdata.h"
+
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <random>
+
+// engine tasks on 1, 2, 4 .. hardware threads of the job system: instance matrices,
+// normals and tangents of a dense sphere, BVH build and frustum queries
+BENCHMARK(jobs)
+{
+    JobSystem& jobs = getJobSystem();
+    const uint32_t maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    Camera camera;
+    std::vector<glm::mat4> matrices(1024 * 1024);
+    std::vector<glm::vec4> spheres(256 * 1024);
+    std::vector<uint32_t> visible;
+    double serialMs = 0.0;
+    for (uint32_t numThreads = 1;; numThreads = std::min(numThreads * 2, maxThreads)) {
+        jobs.setNumThreads(numThreads);
+        const auto start = BenchmarkClock::now();
+
+        jobs.parallelFor(matrices.size(), 4 * 1024, [&](uint32_t first, uint32_t end) {
+            std::minstd_rand rng(first);
+            std::uniform_real_distribution<float> uniform(-3.f, 3.f);
+            for (uint32_t i = first; i < end; ++i) {
+                const glm::mat4 mat = glm::translate(glm::mat4(1), glm::vec3(uniform(rng), uniform(rng), uniform(rng)));
+                matrices[i] = glm::scale(mat, glm::vec3(.2f));
+            }
+        });
+        MeshData data(MeshData::ParametricType::Sphere, 255);
+        data.generateNormals();
+        data.generateTangents();
+        for (size_t i = 0; i < spheres.size(); ++i)
+            spheres[i] = glm::vec4(glm::vec3(matrices[i][3]) * 10.f, 0.1f);
+        InstanceBVH bvh;
+        bvh.build(spheres);
+        for (int i = 0; i < 100; ++i) {
+            visible.clear();
+            bvh.queryFrustum(camera.getProjection() * camera.getView(), visible);
+        }
+
+        const double ms = getElapsedMs(start);
+        serialMs = numThreads == 1 ? ms : serialMs;
+        const JobStats stats = jobs.getStats();
+        uint64_t steals = 0;
+        for (const auto& worker : stats.workers)
+            steals += worker.steals;
+        std::cout << numThreads << " threads: " << ms << " ms, speedup " << serialMs / ms << ", utilization "
+                  << stats.getUtilization() * 100.f << "%, " << steals << " steals" << std::endl;
+        if (numThreads == maxThreads)
+            break;
+    }
+    jobs.setNumThreads(0);
+    return 0;
+}
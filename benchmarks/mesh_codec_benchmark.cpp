@@ -0,0 +1,51 @@
+#include "benchmark.h"
+#include "mesh_codec.h"
+#include "vertex_layout.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+// the vertex layout of the demo meshes
+typedef VertexLayout<
+    Attr<VertexAttribute::Type::Position, MeshAttribFormat::Float3>,
+    Attr<VertexAttribute::Type::Normal, MeshAttribFormat::Half4>>
+    CodecLayout;
+
+// compression of the built-in meshes packed as uploaded and decode throughput: `codec [runs]`
+BENCHMARK(codec)
+{
+    const int numRuns = argc > 0 ? std::max(atoi(argv[0]), 1) : 20;
+    const std::pair<const char*, MeshData> meshes[] = {
+        { "cube", MeshData(MeshData::ParametricType::CylindricalNormalCube) },
+        { "sphere 16", MeshData(MeshData::ParametricType::Sphere, 16) },
+        { "sphere 255", MeshData(MeshData::ParametricType::Sphere, 255) },
+        { "plane 255", MeshData(MeshData::ParametricType::PlaneZ, 255) },
+    };
+    bool valid = true;
+    for (const auto& [name, data] : meshes) {
+        const uint32_t numVertices = data.getNumVertices(), numIndices = data.getNumIndices();
+        std::vector<uint8_t> vertices(numVertices * CodecLayout::s_stride);
+        CodecLayout::pack(data, vertices.data());
+        const std::vector<uint8_t> encodedVertices = MeshCodec::encodeVertices(vertices.data(), numVertices, CodecLayout::s_stride);
+        const std::vector<uint8_t> encodedIndices = MeshCodec::encodeIndices(data.getIndicesPtr(), numIndices);
+
+        std::vector<uint8_t> decodedVertices(vertices.size());
+        std::vector<uint32_t> decodedIndices(numIndices);
+        const auto start = BenchmarkClock::now();
+        for (int i = 0; i < numRuns; ++i) {
+            valid &= MeshCodec::decodeVertices(encodedVertices.data(), encodedVertices.size(), decodedVertices.data(), numVertices, CodecLayout::s_stride);
+            valid &= MeshCodec::decodeIndices(encodedIndices.data(), encodedIndices.size(), decodedIndices.data(), numIndices);
+        }
+        const double ms = getElapsedMs(start);
+
+        const size_t rawBytes = vertices.size() + numIndices * sizeof(VertIndex);
+        const size_t encodedBytes = encodedVertices.size() + encodedIndices.size();
+        std::cout << name << ": " << numVertices << " vertices " << vertices.size() << " -> " << encodedVertices.size()
+                  << " bytes, " << numIndices / 3 << " triangles " << encodedIndices.size() * 8.f / std::max(numIndices / 3, 1u)
+                  << " bits each, ratio " << float(rawBytes) / encodedBytes << ", decode "
+                  << rawBytes * numRuns / ms * 1e-6 << " GB/s" << std::endl;
+    }
+    // the round trip itself is checked by the mesh_codec tests
+    return valid ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+#include "benchmark.h"
+#include "meshdata.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+// normals and tangents of a dense sphere on the job system: `normals [runs]`
+BENCHMARK(normals)
+{
+    const int numRuns = argc > 0 ? std::max(atoi(argv[0]), 1) : 10;
+    MeshData data(MeshData::ParametricType::Sphere, 255);
+    double normalsMs = 0.0, tangentsMs = 0.0;
+    for (int i = 0; i < numRuns; ++i) {
+        auto start = BenchmarkClock::now();
+        data.generateNormals();
+        normalsMs += getElapsedMs(start);
+        start = BenchmarkClock::now();
+        data.generateTangents();
+        tangentsMs += getElapsedMs(start);
+    }
+    std::cout << "normals and tangents of " << data.getNumVertices() << " vertices: " << normalsMs / numRuns
+              << " and " << tangentsMs / numRuns << " ms" << std::endl;
+    return 0;
+}
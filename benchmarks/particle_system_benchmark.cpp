@@ -0,0 +1,77 @@
+#include "benchmark.h"
+#include "camera.h"
+#include "mesh.h"
+#include "particle_system.h"
+#include "profiler.h"
+#include "shader.h"
+#include "vertex_layout.h"
+#include "window.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+// the vertex layout of the demo meshes
+typedef VertexLayout<
+    Attr<VertexAttribute::Type::Position, MeshAttribFormat::Float3>,
+    Attr<VertexAttribute::Type::Normal, MeshAttribFormat::Half4>>
+    ParticleLayout;
+
+// headless: `particles [count]` live through a fixed timestep, GPU time of every stage and
+// simulated particles per second are printed; LIBGL_ALWAYS_SOFTWARE=1 runs it on llvmpipe
+BENCHMARK(particles)
+{
+    const uint32_t count = argc > 0 ? std::max(atoi(argv[0]), 1) : 1024 * 1024;
+    Window window(1000, 1000, 1, true);
+
+    ParticleConfig config;
+    config.capacity = count;
+    config.emitRate = count / (0.5f * (config.minLifetime + config.maxLifetime)); // steady state near capacity
+    ParticleSystem particles(config);
+
+    GL_InstancedMesh mesh(MeshData(MeshData::ParametricType::Sphere, 4), ParticleLayout(), MeshAttribFormat::Uint16, MeshAttribFormat::Mat4x4);
+    mesh.setSphereImpostors(true);
+    Shader shader(ParticleLayout::getAttribData(), ShaderFeature::SphereImpostor);
+    Camera camera;
+    shader.bind();
+    shader.getVariable("model").set(glm::mat4(1));
+    shader.getVariable("view").set(camera.getView());
+    shader.getVariable("projection").set(camera.getProjection());
+    shader.getVariable("viewPos").set(camera.getPos());
+
+    Profiler profiler;
+    constexpr uint32_t numFrames = 600;
+    constexpr float dt = 1.f / 60.f;
+    const char* stages[] = { "particle prepare", "particle simulate", "particle emit", "particle draw" };
+    double stageTimes[4] {}; // ms, summed over the measured frames
+    uint32_t measured = 0;
+    for (uint32_t frame = 0; frame < numFrames && window.update(); ++frame) {
+        window.clear();
+        particles.update(dt, &profiler);
+
+        profiler.begin("particle draw", Profiler::Type::TimeElapsed);
+        shader.bind(); // update() leaves a compute program bound
+        particles.draw(mesh);
+        profiler.end("particle draw");
+        profiler.nextFrame();
+
+        if (frame < numFrames / 2) // warm-up while the particle count ramps up
+            continue;
+        for (uint32_t i = 0; i < 4; ++i)
+            stageTimes[i] += profiler.getValue(stages[i]) / 1e6;
+        ++measured;
+    }
+    if (!measured)
+        return 1;
+
+    const ParticleStats stats = particles.getStats(true);
+    for (uint32_t i = 0; i < 4; ++i) {
+        stageTimes[i] /= measured;
+        std::cout << stages[i] << ": " << stageTimes[i] << " ms" << std::endl;
+    }
+    const double simulateTime = stageTimes[0] + stageTimes[1] + stageTimes[2];
+    std::cout << "particles: " << stats.alive << " alive of " << count << ", " << stats.emitted << " emitted and "
+              << stats.died << " died per frame, "
+              << (simulateTime > 0.0 ? stats.alive / simulateTime / 1e3 : 0.0) << " M particles/s simulated" << std::endl;
+    return 0;
+}
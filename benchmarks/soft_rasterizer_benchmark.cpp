@@ -0,0 +1,126 @@
+#include "benchmark.h"
+#include "camera.h"
+#include "job_system.h"
+#include "material.h"
+#include "mesh.h"
+#include "shader.h"
+#include "soft_rasterizer.h"
+#include "window.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <random>
+
+// the cubes and spheres of the demo, 100 each, the same for both renderers
+struct DemoScene {
+    DemoScene()
+        : cube(MeshData::ParametricType::CylindricalNormalCube)
+        , sphere(MeshData::ParametricType::Sphere, 16)
+    {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> uniform(-3.f, 3.f);
+        for (auto* matrices : { &cubeMatrices, &sphereMatrices })
+            for (uint32_t i = 0; i < 100; ++i)
+                matrices->push_back(glm::scale(glm::translate(glm::mat4(1), glm::vec3(uniform(rng), uniform(rng), uniform(rng))), glm::vec3(.2f)));
+        for (uint32_t i = 0; i < sphereMatrices.size(); ++i)
+            sphereMaterials.push_back({ glm::vec3(i % 3 == 0, i % 3 == 1, i % 3 == 2), 0.05f });
+    }
+    uint64_t getTriangles() const
+    {
+        return (uint64_t)cube.getNumIndices() / 3 * cubeMatrices.size() + (uint64_t)sphere.getNumIndices() / 3 * sphereMatrices.size();
+    }
+
+    const MeshData cube, sphere;
+    std::vector<glm::mat4> cubeMatrices, sphereMatrices;
+    const std::vector<Material> cubeMaterials = { { { .3f, .3f, .3f } } };
+    std::vector<Material> sphereMaterials;
+};
+
+static void printResult(const char* name, uint32_t numFrames, double ms, uint64_t triangles)
+{
+    std::cout << name << ": " << numFrames * 1000.0 / ms << " fps, " << triangles * numFrames / ms / 1000.0 << " Mtris/s";
+}
+
+// the demo scene at 1000x1000 on the CPU rasterizer: `software [frames]`;
+// `opengl [frames]` under LIBGL_ALWAYS_SOFTWARE=1 (llvmpipe) is the baseline to compare with
+BENCHMARK(software)
+{
+    const uint32_t numFrames = argc > 0 ? std::max(atoi(argv[0]), 1) : 100;
+    const DemoScene scene;
+    SoftRasterizer rasterizer;
+    Camera camera;
+    rasterizer.resize({ 1000, 1000 });
+    rasterizer.setCamera(camera.getView(), camera.getProjection(), camera.getPos());
+    const auto start = BenchmarkClock::now();
+    for (uint32_t frame = 0; frame < numFrames; ++frame) {
+        rasterizer.draw(scene.cube, scene.cubeMatrices, scene.cubeMaterials);
+        rasterizer.draw(scene.sphere, scene.sphereMatrices, scene.sphereMaterials);
+        rasterizer.finish();
+    }
+    const double ms = getElapsedMs(start);
+
+    const SoftRasterizerStats& stats = rasterizer.getStats();
+    printResult("software", numFrames, ms, scene.getTriangles());
+    std::cout << ", vertex " << stats.vertexTime / stats.frames << " ms, bin " << stats.binTime / stats.frames
+              << " ms, raster " << stats.rasterTime / stats.frames << " ms, " << stats.rasterTriangles / stats.frames
+              << " triangles and " << stats.shadedPixels / stats.frames << " pixels per frame, "
+              << getJobSystem().getNumThreads() << " threads" << std::endl;
+    return 0;
+}
+
+typedef VertexLayout<
+    Attr<VertexAttribute::Type::Position, MeshAttribFormat::Float3>,
+    Attr<VertexAttribute::Type::Normal, MeshAttribFormat::Half4>>
+    DemoLayout;
+
+// the same scene with the demo's instanced draws in a hidden 1000x1000 window, glFinish()
+// ends every frame: `opengl [frames]`
+BENCHMARK(opengl)
+{
+    const uint32_t numFrames = argc > 0 ? std::max(atoi(argv[0]), 1) : 100;
+    Window window(1000, 1000, 1, true);
+    const DemoScene scene;
+    MaterialTable materials;
+    std::vector<uint32_t> cubeMaterials(scene.cubeMatrices.size(), materials.add(scene.cubeMaterials[0]));
+    std::vector<uint32_t> sphereMaterials;
+    for (const Material& material : scene.sphereMaterials)
+        sphereMaterials.push_back(materials.add(material));
+
+    GL_InstancedMesh cubes(scene.cube, DemoLayout(), MeshAttribFormat::Uint16, MeshAttribFormat::Mat4x4);
+    cubes.setInstanceTransforms(scene.cubeMatrices);
+    cubes.setInstanceMaterials(cubeMaterials);
+    GL_InstancedMesh spheres(scene.sphere, DemoLayout(), MeshAttribFormat::Uint16, MeshAttribFormat::Mat4x4);
+    spheres.setInstanceTransforms(scene.sphereMatrices);
+    spheres.setInstanceMaterials(sphereMaterials);
+
+    Shader shader(DemoLayout::getAttribData(), ShaderFeature::MaterialTable);
+    Camera camera;
+    shader.bind();
+    shader.getVariable("model").set(glm::mat4(1));
+    shader.getVariable("view").set(camera.getView());
+    shader.getVariable("projection").set(camera.getProjection());
+    shader.getVariable("viewPos").set(camera.getPos());
+
+    auto drawFrame = [&]() {
+        window.clear();
+        materials.bind();
+        shader.bind();
+        cubes.draw();
+        spheres.draw();
+        glFinish();
+    };
+    drawFrame(); // uploads and shader compilation
+    const auto start = BenchmarkClock::now();
+    for (uint32_t frame = 0; frame < numFrames; ++frame)
+        drawFrame();
+    const double ms = getElapsedMs(start);
+
+    printResult("opengl", numFrames, ms, scene.getTriangles());
+    std::cout << ", " << glGetString(GL_RENDERER) << std::endl;
+    return 0;
+}
@@ -1,16 +1,43 @@
+#include "allocators.h"
+#include "animation_palette.h"
+#include "buffer_allocator.h"
 #include "camera.h"
+#include "clustered_lighting.h"
+#include "dynamic_resolution.h"
+#include "frame_capture.h"
+#include "hiz_culler.h"
+#include "instance_bvh.h"
+#include "job_system.h"
+#include "material.h"
 #include "mesh.h"
+#include "mesh_pool.h"
 #include "meshdata.h"
+#include "multi_view.h"
+#include "particle_system.h"
+#include "point_cloud.h"
+#include "profiler.h"
 #include "shader.h"
+#include "shadow_map.h"
+#include "soft_rasterizer.h"
+#include "terrain.h"
 #include "window.h"
 
 #include <iostream>
 
 #define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtc/noise.hpp>
 #include <glm/gtc/random.hpp>
 #include <glm/gtx/rotate_vector.hpp>
 
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <math.h>
+#include <memory>
+#include <random>
 
 glm::vec3 rainbow(float x)
 {
@@ -18,22 +45,256 @@ glm::vec3 rainbow(float x)
     return result * result;
 }
 
-std::vector<glm::mat4> getMatrices()
+// uniform in the ball, seeded per instance (glm::ballRand shares std::rand state), same on any thread
+glm::vec3 seededBallRand(uint32_t seed, float radius)
 {
-    std::vector<glm::mat4> matrices;
-    for (int i = 0; i < 100.f; ++i) {
-        glm::mat4 mat(1);
-        mat = glm::translate(mat, glm::ballRand(3.f));
+    std::minstd_rand rng(seed);
+    std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+    glm::vec3 p;
+    do
+        p = { uniform(rng), uniform(rng), uniform(rng) };
+    while (glm::dot(p, p) > 1.f);
+    return p * radius;
+}
 
-        mat = glm::scale(mat, glm::vec3(.2));
-        matrices.push_back(mat);
-    }
+// refills matrices, so repeated calls reuse its storage
+const std::vector<glm::mat4>& getMatrices(std::vector<glm::mat4>& matrices, uint32_t count = 100)
+{
+    matrices.resize(count);
+    const uint32_t seed = std::rand(); // new layout on every call
+    getJobSystem().parallelFor(count, 4 * 1024, [&](uint32_t first, uint32_t end) {
+        for (uint32_t i = first; i < end; ++i) {
+            glm::mat4 mat(1);
+            mat = glm::translate(mat, seededBallRand(seed ^ (i * 2654435761u), 3.f));
+            matrices[i] = glm::scale(mat, glm::vec3(.2));
+        }
+    });
     return matrices;
 }
 
-int main()
+std::vector<PointLight> getPointLights(int count)
+{
+    std::vector<PointLight> lights(count);
+    for (int i = 0; i < count; ++i) {
+        lights[i].position = glm::ballRand(4.f);
+        lights[i].radius = 1.5f;
+        lights[i].color = rainbow(i * 0.37f);
+        lights[i].intensity = 2.f;
+    }
+    return lights;
+}
+
+// joints of the chain swing around X, each one relative to its parent
+std::vector<glm::mat4> getWobblePalette(const std::vector<glm::vec3>& pivots, uint32_t numFrames)
+{
+    std::vector<glm::mat4> frames;
+    frames.reserve(numFrames * pivots.size());
+    for (uint32_t f = 0; f < numFrames; ++f) {
+        glm::mat4 parent(1);
+        for (uint32_t j = 0; j < pivots.size(); ++j) {
+            float angle = 0.35f * sinf(2.f * M_PI * f / numFrames + j * 0.8f);
+            glm::mat4 local = glm::translate(glm::mat4(1), pivots[j]);
+            local = glm::rotate(local, angle, glm::vec3(1, 0, 0));
+            local = glm::translate(local, -pivots[j]);
+            parent = parent * local;
+            frames.push_back(parent);
+        }
+    }
+    return frames;
+}
+
+// raises a bump under brushDir and levels the one left under prevBrushDir; only
+// vertices under either brush are edited, as runs of consecutive indices
+void sculptBlob(MeshData& data, const std::vector<glm::vec3>& baseDirs, const glm::vec3& brushDir, const glm::vec3& prevBrushDir)
+{
+    const float brushCos = cosf(0.5f);
+    auto height = [&](const glm::vec3& dir) { return 0.3f * glm::smoothstep(brushCos, 1.f, glm::dot(dir, brushDir)); };
+
+    uint32_t runStart = 0, runLength = 0;
+    for (uint32_t i = 0; i <= baseDirs.size(); ++i) {
+        if (i < baseDirs.size() && (glm::dot(baseDirs[i], brushDir) > brushCos || glm::dot(baseDirs[i], prevBrushDir) > brushCos)) {
+            runStart = runLength ? runStart : i;
+            runLength++;
+        } else if (runLength) {
+            Vec3* positions = data.editPositions(runStart, runLength);
+            for (uint32_t k = 0; k < runLength; ++k)
+                positions[k] = baseDirs[runStart + k] * (1.f + height(baseDirs[runStart + k]));
+            runLength = 0;
+        }
+    }
+}
+
+// fBm hills around a flat valley in the middle, below the demo scene
+float getTerrainHeight(float u, float v)
+{
+    glm::vec2 p(u * 8.f, v * 8.f);
+    float height = 0.45f, amplitude = 0.5f;
+    for (int octave = 0; octave < 8; ++octave) {
+        height += amplitude * glm::perlin(p);
+        p *= 2.03f;
+        amplitude *= 0.5f;
+    }
+    const float valley = glm::smoothstep(0.02f, 0.08f, glm::length(glm::vec2(u, v) - 0.5f));
+    return glm::mix(0.3f, height, valley);
+}
+
+// a simulated aerial scan of hills, points jittered like sensor noise, colored by height
+std::vector<PointCloudPoint> getScanPoints(uint32_t count)
+{
+    constexpr float size = 400.f, baseHeight = -40.f, heightScale = 60.f;
+    std::vector<PointCloudPoint> points(count);
+    getJobSystem().parallelFor(count, 4096, [&](uint32_t first, uint32_t end) {
+        for (uint32_t i = first; i < end; ++i) {
+            // seeded per point like seededBallRand(), the scan doesn't depend on the chunks
+            std::minstd_rand rng(i * 2654435761u + 1u);
+            std::uniform_real_distribution<float> uniform(0.f, 1.f);
+            std::normal_distribution<float> noise(0.f, 0.05f);
+            const float u = uniform(rng), v = uniform(rng);
+            const float height = getTerrainHeight(u, v);
+            const glm::vec3 color = glm::mix(glm::vec3(0.25f, 0.4f, 0.15f), glm::vec3(0.85f, 0.8f, 0.75f),
+                glm::smoothstep(0.3f, 0.8f, height)) * (0.9f + 0.2f * uniform(rng));
+            const glm::uvec3 rgb = glm::uvec3(glm::clamp(color, 0.f, 1.f) * 255.f + 0.5f);
+            points[i].position = glm::vec3((u - 0.5f) * size, (v - 0.5f) * size, baseHeight + height * heightScale + noise(rng));
+            points[i].color = rgb.x | rgb.y << 8 | rgb.z << 16 | 255u << 24;
+        }
+    });
+    return points;
+}
+
+// frame, CPU ms, GPU ms per line; prints the averages and percentiles to compare runs
+bool writeFrameTimes(const std::string& path, const std::vector<glm::vec2>& times)
+{
+    std::ofstream file(path);
+    file << "frame,cpu_ms,gpu_ms\n";
+    for (size_t i = 0; i < times.size(); ++i)
+        file << i << "," << times[i].x << "," << times[i].y << "\n";
+
+    for (int c = 0; c < 2 && !times.empty(); ++c) {
+        std::vector<float> sorted(times.size());
+        double sum = 0.0;
+        for (size_t i = 0; i < times.size(); ++i)
+            sum += sorted[i] = times[i][c];
+        std::sort(sorted.begin(), sorted.end());
+        std::cout << (c ? "gpu" : "cpu") << " frame ms: mean " << sum / times.size() << ", median "
+                  << sorted[sorted.size() / 2] << ", p95 " << sorted[sorted.size() * 95 / 100] << ", max "
+                  << sorted.back() << " (" << times.size() << " frames)" << std::endl;
+    }
+    return (bool)file;
+}
+
+typedef VertexLayout<
+    Attr<VertexAttribute::Type::Position, MeshAttribFormat::Float3>,
+    Attr<VertexAttribute::Type::Normal, MeshAttribFormat::Half4>>
+    DemoLayout;
+typedef VertexLayout<
+    Attr<VertexAttribute::Type::Position, MeshAttribFormat::Float3>,
+    Attr<VertexAttribute::Type::Normal, MeshAttribFormat::Half4>,
+    Attr<VertexAttribute::Type::Joints, MeshAttribFormat::Uint8x4>,
+    Attr<VertexAttribute::Type::Weights, MeshAttribFormat::Unorm8x4>>
+    SkinnedLayout;
+typedef VertexLayout<
+    Attr<VertexAttribute::Type::Position, MeshAttribFormat::Float3>,
+    Attr<VertexAttribute::Type::Normal, MeshAttribFormat::Float3>>
+    FloatLayout;
+static_assert(DemoLayout::s_stride == 20 && SkinnedLayout::s_stride == 28 && FloatLayout::s_stride == 24, "");
+
+// the cubes and spheres of the GL demo on the CPU rasterizer, timed by `benchmarks software`
+int runSoftwareRenderer(Window& window)
+{
+    window.getKeyMap().bindAction(SDLK_ESCAPE, KMOD_NONE, true, [&]() {
+        window.closeWindow();
+    });
+
+    const MeshData cubeData(MeshData::ParametricType::CylindricalNormalCube);
+    const MeshData sphereData(MeshData::ParametricType::Sphere, 16);
+    std::vector<glm::mat4> cubeMatrices, sphereMatrices;
+    getMatrices(cubeMatrices);
+    getMatrices(sphereMatrices);
+    const std::vector<Material> cubeMaterials = { { { .3f, .3f, .3f } } };
+    std::vector<Material> sphereMaterials;
+    for (uint32_t i = 0; i < sphereMatrices.size(); ++i)
+        sphereMaterials.push_back({ rainbow(i * 0.37f), 0.05f });
+
+    SoftRasterizer rasterizer;
+    Camera camera;
+    glm::vec2 sceneRot = { 0.2f, 0.2f };
+    window.RMBDragEvent = [&](int dx, int dy) {
+        constexpr float offsetScale = 0.003f;
+        sceneRot += glm::vec2(-dx, dy) * offsetScale;
+        sceneRot.y = glm::clamp(sceneRot.y, -(float)M_PI_2 + 0.001f, (float)M_PI_2 - 0.001f);
+        sceneRot.x = fmodf(sceneRot.x, M_PI * 2);
+
+        auto origin = camera.getAim();
+        auto rotatedVector1 = origin + glm::rotateZ(glm::rotateX(glm::vec3(0.f, camera.getDistance(), 0.f), sceneRot.y), sceneRot.x);
+        camera.setPos(rotatedVector1);
+    };
+    window.MouseScrollEvent = [&](int dy) {
+        float distance = camera.getDistance();
+        distance *= powf(0.9f, dy);
+        distance = glm::clamp(distance, 0.1f, 1000.f);
+        camera.setDistance(distance);
+    };
+    window.getKeyMap().bindAction(SDLK_g, KMOD_NONE, true, [&]() {
+        getMatrices(cubeMatrices);
+    });
+    window.RMBDragEvent(0, 0);
+
+    while (window.update()) {
+        const glm::ivec2 size = window.getSize();
+        rasterizer.resize(size);
+        camera.setAR((float)size.x / size.y);
+        rasterizer.setCamera(camera.getView(), camera.getProjection(), camera.getPos());
+        rasterizer.draw(cubeData, cubeMatrices, cubeMaterials);
+        rasterizer.draw(sphereData, sphereMatrices, sphereMaterials);
+        rasterizer.finish();
+        window.present(rasterizer.getPixels(), rasterizer.getSize());
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
 {
-    Window window(1000, 1000, 16);
+    // --software: CPU rasterizer instead of OpenGL, for machines without a GPU
+    if (argc == 2 && !strcmp(argv[1], "--software")) {
+        Window window(1000, 1000, 1, false, RenderBackend::Software);
+        return runSoftwareRenderer(window);
+    }
+
+    // --regression reference.ppm: renders one still frame headless and compares it
+    // with the reference (written when missing), exit code 0 on match (CTest regression)
+    const char* regressionReference = argc == 3 && !strcmp(argv[1], "--regression") ? argv[2] : nullptr;
+    // --record input.inp: saves the input of the session on exit
+    // --replay input.inp [--headless]: repeats it with a fixed timestep, quits at its
+    // end and writes per-frame times to input.inp.csv
+    // --gpu-budget MB: memory limit of mesh and instance buffers
+    // --allocation-check N: renders N animated frames headless after a warm-up, exit
+    // code 0 if none of them reached the heap (CTest allocation_check)
+    const char *recordPath = nullptr, *replayPath = nullptr;
+    bool headless = regressionReference != nullptr;
+    uint32_t allocationCheckFrames = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--record") && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+            replayPath = argv[++i];
+        else if (!strcmp(argv[i], "--headless"))
+            headless = true;
+        else if (!strcmp(argv[i], "--gpu-budget") && i + 1 < argc) {
+            BufferAllocatorConfig config = getBufferAllocator().getConfig();
+            config.budget = size_t(atoi(argv[++i])) << 20;
+            getBufferAllocator().setConfig(config);
+        } else if (!strcmp(argv[i], "--allocation-check") && i + 1 < argc) {
+            allocationCheckFrames = std::max(atoi(argv[++i]), 1);
+            headless = true;
+        }
+    }
+    InputRecording replay;
+    if (replayPath && !replay.load(replayPath)) {
+        std::cout << "can't read input recording " << replayPath << std::endl;
+        return 1;
+    }
+
+    Window window(1000, 1000, 1, headless); // multisampling is done offscreen by DynamicResolution
 
     window.getKeyMap().bindAction(SDLK_ESCAPE, KMOD_NONE, true, [&]() {
         window.closeWindow();
@@ -46,24 +307,19 @@ int main()
 
     //    MeshData mData(MeshData::ParametricType::CylindricalNormalCube);
 
-    VertexAttribData attrib(
-        { { VertexAttribute::Type::Position, MeshAttribFormat::Float3 },
-            { VertexAttribute::Type::Normal, MeshAttribFormat::Half4 } });
-
-    GL_InstancedMesh mesh(mData, attrib, MeshAttribFormat::Uint16, MeshAttribFormat::Mat4x4);
-    mesh.setInstanceTransforms(getMatrices());
+    const VertexAttribData attrib = DemoLayout::getAttribData(); // for shaders
 
-    window.getKeyMap().bindAction(SDLK_g, KMOD_NONE, true, [&]() {
-        mesh.setInstanceTransforms(getMatrices());
-    });
+    std::vector<glm::mat4> matrices;
+    GL_InstancedMesh mesh(mData, DemoLayout(), MeshAttribFormat::Uint16, MeshAttribFormat::Mat4x4);
+    mesh.setInstanceTransforms(getMatrices(matrices));
 
     // GL_InstancedMesh mesh(mData, attrib, MeshAttribFormat::Uint16,
     //                        MeshAttribFormat::Mat4x4);
 
     GL_InstancedMesh sphereMesh(MeshData(MeshData::ParametricType::Sphere, 16),
-        attrib, MeshAttribFormat::Uint16, MeshAttribFormat::Mat4x4);
+        DemoLayout(), MeshAttribFormat::Uint16, MeshAttribFormat::Mat4x4);
 
-    sphereMesh.setInstanceTransforms(getMatrices());
+    sphereMesh.setInstanceTransforms(getMatrices(matrices));
 
     window.getKeyMap().bindAction(SDLK_F11, KMOD_NONE, true, [&]() {
         window.setWindowFullScreen(!window.getWindowFullScreen());
@@ -74,19 +330,186 @@ int main()
         // multiJoint.addOffset(2, 1, offset0);
     });
 
-    Shader shader(attrib);
+    // one material per sphere, all of them in a single draw call
+    MaterialTable materials;
+    const uint32_t cubeMaterial = materials.add({ { .3f, .3f, .3f } });
+    std::vector<uint32_t> sphereMaterials;
+    for (uint32_t i = 0; i < sphereMesh.getInstanceTransforms().size(); ++i)
+        sphereMaterials.push_back(materials.add({ rainbow(i * 0.37f), 0.05f }));
+    sphereMesh.setInstanceMaterials(sphereMaterials);
+    mesh.setInstanceMaterials(std::vector<uint32_t>(mesh.getInstanceTransforms().size(), cubeMaterial));
+
+    // crowd of skinned worms, posed on GPU from one shared palette
+    const VertexAttribData skinnedAttrib = SkinnedLayout::getAttribData();
+
+    MeshData wormData(MeshData::ParametricType::Sphere, 8);
+    const std::vector<glm::vec3> wormPivots = wormData.generateChainSkin(4);
+    GL_InstancedMesh crowdMesh(wormData, SkinnedLayout(), MeshAttribFormat::Uint16, MeshAttribFormat::Mat4x4);
+    crowdMesh.setBoundingSphere(crowdMesh.getBoundingSphere() * glm::vec4(1, 1, 1, 1.5f)); // covers the swing
+
+    AnimationPalette wobble;
+    wobble.setFrames(wormPivots.size(), getWobblePalette(wormPivots, 32), 16.f);
+
+    const int crowdSize = 10000;
+    std::vector<glm::mat4> crowdTransforms;
+    std::vector<glm::vec2> crowdAnimations;
+    std::vector<uint32_t> crowdMaterials;
+    for (int i = 0; i < crowdSize; ++i) {
+        glm::vec2 p = glm::diskRand(8.f);
+        glm::mat4 mat = glm::translate(glm::mat4(1), glm::vec3(p, -3.5f));
+        crowdTransforms.push_back(glm::scale(mat, glm::vec3(.04f, .04f, .12f)));
+        crowdAnimations.emplace_back(glm::linearRand(0.f, wobble.getDuration()), glm::linearRand(0.5f, 1.5f));
+        crowdMaterials.push_back(sphereMaterials[i % sphereMaterials.size()]);
+    }
+    crowdMesh.setInstanceTransforms(crowdTransforms);
+    crowdMesh.setInstanceAnimations(crowdAnimations);
+    crowdMesh.setInstanceMaterials(crowdMaterials);
+
+    // CPU side spatial queries over the crowd, e.g. picking
+    InstanceBVH crowdBVH;
+    crowdBVH.build(crowdMesh);
+    const uint32_t pickedMaterial = materials.add({ { 1.f, 1.f, 1.f }, 0.5f });
+    uint32_t pickedInstance = InstanceBVH::s_none;
+    std::vector<uint32_t> bvhQueryResult;
+    std::vector<uint32_t> crowdVisible; // frustum culled by the BVH when HiZCuller is off
+
+    // blob sculpted every frame, only edited vertices go to GPU
+    MeshData blobData(MeshData::ParametricType::Sphere, 48);
+    const std::vector<glm::vec3> blobDirs(blobData.getNormalsPtr(), blobData.getNormalsPtr() + blobData.getNumVertices());
+    GL_InstancedMesh blobMesh(blobData, DemoLayout(), MeshAttribFormat::Uint16, MeshAttribFormat::Mat4x4);
+    blobMesh.setBoundingSphere(blobMesh.getBoundingSphere() * glm::vec4(1, 1, 1, 1.3f)); // covers the bump
+    blobMesh.setInstanceTransforms({ glm::translate(glm::mat4(1), glm::vec3(0, 0, 4.5f)) });
+    blobMesh.setInstanceMaterials({ materials.add({ { .8f, .6f, .4f }, 0.2f }) });
+    glm::vec3 brushDir(1, 0, 0);
+    bool sculpt = true;
+    MeshUpdateStats blobStats;
+
+    // uniforms used by demo programs, unused ones are ignored by GL
+    struct Program {
+        Program(const VertexAttribData& attrib, ShaderFeature features)
+            : shader(attrib, features)
+            , model(shader.getVariable("model"))
+            , view(shader.getVariable("view"))
+            , projection(shader.getVariable("projection"))
+            , viewPos(shader.getVariable("viewPos"))
+            , animationTime(shader.getVariable("animationTime"))
+        {
+        }
+        Shader shader;
+        Shader::ShaderVariable model, view, projection, viewPos, animationTime;
+        Program* multiView {}; // same program with ShaderFeature::MultiView
+    };
+
+    const ShaderFeature colorFeatures = ShaderFeature::ClusteredLights | ShaderFeature::Shadows | ShaderFeature::MaterialTable
+        | ShaderFeature::LinearOutput;
+    Program colorProgram(attrib, colorFeatures);
+    Program depthProgram(attrib, ShaderFeature::DepthOnly);
+    Program skinnedColorProgram(skinnedAttrib, colorFeatures | ShaderFeature::Skinning);
+    Program skinnedDepthProgram(skinnedAttrib, ShaderFeature::DepthOnly | ShaderFeature::Skinning);
+    Program impostorColorProgram(attrib, colorFeatures | ShaderFeature::SphereImpostor);
+    Program impostorDepthProgram(attrib, ShaderFeature::DepthOnly | ShaderFeature::SphereImpostor);
 
-    auto shaderModel = shader.getVariable("model");
-    auto shaderView = shader.getVariable("view");
-    auto shaderProjection = shader.getVariable("projection");
-    auto shaderViewPos = shader.getVariable("viewPos");
-    auto diffuseColorPos = shader.getVariable("diffuseColor");
+    // side-by-side stereo in one submission, clustered lights are built for a single camera
+    const ShaderFeature multiViewFeatures = ShaderFeature::Shadows | ShaderFeature::MaterialTable | ShaderFeature::LinearOutput
+        | ShaderFeature::MultiView;
+    Program multiViewColorProgram(attrib, multiViewFeatures);
+    Program multiViewDepthProgram(attrib, ShaderFeature::DepthOnly | ShaderFeature::MultiView);
+    Program multiViewSkinnedColorProgram(skinnedAttrib, multiViewFeatures | ShaderFeature::Skinning);
+    Program multiViewSkinnedDepthProgram(skinnedAttrib, ShaderFeature::DepthOnly | ShaderFeature::Skinning | ShaderFeature::MultiView);
+    Program multiViewImpostorColorProgram(attrib, multiViewFeatures | ShaderFeature::SphereImpostor);
+    Program multiViewImpostorDepthProgram(attrib, ShaderFeature::DepthOnly | ShaderFeature::SphereImpostor | ShaderFeature::MultiView);
+    colorProgram.multiView = &multiViewColorProgram;
+    depthProgram.multiView = &multiViewDepthProgram;
+    skinnedColorProgram.multiView = &multiViewSkinnedColorProgram;
+    skinnedDepthProgram.multiView = &multiViewSkinnedDepthProgram;
+    impostorColorProgram.multiView = &multiViewImpostorColorProgram;
+    impostorDepthProgram.multiView = &multiViewImpostorDepthProgram;
+    MultiView multiView;
+    bool stereo = false;
+
+    // cubes and spheres again in two vertex layouts, drawn from one VAO by vertex pulling
+    GL_MeshPool meshPool;
+    const int pooledCube = meshPool.addMesh(mData, DemoLayout());
+    const int pooledSphere = meshPool.addMesh(MeshData(MeshData::ParametricType::Sphere, 16), FloatLayout());
+    Program pulledColorProgram(attrib, colorFeatures | ShaderFeature::VertexPulling);
+    Program pulledDepthProgram(attrib, ShaderFeature::DepthOnly | ShaderFeature::VertexPulling);
+    bool vertexPulling = false;
+    const std::vector<glm::mat4> noTransforms;
+    const std::vector<uint32_t> noMaterials;
+
+    struct DrawItem {
+        GL_InstancedMesh* mesh;
+        Program* color;
+        Program* depth;
+        bool animated; // not sorted, not in cached shadows
+        float distance; // to the nearest instance, for front-to-back order
+        int pooled; // meshPool index of the same mesh, -1 if none
+    };
+    std::vector<DrawItem> drawList = {
+        { &sphereMesh, &colorProgram, &depthProgram, false, 0.f, pooledSphere },
+        { &mesh, &colorProgram, &depthProgram, false, 0.f, pooledCube },
+        { &crowdMesh, &skinnedColorProgram, &skinnedDepthProgram, true, 0.f, -1 },
+        { &blobMesh, &colorProgram, &depthProgram, true, 0.f, -1 },
+    };
+    auto isPulled = [&](const DrawItem& item) {
+        return vertexPulling && !stereo && item.pooled >= 0 && !item.mesh->isSphereImpostors();
+    };
+    bool animate = !regressionReference;
+
+    Profiler profiler;
+    bool depthPrepass = true;
+
+    DynamicResolution dynamicResolution;
+    if (regressionReference || replayPath) { // same work in every run
+        DynamicResolutionConfig config;
+        config.adaptive = false;
+        dynamicResolution.setConfig(config);
+    }
+
+    FrameCapture frameCapture;
+    bool screenshotRequested = false, recordFrames = false;
+    uint32_t screenshotIndex {}, recordedFrame {};
+
+    HiZCuller culler;
+    bool occlusionCulling = false;
+
+    ClusteredLighting lighting;
+    const int numPointLights = 256;
+    lighting.setLights(getPointLights(numPointLights));
+
+    CascadedShadowMap shadowMap;
+    const glm::vec3 lightDir(0, 1, 1); // default of "lightDir" in shader
 
     Camera camera;
 
+    // heightmap tiles stream in around the camera, the file is generated on first use
+    Terrain terrain;
+    const char* heightmapPath = "terrain.hmap";
+    bool showTerrain = false;
+
+    // octree nodes stream in under a GPU budget smaller than the file, generated on first use
+    PointCloudConfig pointCloudConfig;
+    pointCloudConfig.gpuBudget = size_t(16) << 20;
+    PointCloud pointCloud(pointCloudConfig);
+    const char* pointCloudPath = "scan.pcld";
+    bool showPointCloud = false;
+
+    // compute shader particles drawn as sphere impostors, created on first use
+    std::unique_ptr<ParticleSystem> particles;
+    GL_InstancedMesh particleMesh(MeshData(MeshData::ParametricType::Sphere, 4), DemoLayout(), MeshAttribFormat::Uint16,
+        MeshAttribFormat::Mat4x4);
+    particleMesh.setSphereImpostors(true);
+    bool showParticles = false;
+
     glm::vec2 sceneRot = { 0.2f, 0.2f };
     bool isDirty = true;
 
+    window.getKeyMap().bindAction(SDLK_g, KMOD_NONE, true, [&]() {
+        mesh.setInstanceTransforms(getMatrices(matrices));
+        shadowMap.markStaticGeometryDirty();
+        isDirty = true;
+    });
+
     window.RMBDragEvent = [&](int dx, int dy) {
         constexpr float offsetScale = 0.003f;
         sceneRot += glm::vec2(-dx, dy) * offsetScale;
@@ -119,30 +542,494 @@ int main()
         camera.setDistance(distance);
         isDirty = true;
     };
+    window.LMBClickEvent = [&](int32_t x, int32_t y) {
+        const glm::ivec2 size = window.getSize();
+        glm::vec3 origin, direction;
+        camera.getRay(glm::vec2(2.f * x / size.x - 1.f, 1.f - 2.f * y / size.y), origin, direction);
+
+        if (pickedInstance != InstanceBVH::s_none)
+            crowdMaterials[pickedInstance] = sphereMaterials[pickedInstance % sphereMaterials.size()];
+        InstanceBVH::RayHit hit;
+        pickedInstance = crowdBVH.rayCast(origin, direction, hit) ? hit.instance : InstanceBVH::s_none;
+        if (pickedInstance != InstanceBVH::s_none) {
+            crowdMaterials[pickedInstance] = pickedMaterial;
+            std::cout << "picked worm " << pickedInstance << " at distance " << hit.distance << std::endl;
+        }
+        crowdMesh.setInstanceMaterials(crowdMaterials);
+        isDirty = true;
+    };
+
+    // cubes and spheres from GL_MeshPool storage buffers, one multi-draw without VAO switches
+    window.getKeyMap().bindAction(SDLK_v, KMOD_NONE, true, [&]() {
+        vertexPulling = !vertexPulling;
+        std::cout << "vertex pulling: " << (vertexPulling ? "on" : "off") << std::endl;
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_u, KMOD_NONE, true, [&]() {
+        const BufferAllocatorStats stats = getBufferAllocator().getStats();
+        std::cout << "buffer allocator: " << stats.allocations << " allocations in " << stats.arenas << " arenas, "
+                  << (stats.used >> 10) << " KiB used of " << (stats.reserved >> 10) << " KiB, largest free "
+                  << (stats.largestFree >> 10) << " KiB, fragmentation " << int(stats.fragmentation * 100) << "%, "
+                  << stats.moves << " moves (" << (stats.movedBytes >> 10) << " KiB), "
+                  << stats.failed << " over budget" << std::endl;
+    });
+
+    // both eyes from one submission: instances drawn twice, one per viewport; not occlusion culled
+    window.getKeyMap().bindAction(SDLK_s, KMOD_NONE, true, [&]() {
+        stereo = !stereo;
+        std::cout << "multi-view stereo: " << (stereo ? "on" : "off") << std::endl;
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_t, KMOD_NONE, true, [&]() {
+        if (!terrain.isOpen()) {
+            if (!std::ifstream(heightmapPath)) {
+                std::cout << "generating " << heightmapPath << std::endl;
+                if (!writeHeightmap(heightmapPath, 8, 256, 257, getTerrainHeight))
+                    std::cout << "can't write " << heightmapPath << std::endl;
+            }
+            if (!terrain.open(heightmapPath))
+                return;
+        }
+        showTerrain = !showTerrain;
+        const TerrainStats stats = terrain.getStats();
+        std::cout << "terrain: " << (showTerrain ? "on" : "off") << ", " << stats.patches << " patches, "
+                  << stats.visitedNodes << " nodes visited, " << stats.residentTiles << " tiles resident, "
+                  << stats.pendingTiles << " pending, " << stats.loadedTiles << " loaded, " << stats.evictedTiles
+                  << " evicted" << std::endl;
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_o, KMOD_NONE, true, [&]() {
+        if (!pointCloud.isOpen()) {
+            if (!std::ifstream(pointCloudPath)) {
+                std::cout << "generating " << pointCloudPath << std::endl;
+                if (!writePointCloud(pointCloudPath, getScanPoints(4 << 20), 8192))
+                    std::cout << "can't write " << pointCloudPath << std::endl;
+            }
+            if (!pointCloud.open(pointCloudPath))
+                return;
+        }
+        showPointCloud = !showPointCloud;
+        const PointCloudStats stats = pointCloud.getStats();
+        std::cout << "point cloud: " << (showPointCloud ? "on" : "off") << ", " << stats.drawnPoints << " points in "
+                  << stats.drawnNodes << " nodes, " << stats.visitedNodes << " nodes visited, " << stats.residentNodes
+                  << " of " << stats.slots << " slots resident, " << stats.pendingNodes << " pending, "
+                  << stats.loadedNodes << " loaded, " << stats.evictedNodes << " evicted" << std::endl;
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_e, KMOD_NONE, true, [&]() {
+        if (!particles)
+            particles = std::make_unique<ParticleSystem>();
+        showParticles = !showParticles;
+        const ParticleStats stats = particles->getStats();
+        std::cout << "particles: " << (showParticles ? "on" : "off") << ", " << stats.alive << " alive, " << stats.emitted
+                  << " emitted, " << stats.died << " died, " << stats.free << " free" << std::endl;
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_F2, KMOD_NONE, true, [&]() {
+        depthPrepass = !depthPrepass;
+        std::cout << "depth pre-pass: " << (depthPrepass ? "on" : "off") << std::endl;
+        isDirty = true;
+    });
+
+    // spheres as ray traced quads, 4 vertices per instance instead of the mesh
+    window.getKeyMap().bindAction(SDLK_i, KMOD_NONE, true, [&]() {
+        const bool impostors = !sphereMesh.isSphereImpostors();
+        sphereMesh.setSphereImpostors(impostors);
+        for (auto& item : drawList)
+            if (item.mesh == &sphereMesh) {
+                item.color = impostors ? &impostorColorProgram : &colorProgram;
+                item.depth = impostors ? &impostorDepthProgram : &depthProgram;
+            }
+        std::cout << "sphere impostors: " << (impostors ? "on" : "off") << std::endl;
+        shadowMap.markStaticGeometryDirty();
+        isDirty = true;
+    });
+
+    // a million small spheres, materials cycle through the first ones;
+    // not sorted, that would cost more than early-Z saves
+    window.getKeyMap().bindAction(SDLK_m, KMOD_NONE, true, [&]() {
+        const uint32_t count = sphereMesh.getInstanceTransforms().size() == sphereMaterials.size() ? 1024 * 1024 : sphereMaterials.size();
+        std::vector<glm::mat4> sphereMatrices;
+        getMatrices(sphereMatrices, count);
+        std::vector<uint32_t> materialIndices(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (count != sphereMaterials.size())
+                sphereMatrices[i] = glm::scale(sphereMatrices[i], glm::vec3(.1f));
+            materialIndices[i] = sphereMaterials[i % sphereMaterials.size()];
+        }
+        sphereMesh.setInstanceMaterials({});
+        sphereMesh.setInstanceTransforms(sphereMatrices);
+        sphereMesh.setInstanceMaterials(materialIndices);
+        for (auto& item : drawList)
+            if (item.mesh == &sphereMesh)
+                item.animated = count != sphereMaterials.size();
+        std::cout << "spheres: " << count << std::endl;
+        shadowMap.markStaticGeometryDirty();
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_r, KMOD_NONE, true, [&]() { // adaptive -> 100% -> 50%
+        DynamicResolutionConfig config = dynamicResolution.getConfig();
+        if (config.adaptive)
+            config.adaptive = false, config.maxScale = 1.f;
+        else if (config.maxScale == 1.f)
+            config.maxScale = 0.5f;
+        else
+            config.adaptive = true, config.maxScale = 1.f;
+        dynamicResolution.setConfig(config);
+        std::cout << "resolution: " << (config.adaptive ? "adaptive" : config.maxScale == 1.f ? "fixed 100%" : "fixed 50%") << std::endl;
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_F3, KMOD_NONE, true, [&]() {
+        const glm::ivec2 renderSize = dynamicResolution.getRenderSize();
+        double screenSamples = (double)renderSize.x * renderSize.y * dynamicResolution.getConfig().samples;
+        profiler.print();
+        const JobStats jobStats = getJobSystem().getStats();
+        std::cout << "job system: " << jobStats.workers.size() << " threads, utilization "
+                  << jobStats.getUtilization() * 100.f << "% since last F3" << std::endl;
+        getJobSystem().resetStats();
+        std::cout << "resolution scale: " << dynamicResolution.getScale() << " (" << renderSize.x << "x"
+                  << renderSize.y << ")" << std::endl;
+        std::cout << "overdraw (shaded samples per screen sample): "
+                  << profiler.getValue("color") / screenSamples << std::endl;
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_F4, KMOD_NONE, true, [&]() {
+        occlusionCulling = !occlusionCulling;
+        std::cout << "occlusion culling: " << (occlusionCulling ? "on" : "off") << std::endl;
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_F5, KMOD_NONE, true, [&]() {
+        OcclusionStats stats = culler.getStats();
+        std::cout << "instances tested: " << stats.tested << ", visible: " << stats.visible
+                  << ", culled: " << stats.culled << ", newly visible: " << stats.newlyVisible << std::endl;
+        bvhQueryResult.clear();
+        crowdBVH.queryFrustum(camera.getProjection() * camera.getView(), bvhQueryResult);
+        std::cout << "crowd in frustum (CPU BVH): " << bvhQueryResult.size() << " of " << crowdBVH.getNumInstances() << std::endl;
+    });
+
+    window.getKeyMap().bindAction(SDLK_F6, KMOD_NONE, true, [&]() {
+        bool enable = lighting.getLights().empty();
+        lighting.setLights(getPointLights(enable ? numPointLights : 0));
+        std::cout << "point lights: " << lighting.getLights().size() << std::endl;
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_F7, KMOD_NONE, true, [&]() {
+        ShadowConfig config = shadowMap.getConfig();
+        config.numCascades = config.numCascades % 4 + 1;
+        config.numCachedCascades = config.numCascades / 2;
+        shadowMap.setConfig(config);
+        std::cout << "shadow cascades: " << config.numCascades << ", cached: " << config.numCachedCascades << std::endl;
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_F8, KMOD_NONE, true, [&]() {
+        animate = !animate;
+        std::cout << "animation: " << (animate ? "on" : "off") << std::endl;
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_F10, KMOD_NONE, true, [&]() {
+        sculpt = !sculpt;
+        std::cout << "sculpting: " << (sculpt ? "on" : "off") << ", last update: " << blobStats.uploads << " uploads, "
+                  << blobStats.uploadedBytes << " bytes of " << blobData.getNumVertices() * DemoLayout::s_stride
+                  << ", reallocations: " << blobStats.reallocations << std::endl;
+        if (!sculpt) { // shade the final shape
+            blobData.generateNormals();
+            blobMesh.update(blobData);
+        }
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_p, KMOD_NONE, true, [&]() {
+        screenshotRequested = true;
+        isDirty = true;
+    });
+
+    window.getKeyMap().bindAction(SDLK_F1, KMOD_NONE, true, [&]() { // every frame to frame_NNNNN.png
+        recordFrames = !recordFrames;
+        recordedFrame = 0;
+        if (!recordFrames) {
+            frameCapture.flush();
+            const CaptureStats stats = frameCapture.getStats();
+            std::cout << "captured " << stats.captured << ", written " << stats.completed << ", stalls " << stats.stalls
+                      << ", max latency " << stats.maxLatency << " frames" << std::endl;
+        }
+        std::cout << "frame recording: " << (recordFrames ? "on" : "off") << std::endl;
+        isDirty = true;
+    });
+
+    // steady-state frames must not touch the heap
+    const uint32_t allocationWarmupFrames = 30; // pools and arenas grow to their steady size
+    uint32_t allocationCheckLeft = allocationCheckFrames ? allocationWarmupFrames + allocationCheckFrames : 0;
+    uint64_t allocationCheckCount {};
+
     window.RMBDragEvent(0, 0);
     glm::mat4 modelMatrix(1); // unit matrix
+    std::vector<glm::vec2> replayFrameTimes; // CPU, GPU ms
+    if (replayPath)
+        window.startReplay(replay);
+    if (recordPath)
+        window.startRecording();
 
     float currentTime {};
 
+    auto setupProgram = [&](Program& program, const glm::mat4& view, const glm::mat4& projection) {
+        program.shader.bind();
+        program.model.set(modelMatrix);
+        program.view.set(view);
+        program.projection.set(projection);
+        program.viewPos.set(camera.getPos());
+        program.animationTime.set(currentTime);
+    };
+
+    // std::function once, not a temporary per frame
+    const CascadedShadowMap::DrawCasters drawShadowCasters = [&](const glm::mat4& view, const glm::mat4& projection, bool cached) {
+        // 'g' marks static geometry dirty, animated one goes only to dynamic cascades
+        wobble.bind();
+        for (auto& item : drawList) {
+            if (cached && item.animated)
+                continue;
+            setupProgram(*item.depth, view, projection);
+            item.mesh->draw();
+        }
+    };
+
+    // phase == nullptr: all instances, otherwise survivors of occlusion culling phase
+    // without HiZCuller the crowd is frustum culled on CPU by its BVH, the rest is drawn whole
+    auto drawUnculled = [&](DrawItem& item) {
+        item.mesh == &crowdMesh ? crowdMesh.drawSelected(crowdVisible) : item.mesh->draw();
+    };
+
+    auto drawDepth = [&](const HiZCuller::Phase* phase) {
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        wobble.bind();
+        if (stereo)
+            multiView.bind();
+        for (auto& item : drawList) {
+            if (isPulled(item))
+                continue;
+            if (stereo) {
+                setupProgram(*item.depth->multiView, camera.getView(), camera.getProjection());
+                item.mesh->drawMultiView(multiView.getNumViews());
+                continue;
+            }
+            setupProgram(*item.depth, camera.getView(), camera.getProjection());
+            phase ? culler.draw(*item.mesh, *phase) : drawUnculled(item);
+        }
+        if (vertexPulling && (!phase || *phase == HiZCuller::Phase::Main)) { // pooled meshes aren't culled
+            setupProgram(pulledDepthProgram, camera.getView(), camera.getProjection());
+            meshPool.draw();
+        }
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    };
+    auto drawColor = [&](const HiZCuller::Phase* phase) {
+        lighting.bind();
+        shadowMap.bind();
+        materials.bind();
+        wobble.bind();
+        if (stereo)
+            multiView.bind();
+        for (auto& item : drawList) {
+            if (isPulled(item))
+                continue;
+            if (stereo) {
+                setupProgram(*item.color->multiView, camera.getView(), camera.getProjection());
+                item.mesh->drawMultiView(multiView.getNumViews());
+                continue;
+            }
+            setupProgram(*item.color, camera.getView(), camera.getProjection());
+            phase ? culler.draw(*item.mesh, *phase) : drawUnculled(item);
+        }
+        if (vertexPulling && (!phase || *phase == HiZCuller::Phase::Main)) {
+            setupProgram(pulledColorProgram, camera.getView(), camera.getProjection());
+            meshPool.draw();
+        }
+    };
+    const HiZCuller::Phase mainPhase = HiZCuller::Phase::Main, retestPhase = HiZCuller::Phase::Retest;
+
     while (window.update()) {
+        frameCapture.update();
+        if (replayPath && !window.isReplaying()) {
+            const std::string timesPath = std::string(replayPath) + ".csv";
+            if (!writeFrameTimes(timesPath, replayFrameTimes))
+                std::cout << "can't write " << timesPath << std::endl;
+            break;
+        }
+        isDirty |= animate || recordFrames || window.isReplaying() || (showTerrain && terrain.getStats().pendingTiles)
+            || (showPointCloud && pointCloud.getStats().pendingNodes) || showParticles;
         if (isDirty) {
-            window.clear();
-            currentTime += window.getDeltaTime();
+            const AllocationStats frameStart = getAllocationStats();
+            profiler.begin("frame", Profiler::Type::Timestamps);
+            dynamicResolution.begin(window.getSize());
+            if (animate)
+                currentTime += window.getDeltaTime();
+
+            if (animate && sculpt) {
+                const glm::vec3 prevBrushDir = brushDir;
+                brushDir = glm::normalize(glm::vec3(cosf(currentTime), sinf(currentTime), 0.5f * sinf(currentTime * 0.37f)));
+                sculptBlob(blobData, blobDirs, brushDir, prevBrushDir);
+                blobStats = blobMesh.update(blobData);
+            }
+
+            lighting.update(camera);
+            if (showTerrain)
+                terrain.update(camera);
+            if (showPointCloud)
+                pointCloud.update(camera, dynamicResolution.getRenderSize().y);
+
+            for (auto& item : drawList) // animated crowd keeps per-frame CPU cost flat
+                item.distance = item.animated ? 0.f : item.mesh->sortInstancesFrontToBack(camera.getPos());
+            std::sort(drawList.begin(), drawList.end(), [](const DrawItem& a, const DrawItem& b) {
+                return a.distance < b.distance;
+            });
+            if (vertexPulling) // pool follows the sorted instances, impostors stay on their mesh
+                for (auto& item : drawList)
+                    if (item.pooled >= 0)
+                        meshPool.setInstances(item.pooled, isPulled(item) ? item.mesh->getInstanceTransforms() : noTransforms,
+                            isPulled(item) ? item.mesh->getInstanceMaterials() : noMaterials);
+
+            shadowMap.render(camera, lightDir, drawShadowCasters, &profiler);
+            if (showParticles)
+                particles->update(animate ? window.getDeltaTime() : 0.f, &profiler);
 
-            shader.bind();
-            shaderModel.set(modelMatrix);
-            shaderView.set(camera.getView());
-            shaderProjection.set(camera.getProjection());
-            shaderViewPos.set(camera.getPos());
+            if (stereo)
+                multiView.setStereo(camera, 0.03f * camera.getDistance(), dynamicResolution.getRenderSize());
 
-            diffuseColorPos.set({ .3f, .8f, .1f });
-            sphereMesh.draw();
+            if (!occlusionCulling && !stereo) {
+                crowdVisible.clear();
+                crowdBVH.queryFrustum(camera.getProjection() * camera.getView(), crowdVisible);
+            }
 
-            diffuseColorPos.set(glm::vec3 { .3f, .3f, .3f });
-            //      mesh.draw();
+            if (occlusionCulling && !stereo) {
+                culler.beginFrame(camera.getProjection() * camera.getView());
+                for (auto& item : drawList)
+                    culler.cull(*item.mesh, mainPhase, modelMatrix);
+
+                depthPrepass ? drawDepth(&mainPhase) : drawColor(&mainPhase);
+                culler.buildPyramid();
+
+                for (auto& item : drawList)
+                    culler.cull(*item.mesh, retestPhase, modelMatrix);
+
+                if (depthPrepass) {
+                    drawDepth(&retestPhase);
+                    glDepthFunc(GL_EQUAL);
+                    glDepthMask(GL_FALSE);
+                    profiler.begin("color", Profiler::Type::SamplesPassed);
+                    drawColor(&mainPhase);
+                    drawColor(&retestPhase);
+                    profiler.end("color");
+                } else {
+                    drawColor(&retestPhase);
+                }
+                culler.endFrame();
+
+            } else {
+                if (depthPrepass) {
+                    profiler.begin("depth prepass", Profiler::Type::SamplesPassed);
+                    drawDepth(nullptr);
+                    profiler.end("depth prepass");
+
+                    glDepthFunc(GL_EQUAL); // shade only the visible surface
+                    glDepthMask(GL_FALSE);
+                }
+
+                profiler.begin("color", Profiler::Type::SamplesPassed);
+                drawColor(nullptr);
+                profiler.end("color");
+            }
+
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+
+            if (showTerrain && !stereo) {
+                profiler.begin("terrain", Profiler::Type::TimeElapsed);
+                terrain.draw(camera, lightDir);
+                profiler.end("terrain");
+            }
+            if (showPointCloud && !stereo) {
+                profiler.begin("point cloud", Profiler::Type::TimeElapsed);
+                pointCloud.draw(camera);
+                profiler.end("point cloud");
+            }
+            if (showParticles && !stereo) {
+                lighting.bind();
+                shadowMap.bind();
+                materials.bind();
+                setupProgram(impostorColorProgram, camera.getView(), camera.getProjection());
+                profiler.begin("particle draw", Profiler::Type::TimeElapsed);
+                particles->draw(particleMesh);
+                profiler.end("particle draw");
+            }
+
+            dynamicResolution.present();
+            profiler.end("frame");
+            profiler.nextFrame();
+            dynamicResolution.update(profiler.getValue("frame") / 1e6f);
+            if (window.isReplaying())
+                replayFrameTimes.emplace_back(window.getFrameTime() * 1000.f, profiler.getValue("frame") / 1e6f);
             isDirty = false;
+
+            char capturePath[32];
+            if (screenshotRequested) {
+                snprintf(capturePath, sizeof(capturePath), "screenshot_%03u.png", screenshotIndex++);
+                frameCapture.capture(capturePath, window.getSize());
+                std::cout << "screenshot: " << capturePath << std::endl;
+                screenshotRequested = false;
+            }
+            if (recordFrames) {
+                snprintf(capturePath, sizeof(capturePath), "frame_%05u.png", recordedFrame++);
+                frameCapture.capture(capturePath, window.getSize());
+            }
+
+            if (regressionReference) {
+                Image frame, reference;
+                frameCapture.capture([&](Image&& image) { frame = std::move(image); }, window.getSize());
+                frameCapture.flush();
+                if (!readPPM(regressionReference, reference)) {
+                    const bool written = writeImage(regressionReference, frame);
+                    std::cout << (written ? "reference written: " : "can't write reference: ") << regressionReference << std::endl;
+                    return written ? 0 : 1;
+                }
+                const ImageDiff diff = compareImages(frame, reference);
+                std::cout << "regression " << (diff.passed ? "passed" : "FAILED") << ": " << diff.numDifferent
+                          << " pixels differ, max difference " << (int)diff.maxDifference << ", mean "
+                          << diff.meanDifference << std::endl;
+                if (!diff.passed)
+                    writeImage("regression_failed.png", frame);
+                return diff.passed ? 0 : 1;
+            }
+
+            if (allocationCheckLeft) {
+                if (allocationCheckLeft <= allocationCheckFrames)
+                    allocationCheckCount += getAllocationStats().count - frameStart.count;
+                isDirty = true; // keep rendering until checked
+                if (--allocationCheckLeft == 0) {
+                    std::cout << "heap allocations in " << allocationCheckFrames << " frames: " << allocationCheckCount
+                              << (allocationCheckCount ? "" : " (allocation-free)")
+                              << (isMallocCounted() ? "" : ", only operator new counted, malloc of C code and drivers isn't")
+                              << std::endl;
+                    return allocationCheckCount ? 1 : 0;
+                }
+            }
         }
     }
 
+    if (recordPath) {
+        const InputRecording recording = window.stopRecording();
+        const bool saved = recording.save(recordPath);
+        std::cout << (saved ? "input recorded: " : "can't write ") << recordPath << ", " << recording.numFrames
+                  << " frames, " << recording.events.size() << " events" << std::endl;
+    }
     return 0;
 }
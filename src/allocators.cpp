@@ -0,0 +1,426 @@
+#include "allocators.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+//////////// ALLOCATION COUNTERS /////////////
+
+// With glibc malloc and friends are replaced and forward to its __libc_ entry points,
+// so allocations of C code, SDL and the GL driver are counted too. Sanitizers bring
+// their own malloc, there only operator new is counted
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) || __has_feature(memory_sanitizer)
+#define ALLOCATORS_SANITIZED
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define ALLOCATORS_SANITIZED
+#endif
+#if defined(__GLIBC__) && !defined(ALLOCATORS_SANITIZED)
+#define ALLOCATORS_COUNT_MALLOC
+#endif
+
+static std::atomic<uint64_t> s_allocationCount {};
+static std::atomic<uint64_t> s_allocationBytes {};
+
+static void countAllocation(size_t size)
+{
+    s_allocationCount.fetch_add(1, std::memory_order_relaxed);
+    s_allocationBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+#ifdef ALLOCATORS_COUNT_MALLOC
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* p);
+
+void* malloc(size_t size) noexcept
+{
+    countAllocation(size);
+    return __libc_malloc(size);
+}
+void* calloc(size_t count, size_t size) noexcept
+{
+    countAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+void* realloc(void* p, size_t size) noexcept
+{
+    if (size) // realloc(p, 0) frees
+        countAllocation(size);
+    return __libc_realloc(p, size);
+}
+void* memalign(size_t alignment, size_t size) noexcept
+{
+    countAllocation(size);
+    return __libc_memalign(alignment, size);
+}
+void* aligned_alloc(size_t alignment, size_t size) noexcept { return memalign(alignment, size); }
+int posix_memalign(void** p, size_t alignment, size_t size) noexcept
+{
+    if (alignment % sizeof(void*) || (alignment & (alignment - 1)))
+        return EINVAL;
+    void* result = memalign(alignment, size);
+    if (!result)
+        return ENOMEM;
+    *p = result;
+    return 0;
+}
+void free(void* p) noexcept { __libc_free(p); }
+}
+#endif
+
+bool isMallocCounted()
+{
+#ifdef ALLOCATORS_COUNT_MALLOC
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void* countedAlloc(size_t size, bool nothrow = false)
+{
+#ifndef ALLOCATORS_COUNT_MALLOC
+    countAllocation(size);
+#endif
+    void* p = malloc(size ? size : 1);
+    if (!p && !nothrow)
+        throw std::bad_alloc();
+    return p;
+}
+
+static void* countedAlignedAlloc(size_t size, std::align_val_t alignment, bool nothrow = false)
+{
+#ifndef ALLOCATORS_COUNT_MALLOC
+    countAllocation(size);
+#endif
+    const size_t a = (size_t)alignment;
+    void* p = aligned_alloc(a, (size + a - 1) / a * a); // size must be multiple of alignment
+    if (!p && !nothrow)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size) { return countedAlloc(size); }
+void* operator new[](size_t size) { return countedAlloc(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return countedAlignedAlloc(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return countedAlignedAlloc(size, alignment); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size, true); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size, true); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return countedAlignedAlloc(size, alignment, true);
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return countedAlignedAlloc(size, alignment, true);
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { free(p); }
+
+AllocationStats getAllocationStats()
+{
+    return { s_allocationCount.load(std::memory_order_relaxed), s_allocationBytes.load(std::memory_order_relaxed) };
+}
+
+//////////// POOL /////////////
+
+static constexpr size_t s_alignment = alignof(std::max_align_t); // of blocks and arena allocations
+static size_t alignUp(size_t x, size_t a) { return (x + a - 1) & ~(a - 1); }
+
+PoolAllocator::PoolAllocator(size_t blockSize, size_t blocksPerChunk)
+    : m_blockSize(alignUp(std::max(blockSize, sizeof(FreeBlock)), s_alignment))
+    , m_blocksPerChunk(blocksPerChunk)
+{
+    assert(blocksPerChunk > 0);
+}
+
+PoolAllocator::~PoolAllocator()
+{
+    assert(m_numFree == m_numBlocks); // blocks still in use
+    while (m_chunks) {
+        Chunk* next = m_chunks->next;
+        ::operator delete(m_chunks);
+        m_chunks = next;
+    }
+}
+
+void* PoolAllocator::allocate()
+{
+    if (!m_freeList) {
+        uint8_t* memory = (uint8_t*)::operator new(s_alignment + m_blocksPerChunk * m_blockSize);
+        Chunk* chunk = (Chunk*)memory;
+        chunk->next = m_chunks;
+        m_chunks = chunk;
+
+        for (size_t i = m_blocksPerChunk; i-- > 0;) {
+            FreeBlock* block = (FreeBlock*)(memory + s_alignment + i * m_blockSize);
+            block->next = m_freeList;
+            m_freeList = block;
+        }
+        m_numBlocks += m_blocksPerChunk;
+        m_numFree += m_blocksPerChunk;
+    }
+
+    FreeBlock* block = m_freeList;
+    m_freeList = block->next;
+    m_numFree--;
+    return block;
+}
+
+void PoolAllocator::free(void* p)
+{
+    if (!p)
+        return;
+    FreeBlock* block = (FreeBlock*)p;
+    block->next = m_freeList;
+    m_freeList = block;
+    m_numFree++;
+}
+
+//////////// ARENA /////////////
+
+LinearArena::LinearArena(size_t blockSize)
+    : m_ownPool(new PoolAllocator(blockSize, 1))
+    , m_pool(*m_ownPool)
+{
+}
+
+LinearArena::LinearArena(PoolAllocator& blocks)
+    : m_pool(blocks)
+{
+}
+
+LinearArena::~LinearArena()
+{
+    reset();
+}
+
+void* LinearArena::allocate(size_t size, size_t alignment)
+{
+    assert(alignment <= s_alignment && (alignment & (alignment - 1)) == 0);
+    const size_t blockHeader = alignUp(sizeof(BlockHeader), s_alignment);
+    const size_t capacity = m_pool.getBlockSize() - blockHeader;
+
+    m_used += size;
+    m_peakUsed = std::max(m_peakUsed, m_used);
+
+    if (size > capacity) {
+        const size_t largeHeader = alignUp(sizeof(LargeHeader), s_alignment);
+        LargeHeader* large = (LargeHeader*)::operator new(largeHeader + size);
+        large->prev = m_large;
+        large->size = size;
+        m_large = large;
+        return (uint8_t*)large + largeHeader;
+    }
+
+    size_t offset = alignUp(m_offset, alignment);
+    if (!m_block || offset + size > capacity) {
+        BlockHeader* block = (BlockHeader*)m_pool.allocate();
+        block->prev = m_block;
+        m_block = block;
+        offset = 0;
+    }
+    m_offset = offset + size;
+    return (uint8_t*)m_block + blockHeader + offset;
+}
+
+void LinearArena::rewind(const Marker& marker)
+{
+    while (m_block != marker.block) {
+        assert(m_block); // marker of another arena
+        BlockHeader* prev = m_block->prev;
+        m_pool.free(m_block);
+        m_block = prev;
+    }
+    while (m_large != marker.large) {
+        assert(m_large);
+        LargeHeader* prev = m_large->prev;
+        ::operator delete(m_large);
+        m_large = prev;
+    }
+    m_offset = marker.offset;
+    m_used = marker.used;
+}
+
+LinearArena& getScratchArena()
+{
+    static thread_local LinearArena arena;
+    return arena;
+}
+
+//////////// RANGES /////////////
+
+// free block sizes to bins: [0, 16) one per size, then 16 bins per power of two
+void RangeAllocator::mapping(uint32_t size, uint32_t& fl, uint32_t& sl)
+{
+    if (size < s_slCount) {
+        fl = 0;
+        sl = size;
+        return;
+    }
+    const uint32_t log2 = 31 - __builtin_clz(size);
+    fl = log2 - s_slBits + 1;
+    sl = (size >> (log2 - s_slBits)) - s_slCount;
+}
+
+RangeAllocator::RangeAllocator(uint32_t size)
+    : m_capacity(size)
+{
+    for (auto& heads : m_heads)
+        for (uint32_t& head : heads)
+            head = s_invalid;
+    if (size) {
+        m_nodes.push_back({ 0, size, s_invalid, s_invalid, s_invalid, s_invalid, false });
+        insertFree(0);
+    }
+}
+
+uint32_t RangeAllocator::newNode()
+{
+    if (m_unusedNodes.empty()) {
+        m_nodes.emplace_back();
+        return m_nodes.size() - 1;
+    }
+    const uint32_t node = m_unusedNodes.back();
+    m_unusedNodes.pop_back();
+    return node;
+}
+
+void RangeAllocator::insertFree(uint32_t node)
+{
+    uint32_t fl, sl;
+    mapping(m_nodes[node].size, fl, sl);
+    Node& n = m_nodes[node];
+    n.used = false;
+    n.prevFree = s_invalid;
+    n.nextFree = m_heads[fl][sl];
+    if (n.nextFree != s_invalid)
+        m_nodes[n.nextFree].prevFree = node;
+    m_heads[fl][sl] = node;
+    m_flBitmap |= 1u << fl;
+    m_slBitmaps[fl] |= 1u << sl;
+}
+
+void RangeAllocator::removeFree(uint32_t node)
+{
+    const Node& n = m_nodes[node];
+    if (n.prevFree != s_invalid)
+        m_nodes[n.prevFree].nextFree = n.nextFree;
+    if (n.nextFree != s_invalid)
+        m_nodes[n.nextFree].prevFree = n.prevFree;
+    uint32_t fl, sl;
+    mapping(n.size, fl, sl);
+    if (m_heads[fl][sl] == node) {
+        m_heads[fl][sl] = n.nextFree;
+        if (n.nextFree == s_invalid) {
+            m_slBitmaps[fl] &= ~(1u << sl);
+            if (!m_slBitmaps[fl])
+                m_flBitmap &= ~(1u << fl);
+        }
+    }
+}
+
+uint32_t RangeAllocator::allocate(uint32_t size)
+{
+    assert(size > 0);
+    uint32_t fl, sl;
+    uint32_t node = s_invalid;
+    // round up to the next bin, so any block in the found bin fits
+    const uint32_t round = size >= s_slCount ? (1u << (31 - __builtin_clz(size) - s_slBits)) - 1 : 0;
+    if (size <= ~0u - round) {
+        mapping(size + round, fl, sl);
+        uint32_t slMap = m_slBitmaps[fl] & (~0u << sl);
+        if (!slMap) {
+            const uint32_t flMap = fl + 1 < 32 ? m_flBitmap & (~0u << (fl + 1)) : 0;
+            fl = flMap ? __builtin_ctz(flMap) : 0;
+            slMap = flMap ? m_slBitmaps[fl] : 0;
+        }
+        if (slMap)
+            node = m_heads[fl][__builtin_ctz(slMap)];
+    }
+    if (node == s_invalid) { // blocks of the size's own bin may still fit, first fit there
+        mapping(size, fl, sl);
+        node = m_heads[fl][sl];
+        while (node != s_invalid && m_nodes[node].size < size)
+            node = m_nodes[node].nextFree;
+        if (node == s_invalid)
+            return s_invalid;
+    }
+    assert(m_nodes[node].size >= size);
+    removeFree(node);
+
+    if (m_nodes[node].size > size) { // remainder goes back as a free block after node
+        const uint32_t rest = newNode();
+        Node& n = m_nodes[node];
+        m_nodes[rest] = { n.offset + size, n.size - size, node, n.nextPhysical, s_invalid, s_invalid, false };
+        if (n.nextPhysical != s_invalid)
+            m_nodes[n.nextPhysical].prevPhysical = rest;
+        n.nextPhysical = rest;
+        n.size = size;
+        insertFree(rest);
+    }
+    m_nodes[node].used = true;
+    m_used += size;
+    m_numAllocations++;
+    return node;
+}
+
+void RangeAllocator::free(uint32_t node)
+{
+    assert(node < m_nodes.size() && m_nodes[node].used);
+    m_used -= m_nodes[node].size;
+    m_numAllocations--;
+
+    // merge with free neighbours, the survivor is the lower one
+    const uint32_t next = m_nodes[node].nextPhysical;
+    if (next != s_invalid && !m_nodes[next].used) {
+        removeFree(next);
+        m_nodes[node].size += m_nodes[next].size;
+        m_nodes[node].nextPhysical = m_nodes[next].nextPhysical;
+        if (m_nodes[next].nextPhysical != s_invalid)
+            m_nodes[m_nodes[next].nextPhysical].prevPhysical = node;
+        m_unusedNodes.push_back(next);
+    }
+    const uint32_t prev = m_nodes[node].prevPhysical;
+    if (prev != s_invalid && !m_nodes[prev].used) {
+        removeFree(prev);
+        m_nodes[prev].size += m_nodes[node].size;
+        m_nodes[prev].nextPhysical = m_nodes[node].nextPhysical;
+        if (m_nodes[node].nextPhysical != s_invalid)
+            m_nodes[m_nodes[node].nextPhysical].prevPhysical = prev;
+        m_unusedNodes.push_back(node);
+        node = prev;
+    }
+    insertFree(node);
+}
+
+uint32_t RangeAllocator::getLargestFree() const
+{
+    if (!m_flBitmap)
+        return 0;
+    const uint32_t fl = 31 - __builtin_clz(m_flBitmap);
+    const uint32_t sl = 31 - __builtin_clz(m_slBitmaps[fl]);
+    uint32_t largest = 0; // sizes differ within the bin
+    for (uint32_t node = m_heads[fl][sl]; node != s_invalid; node = m_nodes[node].nextFree)
+        largest = std::max(largest, m_nodes[node].size);
+    return largest;
+}
@@ -0,0 +1,197 @@
+#ifndef ALLOCATORS_H
+#define ALLOCATORS_H
+
+#include <cstddef>
+#include <cstdint> // uintXX_t
+#include <memory>
+#include <vector>
+
+// counted by replaced malloc/calloc/realloc/aligned_alloc (glibc builds without
+// sanitizers) or else only by replaced global operator new, since program start, all threads
+struct AllocationStats {
+    uint64_t count {};
+    uint64_t bytes {};
+};
+AllocationStats getAllocationStats();
+// false if only operator new is counted, allocations of C libraries and drivers are missed
+bool isMallocCounted();
+
+// Fixed-size blocks with an intrusive free list. Chunks are kept until
+// destruction, so after warm-up allocate()/free() never reach the heap.
+// Not thread safe.
+class PoolAllocator {
+public:
+    PoolAllocator(size_t blockSize, size_t blocksPerChunk = 16);
+    PoolAllocator(const PoolAllocator&) = delete;
+    PoolAllocator& operator=(const PoolAllocator&) = delete;
+    ~PoolAllocator();
+
+    void* allocate();
+    void free(void* block);
+
+    size_t getBlockSize() const { return m_blockSize; }
+    size_t getNumBlocks() const { return m_numBlocks; }
+    size_t getNumFree() const { return m_numFree; }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+    struct Chunk {
+        Chunk* next;
+    };
+
+    const size_t m_blockSize, m_blocksPerChunk;
+    FreeBlock* m_freeList {};
+    Chunk* m_chunks {};
+    size_t m_numBlocks {}, m_numFree {};
+};
+
+// Bump allocator over blocks taken from a PoolAllocator. Individual frees are
+// no-ops, memory is released by rewind() to a marker or reset(). Requests
+// bigger than a block get dedicated heap allocations. Not thread safe.
+class LinearArena {
+public:
+    struct Marker {
+        void* block;
+        size_t offset;
+        void* large;
+        size_t used;
+    };
+
+    explicit LinearArena(size_t blockSize = 1 << 20); // with own pool
+    explicit LinearArena(PoolAllocator& blocks);
+    LinearArena(const LinearArena&) = delete;
+    LinearArena& operator=(const LinearArena&) = delete;
+    ~LinearArena();
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    template <typename T>
+    T* allocate(size_t count) { return (T*)allocate(count * sizeof(T), alignof(T)); }
+
+    Marker getMarker() const { return { m_block, m_offset, m_large, m_used }; }
+    void rewind(const Marker& marker); // frees everything allocated after marker
+    void reset() { rewind({}); }
+
+    size_t getUsed() const { return m_used; }
+    size_t getPeakUsed() const { return m_peakUsed; }
+
+private:
+    struct BlockHeader {
+        BlockHeader* prev;
+    };
+    struct LargeHeader {
+        LargeHeader* prev;
+        size_t size;
+    };
+
+    std::unique_ptr<PoolAllocator> m_ownPool;
+    PoolAllocator& m_pool;
+
+    BlockHeader* m_block {}; // current block, linked to previous ones
+    size_t m_offset {}; // in current block
+    LargeHeader* m_large {};
+    size_t m_used {}, m_peakUsed {};
+};
+
+// per-thread arena for temporaries (mesh building, packing),
+// take a ScratchScope so allocations are released when it ends
+LinearArena& getScratchArena();
+
+class ScratchScope {
+public:
+    ScratchScope()
+        : m_arena(getScratchArena())
+        , m_marker(m_arena.getMarker())
+    {
+    }
+    ScratchScope(const ScratchScope&) = delete;
+    ScratchScope& operator=(const ScratchScope&) = delete;
+    ~ScratchScope() { m_arena.rewind(m_marker); }
+
+    LinearArena& getArena() { return m_arena; }
+
+private:
+    LinearArena& m_arena;
+    const LinearArena::Marker m_marker;
+};
+
+// std allocator over LinearArena, deallocate() is a no-op (memory is reused on rewind)
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    ArenaAllocator(LinearArena& arena)
+        : arena(&arena)
+    {
+    }
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other)
+        : arena(other.arena)
+    {
+    }
+
+    T* allocate(size_t n) { return (T*)arena->allocate(n * sizeof(T)); } // aligned like malloc
+    void deallocate(T*, size_t) { }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+    LinearArena* arena;
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Two-level segregated fit (TLSF) allocator of ranges in [0, size) of memory it
+// doesn't touch, e.g. GPU buffers. allocate() and free() are O(1): free blocks are
+// binned by power of two and 16 steps within it, bitmaps find the first bin that
+// fits, and free neighbours coalesce. Only when no such bin has a block, the bin of
+// the size itself is searched first fit, so any free block >= size is found. Units
+// are up to the caller. Not thread safe.
+class RangeAllocator {
+public:
+    static constexpr uint32_t s_invalid = ~0u;
+
+    explicit RangeAllocator(uint32_t size);
+
+    uint32_t allocate(uint32_t size); // returns the node, s_invalid if no free block fits
+    void free(uint32_t node);
+
+    uint32_t getOffset(uint32_t node) const { return m_nodes[node].offset; }
+    uint32_t getSize(uint32_t node) const { return m_nodes[node].size; }
+
+    uint32_t getCapacity() const { return m_capacity; }
+    uint32_t getUsed() const { return m_used; }
+    uint32_t getNumAllocations() const { return m_numAllocations; }
+    uint32_t getLargestFree() const;
+
+private:
+    static constexpr uint32_t s_slBits = 4;
+    static constexpr uint32_t s_slCount = 1 << s_slBits;
+    static constexpr uint32_t s_flCount = 32 - s_slBits + 1;
+
+    struct Node {
+        uint32_t offset, size;
+        uint32_t prevPhysical, nextPhysical; // neighbours in memory
+        uint32_t prevFree, nextFree; // in bin list
+        bool used;
+    };
+
+    static void mapping(uint32_t size, uint32_t& fl, uint32_t& sl);
+    uint32_t newNode();
+    void insertFree(uint32_t node);
+    void removeFree(uint32_t node);
+
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_unusedNodes; // recycled entries of m_nodes
+    uint32_t m_heads[s_flCount][s_slCount];
+    uint32_t m_flBitmap {};
+    uint32_t m_slBitmaps[s_flCount] {};
+    const uint32_t m_capacity;
+    uint32_t m_used {}, m_numAllocations {};
+};
+
+#endif // ALLOCATORS_H
@@ -0,0 +1,38 @@
+#include "animation_palette.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <cassert>
+
+// must match s_skinningDeclarations in shader.cpp
+static constexpr uint32_t s_paletteBinding = 11;
+
+AnimationPalette::AnimationPalette()
+    : m_SSBO(GL_Buffer::create())
+{
+    // identity pose until frames are set, never bind empty storage
+    setFrames(1, { glm::mat4(1) }, 1.f);
+}
+
+void AnimationPalette::setFrames(uint32_t numJoints, const std::vector<glm::mat4>& frames, float framesPerSecond)
+{
+    assert(numJoints && !frames.empty() && frames.size() % numJoints == 0);
+    assert(framesPerSecond > 0.f);
+    m_numJoints = numJoints;
+    m_numFrames = frames.size() / numJoints;
+    m_framesPerSecond = framesPerSecond;
+
+    // std430: vec4 header, then mat4 array
+    const glm::vec4 header((float)m_numJoints, (float)m_numFrames, m_framesPerSecond, 0.f);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_SSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(header) + frames.size() * sizeof(glm::mat4), nullptr, GL_STATIC_DRAW);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(header), &header);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(header), frames.size() * sizeof(glm::mat4), frames.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void AnimationPalette::bind() const
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, s_paletteBinding, m_SSBO);
+}
@@ -0,0 +1,36 @@
+#ifndef ANIMATION_PALETTE_H
+#define ANIMATION_PALETTE_H
+
+#include "gl_handle.h"
+
+#include <cstdint> // uintXX_t
+#include <glm/glm.hpp>
+#include <vector>
+
+// Baked joint matrices of one looping clip in a storage buffer, shared by all
+// instances. Shaders with ShaderFeature::Skinning blend two nearest frames at
+// animationTime * rate + offset of the instance (GL_InstancedMesh::setInstanceAnimations),
+// so CPU cost doesn't depend on the number of animated instances.
+class AnimationPalette {
+public:
+    AnimationPalette();
+    AnimationPalette(const AnimationPalette&) = delete;
+    AnimationPalette& operator=(const AnimationPalette&) = delete;
+
+    // frames: numFrames * numJoints matrices, frame after frame, bind pose -> animated pose (mesh space)
+    void setFrames(uint32_t numJoints, const std::vector<glm::mat4>& frames, float framesPerSecond);
+
+    uint32_t getNumJoints() const { return m_numJoints; }
+    uint32_t getNumFrames() const { return m_numFrames; }
+    float getDuration() const { return m_numFrames / m_framesPerSecond; } // of the loop, s
+
+    void bind() const; // before drawing with ShaderFeature::Skinning
+
+private:
+    uint32_t m_numJoints {}, m_numFrames {};
+    float m_framesPerSecond { 1.f };
+
+    GL_Buffer m_SSBO;
+};
+
+#endif // ANIMATION_PALETTE_H
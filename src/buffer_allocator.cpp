@@ -0,0 +1,287 @@
+#include "buffer_allocator.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+static constexpr uint32_t s_noArena = ~0u;
+
+static uint32_t toUnits(size_t bytes)
+{
+    return uint32_t((bytes + GL_BufferAllocator::s_alignment - 1) / GL_BufferAllocator::s_alignment);
+}
+
+GL_BufferAllocation::GL_BufferAllocation(GL_BufferAllocation&& other) noexcept
+    : m_allocator(other.m_allocator)
+    , m_id(other.m_id)
+{
+    other.m_allocator = nullptr;
+}
+
+GL_BufferAllocation& GL_BufferAllocation::operator=(GL_BufferAllocation&& other) noexcept
+{
+    if (this != &other) {
+        reset();
+        m_allocator = other.m_allocator;
+        m_id = other.m_id;
+        other.m_allocator = nullptr;
+    }
+    return *this;
+}
+
+uint32_t GL_BufferAllocation::getBuffer() const
+{
+    return m_allocator ? m_allocator->m_arenas[m_allocator->m_allocations[m_id].arena]->buffer.get() : 0;
+}
+
+size_t GL_BufferAllocation::getOffset() const
+{
+    if (!m_allocator)
+        return 0;
+    const auto& allocation = m_allocator->m_allocations[m_id];
+    return size_t(m_allocator->m_arenas[allocation.arena]->ranges.getOffset(allocation.node)) * GL_BufferAllocator::s_alignment;
+}
+
+size_t GL_BufferAllocation::getSize() const
+{
+    return m_allocator ? m_allocator->m_allocations[m_id].size : 0;
+}
+
+void GL_BufferAllocation::upload(const void* data, size_t size, size_t offset)
+{
+    assert(offset + size <= getSize());
+    if (!size)
+        return;
+    // copy-write target keeps VAO element buffer and array buffer bindings untouched
+    glBindBuffer(GL_COPY_WRITE_BUFFER, getBuffer());
+    glBufferSubData(GL_COPY_WRITE_BUFFER, getOffset() + offset, size, data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GL_BufferAllocation::reset()
+{
+    if (m_allocator)
+        m_allocator->release(m_id);
+    m_allocator = nullptr;
+}
+
+GL_BufferAllocator::Arena::Arena(size_t size)
+    : buffer(GL_Buffer::create())
+    , ranges(size / s_alignment)
+{
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+GL_BufferAllocator::GL_BufferAllocator()
+{
+    getDeletionQueue(); // constructed first, so it outlives arena buffers released at exit
+}
+
+bool GL_BufferAllocator::findRange(uint32_t units, uint32_t exclude, Range& range)
+{
+    for (uint32_t a = 0; a < m_arenas.size(); ++a) {
+        if (!m_arenas[a] || a == exclude)
+            continue;
+        const uint32_t node = m_arenas[a]->ranges.allocate(units);
+        if (node != RangeAllocator::s_invalid) {
+            range = { a, node };
+            return true;
+        }
+    }
+    return false;
+}
+
+GL_BufferAllocation GL_BufferAllocator::allocate(size_t size)
+{
+    GL_BufferAllocation allocation;
+    if (!size)
+        return allocation;
+
+    const uint32_t units = toUnits(size);
+    Range range;
+    if (!findRange(units, s_noArena, range)) {
+        // new arena, smaller than arenaSize if that's all the budget has left
+        const size_t needed = size_t(units) * s_alignment;
+        size_t arenaSize = std::min(std::max(m_config.arenaSize, needed), m_config.budget - std::min(m_reserved, m_config.budget));
+        arenaSize -= arenaSize % s_alignment;
+        if (arenaSize < needed) {
+            m_failed++;
+            std::cout << "GL_BufferAllocator: " << size << " bytes don't fit the budget of " << m_config.budget
+                      << " bytes, " << m_reserved << " reserved" << std::endl;
+            return allocation;
+        }
+        range.arena = std::find(m_arenas.begin(), m_arenas.end(), nullptr) - m_arenas.begin();
+        if (range.arena == m_arenas.size())
+            m_arenas.emplace_back();
+        m_arenas[range.arena] = std::make_unique<Arena>(arenaSize);
+        m_reserved += arenaSize;
+        range.node = m_arenas[range.arena]->ranges.allocate(units);
+        assert(range.node != RangeAllocator::s_invalid);
+    }
+
+    uint32_t id = m_allocations.size();
+    if (m_unusedAllocations.empty())
+        m_allocations.emplace_back();
+    else {
+        id = m_unusedAllocations.back();
+        m_unusedAllocations.pop_back();
+    }
+    m_allocations[id] = { range.arena, range.node, size };
+    allocation.m_allocator = this;
+    allocation.m_id = id;
+    return allocation;
+}
+
+void GL_BufferAllocator::release(uint32_t id)
+{
+    Allocation& allocation = m_allocations[id];
+    m_incoming.ranges.push_back({ allocation.arena, allocation.node });
+    allocation.arena = s_noArena;
+    m_unusedAllocations.push_back(id);
+}
+
+void GL_BufferAllocator::releaseBatch(FreeBatch& batch)
+{
+    if (batch.fence) {
+        // submitted s_framesInFlight frames ago, normally signaled already
+        glClientWaitSync((GLsync)batch.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync((GLsync)batch.fence);
+        batch.fence = nullptr;
+    }
+    for (const Range& range : batch.ranges)
+        m_arenas[range.arena]->ranges.free(range.node);
+    batch.ranges.clear(); // keeps capacity
+}
+
+void GL_BufferAllocator::move(uint32_t id, const Range& to)
+{
+    Allocation& allocation = m_allocations[id];
+    const Arena& src = *m_arenas[allocation.arena];
+    const Arena& dst = *m_arenas[to.arena];
+    glBindBuffer(GL_COPY_READ_BUFFER, src.buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, dst.buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, size_t(src.ranges.getOffset(allocation.node)) * s_alignment,
+        size_t(dst.ranges.getOffset(to.node)) * s_alignment, allocation.size);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    // the old range may still be read by frames in flight, it's freed like a released one
+    m_incoming.ranges.push_back({ allocation.arena, allocation.node });
+    allocation.arena = to.arena;
+    allocation.node = to.node;
+    m_moves++;
+    m_movedBytes += allocation.size;
+}
+
+void GL_BufferAllocator::defragment()
+{
+    if (!m_config.defragBytesPerFrame)
+        return;
+
+    // the emptiest arena is evacuated into the others when it's at most half full,
+    // otherwise the most fragmented one is compacted toward its start
+    uint32_t numArenas = 0, emptiest = s_noArena, fragmented = s_noArena;
+    float maxFragmentation = m_config.defragThreshold;
+    for (uint32_t a = 0; a < m_arenas.size(); ++a) {
+        if (!m_arenas[a])
+            continue;
+        const RangeAllocator& ranges = m_arenas[a]->ranges;
+        numArenas++;
+        if (emptiest == s_noArena || ranges.getUsed() < m_arenas[emptiest]->ranges.getUsed())
+            emptiest = a;
+        const uint32_t free = ranges.getCapacity() - ranges.getUsed();
+        const float fragmentation = free ? 1.f - float(ranges.getLargestFree()) / free : 0.f;
+        if (fragmentation > maxFragmentation) {
+            maxFragmentation = fragmentation;
+            fragmented = a;
+        }
+    }
+    const bool evacuate = numArenas > 1 && m_arenas[emptiest]->ranges.getUsed() <= m_arenas[emptiest]->ranges.getCapacity() / 2;
+    const uint32_t source = evacuate ? emptiest : fragmented;
+    if (source == s_noArena)
+        return;
+
+    ScratchScope scratch;
+    ArenaVector<std::pair<uint32_t, uint32_t>> candidates(ArenaAllocator<std::pair<uint32_t, uint32_t>>(scratch.getArena())); // offset, id
+    for (uint32_t id = 0; id < m_allocations.size(); ++id)
+        if (m_allocations[id].arena == source)
+            candidates.push_back({ m_arenas[source]->ranges.getOffset(m_allocations[id].node), id });
+    std::sort(candidates.begin(), candidates.end(), std::greater<>()); // top first
+
+    size_t budget = m_config.defragBytesPerFrame;
+    for (const auto& [offset, id] : candidates) {
+        const size_t size = m_allocations[id].size;
+        if (size > budget && budget < m_config.defragBytesPerFrame)
+            break; // a bigger one than the budget goes alone
+        const uint32_t units = toUnits(size);
+        Range to;
+        if (evacuate) {
+            if (!findRange(units, source, to))
+                break;
+        } else {
+            to = { source, m_arenas[source]->ranges.allocate(units) };
+            if (to.node == RangeAllocator::s_invalid)
+                break;
+            if (m_arenas[source]->ranges.getOffset(to.node) > offset) { // no room below
+                m_arenas[source]->ranges.free(to.node);
+                break;
+            }
+        }
+        move(id, to);
+        budget -= std::min(size, budget);
+    }
+}
+
+void GL_BufferAllocator::nextFrame()
+{
+    FreeBatch& batch = m_batches[m_frame % GL_DeletionQueue::s_framesInFlight];
+    releaseBatch(batch);
+
+    defragment();
+
+    batch.ranges.swap(m_incoming.ranges);
+    if (!batch.ranges.empty())
+        batch.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_frame++;
+
+    // empty arenas go back to the driver, one is kept to avoid churn
+    uint32_t numArenas = m_arenas.size() - std::count(m_arenas.begin(), m_arenas.end(), nullptr);
+    for (uint32_t a = 0; a < m_arenas.size() && numArenas > 1; ++a)
+        if (m_arenas[a] && m_arenas[a]->ranges.getNumAllocations() == 0) {
+            m_reserved -= getArenaSize(a);
+            m_arenas[a].reset();
+            numArenas--;
+        }
+}
+
+BufferAllocatorStats GL_BufferAllocator::getStats() const
+{
+    BufferAllocatorStats stats;
+    size_t free = 0;
+    for (const auto& arena : m_arenas) {
+        if (!arena)
+            continue;
+        stats.arenas++;
+        stats.used += size_t(arena->ranges.getUsed()) * s_alignment;
+        free += size_t(arena->ranges.getCapacity() - arena->ranges.getUsed()) * s_alignment;
+        stats.largestFree = std::max(stats.largestFree, size_t(arena->ranges.getLargestFree()) * s_alignment);
+    }
+    stats.allocations = m_allocations.size() - m_unusedAllocations.size();
+    stats.reserved = m_reserved;
+    stats.fragmentation = free ? 1.f - float(stats.largestFree) / free : 0.f;
+    stats.moves = m_moves;
+    stats.movedBytes = m_movedBytes;
+    stats.failed = m_failed;
+    return stats;
+}
+
+GL_BufferAllocator& getBufferAllocator()
+{
+    static GL_BufferAllocator allocator;
+    return allocator;
+}
@@ -0,0 +1,122 @@
+#ifndef BUFFER_ALLOCATOR_H
+#define BUFFER_ALLOCATOR_H
+#include "allocators.h"
+#include "gl_handle.h"
+
+#include <cstddef>
+#include <cstdint> // uintXX_t
+#include <memory>
+#include <vector>
+
+struct BufferAllocatorConfig {
+    size_t budget = size_t(1) << 30; // bytes of all arenas, allocations past it fail
+    size_t arenaSize = 64 << 20; // bigger allocations get an arena of their own
+    size_t defragBytesPerFrame = 4 << 20; // copied by nextFrame(), 0 - no defragmentation
+    float defragThreshold = 0.3f; // fragmentation of an arena that gets it compacted
+};
+
+struct BufferAllocatorStats {
+    uint32_t arenas {}, allocations {};
+    size_t reserved {}; // bytes of arena buffers
+    size_t used {}; // by allocations, rounded up to s_alignment
+    size_t largestFree {}; // biggest allocation that fits without a new arena
+    float fragmentation {}; // 1 - largestFree / free bytes, 0 - free space is one block
+    uint32_t moves {}; // by defragmentation, since start
+    size_t movedBytes {};
+    uint32_t failed {}; // allocations refused by the budget
+};
+
+class GL_BufferAllocator;
+
+// Range of an arena buffer, move-only, released on destruction. Defragmentation
+// can move it to another offset or buffer, users rebind when
+// GL_BufferAllocator::getGeneration() changes.
+class GL_BufferAllocation {
+public:
+    GL_BufferAllocation() = default;
+    GL_BufferAllocation(GL_BufferAllocation&& other) noexcept;
+    GL_BufferAllocation& operator=(GL_BufferAllocation&& other) noexcept;
+    GL_BufferAllocation(const GL_BufferAllocation&) = delete;
+    GL_BufferAllocation& operator=(const GL_BufferAllocation&) = delete;
+    ~GL_BufferAllocation() { reset(); }
+
+    explicit operator bool() const { return m_allocator; }
+    uint32_t getBuffer() const; // 0 if empty
+    size_t getOffset() const; // bytes, multiple of GL_BufferAllocator::s_alignment
+    size_t getSize() const; // as requested
+
+    void upload(const void* data, size_t size, size_t offset = 0); // within the range
+    void reset(); // the range is reused once the GPU is done with the current frame
+
+private:
+    friend class GL_BufferAllocator;
+    GL_BufferAllocator* m_allocator {};
+    uint32_t m_id {};
+};
+
+// Vertex, index and instance ranges carved by a RangeAllocator (TLSF) out of a few big
+// GL buffers, instead of a buffer object each. Arenas are created on demand within the
+// memory budget and released when empty. Freed ranges wait for a fence of the frame
+// they were freed in. nextFrame() defragments incrementally: ranges of the emptiest
+// arena move to the others, the top ranges of a fragmented one move into free space
+// below, by glCopyBufferSubData of at most defragBytesPerFrame. GL thread only.
+class GL_BufferAllocator {
+public:
+    static constexpr size_t s_alignment = 256; // of offsets, covers index, vertex and SSBO bindings
+
+    GL_BufferAllocator();
+    GL_BufferAllocator(const GL_BufferAllocator&) = delete;
+    GL_BufferAllocator& operator=(const GL_BufferAllocator&) = delete;
+
+    void setConfig(const BufferAllocatorConfig& config) { m_config = config; }
+    const BufferAllocatorConfig& getConfig() const { return m_config; }
+
+    GL_BufferAllocation allocate(size_t size); // empty if size is 0 or over the budget
+    void nextFrame(); // after the frame is submitted, called by Window::update
+
+    uint32_t getGeneration() const { return m_moves; } // changes when ranges move
+    BufferAllocatorStats getStats() const;
+
+private:
+    friend class GL_BufferAllocation;
+
+    struct Arena {
+        Arena(size_t size);
+        GL_Buffer buffer;
+        RangeAllocator ranges; // in s_alignment units
+    };
+    struct Allocation {
+        uint32_t arena, node;
+        size_t size;
+    };
+    struct Range {
+        uint32_t arena, node;
+    };
+    struct FreeBatch {
+        std::vector<Range> ranges;
+        void* fence {};
+    };
+
+    // free block of units, not in arena exclude; false if none fits
+    bool findRange(uint32_t units, uint32_t exclude, Range& range);
+    void release(uint32_t id); // by GL_BufferAllocation
+    void releaseBatch(FreeBatch& batch);
+    void move(uint32_t id, const Range& to); // copies, the old range is freed deferred
+    void defragment();
+    size_t getArenaSize(uint32_t arena) const { return size_t(m_arenas[arena]->ranges.getCapacity()) * s_alignment; }
+
+    BufferAllocatorConfig m_config;
+    std::vector<std::unique_ptr<Arena>> m_arenas; // nullptr - released slot
+    std::vector<Allocation> m_allocations;
+    std::vector<uint32_t> m_unusedAllocations; // recycled ids
+    FreeBatch m_incoming;
+    FreeBatch m_batches[GL_DeletionQueue::s_framesInFlight];
+    uint32_t m_frame {};
+    size_t m_reserved {};
+    uint32_t m_moves {}, m_failed {};
+    size_t m_movedBytes {};
+};
+
+GL_BufferAllocator& getBufferAllocator(); // engine wide
+
+#endif // BUFFER_ALLOCATOR_H
@@ -0,0 +1,73 @@
+#ifndef BYTE_STREAM_H
+#define BYTE_STREAM_H
+
+#include <cstdint> // uintXX_t
+#include <vector>
+
+// little endian integers and LEB128 varints of the binary formats (input recordings, mesh codec)
+
+inline void putU32(std::vector<uint8_t>& out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        out.push_back(uint8_t(value >> (i * 8)));
+}
+
+inline void putVarint(std::vector<uint8_t>& out, uint32_t value)
+{
+    for (; value >= 0x80; value >>= 7)
+        out.push_back(uint8_t(value | 0x80));
+    out.push_back(uint8_t(value));
+}
+
+inline void putSigned(std::vector<uint8_t>& out, int32_t value) // zigzag, small magnitudes stay short
+{
+    putVarint(out, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+// reads [pos, end); past the end or on a malformed varint values are 0 and failed is set
+struct ByteReader {
+    const uint8_t* pos;
+    const uint8_t* end;
+    bool failed = false;
+
+    uint8_t byte()
+    {
+        if (pos == end) {
+            failed = true;
+            return 0;
+        }
+        return *pos++;
+    }
+    uint32_t u32()
+    {
+        if (end - pos < 4) {
+            failed = true;
+            return 0;
+        }
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i)
+            value |= uint32_t(*pos++) << (i * 8);
+        return value;
+    }
+    uint32_t varint()
+    {
+        uint32_t value = 0;
+        for (uint32_t shift = 0; shift < 35; shift += 7) {
+            if (pos == end)
+                break;
+            const uint8_t byte = *pos++;
+            value |= uint32_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        failed = true;
+        return 0;
+    }
+    int32_t signedVarint()
+    {
+        const uint32_t value = varint();
+        return int32_t(value >> 1) ^ -int32_t(value & 1);
+    }
+};
+
+#endif // BYTE_STREAM_H
@@ -61,3 +61,26 @@ void Camera::updateViewMatrix()
 {
     m_view = glm::lookAt(m_pos, m_aim, m_up);
 }
+
+void Camera::getRay(const glm::vec2& ndc, glm::vec3& origin, glm::vec3& direction) const
+{
+    const glm::mat4 invViewProjection = glm::inverse(m_projection * m_view);
+    const glm::vec4 nearPoint = invViewProjection * glm::vec4(ndc, -1.f, 1.f);
+    const glm::vec4 farPoint = invViewProjection * glm::vec4(ndc, 1.f, 1.f);
+    origin = glm::vec3(nearPoint) / nearPoint.w;
+    direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - origin);
+}
+
+void extractFrustumPlanes(const glm::mat4& m, glm::vec4 planes[6])
+{
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; ++i)
+        rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+    for (int i = 0; i < 3; ++i) {
+        planes[i * 2 + 0] = rows[3] + rows[i];
+        planes[i * 2 + 1] = rows[3] - rows[i];
+    }
+    for (int i = 0; i < 6; ++i)
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+}
@@ -12,6 +12,10 @@ public:
     }
     void setFOV(float fov, bool b_updateProjection = true);
     void setAR(float ar, bool b_updateProjection = true);
+    float getFOV() const { return m_fov; } // vertical, radians
+    float getAR() const { return m_ar; }
+    float getNear() const { return m_near; }
+    float getFar() const { return m_far; }
 
     glm::vec3 getPos() const { return m_pos; }
     void setPos(glm::vec3 pos, bool b_updateView = true);
@@ -30,8 +34,11 @@ public:
     void updateProjectionMatrix();
     void updateViewMatrix();
 
-    const glm::mat4& getView() { return m_view; };
-    const glm::mat4& getProjection() { return m_projection; };
+    const glm::mat4& getView() const { return m_view; };
+    const glm::mat4& getProjection() const { return m_projection; };
+
+    // world space ray through ndc point (x, y in [-1, 1]), e.g. for mouse picking
+    void getRay(const glm::vec2& ndc, glm::vec3& origin, glm::vec3& direction) const;
 
 private:
     glm::mat4 m_view;
@@ -41,4 +48,7 @@ private:
     float m_fov = 1.f /*radians*/, m_ar = 1.f;
 };
 
+// Gribb-Hartmann, planes (xyz - unit normal, w - distance) pointing inside
+void extractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
+
 #endif // CAMERA_H
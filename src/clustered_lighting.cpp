@@ -0,0 +1,155 @@
+#include "clustered_lighting.h"
+#include "camera.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <algorithm>
+#include <cmath>
+
+// binding points, must match s_clusteredLightsDeclarations in shader.cpp
+static constexpr uint32_t s_paramsBinding = 0; // uniform block
+static constexpr uint32_t s_lightsBinding = 5, s_clustersBinding = 6, s_indicesBinding = 7; // storage blocks
+
+struct ClusterParams { // std140
+    glm::uvec4 grid; // x, y, z, unused
+    glm::vec4 depth; // slice scale, slice bias, viewport width, viewport height
+};
+
+static_assert(sizeof(PointLight) == 2 * sizeof(glm::vec4), "PointLight must match std430 layout");
+
+// grows buffer geometrically, never shrinks
+static void uploadBuffer(uint32_t buffer, GLenum target, const void* data, size_t size, size_t& capacity)
+{
+    glBindBuffer(target, buffer);
+    if (size > capacity) {
+        capacity = std::max(size, capacity * 2);
+        glBufferData(target, capacity, nullptr, GL_DYNAMIC_DRAW);
+    }
+    if (size)
+        glBufferSubData(target, 0, size, data);
+}
+
+ClusteredLighting::ClusteredLighting()
+    : m_paramsUBO(GL_Buffer::create())
+    , m_lightsSSBO(GL_Buffer::create())
+    , m_clustersSSBO(GL_Buffer::create())
+    , m_indicesSSBO(GL_Buffer::create())
+{
+    m_clusters.resize(s_numClusters);
+    m_clusterCursors.resize(s_numClusters);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, m_paramsUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ClusterParams), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_clustersSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, s_numClusters * sizeof(glm::uvec2), nullptr, GL_DYNAMIC_DRAW);
+
+    // never bind empty storage
+    m_lightsCapacity = sizeof(PointLight), m_indicesCapacity = sizeof(uint32_t);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_lightsSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, m_lightsCapacity, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_indicesSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, m_indicesCapacity, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// calls func(clusterIndex) for every froxel touched by bounding box of the light sphere
+template <typename Func>
+void ClusteredLighting::forEachCluster(const PointLight& light, Func func) const
+{
+    const glm::vec3 p = glm::vec3(m_view * glm::vec4(light.position, 1.f));
+    const float r = light.radius;
+    const float depth = -p.z;
+
+    const float zLo = std::max(depth - r, m_near), zHi = std::min(depth + r, m_far);
+    if (zLo > zHi)
+        return;
+
+    auto depthToSlice = [&](float z) {
+        return std::clamp((int)floorf(logf(z) * m_sliceScale + m_sliceBias), 0, (int)s_gridZ - 1);
+    };
+    auto sliceDepth = [&](int k) { return expf((k - m_sliceBias) / m_sliceScale); };
+
+    // screen extent of [lo, hi] (view space) at depths [z0, z1], as tile range
+    auto tileRange = [](float lo, float hi, float z0, float z1, float tanHalf, int gridSize, int& first, int& last) {
+        float ndcLo = lo / ((lo >= 0 ? z1 : z0) * tanHalf);
+        float ndcHi = hi / ((hi >= 0 ? z0 : z1) * tanHalf);
+        if (ndcHi < -1.f || ndcLo > 1.f)
+            return false;
+        first = std::clamp((int)floorf((ndcLo * 0.5f + 0.5f) * gridSize), 0, gridSize - 1);
+        last = std::clamp((int)floorf((ndcHi * 0.5f + 0.5f) * gridSize), 0, gridSize - 1);
+        return true;
+    };
+
+    const int kFirst = depthToSlice(zLo), kLast = depthToSlice(zHi);
+    for (int k = kFirst; k <= kLast; ++k) {
+        const float z0 = std::max(zLo, sliceDepth(k)), z1 = std::min(zHi, sliceDepth(k + 1));
+        int x0, x1, y0, y1;
+        if (!tileRange(p.x - r, p.x + r, z0, z1, m_tanX, s_gridX, x0, x1)
+            || !tileRange(p.y - r, p.y + r, z0, z1, m_tanY, s_gridY, y0, y1))
+            continue;
+
+        for (int y = y0; y <= y1; ++y)
+            for (int x = x0; x <= x1; ++x)
+                func((k * s_gridY + y) * s_gridX + x);
+    }
+}
+
+void ClusteredLighting::update(const Camera& camera)
+{
+    m_view = camera.getView();
+    m_near = camera.getNear(), m_far = camera.getFar();
+    m_tanY = tanf(camera.getFOV() * 0.5f), m_tanX = m_tanY * camera.getAR();
+
+    // slice = log(z) * scale + bias, exponential slices keep froxels roughly cubic
+    const float logFarNear = logf(m_far / m_near);
+    m_sliceScale = s_gridZ / logFarNear;
+    m_sliceBias = -(float)s_gridZ * logf(m_near) / logFarNear;
+
+    // counting pass
+    std::fill(m_clusterCursors.begin(), m_clusterCursors.end(), 0);
+    for (const auto& light : m_lights)
+        forEachCluster(light, [this](uint32_t cluster) { m_clusterCursors[cluster]++; });
+
+    uint32_t offset = 0;
+    m_maxLightsPerCluster = 0;
+    for (uint32_t i = 0; i < s_numClusters; ++i) {
+        m_clusters[i] = { offset, 0 };
+        offset += m_clusterCursors[i];
+        m_maxLightsPerCluster = std::max(m_maxLightsPerCluster, m_clusterCursors[i]);
+    }
+
+    // filling pass
+    m_lightIndices.resize(offset);
+    for (uint32_t i_light = 0; i_light < m_lights.size(); ++i_light)
+        forEachCluster(m_lights[i_light], [this, i_light](uint32_t cluster) {
+            glm::uvec2& c = m_clusters[cluster];
+            m_lightIndices[c.x + c.y++] = i_light;
+        });
+
+    GLint viewport[4] {};
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const ClusterParams params {
+        { s_gridX, s_gridY, s_gridZ, 0 },
+        { m_sliceScale, m_sliceBias, (float)viewport[2], (float)viewport[3] }
+    };
+    glBindBuffer(GL_UNIFORM_BUFFER, m_paramsUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(params), &params);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    uploadBuffer(m_lightsSSBO, GL_SHADER_STORAGE_BUFFER, m_lights.data(), m_lights.size() * sizeof(PointLight), m_lightsCapacity);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_clustersSSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, m_clusters.size() * sizeof(glm::uvec2), m_clusters.data());
+    uploadBuffer(m_indicesSSBO, GL_SHADER_STORAGE_BUFFER, m_lightIndices.data(), m_lightIndices.size() * sizeof(uint32_t), m_indicesCapacity);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void ClusteredLighting::bind() const
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, s_paramsBinding, m_paramsUBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, s_lightsBinding, m_lightsSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, s_clustersBinding, m_clustersSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, s_indicesBinding, m_indicesSSBO);
+}
@@ -0,0 +1,60 @@
+#ifndef CLUSTERED_LIGHTING_H
+#define CLUSTERED_LIGHTING_H
+
+#include "gl_handle.h"
+
+#include <cstdint> // uintXX_t
+#include <glm/glm.hpp>
+#include <vector>
+
+class Camera;
+
+struct PointLight { // std430 layout, mirrored in shader.cpp
+    glm::vec3 position {};
+    float radius { 1.f }; // light has no influence beyond
+    glm::vec3 color { 1.f };
+    float intensity { 1.f };
+};
+
+// Clustered forward shading: view frustum is split into a froxel grid
+// (screen tiles x exponential depth slices), every froxel gets the list of
+// point lights touching it. Shaders with ShaderFeature::ClusteredLights
+// loop only over the lights of the fragment's froxel.
+class ClusteredLighting {
+public:
+    static constexpr uint32_t s_gridX = 16, s_gridY = 9, s_gridZ = 24;
+    static constexpr uint32_t s_numClusters = s_gridX * s_gridY * s_gridZ;
+
+    ClusteredLighting();
+    ClusteredLighting(const ClusteredLighting&) = delete;
+    ClusteredLighting& operator=(const ClusteredLighting&) = delete;
+
+    void setLights(const std::vector<PointLight>& lights) { m_lights = lights; }
+    std::vector<PointLight>& getLights() { return m_lights; }
+
+    // bins lights on CPU and uploads light, cluster and index buffers (viewport sized grid)
+    void update(const Camera& camera);
+    void bind() const; // before drawing with ShaderFeature::ClusteredLights
+
+    uint32_t getNumLightIndices() const { return m_lightIndices.size(); }
+    uint32_t getMaxLightsPerCluster() const { return m_maxLightsPerCluster; }
+
+private:
+    template <typename Func>
+    void forEachCluster(const PointLight& light, Func func) const;
+
+    std::vector<PointLight> m_lights;
+    std::vector<glm::uvec2> m_clusters; // offset, count in m_lightIndices
+    std::vector<uint32_t> m_clusterCursors;
+    std::vector<uint32_t> m_lightIndices;
+    uint32_t m_maxLightsPerCluster {};
+
+    // per-frame binning parameters
+    glm::mat4 m_view { 1 };
+    float m_near {}, m_far {}, m_tanX {}, m_tanY {}, m_sliceScale {}, m_sliceBias {};
+
+    GL_Buffer m_paramsUBO, m_lightsSSBO, m_clustersSSBO, m_indicesSSBO;
+    size_t m_lightsCapacity {}, m_indicesCapacity {};
+};
+
+#endif // CLUSTERED_LIGHTING_H
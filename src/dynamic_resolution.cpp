@@ -0,0 +1,176 @@
+#include "dynamic_resolution.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+static constexpr GLenum s_colorFormat = GL_R11F_G11F_B10F; // HDR, 4 bytes per sample
+static constexpr GLenum s_depthFormat = GL_DEPTH_COMPONENT32F;
+
+static constexpr float s_scaleStep = 1.f / 32.f; // scales are quantized, small jitter doesn't change them
+static constexpr float s_upscaleHeadroom = 0.85f; // upscale only below this fraction of the target
+static constexpr float s_timeFilter = 0.2f; // weight of a new measurement
+static constexpr uint32_t s_settleFrames = 6; // > Profiler latency, skips frames measured at the old scale
+
+static const char* s_presentVertexSource = R"(#version 460 core
+uniform vec2 uvScale; // render size / allocated size
+out vec2 uv;
+
+void main()
+{
+    vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2); // triangle covering the screen
+    uv = p * uvScale;
+    gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+}
+)";
+
+static const char* s_presentFragmentSource = R"(#version 460 core
+uniform sampler2D hdrColor;
+uniform vec2 uvMax; // last texel center of the rendered rectangle, texels beyond are stale
+in vec2 uv;
+layout(location = 0) out vec3 fragColor;
+)";
+
+DynamicResolution::DynamicResolution(const DynamicResolutionConfig& config)
+    : m_msaaFBO(GL_Framebuffer::create())
+    , m_resolveFBO(GL_Framebuffer::create())
+    , m_presentShader(s_presentVertexSource,
+          std::string(s_presentFragmentSource) + getTonemapFunction()
+              + "void main() { fragColor = tonemap(texture(hdrColor, min(uv, uvMax)).rgb); }\n")
+    , m_uvScale(m_presentShader.getVariable("uvScale"))
+    , m_uvMax(m_presentShader.getVariable("uvMax"))
+    , m_emptyVAO(GL_VertexArray::create())
+{
+    setConfig(config);
+}
+
+void DynamicResolution::setConfig(const DynamicResolutionConfig& config)
+{
+    assert(config.minScale > 0.f && config.minScale <= config.maxScale && config.samples >= 1);
+    const bool reallocate = config.maxScale != m_config.maxScale || config.samples != m_config.samples;
+    m_config = config;
+    m_scale = std::clamp(m_scale, config.minScale, config.maxScale);
+    m_filteredTime = 0.f;
+    if (reallocate && m_outputSize != glm::ivec2(0))
+        createTargets(m_outputSize);
+}
+
+void DynamicResolution::createTargets(const glm::ivec2& outputSize)
+{
+    m_outputSize = outputSize;
+    m_allocatedSize = glm::max(glm::ivec2(glm::ceil(glm::vec2(outputSize) * m_config.maxScale)), glm::ivec2(1));
+    const int width = m_allocatedSize.x, height = m_allocatedSize.y;
+
+    m_resolveColor = GL_Texture::create();
+    glBindTexture(GL_TEXTURE_2D, m_resolveColor);
+    glTexStorage2D(GL_TEXTURE_2D, 1, s_colorFormat, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_resolveFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_resolveColor, 0);
+
+    if (m_config.samples > 1) {
+        m_resolveDepth.reset();
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+
+        m_msaaColor = GL_Texture::create();
+        m_msaaDepth = GL_Texture::create();
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, m_msaaColor);
+        glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, m_config.samples, s_colorFormat, width, height, GL_TRUE);
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, m_msaaDepth);
+        glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, m_config.samples, s_depthFormat, width, height, GL_TRUE);
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, m_msaaFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D_MULTISAMPLE, m_msaaColor, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D_MULTISAMPLE, m_msaaDepth, 0);
+    } else {
+        m_msaaColor.reset();
+        m_msaaDepth.reset();
+
+        m_resolveDepth = GL_Texture::create();
+        glBindTexture(GL_TEXTURE_2D, m_resolveDepth);
+        glTexStorage2D(GL_TEXTURE_2D, 1, s_depthFormat, width, height);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_resolveDepth, 0);
+    }
+    assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DynamicResolution::begin(const glm::ivec2& outputSize)
+{
+    if (outputSize != m_outputSize)
+        createTargets(outputSize);
+
+    const float scale = m_config.adaptive ? m_scale : m_config.maxScale;
+    m_renderSize = glm::clamp(glm::ivec2(glm::round(glm::vec2(outputSize) * scale)), glm::ivec2(1), m_allocatedSize);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_config.samples > 1 ? m_msaaFBO : m_resolveFBO);
+    glViewport(0, 0, m_renderSize.x, m_renderSize.y);
+    glEnable(GL_SCISSOR_TEST); // the rest of the target isn't shown
+    glScissor(0, 0, m_renderSize.x, m_renderSize.y);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDisable(GL_SCISSOR_TEST);
+}
+
+void DynamicResolution::present(uint32_t outputFramebuffer)
+{
+    if (m_config.samples > 1) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_msaaFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_resolveFBO);
+        glBlitFramebuffer(0, 0, m_renderSize.x, m_renderSize.y, 0, 0, m_renderSize.x, m_renderSize.y,
+            GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+    glViewport(0, 0, m_outputSize.x, m_outputSize.y);
+    glDisable(GL_DEPTH_TEST);
+
+    const glm::vec2 allocatedSize(m_allocatedSize);
+    m_presentShader.bind();
+    m_uvScale.set(glm::vec2(m_renderSize) / allocatedSize);
+    m_uvMax.set((glm::vec2(m_renderSize) - 0.5f) / allocatedSize);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_resolveColor);
+    glBindVertexArray(m_emptyVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glEnable(GL_DEPTH_TEST);
+}
+
+void DynamicResolution::update(float gpuFrameTime)
+{
+    if (!m_config.adaptive || gpuFrameTime <= 0.f)
+        return;
+
+    m_filteredTime = m_filteredTime > 0.f ? glm::mix(m_filteredTime, gpuFrameTime, s_timeFilter) : gpuFrameTime;
+    if (m_settleFrames) {
+        m_settleFrames--;
+        m_filteredTime = 0.f;
+        return;
+    }
+
+    // cost ~ pixels ~ scale^2
+    const float ratio = m_config.targetFrameTime / m_filteredTime;
+    if (ratio >= 1.f && ratio * s_upscaleHeadroom < 1.f)
+        return; // within budget, without room to grow
+    float scale = m_scale * sqrtf(ratio);
+    scale = ratio < 1.f ? floorf(scale / s_scaleStep) * s_scaleStep : ceilf(scale / s_scaleStep - 0.5f) * s_scaleStep;
+    scale = std::clamp(scale, m_config.minScale, m_config.maxScale);
+
+    if (scale != m_scale) {
+        m_scale = scale;
+        m_settleFrames = s_settleFrames;
+        m_filteredTime = 0.f;
+    }
+}
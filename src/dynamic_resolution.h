@@ -0,0 +1,62 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include "gl_handle.h"
+#include "shader.h"
+
+#include <cstdint> // uintXX_t
+#include <glm/glm.hpp>
+
+struct DynamicResolutionConfig {
+    float targetFrameTime = 1000.f / 60.f; // GPU ms the scale is adjusted to
+    float minScale = 0.5f, maxScale = 1.f; // of output size, per axis
+    uint32_t samples = 4; // MSAA of the offscreen target, resolved before upscale
+    bool adaptive = true; // false: fixed at maxScale
+};
+
+// Offscreen HDR rendering at a fraction of the window size. Targets are
+// allocated once for maxScale and the scene is drawn into a viewport sized
+// sub-rectangle, so changing the scale never reallocates. present() resolves
+// MSAA, then tonemaps and bilinearly upscales to the window in one pass;
+// programs drawn into the target use ShaderFeature::LinearOutput.
+// update() steers the scale towards the target GPU frame time: pixel count is
+// assumed proportional to cost, downscaling is immediate, upscaling waits for
+// headroom, and after every change measurements in flight are skipped.
+class DynamicResolution {
+public:
+    DynamicResolution(const DynamicResolutionConfig& config = {});
+    DynamicResolution(const DynamicResolution&) = delete;
+    DynamicResolution& operator=(const DynamicResolution&) = delete;
+
+    void setConfig(const DynamicResolutionConfig& config);
+    const DynamicResolutionConfig& getConfig() const { return m_config; }
+
+    // binds the target with viewport at current scale of outputSize and clears it
+    void begin(const glm::ivec2& outputSize);
+    // tonemaps and upscales into outputFramebuffer, viewport is left at output size
+    void present(uint32_t outputFramebuffer = 0);
+    // GPU time of a finished frame in ms (e.g. Profiler::Type::Timestamps), adjusts next begin()
+    void update(float gpuFrameTime);
+
+    float getScale() const { return m_scale; }
+    glm::ivec2 getRenderSize() const { return m_renderSize; }
+
+private:
+    void createTargets(const glm::ivec2& outputSize);
+
+    DynamicResolutionConfig m_config;
+    float m_scale = 1.f;
+    float m_filteredTime {}; // 0 - no measurement since last change
+    uint32_t m_settleFrames {};
+
+    glm::ivec2 m_outputSize {}, m_allocatedSize {}, m_renderSize {};
+    GL_Framebuffer m_msaaFBO, m_resolveFBO;
+    GL_Texture m_msaaColor, m_msaaDepth; // samples > 1 only
+    GL_Texture m_resolveColor, m_resolveDepth; // depth only without MSAA
+
+    Shader m_presentShader;
+    Shader::ShaderVariable m_uvScale, m_uvMax;
+    GL_VertexArray m_emptyVAO; // fullscreen triangle is generated from gl_VertexID
+};
+
+#endif // DYNAMIC_RESOLUTION_H
@@ -0,0 +1,179 @@
+#include "frame_capture.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+FrameCapture::FrameCapture(uint32_t numBuffers)
+    : m_slots(numBuffers)
+{
+    assert(numBuffers > 0);
+    m_worker = std::thread(&FrameCapture::workerLoop, this);
+}
+
+FrameCapture::~FrameCapture()
+{
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_jobReady.notify_one();
+    m_worker.join();
+    // buffers are unmapped by the deletion queue
+}
+
+FrameCapture::Slot& FrameCapture::acquireSlot()
+{
+    const uint32_t index = m_nextSlot;
+    m_nextSlot = (m_nextSlot + 1) % m_slots.size();
+    Slot& slot = m_slots[index];
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const State state = slot.state;
+    lock.unlock();
+    if (state == State::Free)
+        return slot;
+
+    m_stats.stalls++;
+    if (state == State::Reading) {
+        glClientWaitSync((GLsync)slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        dispatch(index);
+    }
+    waitForWorker(index);
+    return slot;
+}
+
+void FrameCapture::readPixels(Slot& slot, const glm::ivec2& size, uint32_t framebuffer)
+{
+    assert(size.x > 0 && size.y > 0);
+    const size_t bytes = (size_t)size.x * size.y * 4;
+    if (slot.capacity < bytes) { // immutable storage, grow by replacing
+        slot.buffer = GL_Buffer::create();
+        const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        glBufferStorage(GL_PIXEL_PACK_BUFFER, bytes, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+        slot.mapped = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, flags);
+        assert(slot.mapped);
+        slot.capacity = bytes;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr); // native layout, no conversion on the GPU path
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.frame = m_frame;
+    slot.size = size;
+    m_stats.captured++;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    slot.state = State::Reading;
+}
+
+void FrameCapture::capture(const std::string& path, const glm::ivec2& size, uint32_t framebuffer)
+{
+    Slot& slot = acquireSlot();
+    slot.path = path;
+    slot.callback = nullptr;
+    readPixels(slot, size, framebuffer);
+}
+
+void FrameCapture::capture(Callback callback, const glm::ivec2& size, uint32_t framebuffer)
+{
+    Slot& slot = acquireSlot();
+    slot.path.clear();
+    slot.callback = std::move(callback);
+    readPixels(slot, size, framebuffer);
+}
+
+void FrameCapture::dispatch(uint32_t index)
+{
+    Slot& slot = m_slots[index];
+    glDeleteSync((GLsync)slot.fence);
+    slot.fence = nullptr;
+    m_stats.maxLatency = std::max(m_stats.maxLatency, m_frame - slot.frame);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        slot.state = State::Encoding;
+        m_jobs.push_back(index);
+    }
+    m_jobReady.notify_one();
+}
+
+void FrameCapture::update()
+{
+    m_frame++;
+    for (uint32_t i = 0; i < m_slots.size(); i++) {
+        Slot& slot = m_slots[i];
+        if (slot.fence && glClientWaitSync((GLsync)slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) != GL_TIMEOUT_EXPIRED)
+            dispatch(i);
+    }
+}
+
+void FrameCapture::waitForWorker(uint32_t index)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_slotFreed.wait(lock, [&]() { return m_slots[index].state == State::Free; });
+}
+
+void FrameCapture::flush()
+{
+    for (uint32_t i = 0; i < m_slots.size(); i++) {
+        Slot& slot = m_slots[i];
+        if (slot.fence) {
+            glClientWaitSync((GLsync)slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            dispatch(i);
+        }
+    }
+    for (uint32_t i = 0; i < m_slots.size(); i++)
+        waitForWorker(i);
+}
+
+CaptureStats FrameCapture::getStats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void FrameCapture::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_jobReady.wait(lock, [&]() { return m_quit || !m_jobs.empty(); });
+        if (m_jobs.empty())
+            return;
+        const uint32_t index = m_jobs.front();
+        m_jobs.pop_front();
+
+        lock.unlock();
+        encode(m_slots[index]);
+        lock.lock();
+
+        m_slots[index].state = State::Free;
+        m_stats.completed++;
+        m_slotFreed.notify_all();
+    }
+}
+
+void FrameCapture::encode(Slot& slot)
+{
+    Image image;
+    image.resize(slot.size.x, slot.size.y);
+    for (uint32_t y = 0; y < image.height; y++) { // GL rows go bottom up
+        const uint8_t* src = slot.mapped + (size_t)(image.height - 1 - y) * image.width * 4;
+        uint8_t* dst = image.getRow(y);
+        for (uint32_t x = 0; x < image.width; x++, src += 4, dst += 3)
+            dst[0] = src[0], dst[1] = src[1], dst[2] = src[2];
+    }
+
+    if (slot.callback)
+        slot.callback(std::move(image));
+    else if (!writeImage(slot.path, image))
+        std::cout << "frame capture: can't write " << slot.path << std::endl;
+}
@@ -0,0 +1,81 @@
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include "gl_handle.h"
+#include "image.h"
+
+#include <condition_variable>
+#include <cstdint> // uintXX_t
+#include <deque>
+#include <functional>
+#include <glm/glm.hpp>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct CaptureStats {
+    uint64_t captured {}; // readbacks issued
+    uint64_t completed {}; // encoded / delivered
+    uint64_t stalls {}; // capture() waited for a busy buffer
+    uint32_t maxLatency {}; // frames from capture() to the worker getting the pixels
+};
+
+// Framebuffer readback without stalls: glReadPixels goes into a ring of
+// persistently mapped pixel buffers and is fenced; update() hands finished
+// buffers to a worker thread, which flips rows, drops alpha and encodes the
+// image straight from the mapping. The buffer is reused once the worker is done;
+// capture() only waits when all of them are busy.
+class FrameCapture {
+public:
+    typedef std::function<void(Image&&)> Callback; // called on the worker thread
+
+    FrameCapture(uint32_t numBuffers = 3);
+    FrameCapture(const FrameCapture&) = delete;
+    FrameCapture& operator=(const FrameCapture&) = delete;
+    ~FrameCapture(); // finishes pending captures
+
+    // reads the lower left size rectangle of framebuffer (0: back buffer of the window),
+    // call after the frame is drawn, before it's swapped
+    void capture(const std::string& path, const glm::ivec2& size, uint32_t framebuffer = 0); // see writeImage
+    void capture(Callback callback, const glm::ivec2& size, uint32_t framebuffer = 0);
+    void update(); // once per frame
+    void flush(); // blocks until every capture is written / delivered
+
+    CaptureStats getStats() const;
+
+private:
+    enum class State : uint8_t { Free, Reading, Encoding };
+
+    struct Slot {
+        State state = State::Free; // guarded by m_mutex
+        GL_Buffer buffer;
+        const uint8_t* mapped {};
+        size_t capacity {};
+        void* fence {};
+        uint32_t frame {}; // of capture()
+        glm::ivec2 size {};
+        std::string path;
+        Callback callback;
+    };
+
+    Slot& acquireSlot();
+    void readPixels(Slot& slot, const glm::ivec2& size, uint32_t framebuffer);
+    void dispatch(uint32_t slot); // fence has signaled
+    void waitForWorker(uint32_t slot); // until the slot is free
+    void workerLoop();
+    void encode(Slot& slot);
+
+    std::vector<Slot> m_slots;
+    uint32_t m_nextSlot {};
+    uint32_t m_frame {};
+    CaptureStats m_stats;
+
+    mutable std::mutex m_mutex; // also guards m_stats.completed
+    std::condition_variable m_jobReady, m_slotFreed;
+    std::deque<uint32_t> m_jobs; // guarded by m_mutex
+    bool m_quit {}; // guarded by m_mutex
+    std::thread m_worker;
+};
+
+#endif // FRAME_CAPTURE_H
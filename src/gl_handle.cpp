@@ -0,0 +1,100 @@
+#include "gl_handle.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <cassert>
+
+uint32_t createGLObject(GL_ResourceType type)
+{
+    GLuint name = 0;
+    switch (type) {
+    case GL_ResourceType::Buffer:
+        glGenBuffers(1, &name);
+        break;
+    case GL_ResourceType::VertexArray:
+        glGenVertexArrays(1, &name);
+        break;
+    case GL_ResourceType::Texture:
+        glGenTextures(1, &name);
+        break;
+    case GL_ResourceType::Framebuffer:
+        glGenFramebuffers(1, &name);
+        break;
+    case GL_ResourceType::Query:
+        glGenQueries(1, &name);
+        break;
+    case GL_ResourceType::Program:
+        name = glCreateProgram();
+        break;
+    default:
+        assert(false); // unknown resource type
+    }
+    return name;
+}
+
+void GL_DeletionQueue::push(GL_ResourceType type, uint32_t name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_incoming.names[(uint32_t)type].push_back(name);
+}
+
+void GL_DeletionQueue::deleteBatch(Batch& batch)
+{
+    if (batch.fence) {
+        // submitted s_framesInFlight frames ago, normally signaled already
+        glClientWaitSync((GLsync)batch.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync((GLsync)batch.fence);
+        batch.fence = nullptr;
+    }
+
+    auto& names = batch.names;
+    if (auto& n = names[(uint32_t)GL_ResourceType::Buffer]; !n.empty())
+        glDeleteBuffers(n.size(), n.data());
+    if (auto& n = names[(uint32_t)GL_ResourceType::VertexArray]; !n.empty())
+        glDeleteVertexArrays(n.size(), n.data());
+    if (auto& n = names[(uint32_t)GL_ResourceType::Texture]; !n.empty())
+        glDeleteTextures(n.size(), n.data());
+    if (auto& n = names[(uint32_t)GL_ResourceType::Framebuffer]; !n.empty())
+        glDeleteFramebuffers(n.size(), n.data());
+    if (auto& n = names[(uint32_t)GL_ResourceType::Query]; !n.empty())
+        glDeleteQueries(n.size(), n.data());
+    for (uint32_t program : names[(uint32_t)GL_ResourceType::Program])
+        glDeleteProgram(program);
+
+    for (auto& n : names)
+        n.clear(); // keeps capacity, steady state doesn't allocate
+}
+
+void GL_DeletionQueue::nextFrame()
+{
+    Batch& batch = m_batches[m_frame % s_framesInFlight];
+    deleteBatch(batch);
+
+    bool isEmpty = true;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (uint32_t i = 0; i < s_numTypes; ++i) {
+            batch.names[i].swap(m_incoming.names[i]);
+            isEmpty &= batch.names[i].empty();
+        }
+    }
+    if (!isEmpty)
+        batch.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_frame++;
+}
+
+void GL_DeletionQueue::flush()
+{
+    for (auto& batch : m_batches)
+        deleteBatch(batch);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    deleteBatch(m_incoming);
+}
+
+GL_DeletionQueue& getDeletionQueue()
+{
+    static GL_DeletionQueue queue;
+    return queue;
+}
@@ -0,0 +1,99 @@
+#ifndef GL_HANDLE_H
+#define GL_HANDLE_H
+
+#include <cstdint> // uintXX_t
+#include <mutex>
+#include <vector>
+
+// clang-format off
+enum class GL_ResourceType : uint8_t { Buffer, VertexArray, Texture, Framebuffer, Query, Program, Count };
+// clang-format on
+
+// Names of dropped GL objects, deleted in bulk once the GPU has finished the frame
+// they were dropped in. push() is thread safe, the rest runs on the GL thread.
+class GL_DeletionQueue {
+public:
+    static constexpr uint32_t s_framesInFlight = 3;
+
+    GL_DeletionQueue() = default;
+    GL_DeletionQueue(const GL_DeletionQueue&) = delete;
+    GL_DeletionQueue& operator=(const GL_DeletionQueue&) = delete;
+
+    void push(GL_ResourceType type, uint32_t name);
+    void nextFrame(); // after the frame is submitted, called by Window::update
+    void flush(); // deletes everything now, before the context goes away
+
+private:
+    static constexpr uint32_t s_numTypes = (uint32_t)GL_ResourceType::Count;
+
+    struct Batch {
+        std::vector<uint32_t> names[s_numTypes];
+        void* fence {};
+    };
+
+    void deleteBatch(Batch& batch);
+
+    std::mutex m_mutex;
+    Batch m_incoming; // guarded by m_mutex
+    Batch m_batches[s_framesInFlight];
+    uint32_t m_frame {};
+};
+
+GL_DeletionQueue& getDeletionQueue();
+
+uint32_t createGLObject(GL_ResourceType type); // GL thread
+
+// Owning GL object name, move-only. The destructor doesn't call GL, the name
+// goes to the deletion queue, so handles can be dropped from any thread.
+template <GL_ResourceType Type>
+class GL_Handle {
+public:
+    GL_Handle() = default;
+    explicit GL_Handle(uint32_t name) // takes ownership
+        : m_name(name)
+    {
+    }
+    GL_Handle(GL_Handle&& other) noexcept
+        : m_name(other.release())
+    {
+    }
+    GL_Handle& operator=(GL_Handle&& other) noexcept
+    {
+        if (this != &other)
+            reset(other.release());
+        return *this;
+    }
+    GL_Handle(const GL_Handle&) = delete;
+    GL_Handle& operator=(const GL_Handle&) = delete;
+    ~GL_Handle() { reset(); }
+
+    static GL_Handle create() { return GL_Handle(createGLObject(Type)); }
+
+    uint32_t get() const { return m_name; }
+    operator uint32_t() const { return m_name; }
+
+    void reset(uint32_t name = 0) // queues the old name for deletion
+    {
+        if (m_name)
+            getDeletionQueue().push(Type, m_name);
+        m_name = name;
+    }
+    uint32_t release()
+    {
+        uint32_t name = m_name;
+        m_name = 0;
+        return name;
+    }
+
+private:
+    uint32_t m_name {};
+};
+
+typedef GL_Handle<GL_ResourceType::Buffer> GL_Buffer;
+typedef GL_Handle<GL_ResourceType::VertexArray> GL_VertexArray;
+typedef GL_Handle<GL_ResourceType::Texture> GL_Texture;
+typedef GL_Handle<GL_ResourceType::Framebuffer> GL_Framebuffer;
+typedef GL_Handle<GL_ResourceType::Query> GL_Query;
+typedef GL_Handle<GL_ResourceType::Program> GL_Program;
+
+#endif // GL_HANDLE_H
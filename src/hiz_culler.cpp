@@ -0,0 +1,432 @@
+#include "hiz_culler.h"
+#include "camera.h"
+#include "mesh.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+static constexpr uint32_t s_commandSize = 5 * sizeof(uint32_t); // DrawElementsIndirectCommand
+static constexpr uint32_t s_cullGroupSize = 64;
+
+static const std::string s_downsampleSource = R"(
+#version 460 core
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D srcDepth;
+uniform int srcLevel;
+uniform ivec2 srcSize;
+uniform int reduction; // 1 - copy of depth buffer, 2 - next pyramid level
+layout(r32f, binding = 0) writeonly uniform image2D dstLevel;
+
+void main()
+{
+    ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 dstSize = imageSize(dstLevel);
+    if (any(greaterThanEqual(dst, dstSize)))
+        return;
+
+    ivec2 begin = dst * reduction;
+    ivec2 end = begin + ivec2(reduction);
+    if (reduction > 1) { // odd source size: last texel folds the leftover row/column
+        if (dst.x == dstSize.x - 1) end.x = srcSize.x;
+        if (dst.y == dstSize.y - 1) end.y = srcSize.y;
+    }
+
+    float depth = 0.0;
+    for (int y = begin.y; y < end.y; ++y)
+        for (int x = begin.x; x < end.x; ++x)
+            depth = max(depth, texelFetch(srcDepth, ivec2(x, y), srcLevel).r);
+
+    imageStore(dstLevel, dst, vec4(depth));
+}
+)";
+
+static const std::string s_cullSource = R"(
+#version 460 core
+layout(local_size_x = 64) in;
+
+layout(std430, binding = 0) readonly buffer Instances { mat4 instances[]; };
+layout(std430, binding = 1) buffer Visibility { uint visibility[]; }; // 0 - out of frustum, 1 - visible, 2 - occluded
+layout(std430, binding = 2) writeonly buffer Visible { mat4 visibleInstances[]; };
+layout(std430, binding = 3) buffer Commands { uint commands[]; }; // DrawElementsIndirectCommand per phase
+layout(std430, binding = 4) buffer Stats { uint statTested, statVisible, statCulled, statNewlyVisible; };
+layout(std430, binding = 9) readonly buffer Materials { uint materials[]; };
+layout(std430, binding = 10) writeonly buffer VisibleMaterials { uint visibleMaterials[]; };
+layout(std430, binding = 12) readonly buffer Animations { vec2 animations[]; };
+layout(std430, binding = 13) writeonly buffer VisibleAnimations { vec2 visibleAnimations[]; };
+
+uniform mat4 model;
+uniform mat4 pyramidViewProjection;
+uniform vec4 frustumPlanes[6];
+uniform vec4 boundingSphere;
+uniform uint numInstances;
+uniform int phase; // 0 - main, 1 - retest
+uniform bool hasPyramid;
+uniform bool hasMaterials;
+uniform bool hasAnimations;
+uniform sampler2D hiz;
+
+shared uint localVisible, localCulled, localNewlyVisible;
+
+bool isInFrustum(vec3 c, float r)
+{
+    for (int i = 0; i < 6; ++i)
+        if (dot(frustumPlanes[i].xyz, c) + frustumPlanes[i].w < -r)
+            return false;
+    return true;
+}
+
+bool isOccluded(vec3 c, float r)
+{
+    vec2 minUV = vec2(1.0), maxUV = vec2(0.0);
+    float minZ = 1.0;
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner = c + r * vec3((i & 1) != 0 ? 1 : -1, (i & 2) != 0 ? 1 : -1, (i & 4) != 0 ? 1 : -1);
+        vec4 clip = pyramidViewProjection * vec4(corner, 1.0);
+        if (clip.w <= 0.0)
+            return false; // crosses camera plane
+        vec3 ndc = clip.xyz / clip.w;
+        minUV = min(minUV, ndc.xy * 0.5 + 0.5);
+        maxUV = max(maxUV, ndc.xy * 0.5 + 0.5);
+        minZ = min(minZ, ndc.z * 0.5 + 0.5);
+    }
+    // partially outside of pyramid view: nothing known about hidden part
+    if (any(lessThan(minUV, vec2(0.0))) || any(greaterThan(maxUV, vec2(1.0))))
+        return false;
+
+    // level where the rectangle covers at most 2x2 texels
+    vec2 size = (maxUV - minUV) * vec2(textureSize(hiz, 0));
+    int level = clamp(int(ceil(log2(max(max(size.x, size.y), 1.0)))), 0, textureQueryLevels(hiz) - 1);
+    // texel t of a level covers pixels [t << level, (t + 1) << level), the last one also
+    // the leftover of odd sizes, so the texel follows from the level 0 pixel
+    ivec2 levelSize = textureSize(hiz, level);
+    ivec2 p0 = min(ivec2(minUV * vec2(textureSize(hiz, 0))) >> level, levelSize - 1);
+    ivec2 p1 = min(ivec2(maxUV * vec2(textureSize(hiz, 0))) >> level, levelSize - 1);
+
+    float maxDepth = max(max(texelFetch(hiz, p0, level).r, texelFetch(hiz, ivec2(p1.x, p0.y), level).r),
+        max(texelFetch(hiz, ivec2(p0.x, p1.y), level).r, texelFetch(hiz, p1, level).r));
+    return minZ > maxDepth;
+}
+
+void emit(uint i)
+{
+    uint slot = atomicAdd(commands[phase * 5 + 1], 1u);
+    visibleInstances[slot] = instances[i];
+    if (hasMaterials)
+        visibleMaterials[slot] = materials[i];
+    if (hasAnimations)
+        visibleAnimations[slot] = animations[i];
+}
+
+void main()
+{
+    if (gl_LocalInvocationIndex == 0) {
+        localVisible = 0u, localCulled = 0u, localNewlyVisible = 0u;
+    }
+    barrier();
+
+    uint i = gl_GlobalInvocationID.x;
+    if (i < numInstances) {
+        mat4 m = model * instances[i];
+        vec3 c = (m * vec4(boundingSphere.xyz, 1.0)).xyz;
+        float scale = sqrt(max(max(dot(m[0].xyz, m[0].xyz), dot(m[1].xyz, m[1].xyz)), dot(m[2].xyz, m[2].xyz)));
+        float r = boundingSphere.w * scale;
+
+        if (phase == 0) {
+            uint state = 0u;
+            if (isInFrustum(c, r))
+                state = hasPyramid && isOccluded(c, r) ? 2u : 1u;
+            visibility[i] = state;
+            if (state == 1u) {
+                emit(i);
+                atomicAdd(localVisible, 1u);
+            } else if (state == 0u) {
+                atomicAdd(localCulled, 1u);
+            }
+        } else if (visibility[i] == 2u) {
+            if (isOccluded(c, r)) {
+                atomicAdd(localCulled, 1u);
+            } else {
+                emit(i);
+                atomicAdd(localVisible, 1u);
+                atomicAdd(localNewlyVisible, 1u);
+            }
+        }
+    }
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0) {
+        if (phase == 0)
+            atomicAdd(statTested, min(numInstances - gl_WorkGroupID.x * gl_WorkGroupSize.x, gl_WorkGroupSize.x));
+        atomicAdd(statVisible, localVisible);
+        atomicAdd(statCulled, localCulled);
+        atomicAdd(statNewlyVisible, localNewlyVisible);
+    }
+}
+)";
+
+static GLenum chooseDepthCopyFormat()
+{
+    GLint readFramebuffer {};
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+    GLenum depthAttachment = readFramebuffer ? GL_DEPTH_ATTACHMENT : GL_DEPTH;
+    GLenum stencilAttachment = readFramebuffer ? GL_STENCIL_ATTACHMENT : GL_STENCIL;
+
+    GLint depthBits {}, stencilBits {}, componentType {};
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, depthAttachment, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, depthAttachment, GL_FRAMEBUFFER_ATTACHMENT_COMPONENT_TYPE, &componentType);
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, stencilAttachment, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+
+    // blit requires identical depth/stencil formats
+    if (componentType == GL_FLOAT)
+        return stencilBits ? GL_DEPTH32F_STENCIL8 : GL_DEPTH_COMPONENT32F;
+    if (depthBits == 16)
+        return GL_DEPTH_COMPONENT16;
+    if (depthBits == 32)
+        return GL_DEPTH_COMPONENT32;
+    return stencilBits ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT24;
+}
+
+HiZCuller::HiZCuller()
+    : m_downsampleShader(s_downsampleSource)
+    , m_cullShader(s_cullSource)
+    , m_depthFBO(GL_Framebuffer::create())
+    , m_dsSrcLevel(m_downsampleShader.getVariable("srcLevel"))
+    , m_dsSrcSize(m_downsampleShader.getVariable("srcSize"))
+    , m_dsReduction(m_downsampleShader.getVariable("reduction"))
+    , m_cullModel(m_cullShader.getVariable("model"))
+    , m_cullPyramidViewProjection(m_cullShader.getVariable("pyramidViewProjection"))
+    , m_cullFrustumPlanes(m_cullShader.getVariable("frustumPlanes"))
+    , m_cullBoundingSphere(m_cullShader.getVariable("boundingSphere"))
+    , m_cullNumInstances(m_cullShader.getVariable("numInstances"))
+    , m_cullPhase(m_cullShader.getVariable("phase"))
+    , m_cullHasPyramid(m_cullShader.getVariable("hasPyramid"))
+    , m_cullHasMaterials(m_cullShader.getVariable("hasMaterials"))
+    , m_cullHasAnimations(m_cullShader.getVariable("hasAnimations"))
+{
+    for (uint32_t i = 0; i < s_statsLatency; ++i) {
+        m_statsBuffers[i] = GL_Buffer::create();
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_statsBuffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(OcclusionStats), nullptr, GL_DYNAMIC_READ);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+HiZCuller::~HiZCuller()
+{
+    for (uint32_t i = 0; i < s_statsLatency; ++i)
+        if (m_statsFences[i])
+            glDeleteSync((GLsync)m_statsFences[i]);
+}
+
+void HiZCuller::readStats(uint32_t slot)
+{
+    if (!m_statsFences[slot])
+        return;
+    if (glClientWaitSync((GLsync)m_statsFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+        return;
+
+    glDeleteSync((GLsync)m_statsFences[slot]);
+    m_statsFences[slot] = nullptr;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_statsBuffers[slot]);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(OcclusionStats), &m_lastStats);
+}
+
+OcclusionStats HiZCuller::getStats(bool wait)
+{
+    const uint32_t newestSlot = (m_frame + s_statsLatency - 1) % s_statsLatency;
+    if (wait && m_statsFences[newestSlot])
+        glClientWaitSync((GLsync)m_statsFences[newestSlot], GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+
+    for (uint32_t age = s_statsLatency; age > 0; --age) // oldest first
+        readStats((m_frame + s_statsLatency - age) % s_statsLatency);
+    return m_lastStats;
+}
+
+void HiZCuller::beginFrame(const glm::mat4& viewProjection)
+{
+    m_viewProjection = viewProjection;
+    extractFrustumPlanes(viewProjection, m_frustumPlanes);
+
+    const uint32_t slot = m_frame % s_statsLatency;
+    if (m_statsFences[slot]) // s_statsLatency frames old, normally doesn't wait
+        glClientWaitSync((GLsync)m_statsFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+    readStats(slot);
+
+    const OcclusionStats zero {};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_statsBuffers[slot]);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(OcclusionStats), &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void HiZCuller::endFrame()
+{
+    const uint32_t slot = m_frame % s_statsLatency;
+    m_statsFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_frame++;
+}
+
+HiZCuller::MeshState& HiZCuller::getMeshState(const GL_InstancedMesh& mesh)
+{
+    MeshState& state = m_meshStates[&mesh];
+    if (!state.commandBuffer) {
+        state.visibilityBuffer = GL_Buffer::create();
+        for (uint32_t p = 0; p < 2; ++p) {
+            state.instanceBuffers[p] = GL_Buffer::create();
+            state.materialBuffers[p] = GL_Buffer::create();
+            state.animationBuffers[p] = GL_Buffer::create();
+        }
+        state.commandBuffer = GL_Buffer::create();
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.commandBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * s_commandSize, nullptr, GL_DYNAMIC_DRAW);
+    }
+
+    if (state.capacity < mesh.m_instanceArraySize) {
+        state.capacity = mesh.m_instanceArraySize;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.visibilityBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, state.capacity * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+        for (uint32_t buffer : state.instanceBuffers) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, state.capacity * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+        }
+        for (uint32_t buffer : state.materialBuffers) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, state.capacity * sizeof(uint32_t), nullptr, GL_DYNAMIC_DRAW);
+        }
+        for (uint32_t buffer : state.animationBuffers) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, state.capacity * sizeof(glm::vec2), nullptr, GL_DYNAMIC_DRAW);
+        }
+    }
+    return state;
+}
+
+void HiZCuller::cull(GL_InstancedMesh& mesh, Phase phase, const glm::mat4& model)
+{
+    MeshState& state = getMeshState(mesh);
+    const uint32_t phaseIndex = (uint32_t)phase;
+
+    // firstIndex: the index range's place in its arena buffer
+    const uint32_t command[5] = { mesh.getNumDrawVertices(), 0, mesh.isSphereImpostors() ? 0 : mesh.getFirstIndex(), 0, 0 };
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, state.commandBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, phaseIndex * s_commandSize, s_commandSize, command);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if (!mesh.m_instanceArraySize)
+        return;
+
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, mesh.m_IBO.getBuffer(), mesh.m_IBO.getOffset(), mesh.m_IBO.getSize());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, state.visibilityBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, state.instanceBuffers[phaseIndex]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, state.commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_statsBuffers[m_frame % s_statsLatency]);
+    if (mesh.hasInstanceMaterials()) {
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 9, mesh.m_MBO.getBuffer(), mesh.m_MBO.getOffset(), mesh.m_MBO.getSize());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, state.materialBuffers[phaseIndex]);
+    }
+    if (mesh.hasInstanceAnimations()) {
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 12, mesh.m_ABO.getBuffer(), mesh.m_ABO.getOffset(), mesh.m_ABO.getSize());
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, state.animationBuffers[phaseIndex]);
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_pyramidTexture);
+
+    m_cullShader.bind();
+    m_cullModel.set(model);
+    m_cullPyramidViewProjection.set(m_pyramidViewProjection);
+    m_cullFrustumPlanes.set(m_frustumPlanes, 6);
+    m_cullBoundingSphere.set(mesh.getBoundingSphere());
+    m_cullNumInstances.set(mesh.m_instanceArraySize);
+    m_cullPhase.set((int)phaseIndex);
+    m_cullHasPyramid.set((int)m_hasPyramid);
+    m_cullHasMaterials.set((int)mesh.hasInstanceMaterials());
+    m_cullHasAnimations.set((int)mesh.hasInstanceAnimations());
+
+    m_cullShader.dispatch((mesh.m_instanceArraySize + s_cullGroupSize - 1) / s_cullGroupSize);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void HiZCuller::draw(GL_InstancedMesh& mesh, Phase phase)
+{
+    auto it = m_meshStates.find(&mesh);
+    assert(it != m_meshStates.end()); // draw() without cull()
+    const MeshState& state = it->second;
+    const uint32_t p = (uint32_t)phase;
+    mesh.drawIndirect({ state.instanceBuffers[p], state.materialBuffers[p], state.animationBuffers[p] },
+        state.commandBuffer, p * s_commandSize);
+}
+
+void HiZCuller::resizeTargets(int width, int height)
+{
+    const GLenum depthFormat = chooseDepthCopyFormat();
+    if (width == m_width && height == m_height && depthFormat == m_depthFormat)
+        return;
+
+    m_width = width, m_height = height, m_depthFormat = depthFormat;
+    m_numLevels = (int)floorf(log2f((float)std::max(width, height))) + 1;
+
+    m_depthTexture = GL_Texture::create();
+    glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, depthFormat, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    const bool hasStencil = depthFormat == GL_DEPTH24_STENCIL8 || depthFormat == GL_DEPTH32F_STENCIL8;
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_depthFBO);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, hasStencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT,
+        GL_TEXTURE_2D, m_depthTexture, 0);
+
+    m_pyramidTexture = GL_Texture::create();
+    glBindTexture(GL_TEXTURE_2D, m_pyramidTexture);
+    glTexStorage2D(GL_TEXTURE_2D, m_numLevels, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    m_hasPyramid = false;
+}
+
+void HiZCuller::buildPyramid()
+{
+    GLint viewport[4] {}, drawFramebuffer {};
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+    const int width = viewport[2], height = viewport[3];
+    if (width <= 0 || height <= 0)
+        return;
+
+    resizeTargets(width, height);
+
+    // resolves MSAA depth as well
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_depthFBO);
+    glBlitFramebuffer(viewport[0], viewport[1], viewport[0] + width, viewport[1] + height,
+        0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+
+    glActiveTexture(GL_TEXTURE0);
+    m_downsampleShader.bind();
+
+    glm::ivec2 srcSize(width, height);
+    for (int level = 0; level < m_numLevels; ++level) {
+        glm::ivec2 dstSize = glm::max(glm::ivec2(width >> level, height >> level), glm::ivec2(1));
+
+        glBindTexture(GL_TEXTURE_2D, level == 0 ? m_depthTexture : m_pyramidTexture);
+        m_dsSrcLevel.set(level == 0 ? 0 : level - 1);
+        m_dsSrcSize.set(srcSize);
+        m_dsReduction.set(level == 0 ? 1 : 2);
+        glBindImageTexture(0, m_pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+        m_downsampleShader.dispatch((dstSize.x + 7) / 8, (dstSize.y + 7) / 8);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        srcSize = dstSize;
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    m_pyramidViewProjection = m_viewProjection;
+    m_hasPyramid = true;
+}
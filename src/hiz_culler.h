@@ -0,0 +1,92 @@
+#ifndef HIZ_CULLER_H
+#define HIZ_CULLER_H
+
+#include "gl_handle.h"
+#include "shader.h"
+
+#include <cstdint> // uintXX_t
+#include <glm/glm.hpp>
+#include <unordered_map>
+
+class GL_InstancedMesh;
+
+struct OcclusionStats {
+    uint32_t tested {}; // instances submitted to culling
+    uint32_t visible {}; // drawn in main or re-test phase
+    uint32_t culled {}; // rejected by frustum or Hi-Z
+    uint32_t newlyVisible {}; // rejected by previous frame Hi-Z, accepted by re-test
+};
+
+// Two phase occlusion culling of GL_InstancedMesh instances (bounding spheres):
+//  Main:   frustum + test against Hi-Z pyramid of the previous frame, draws survivors
+//  Retest: buildPyramid() from the depth of the main phase, instances rejected
+//          in the main phase are tested again and drawn if they became visible
+// Per frame:
+//  beginFrame -> cull(Main) per mesh -> draw(Main) -> buildPyramid
+//             -> cull(Retest) per mesh -> draw(Retest) -> endFrame
+// cull() and buildPyramid() bind compute programs, rebind draw shader after them.
+class HiZCuller {
+public:
+    // clang-format off
+    enum class Phase : uint8_t { Main, Retest };
+    // clang-format on
+
+    HiZCuller();
+    HiZCuller(const HiZCuller&) = delete;
+    HiZCuller& operator=(const HiZCuller&) = delete;
+    ~HiZCuller();
+
+    void beginFrame(const glm::mat4& viewProjection);
+    void cull(GL_InstancedMesh& mesh, Phase phase, const glm::mat4& model = glm::mat4(1));
+    void draw(GL_InstancedMesh& mesh, Phase phase);
+    // downsamples depth of the currently bound read framebuffer (viewport sized)
+    void buildPyramid();
+    void endFrame();
+
+    // stats are read back asynchronously, a few frames late, no stalls;
+    // wait = true blocks until the latest ended frame is available (headless tests)
+    OcclusionStats getStats(bool wait = false);
+
+private:
+    static constexpr uint32_t s_statsLatency = 3;
+
+    struct MeshState {
+        uint32_t capacity {};
+        GL_Buffer visibilityBuffer; // uint per instance, written by main phase
+        GL_Buffer instanceBuffers[2]; // compacted matrices per phase
+        GL_Buffer materialBuffers[2]; // compacted material indices per phase
+        GL_Buffer animationBuffers[2]; // compacted animation parameters per phase
+        GL_Buffer commandBuffer; // DrawElementsIndirectCommand per phase
+    };
+
+    MeshState& getMeshState(const GL_InstancedMesh& mesh);
+    void resizeTargets(int width, int height);
+    void readStats(uint32_t slot);
+
+    ComputeShader m_downsampleShader;
+    ComputeShader m_cullShader;
+
+    GL_Framebuffer m_depthFBO;
+    GL_Texture m_depthTexture;
+    uint32_t m_depthFormat {};
+    GL_Texture m_pyramidTexture;
+    int m_width {}, m_height {}, m_numLevels {};
+    bool m_hasPyramid {};
+
+    Shader::ShaderVariable m_dsSrcLevel, m_dsSrcSize, m_dsReduction;
+    Shader::ShaderVariable m_cullModel, m_cullPyramidViewProjection, m_cullFrustumPlanes, m_cullBoundingSphere;
+    Shader::ShaderVariable m_cullNumInstances, m_cullPhase, m_cullHasPyramid, m_cullHasMaterials, m_cullHasAnimations;
+
+    glm::mat4 m_viewProjection { 1 };
+    glm::mat4 m_pyramidViewProjection { 1 }; // matrix the pyramid depth was rendered with
+    glm::vec4 m_frustumPlanes[6] {};
+
+    GL_Buffer m_statsBuffers[s_statsLatency];
+    void* m_statsFences[s_statsLatency] {};
+    uint32_t m_frame {};
+    OcclusionStats m_lastStats {};
+
+    std::unordered_map<const GL_InstancedMesh*, MeshState> m_meshStates; // by address, moved meshes start over
+};
+
+#endif // HIZ_CULLER_H
@@ -0,0 +1,307 @@
+#include "image.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+    static const auto table = []() {
+        std::vector<uint32_t> t(256);
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[n] = c;
+        }
+        return t;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+uint32_t adler32(const uint8_t* data, size_t size)
+{
+    uint32_t a = 1, b = 0;
+    while (size) {
+        const size_t block = std::min<size_t>(size, 5552); // no overflow before the modulo
+        for (size_t i = 0; i < block; i++)
+            a += data[i], b += a;
+        a %= 65521, b %= 65521;
+        data += block, size -= block;
+    }
+    return b << 16 | a;
+}
+
+void putBigEndian(std::vector<uint8_t>& out, uint32_t value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(uint8_t(value >> shift));
+}
+
+// deflate bit stream, least significant bit first
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out)
+        : m_out(out)
+    {
+    }
+    void put(uint32_t value, uint32_t count)
+    {
+        m_bits |= (uint64_t)value << m_count;
+        m_count += count;
+        while (m_count >= 8) {
+            m_out.push_back(uint8_t(m_bits));
+            m_bits >>= 8, m_count -= 8;
+        }
+    }
+    void putHuffman(uint32_t code, uint32_t length) // Huffman codes go most significant bit first
+    {
+        uint32_t reversed = 0;
+        for (uint32_t i = 0; i < length; i++)
+            reversed |= ((code >> i) & 1) << (length - 1 - i);
+        put(reversed, length);
+    }
+    void flush()
+    {
+        if (m_count)
+            m_out.push_back(uint8_t(m_bits));
+        m_bits = 0, m_count = 0;
+    }
+
+private:
+    std::vector<uint8_t>& m_out;
+    uint64_t m_bits {};
+    uint32_t m_count {};
+};
+
+// clang-format off
+const uint16_t s_lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+                                    67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t s_lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t s_distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+                                      1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const uint8_t s_distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+// clang-format on
+
+void putFixedSymbol(BitWriter& writer, uint32_t symbol) // literal/length alphabet, RFC 1951 3.2.6
+{
+    if (symbol < 144)
+        writer.putHuffman(0x30 + symbol, 8);
+    else if (symbol < 256)
+        writer.putHuffman(0x190 + symbol - 144, 9);
+    else if (symbol < 280)
+        writer.putHuffman(symbol - 256, 7);
+    else
+        writer.putHuffman(0xC0 + symbol - 280, 8);
+}
+
+void putMatch(BitWriter& writer, uint32_t length, uint32_t distance)
+{
+    const uint32_t l = std::upper_bound(s_lengthBase, s_lengthBase + 29, length) - s_lengthBase - 1;
+    putFixedSymbol(writer, 257 + l);
+    writer.put(length - s_lengthBase[l], s_lengthExtra[l]);
+    const uint32_t d = std::upper_bound(s_distanceBase, s_distanceBase + 30, distance) - s_distanceBase - 1;
+    writer.putHuffman(d, 5);
+    writer.put(distance - s_distanceBase[d], s_distanceExtra[d]);
+}
+
+// zlib stream of one fixed Huffman block, greedy LZ77 over hash chains
+void deflate(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+{
+    constexpr uint32_t windowSize = 32768, hashBits = 15, maxChain = 16, minMatch = 3, maxMatch = 258;
+    std::vector<int32_t> head(1u << hashBits, -1), prev(windowSize, -1);
+    auto hash = [&](size_t i) { return (uint32_t(data[i] << 16 | data[i + 1] << 8 | data[i + 2]) * 2654435761u) >> (32 - hashBits); };
+    auto insert = [&](size_t i) {
+        const uint32_t h = hash(i);
+        prev[i % windowSize] = head[h];
+        head[h] = (int32_t)i;
+    };
+
+    out.push_back(0x78), out.push_back(0x01); // deflate, 32K window, fastest
+    BitWriter writer(out);
+    writer.put(1, 1); // final block
+    writer.put(1, 2); // fixed Huffman codes
+
+    size_t i = 0;
+    while (i < size) {
+        uint32_t bestLength = 0, bestDistance = 0;
+        if (i + minMatch <= size) {
+            const uint32_t limit = (uint32_t)std::min<size_t>(maxMatch, size - i);
+            int32_t candidate = head[hash(i)];
+            for (uint32_t chain = 0; candidate >= 0 && i - candidate <= windowSize && chain < maxChain; chain++) {
+                uint32_t length = 0;
+                while (length < limit && data[candidate + length] == data[i + length])
+                    length++;
+                if (length > bestLength) {
+                    bestLength = length, bestDistance = uint32_t(i - candidate);
+                    if (length == limit)
+                        break;
+                }
+                const int32_t next = prev[candidate % windowSize];
+                if (next >= candidate) // slot reused by a newer position
+                    break;
+                candidate = next;
+            }
+            insert(i);
+        }
+
+        if (bestLength >= minMatch) {
+            putMatch(writer, bestLength, bestDistance);
+            for (size_t k = i + 1; k < i + bestLength && k + minMatch <= size; k++)
+                insert(k);
+            i += bestLength;
+        } else {
+            putFixedSymbol(writer, data[i]);
+            i++;
+        }
+    }
+    putFixedSymbol(writer, 256); // end of block
+    writer.flush();
+    putBigEndian(out, adler32(data, size));
+}
+
+uint8_t paeth(int a, int b, int c)
+{
+    const int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return uint8_t(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+// each row gets the filter with the smallest sum of signed residuals, the usual heuristic
+std::vector<uint8_t> filterRows(const Image& image)
+{
+    const size_t rowSize = (size_t)image.width * 3;
+    std::vector<uint8_t> filtered(image.height * (rowSize + 1));
+    std::vector<uint8_t> candidate(rowSize), zeros(rowSize);
+
+    for (uint32_t y = 0; y < image.height; y++) {
+        const uint8_t* row = image.getRow(y);
+        const uint8_t* up = y ? image.getRow(y - 1) : zeros.data();
+        uint8_t* dst = filtered.data() + y * (rowSize + 1);
+
+        uint64_t bestCost = UINT64_MAX;
+        for (uint8_t type : { 0, 1, 2, 4 }) { // none, sub, up, paeth
+            uint64_t cost = 0;
+            for (size_t x = 0; x < rowSize; x++) {
+                const uint8_t left = x >= 3 ? row[x - 3] : 0, upLeft = x >= 3 ? up[x - 3] : 0;
+                const uint8_t predicted = type == 0 ? 0 : type == 1 ? left : type == 2 ? up[x] : paeth(left, up[x], upLeft);
+                candidate[x] = uint8_t(row[x] - predicted);
+                cost += abs((int8_t)candidate[x]);
+            }
+            if (cost < bestCost) {
+                bestCost = cost;
+                dst[0] = type;
+                memcpy(dst + 1, candidate.data(), rowSize);
+            }
+        }
+    }
+    return filtered;
+}
+
+void putChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data)
+{
+    putBigEndian(out, (uint32_t)data.size());
+    const size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    putBigEndian(out, crc32(out.data() + start, out.size() - start));
+}
+
+std::vector<uint8_t> encodePNG(const Image& image)
+{
+    std::vector<uint8_t> out = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+    std::vector<uint8_t> header;
+    putBigEndian(header, image.width);
+    putBigEndian(header, image.height);
+    header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8 bit RGB, deflate, adaptive filtering, no interlace
+    putChunk(out, "IHDR", header);
+
+    const std::vector<uint8_t> filtered = filterRows(image);
+    std::vector<uint8_t> compressed;
+    compressed.reserve(filtered.size() / 2);
+    deflate(filtered.data(), filtered.size(), compressed);
+    putChunk(out, "IDAT", compressed);
+
+    putChunk(out, "IEND", {});
+    return out;
+}
+
+bool endsWith(const std::string& str, const char* suffix)
+{
+    const size_t length = strlen(suffix);
+    return str.size() >= length && str.compare(str.size() - length, length, suffix) == 0;
+}
+
+} // namespace
+
+bool writeImage(const std::string& path, const Image& image)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    if (endsWith(path, ".png")) {
+        const std::vector<uint8_t> png = encodePNG(image);
+        file.write((const char*)png.data(), png.size());
+    } else if (endsWith(path, ".ppm")) {
+        file << "P6\n" << image.width << " " << image.height << "\n255\n";
+        file.write((const char*)image.pixels.data(), image.pixels.size());
+    } else {
+        return false; // unknown format
+    }
+    return (bool)file;
+}
+
+bool readPPM(const std::string& path, Image& image)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    uint32_t values[3] {}; // width, height, maxval
+    file >> magic;
+    if (!file || magic != "P6")
+        return false;
+    for (uint32_t& value : values) {
+        file >> std::ws;
+        while (file.peek() == '#') { // comment line
+            file.ignore(1 << 16, '\n');
+            file >> std::ws;
+        }
+        file >> value;
+    }
+    if (!file || values[2] != 255)
+        return false;
+    file.get(); // single whitespace before the data
+
+    image.resize(values[0], values[1]);
+    file.read((char*)image.pixels.data(), image.pixels.size());
+    return (bool)file;
+}
+
+ImageDiff compareImages(const Image& image, const Image& reference, const ImageCompareThresholds& thresholds)
+{
+    ImageDiff diff;
+    if (image.width != reference.width || image.height != reference.height)
+        return diff;
+
+    uint64_t sum = 0;
+    const size_t numPixels = (size_t)image.width * image.height;
+    for (size_t p = 0; p < numPixels; p++) {
+        uint8_t pixelDifference = 0;
+        for (size_t c = p * 3; c < p * 3 + 3; c++) {
+            const uint8_t d = uint8_t(abs(image.pixels[c] - reference.pixels[c]));
+            pixelDifference = std::max(pixelDifference, d);
+            sum += d;
+        }
+        diff.maxDifference = std::max(diff.maxDifference, pixelDifference);
+        diff.numDifferent += pixelDifference > thresholds.pixelTolerance;
+    }
+    diff.meanDifference = numPixels ? float((double)sum / (numPixels * 3)) : 0.f;
+    diff.passed = diff.numDifferent <= thresholds.maxDifferentFraction * numPixels;
+    return diff;
+}
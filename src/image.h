@@ -0,0 +1,37 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <cstdint> // uintXX_t
+#include <string>
+#include <vector>
+
+// 8-bit RGB, rows top to bottom
+struct Image {
+    uint32_t width {}, height {};
+    std::vector<uint8_t> pixels;
+
+    void resize(uint32_t w, uint32_t h) { width = w, height = h, pixels.resize((size_t)w * h * 3); }
+    uint8_t* getRow(uint32_t y) { return pixels.data() + (size_t)y * width * 3; }
+    const uint8_t* getRow(uint32_t y) const { return pixels.data() + (size_t)y * width * 3; }
+};
+
+// format by extension: ".png" (lossless, fixed Huffman deflate) or ".ppm" (binary P6, raw pixels)
+bool writeImage(const std::string& path, const Image& image);
+bool readPPM(const std::string& path, Image& image); // P6 with maxval 255
+
+struct ImageCompareThresholds {
+    uint8_t pixelTolerance = 2; // per channel, larger differences make the pixel differ
+    float maxDifferentFraction = 0.001f; // of all pixels
+};
+
+struct ImageDiff {
+    uint64_t numDifferent {}; // pixels over tolerance
+    uint8_t maxDifference {}; // largest channel difference
+    float meanDifference {}; // per channel
+    bool passed {};
+};
+
+// images of different size never pass
+ImageDiff compareImages(const Image& image, const Image& reference, const ImageCompareThresholds& thresholds = {});
+
+#endif // IMAGE_H
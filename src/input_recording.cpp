@@ -0,0 +1,106 @@
+#include "input_recording.h"
+#include "byte_stream.h"
+
+#include <cstring>
+#include <fstream>
+
+static const char s_magic[4] = { 'I', 'N', 'P', 'R' };
+static constexpr uint32_t s_version = 1;
+
+bool InputRecording::save(const std::string& path) const
+{
+    std::vector<uint8_t> data(s_magic, s_magic + 4);
+    uint32_t timestepBits;
+    memcpy(&timestepBits, &timestep, 4);
+    putU32(data, s_version);
+    putU32(data, timestepBits);
+    putU32(data, numFrames);
+    putU32(data, events.size());
+
+    uint32_t frame = 0;
+    for (const InputEvent& event : events) {
+        putVarint(data, event.frame - frame);
+        frame = event.frame;
+        data.push_back((uint8_t)event.type);
+        switch (event.type) {
+        case InputEvent::Type::KeyDown:
+        case InputEvent::Type::KeyUp:
+            putVarint(data, event.code);
+            putVarint(data, event.mod);
+            break;
+        case InputEvent::Type::ButtonDown:
+        case InputEvent::Type::ButtonUp:
+            putVarint(data, event.code);
+            putSigned(data, event.x);
+            putSigned(data, event.y);
+            break;
+        case InputEvent::Type::MouseMotion:
+            putSigned(data, event.x);
+            putSigned(data, event.y);
+            break;
+        case InputEvent::Type::MouseWheel:
+            putSigned(data, event.y);
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char*)data.data(), data.size());
+    return (bool)file;
+}
+
+bool InputRecording::load(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    const std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (data.size() < 20 || memcmp(data.data(), s_magic, 4))
+        return false;
+
+    ByteReader reader { data.data() + 4, data.data() + data.size() };
+    if (reader.u32() != s_version)
+        return false;
+    const uint32_t timestepBits = reader.u32();
+    memcpy(&timestep, &timestepBits, 4);
+    numFrames = reader.u32();
+    const uint32_t numEvents = reader.u32();
+    if (numEvents > data.size()) // corrupt, every event takes bytes
+        return false;
+
+    events.resize(numEvents);
+    uint32_t frame = 0;
+    for (InputEvent& event : events) {
+        event = {};
+        frame += reader.varint();
+        event.frame = frame;
+        if (reader.pos == reader.end || *reader.pos >= (uint8_t)InputEvent::Type::Count)
+            return false;
+        event.type = (InputEvent::Type)*reader.pos++;
+        switch (event.type) {
+        case InputEvent::Type::KeyDown:
+        case InputEvent::Type::KeyUp:
+            event.code = reader.varint();
+            event.mod = reader.varint();
+            break;
+        case InputEvent::Type::ButtonDown:
+        case InputEvent::Type::ButtonUp:
+            event.code = reader.varint();
+            event.x = reader.signedVarint();
+            event.y = reader.signedVarint();
+            break;
+        case InputEvent::Type::MouseMotion:
+            event.x = reader.signedVarint();
+            event.y = reader.signedVarint();
+            break;
+        case InputEvent::Type::MouseWheel:
+            event.y = reader.signedVarint();
+            break;
+        default:
+            break;
+        }
+        if (reader.failed)
+            return false;
+    }
+    return true;
+}
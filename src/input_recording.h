@@ -0,0 +1,33 @@
+#ifndef INPUT_RECORDING_H
+#define INPUT_RECORDING_H
+
+#include <cstdint> // uintXX_t
+#include <string>
+#include <vector>
+
+// input Window dispatches to KeyMap and the mouse callbacks
+struct InputEvent {
+    // clang-format off
+    enum class Type : uint8_t { KeyDown, KeyUp, ButtonDown, ButtonUp, MouseMotion, MouseWheel, Count };
+    // clang-format on
+
+    uint32_t frame {}; // Window::getFrameIndex() when dispatched
+    Type type {};
+    uint16_t mod {}; // keys
+    int32_t code {}; // SDL key code or mouse button
+    int32_t x {}, y {}; // button position, motion delta, wheel in y
+};
+
+// Timestamped input of a session and the timestep its replay advances by.
+// Saved as a small header and per event a varint frame delta, the type and
+// only the fields of that type as (zigzag) varints, 3-8 bytes for most events.
+struct InputRecording {
+    float timestep = 1.f / 60.f; // s, Window::getDeltaTime() while replaying
+    uint32_t numFrames {};
+    std::vector<InputEvent> events; // by frame
+
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+};
+
+#endif // INPUT_RECORDING_H
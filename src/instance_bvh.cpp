@@ -0,0 +1,417 @@
+#include "instance_bvh.h"
+#include "camera.h"
+#include "job_system.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+
+static constexpr uint32_t s_numBins = 16;
+static constexpr uint32_t s_parallelSize = 8 * 1024; // subtrees at least this big become jobs
+static constexpr uint32_t s_parallelDepth = 3; // refit doesn't know subtree sizes, jobs only near the root
+static constexpr uint32_t s_stackSize = 256;
+
+struct InstanceBVH::BuildContext {
+    std::atomic<uint32_t> numNodes {};
+};
+
+static AABB getSphereBounds(const glm::vec4& sphere)
+{
+    AABB box;
+    box.min = glm::vec3(sphere) - sphere.w;
+    box.max = glm::vec3(sphere) + sphere.w;
+    return box;
+}
+
+void InstanceBVH::computeSpheres(const GL_InstancedMesh& mesh, const glm::mat4& model)
+{
+    // same bounds as HiZCuller tests on GPU
+    const glm::vec4 meshSphere = mesh.getBoundingSphere();
+    const auto& transforms = mesh.getInstanceTransforms();
+    m_spheres.resize(transforms.size());
+    for (size_t i = 0; i < transforms.size(); ++i) {
+        const glm::mat4 m = model * transforms[i];
+        const float scaleSq = std::max(std::max(glm::dot(glm::vec3(m[0]), glm::vec3(m[0])), glm::dot(glm::vec3(m[1]), glm::vec3(m[1]))),
+            glm::dot(glm::vec3(m[2]), glm::vec3(m[2])));
+        m_spheres[i] = glm::vec4(glm::vec3(m * glm::vec4(glm::vec3(meshSphere), 1.f)), meshSphere.w * sqrtf(scaleSq));
+    }
+}
+
+AABB InstanceBVH::getBounds(uint32_t first, uint32_t end) const
+{
+    AABB box;
+    for (uint32_t i = first; i < end; ++i)
+        box.grow(getSphereBounds(m_spheres[m_instances[i]]));
+    return box;
+}
+
+void InstanceBVH::setLane(Node& node, uint32_t lane, const AABB& box)
+{
+    node.minX[lane] = box.min.x, node.minY[lane] = box.min.y, node.minZ[lane] = box.min.z;
+    node.maxX[lane] = box.max.x, node.maxY[lane] = box.max.y, node.maxZ[lane] = box.max.z;
+}
+
+uint32_t InstanceBVH::split(uint32_t first, uint32_t end)
+{
+    AABB centroids;
+    for (uint32_t i = first; i < end; ++i)
+        centroids.grow(glm::vec3(m_spheres[m_instances[i]]));
+    const glm::vec3 extent = centroids.max - centroids.min;
+    auto getBin = [&](uint32_t instance, int axis) {
+        const float t = (m_spheres[instance][axis] - centroids.min[axis]) / extent[axis];
+        return std::min((uint32_t)(t * s_numBins), s_numBins - 1);
+    };
+
+    // cost of a split is surface area times instance count on both sides
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    uint32_t bestBin = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] <= 0.f)
+            continue;
+
+        AABB bins[s_numBins];
+        uint32_t counts[s_numBins] {};
+        for (uint32_t i = first; i < end; ++i) {
+            const uint32_t bin = getBin(m_instances[i], axis);
+            bins[bin].grow(getSphereBounds(m_spheres[m_instances[i]]));
+            counts[bin]++;
+        }
+
+        float rightCosts[s_numBins] {};
+        AABB right;
+        uint32_t rightCount = 0;
+        for (uint32_t b = s_numBins - 1; b > 0; --b) {
+            right.grow(bins[b]);
+            rightCount += counts[b];
+            rightCosts[b] = right.getHalfArea() * rightCount;
+        }
+        AABB left;
+        uint32_t leftCount = 0;
+        for (uint32_t b = 0; b + 1 < s_numBins; ++b) {
+            left.grow(bins[b]);
+            leftCount += counts[b];
+            const float cost = left.getHalfArea() * leftCount + rightCosts[b + 1];
+            if (leftCount && leftCount < end - first && cost < bestCost)
+                bestCost = cost, bestAxis = axis, bestBin = b;
+        }
+    }
+
+    if (bestAxis < 0) // all centroids in one point
+        return first + (end - first) / 2;
+
+    const uint32_t* mid = std::partition(m_instances.data() + first, m_instances.data() + end,
+        [&](uint32_t instance) { return getBin(instance, bestAxis) <= bestBin; });
+    return mid - m_instances.data();
+}
+
+uint32_t InstanceBVH::buildNode(BuildContext& context, uint32_t first, uint32_t end)
+{
+    const uint32_t index = context.numNodes++;
+
+    // split the biggest range until there are 4 or all of them fit into leaves
+    uint32_t rangeFirst[s_width] = { first }, rangeEnd[s_width] = { end };
+    uint32_t numRanges = 1;
+    while (numRanges < s_width) {
+        uint32_t biggest = s_none;
+        for (uint32_t r = 0; r < numRanges; ++r)
+            if (rangeEnd[r] - rangeFirst[r] > s_maxLeafSize
+                && (biggest == s_none || rangeEnd[r] - rangeFirst[r] > rangeEnd[biggest] - rangeFirst[biggest]))
+                biggest = r;
+        if (biggest == s_none)
+            break;
+        const uint32_t mid = split(rangeFirst[biggest], rangeEnd[biggest]);
+        rangeFirst[numRanges] = mid, rangeEnd[numRanges] = rangeEnd[biggest];
+        rangeEnd[biggest] = mid;
+        numRanges++;
+    }
+
+    // nodes are preallocated, so the reference stays valid while children are added
+    Node& node = m_nodes[index];
+    uint32_t innerLanes[s_width], numInner = 0;
+    for (uint32_t lane = 0; lane < s_width; ++lane) {
+        if (lane >= numRanges) {
+            setLane(node, lane, AABB());
+            node.child[lane] = s_none, node.count[lane] = 0;
+            continue;
+        }
+        const uint32_t size = rangeEnd[lane] - rangeFirst[lane];
+        setLane(node, lane, getBounds(rangeFirst[lane], rangeEnd[lane]));
+        if (size <= s_maxLeafSize) {
+            node.child[lane] = rangeFirst[lane], node.count[lane] = size;
+            continue;
+        }
+        node.count[lane] = 0;
+        innerLanes[numInner++] = lane;
+    }
+
+    auto buildLanes = [&](uint32_t firstLane, uint32_t endLane) {
+        for (uint32_t i = firstLane; i < endLane; ++i) {
+            const uint32_t lane = innerLanes[i];
+            node.child[lane] = buildNode(context, rangeFirst[lane], rangeEnd[lane]);
+        }
+    };
+    if (end - first >= s_parallelSize)
+        getJobSystem().parallelFor(numInner, 1, buildLanes);
+    else
+        buildLanes(0, numInner);
+    return index;
+}
+
+void InstanceBVH::build(const GL_InstancedMesh& mesh, const glm::mat4& model)
+{
+    computeSpheres(mesh, model);
+    build(m_spheres);
+}
+
+void InstanceBVH::build(const std::vector<glm::vec4>& spheres)
+{
+    if (&spheres != &m_spheres)
+        m_spheres = spheres;
+    const uint32_t numInstances = m_spheres.size();
+    m_instances.resize(numInstances);
+    for (uint32_t i = 0; i < numInstances; ++i)
+        m_instances[i] = i;
+
+    m_nodes.clear();
+    if (!numInstances)
+        return;
+    // every node splits its range at least in two, so there are fewer nodes than instances
+    m_nodes.resize(numInstances);
+    BuildContext context;
+    buildNode(context, 0, numInstances);
+    m_nodes.resize(context.numNodes);
+}
+
+AABB InstanceBVH::refitNode(uint32_t index, uint32_t depth)
+{
+    Node& node = m_nodes[index];
+    AABB boxes[s_width];
+    auto refitLanes = [&](uint32_t firstLane, uint32_t endLane) {
+        for (uint32_t lane = firstLane; lane < endLane; ++lane) {
+            if (node.child[lane] == s_none)
+                continue;
+            if (node.count[lane])
+                boxes[lane] = getBounds(node.child[lane], node.child[lane] + node.count[lane]);
+            else
+                boxes[lane] = refitNode(node.child[lane], depth + 1);
+        }
+    };
+    if (m_spheres.size() >= s_parallelSize && depth < s_parallelDepth)
+        getJobSystem().parallelFor(s_width, 1, refitLanes);
+    else
+        refitLanes(0, s_width);
+
+    AABB result;
+    for (uint32_t lane = 0; lane < s_width; ++lane) {
+        if (node.child[lane] != s_none) {
+            setLane(node, lane, boxes[lane]);
+            result.grow(boxes[lane]);
+        }
+    }
+    return result;
+}
+
+void InstanceBVH::refit(const GL_InstancedMesh& mesh, const glm::mat4& model)
+{
+    computeSpheres(mesh, model);
+    refit(m_spheres);
+}
+
+void InstanceBVH::refit(const std::vector<glm::vec4>& spheres)
+{
+    assert(spheres.size() == m_instances.size()); // instances added or removed, build() instead
+    if (&spheres != &m_spheres)
+        m_spheres = spheres;
+    if (!m_nodes.empty())
+        refitNode(0, 0);
+}
+
+template <typename Func>
+void InstanceBVH::forEachInstance(uint32_t index, Func func) const
+{
+    uint32_t stack[s_stackSize];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = index;
+    while (stackSize) {
+        const Node& node = m_nodes[stack[--stackSize]];
+        for (uint32_t lane = 0; lane < s_width; ++lane) {
+            if (node.child[lane] == s_none)
+                continue;
+            if (node.count[lane]) {
+                for (uint32_t i = node.child[lane]; i < node.child[lane] + node.count[lane]; ++i)
+                    func(m_instances[i]);
+            } else {
+                assert(stackSize < s_stackSize);
+                stack[stackSize++] = node.child[lane];
+            }
+        }
+    }
+}
+
+bool InstanceBVH::rayCast(const glm::vec3& origin, const glm::vec3& direction, RayHit& hit, float maxDistance) const
+{
+    hit = RayHit();
+    hit.distance = maxDistance;
+    if (m_nodes.empty())
+        return false;
+
+    const glm::vec3 invDir = 1.f / direction;
+    uint32_t stack[s_stackSize];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize) {
+        const Node& node = m_nodes[stack[--stackSize]];
+
+        // slab test of all lanes at once
+        float tNear[s_width];
+        for (uint32_t lane = 0; lane < s_width; ++lane) {
+            const float tx0 = (node.minX[lane] - origin.x) * invDir.x, tx1 = (node.maxX[lane] - origin.x) * invDir.x;
+            const float ty0 = (node.minY[lane] - origin.y) * invDir.y, ty1 = (node.maxY[lane] - origin.y) * invDir.y;
+            const float tz0 = (node.minZ[lane] - origin.z) * invDir.z, tz1 = (node.maxZ[lane] - origin.z) * invDir.z;
+            const float tMin = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.f));
+            const float tMax = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), hit.distance));
+            tNear[lane] = tMin <= tMax ? tMin : FLT_MAX;
+        }
+
+        uint32_t innerLanes[s_width];
+        uint32_t numInner = 0;
+        for (uint32_t lane = 0; lane < s_width; ++lane) {
+            if (node.child[lane] == s_none || tNear[lane] >= hit.distance)
+                continue;
+            if (!node.count[lane]) {
+                innerLanes[numInner++] = lane;
+                continue;
+            }
+            for (uint32_t i = node.child[lane]; i < node.child[lane] + node.count[lane]; ++i) {
+                const glm::vec4& sphere = m_spheres[m_instances[i]];
+                const glm::vec3 oc = origin - glm::vec3(sphere);
+                const float b = glm::dot(oc, direction);
+                const float discriminant = b * b - (glm::dot(oc, oc) - sphere.w * sphere.w);
+                if (discriminant < 0.f)
+                    continue;
+                const float root = sqrtf(discriminant);
+                const float t = -b - root >= 0.f ? -b - root : -b + root; // origin inside: exit point
+                if (t >= 0.f && t < hit.distance)
+                    hit.instance = m_instances[i], hit.distance = t;
+            }
+        }
+
+        // farthest pushed first, so the nearest child is visited next
+        std::sort(innerLanes, innerLanes + numInner, [&](uint32_t a, uint32_t b) { return tNear[a] > tNear[b]; });
+        for (uint32_t k = 0; k < numInner; ++k) {
+            assert(stackSize < s_stackSize);
+            stack[stackSize++] = node.child[innerLanes[k]];
+        }
+    }
+    return hit.instance != s_none;
+}
+
+void InstanceBVH::queryBox(const AABB& box, std::vector<uint32_t>& result) const
+{
+    if (m_nodes.empty())
+        return;
+
+    uint32_t stack[s_stackSize];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize) {
+        const Node& node = m_nodes[stack[--stackSize]];
+        bool overlaps[s_width], contained[s_width];
+        for (uint32_t lane = 0; lane < s_width; ++lane) {
+            overlaps[lane] = node.minX[lane] <= box.max.x && node.maxX[lane] >= box.min.x
+                && node.minY[lane] <= box.max.y && node.maxY[lane] >= box.min.y
+                && node.minZ[lane] <= box.max.z && node.maxZ[lane] >= box.min.z;
+            contained[lane] = node.minX[lane] >= box.min.x && node.maxX[lane] <= box.max.x
+                && node.minY[lane] >= box.min.y && node.maxY[lane] <= box.max.y
+                && node.minZ[lane] >= box.min.z && node.maxZ[lane] <= box.max.z;
+        }
+
+        for (uint32_t lane = 0; lane < s_width; ++lane) {
+            if (node.child[lane] == s_none || !overlaps[lane])
+                continue;
+            if (node.count[lane]) {
+                for (uint32_t i = node.child[lane]; i < node.child[lane] + node.count[lane]; ++i) {
+                    const glm::vec4& sphere = m_spheres[m_instances[i]];
+                    const glm::vec3 d = glm::vec3(sphere) - glm::clamp(glm::vec3(sphere), box.min, box.max);
+                    if (contained[lane] || glm::dot(d, d) <= sphere.w * sphere.w)
+                        result.push_back(m_instances[i]);
+                }
+            } else if (contained[lane]) {
+                forEachInstance(node.child[lane], [&](uint32_t instance) { result.push_back(instance); });
+            } else {
+                assert(stackSize < s_stackSize);
+                stack[stackSize++] = node.child[lane];
+            }
+        }
+    }
+}
+
+void InstanceBVH::queryFrustum(const glm::mat4& viewProjection, std::vector<uint32_t>& result) const
+{
+    if (m_nodes.empty())
+        return;
+
+    glm::vec4 planes[6];
+    extractFrustumPlanes(viewProjection, planes);
+
+    if (m_spheres.size() < s_parallelSize) {
+        queryFrustum(planes, (1u << s_width) - 1, result);
+        return;
+    }
+    // subtrees of the root lanes in parallel, one result array per lane
+    std::vector<uint32_t> laneResults[s_width];
+    getJobSystem().parallelFor(s_width, 1, [&](uint32_t firstLane, uint32_t endLane) {
+        for (uint32_t lane = firstLane; lane < endLane; ++lane)
+            queryFrustum(planes, 1u << lane, laneResults[lane]);
+    });
+    for (uint32_t lane = 0; lane < s_width; ++lane)
+        result.insert(result.end(), laneResults[lane].begin(), laneResults[lane].end());
+}
+
+void InstanceBVH::queryFrustum(const glm::vec4* planes, uint32_t rootLanes, std::vector<uint32_t>& result) const
+{
+    uint32_t stack[s_stackSize];
+    uint32_t stackSize = 0;
+    stack[stackSize++] = 0;
+    for (uint32_t lanes = rootLanes; stackSize; lanes = (1u << s_width) - 1) {
+        const Node& node = m_nodes[stack[--stackSize]];
+
+        // box corner farthest along the plane normal decides outside, nearest one inside
+        bool outside[s_width] {}, inside[s_width];
+        std::fill(inside, inside + s_width, true);
+        for (int p = 0; p < 6; ++p)
+            for (uint32_t lane = 0; lane < s_width; ++lane) {
+                const glm::vec4& plane = planes[p];
+                const float farthest = plane.w + plane.x * (plane.x > 0.f ? node.maxX[lane] : node.minX[lane])
+                    + plane.y * (plane.y > 0.f ? node.maxY[lane] : node.minY[lane])
+                    + plane.z * (plane.z > 0.f ? node.maxZ[lane] : node.minZ[lane]);
+                const float nearest = plane.w + plane.x * (plane.x > 0.f ? node.minX[lane] : node.maxX[lane])
+                    + plane.y * (plane.y > 0.f ? node.minY[lane] : node.maxY[lane])
+                    + plane.z * (plane.z > 0.f ? node.minZ[lane] : node.maxZ[lane]);
+                outside[lane] |= farthest < 0.f;
+                inside[lane] &= nearest >= 0.f;
+            }
+
+        for (uint32_t lane = 0; lane < s_width; ++lane) {
+            if (node.child[lane] == s_none || outside[lane] || !(lanes & (1u << lane)))
+                continue;
+            if (node.count[lane]) {
+                for (uint32_t i = node.child[lane]; i < node.child[lane] + node.count[lane]; ++i) {
+                    const glm::vec4& sphere = m_spheres[m_instances[i]];
+                    bool visible = true;
+                    for (int p = 0; p < 6 && visible && !inside[lane]; ++p)
+                        visible = glm::dot(glm::vec3(planes[p]), glm::vec3(sphere)) + planes[p].w >= -sphere.w;
+                    if (visible)
+                        result.push_back(m_instances[i]);
+                }
+            } else if (inside[lane]) {
+                forEachInstance(node.child[lane], [&](uint32_t instance) { result.push_back(instance); });
+            } else {
+                assert(stackSize < s_stackSize);
+                stack[stackSize++] = node.child[lane];
+            }
+        }
+    }
+}
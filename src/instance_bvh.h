@@ -0,0 +1,80 @@
+#ifndef INSTANCE_BVH_H
+#define INSTANCE_BVH_H
+
+#include <cfloat>
+#include <cstdint> // uintXX_t
+#include <glm/glm.hpp>
+#include <vector>
+
+class GL_InstancedMesh;
+
+struct AABB {
+    glm::vec3 min { FLT_MAX }, max { -FLT_MAX };
+
+    void grow(const glm::vec3& p) { min = glm::min(min, p), max = glm::max(max, p); }
+    void grow(const AABB& box) { min = glm::min(min, box.min), max = glm::max(max, box.max); }
+    float getHalfArea() const
+    {
+        const glm::vec3 d = glm::max(max - min, glm::vec3(0));
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+};
+
+// Bounding volume hierarchy over world bounding spheres of GL_InstancedMesh
+// instances, for picking and spatial queries on CPU. Built top-down with binned
+// SAH, big subtrees in parallel; nodes have 4 children stored as SoA lanes, so
+// a node visit tests all of them in one vectorizable loop. Results are instance
+// indices into getInstanceTransforms(); after instances are reordered
+// (sortInstancesFrontToBack) or added, build again.
+class InstanceBVH {
+public:
+    static constexpr uint32_t s_width = 4;
+    static constexpr uint32_t s_maxLeafSize = 4;
+    static constexpr uint32_t s_none = ~0u;
+
+    struct RayHit {
+        uint32_t instance = s_none;
+        float distance = FLT_MAX; // along normalized direction
+    };
+
+    void build(const GL_InstancedMesh& mesh, const glm::mat4& model = glm::mat4(1));
+    void build(const std::vector<glm::vec4>& spheres); // xyz - center, w - radius, world space
+    // keeps the tree and recomputes its bounds for moved instances (same count and order),
+    // much faster than build() but trees get looser when instances travel far
+    void refit(const GL_InstancedMesh& mesh, const glm::mat4& model = glm::mat4(1));
+    void refit(const std::vector<glm::vec4>& spheres);
+
+    // nearest instance sphere hit by the ray
+    bool rayCast(const glm::vec3& origin, const glm::vec3& direction, RayHit& hit, float maxDistance = FLT_MAX) const;
+    // appends instances whose spheres intersect the box / frustum, result isn't cleared
+    void queryBox(const AABB& box, std::vector<uint32_t>& result) const;
+    void queryFrustum(const glm::mat4& viewProjection, std::vector<uint32_t>& result) const;
+
+    uint32_t getNumInstances() const { return m_spheres.size(); }
+    uint32_t getNumNodes() const { return m_nodes.size(); }
+
+private:
+    struct alignas(64) Node {
+        float minX[s_width], minY[s_width], minZ[s_width];
+        float maxX[s_width], maxY[s_width], maxZ[s_width];
+        uint32_t child[s_width]; // inner: node index, leaf: first in m_instances
+        uint32_t count[s_width]; // 0: inner node (or empty lane, child == s_none), else leaf size
+    };
+
+    void computeSpheres(const GL_InstancedMesh& mesh, const glm::mat4& model);
+    AABB getBounds(uint32_t first, uint32_t end) const; // of m_instances range
+    uint32_t split(uint32_t first, uint32_t end); // binned SAH, reorders range, returns middle
+    struct BuildContext;
+    uint32_t buildNode(BuildContext& context, uint32_t first, uint32_t end);
+    AABB refitNode(uint32_t node, uint32_t depth);
+    void queryFrustum(const glm::vec4* planes, uint32_t rootLanes, std::vector<uint32_t>& result) const; // rootLanes - mask
+    void setLane(Node& node, uint32_t lane, const AABB& box);
+    template <typename Func>
+    void forEachInstance(uint32_t node, Func func) const; // whole subtree
+
+    std::vector<glm::vec4> m_spheres; // per instance
+    std::vector<uint32_t> m_instances; // leaf order
+    std::vector<Node> m_nodes; // root at 0
+};
+
+#endif // INSTANCE_BVH_H
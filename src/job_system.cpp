@@ -0,0 +1,238 @@
+#include "job_system.h"
+
+#include <cassert>
+#include <chrono>
+
+struct alignas(64) JobSystem::Worker {
+    std::mutex mutex;
+    Job jobs[s_queueSize]; // ring, owner end at tail, thieves take from head
+    uint32_t head {}, tail {}; // guarded by mutex, monotonic
+
+    std::atomic<uint64_t> numJobs {}, numSteals {}, busyTime {};
+};
+
+static thread_local const JobSystem* t_system {}; // pool the thread belongs to
+static thread_local uint32_t t_queue {};
+static thread_local uint32_t t_depth {}; // nested execute(), only the outer one is timed
+
+static uint64_t getTime()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+float JobStats::getUtilization() const
+{
+    uint64_t busyTime = 0;
+    for (const auto& worker : workers)
+        busyTime += worker.busyTime;
+    return elapsedTime && !workers.empty() ? float((double)busyTime / ((double)elapsedTime * workers.size())) : 0.f;
+}
+
+JobSystem::JobSystem(uint32_t numThreads)
+{
+    start(numThreads);
+}
+
+JobSystem::~JobSystem()
+{
+    stop();
+}
+
+void JobSystem::start(uint32_t numThreads)
+{
+    if (!numThreads)
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    m_numThreads = numThreads;
+    m_workers.reset(new Worker[numThreads]);
+    m_quit = false;
+    m_threads.reserve(numThreads - 1);
+    for (uint32_t i = 1; i < numThreads; ++i)
+        m_threads.emplace_back(&JobSystem::workerLoop, this, i);
+    resetStats();
+}
+
+void JobSystem::stop()
+{
+    assert(m_pending == 0); // jobs still queued
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    for (auto& thread : m_threads)
+        thread.join();
+    m_threads.clear();
+}
+
+void JobSystem::setNumThreads(uint32_t numThreads)
+{
+    stop();
+    start(numThreads);
+}
+
+uint32_t JobSystem::getQueueIndex() const
+{
+    return t_system == this ? t_queue : 0;
+}
+
+void JobSystem::enqueue(const Job& job)
+{
+    Worker& worker = m_workers[getQueueIndex()];
+    {
+        std::unique_lock<std::mutex> lock(worker.mutex);
+        if (worker.tail - worker.head == s_queueSize) { // full, no point in queuing more
+            lock.unlock();
+            Job inlineJob = job;
+            execute(inlineJob, getQueueIndex());
+            return;
+        }
+        worker.jobs[worker.tail++ % s_queueSize] = job;
+    }
+    m_pending++;
+    if (m_numSleeping) { // pairs with the check in workerLoop, both sequentially consistent
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_wake.notify_one();
+    }
+}
+
+void JobSystem::run(const Job& job)
+{
+    if (job.counter)
+        job.counter->m_count++;
+    enqueue(job);
+}
+
+void JobSystem::runAfter(JobCounter& dependency, const Job& job)
+{
+    if (job.counter)
+        job.counter->m_count++;
+    {
+        std::lock_guard<std::mutex> lock(dependency.m_mutex);
+        if (!dependency.isDone()) {
+            dependency.m_continuations.push_back(job);
+            return;
+        }
+    }
+    enqueue(job);
+}
+
+bool JobSystem::tryPop(uint32_t index, Job& job)
+{
+    { // own queue, newest first
+        Worker& worker = m_workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tail != worker.head) {
+            job = worker.jobs[--worker.tail % s_queueSize];
+            m_pending--;
+            return true;
+        }
+    }
+    for (uint32_t i = 1; i < m_numThreads; ++i) { // steal the oldest, starting at the neighbour
+        Worker& victim = m_workers[(index + i) % m_numThreads];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tail != victim.head) {
+            job = victim.jobs[victim.head++ % s_queueSize];
+            m_pending--;
+            m_workers[index].numSteals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobSystem::execute(Job& job, uint32_t index)
+{
+    const uint64_t start = t_depth++ ? 0 : getTime();
+
+    while (job.grain && job.end - job.first > job.grain) { // keep the first half, offer the second
+        Job half = job;
+        half.first = job.first + (job.end - job.first) / 2;
+        job.end = half.first;
+        run(half);
+    }
+    job.func(job.data, job.first, job.end);
+    finish(job.counter);
+
+    Worker& worker = m_workers[index];
+    worker.numJobs++;
+    if (--t_depth == 0)
+        worker.busyTime += getTime() - start;
+}
+
+void JobSystem::finish(JobCounter* counter)
+{
+    if (!counter)
+        return;
+    uint32_t count = counter->m_count.load(std::memory_order_relaxed);
+    while (count > 1) // not the last one, the counter is untouched afterwards
+        if (counter->m_count.compare_exchange_weak(count, count - 1, std::memory_order_acq_rel))
+            return;
+
+    // the last one, done under the lock wait() takes before the counter may go away
+    std::vector<Job> continuations;
+    {
+        std::lock_guard<std::mutex> lock(counter->m_mutex);
+        if (counter->m_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            continuations.swap(counter->m_continuations);
+    }
+    for (const Job& job : continuations)
+        enqueue(job);
+}
+
+void JobSystem::wait(JobCounter& counter)
+{
+    const uint32_t index = getQueueIndex();
+    Job job;
+    while (!counter.isDone()) {
+        if (tryPop(index, job))
+            execute(job, index);
+        else
+            std::this_thread::yield(); // the rest runs on other threads
+    }
+    std::lock_guard<std::mutex> lock(counter.m_mutex); // finish() may still hold it
+}
+
+void JobSystem::workerLoop(uint32_t index)
+{
+    t_system = this;
+    t_queue = index;
+    Job job;
+    for (;;) {
+        if (tryPop(index, job)) {
+            execute(job, index);
+            continue;
+        }
+        m_numSleeping++;
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_wake.wait(lock, [&]() { return m_quit || m_pending > 0; });
+        m_numSleeping--;
+        if (m_quit && m_pending == 0)
+            return;
+    }
+}
+
+JobStats JobSystem::getStats() const
+{
+    JobStats stats;
+    stats.workers.resize(m_numThreads);
+    for (uint32_t i = 0; i < m_numThreads; ++i) {
+        stats.workers[i].jobs = m_workers[i].numJobs;
+        stats.workers[i].steals = m_workers[i].numSteals;
+        stats.workers[i].busyTime = m_workers[i].busyTime;
+    }
+    stats.elapsedTime = getTime() - m_statsStart;
+    return stats;
+}
+
+void JobSystem::resetStats()
+{
+    for (uint32_t i = 0; i < m_numThreads; ++i)
+        m_workers[i].numJobs = 0, m_workers[i].numSteals = 0, m_workers[i].busyTime = 0;
+    m_statsStart = getTime();
+}
+
+JobSystem& getJobSystem()
+{
+    static JobSystem jobSystem;
+    return jobSystem;
+}
@@ -0,0 +1,141 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint> // uintXX_t
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobCounter;
+
+// Plain function and pointer, so queuing a job never allocates. Range jobs
+// (grain > 0) split themselves in halves while bigger than grain, the halves
+// go to the queue and idle threads steal them.
+struct Job {
+    void (*func)(void* data, uint32_t first, uint32_t end) {};
+    void* data {};
+    uint32_t first {}, end {};
+    uint32_t grain {};
+    JobCounter* counter {}; // decremented when done, may be null
+};
+
+// Number of unfinished jobs of a group. JobSystem::wait() returns at zero and
+// jobs added with runAfter() start then. Must outlive its jobs, destroy it only
+// after JobSystem::wait().
+class JobCounter {
+public:
+    JobCounter() = default;
+    JobCounter(const JobCounter&) = delete;
+    JobCounter& operator=(const JobCounter&) = delete;
+
+    bool isDone() const { return m_count.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class JobSystem;
+    std::atomic<uint32_t> m_count {};
+    std::mutex m_mutex;
+    std::vector<Job> m_continuations; // guarded by m_mutex
+};
+
+struct JobWorkerStats {
+    uint64_t jobs {}, steals {};
+    uint64_t busyTime {}; // ns in top level jobs
+};
+
+struct JobStats {
+    std::vector<JobWorkerStats> workers; // [0] - threads outside the pool (main thread)
+    uint64_t elapsedTime {}; // ns since resetStats()
+
+    float getUtilization() const; // busy time of all threads / (elapsed * threads)
+};
+
+// Work-stealing scheduler. Every pool thread has its own queue, it takes its
+// newest job (cache-warm) and steals the oldest ones (the biggest ranges) from
+// others when empty. Queue 0 is shared by threads outside the pool, which run
+// jobs while they wait(), so nested waits inside jobs don't deadlock.
+class JobSystem {
+public:
+    static constexpr uint32_t s_queueSize = 4096; // per thread, jobs run inline when full
+
+    explicit JobSystem(uint32_t numThreads = 0); // including the caller, 0 - hardware threads
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+    ~JobSystem();
+
+    void setNumThreads(uint32_t numThreads); // when idle, restarts the pool
+    uint32_t getNumThreads() const { return m_numThreads; }
+
+    void run(const Job& job);
+    template <typename Func>
+    void run(JobCounter& counter, const Func& func); // func() must live until wait(counter)
+    void runAfter(JobCounter& dependency, const Job& job); // once dependency is done
+    void wait(JobCounter& counter); // runs queued jobs meanwhile
+
+    // func(first, end) over [0, count) in chunks of at most grain, returns when all are done
+    template <typename Func>
+    void parallelFor(uint32_t count, uint32_t grain, const Func& func);
+
+    JobStats getStats() const;
+    void resetStats();
+
+private:
+    struct Worker;
+
+    void start(uint32_t numThreads);
+    void stop();
+    void workerLoop(uint32_t index);
+    uint32_t getQueueIndex() const; // of the calling thread
+    void enqueue(const Job& job);
+    bool tryPop(uint32_t index, Job& job);
+    void execute(Job& job, uint32_t index);
+    void finish(JobCounter* counter);
+
+    uint32_t m_numThreads {};
+    std::unique_ptr<Worker[]> m_workers; // m_numThreads
+    std::vector<std::thread> m_threads; // m_numThreads - 1, thread i serves queue i + 1
+
+    std::atomic<uint32_t> m_pending {}; // queued jobs
+    std::atomic<uint32_t> m_numSleeping {};
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    bool m_quit {}; // guarded by m_sleepMutex
+    uint64_t m_statsStart {};
+};
+
+JobSystem& getJobSystem(); // engine wide pool
+
+template <typename Func>
+void JobSystem::run(JobCounter& counter, const Func& func)
+{
+    Job job;
+    job.func = [](void* data, uint32_t, uint32_t) { (*(const Func*)data)(); };
+    job.data = (void*)&func;
+    job.counter = &counter;
+    run(job);
+}
+
+template <typename Func>
+void JobSystem::parallelFor(uint32_t count, uint32_t grain, const Func& func)
+{
+    grain = std::max(grain, 1u);
+    if (count <= grain || m_numThreads == 1) {
+        if (count)
+            func(0u, count);
+        return;
+    }
+    JobCounter counter;
+    Job job;
+    job.func = [](void* data, uint32_t first, uint32_t end) { (*(const Func*)data)(first, end); };
+    job.data = (void*)&func;
+    job.end = count;
+    job.grain = grain;
+    job.counter = &counter;
+    run(job);
+    wait(counter);
+}
+
+#endif // JOB_SYSTEM_H
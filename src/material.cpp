@@ -0,0 +1,53 @@
+#include "material.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <algorithm>
+#include <cassert>
+
+// must match s_materialTableDeclarations in shader.cpp
+static constexpr uint32_t s_materialsBinding = 8;
+
+static_assert(sizeof(Material) == sizeof(glm::vec4), "Material must match std430 layout");
+
+MaterialTable::MaterialTable()
+    : m_SSBO(GL_Buffer::create())
+{
+    // never bind empty storage
+    m_capacity = sizeof(Material);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_SSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, m_capacity, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+uint32_t MaterialTable::add(const Material& material)
+{
+    m_materials.push_back(material);
+    m_dirty = true;
+    return m_materials.size() - 1;
+}
+
+void MaterialTable::set(uint32_t index, const Material& material)
+{
+    assert(index < m_materials.size());
+    m_materials[index] = material;
+    m_dirty = true;
+}
+
+void MaterialTable::bind()
+{
+    if (m_dirty) {
+        const size_t size = m_materials.size() * sizeof(Material);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_SSBO);
+        if (size > m_capacity) {
+            m_capacity = std::max(size, m_capacity * 2);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, m_capacity, nullptr, GL_DYNAMIC_DRAW);
+        }
+        if (size)
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, m_materials.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        m_dirty = false;
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, s_materialsBinding, m_SSBO);
+}
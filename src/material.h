@@ -0,0 +1,39 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include "gl_handle.h"
+
+#include <cstdint> // uintXX_t
+#include <glm/glm.hpp>
+#include <vector>
+
+struct Material { // std430 layout, mirrored in shader.cpp
+    glm::vec3 diffuseColor { 1.f };
+    float specular { 0.01f };
+};
+
+// Materials in a storage buffer, shaders with ShaderFeature::MaterialTable
+// index it with the per-instance material of GL_InstancedMesh, so instances
+// with different materials go out in one draw call.
+class MaterialTable {
+public:
+    MaterialTable();
+    MaterialTable(const MaterialTable&) = delete;
+    MaterialTable& operator=(const MaterialTable&) = delete;
+
+    uint32_t add(const Material& material); // returns index for setInstanceMaterials
+    void set(uint32_t index, const Material& material);
+    const Material& get(uint32_t index) const { return m_materials[index]; }
+    uint32_t size() const { return m_materials.size(); }
+
+    void bind(); // uploads if changed, before drawing with ShaderFeature::MaterialTable
+
+private:
+    std::vector<Material> m_materials;
+    bool m_dirty {};
+
+    GL_Buffer m_SSBO;
+    size_t m_capacity {};
+};
+
+#endif // MATERIAL_H
@@ -1,4 +1,6 @@
 #include "mesh.h"
+#include "allocators.h"
+#include "job_system.h"
 #include "meshdata.h"
 
 #define GL_GLEXT_PROTOTYPES
@@ -6,26 +8,38 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/packing.hpp>
+#include <algorithm>
 #include <iostream>
 
 #include <cassert>
 uint32_t GL_Mesh::s_currentlyBindedVAO {};
+static constexpr uint32_t s_vertexBindingIndex = 0; // vertex buffer binding for interleaved vertices
+static constexpr uint32_t s_instanceBindingIndex = 1; // vertex buffer binding for instance data
+static constexpr uint32_t s_materialBindingIndex = 2; // vertex buffer binding for instance material index
+static constexpr uint32_t s_animationBindingIndex = 3; // vertex buffer binding for instance animation
 
 #define LOG(x) std::cout << __FUNCTION__ << ", " << x << std::endl
 #define RANGE(x) x.begin(), x.end()
-typedef std::vector<uint8_t> ByteArray;
+typedef ArenaVector<uint8_t> ByteArray; // temporaries, live in scratch arena until uploaded
 
+// formats only, the vertex range is bound to s_vertexBindingIndex by bindBuffers()
 static void createVertexPointerAttrbutes(const VertexAttribData& attributes)
 {
+    assert(attributes.attributes.size() <= InstanceAttribData::s_maxVertexAttribs); // would overlap instance data
     size_t offset = 0;
     for (int i = 0; i < attributes.attributes.size(); ++i) {
         const auto& currentAttrib = attributes.attributes[i];
         if (currentAttrib.parameters.sizeInBytes) {
-            glVertexAttribPointer(i, currentAttrib.parameters.vectorSize,
-                currentAttrib.parameters.openGLTypeFormat,
-                currentAttrib.parameters.normalized ? GL_TRUE : GL_FALSE,
-                attributes.strideSize,
-                (GLvoid*)offset);
+            if (currentAttrib.parameters.isIntegerVector())
+                glVertexAttribIFormat(i, currentAttrib.parameters.vectorSize,
+                    currentAttrib.parameters.openGLTypeFormat,
+                    offset);
+            else
+                glVertexAttribFormat(i, currentAttrib.parameters.vectorSize,
+                    currentAttrib.parameters.openGLTypeFormat,
+                    currentAttrib.parameters.normalized ? GL_TRUE : GL_FALSE,
+                    offset);
+            glVertexAttribBinding(i, s_vertexBindingIndex);
             glEnableVertexAttribArray(i);
 
             offset += currentAttrib.parameters.sizeInBytes;
@@ -33,61 +47,107 @@ static void createVertexPointerAttrbutes(const VertexAttribData& attributes)
     }
 }
 
-static ByteArray makePlainVertexByteArray(
-    const glm::vec3* positions, const glm::vec3* normals, size_t vertArraySize, VertexAttribData& attribData)
+static glm::vec4 toVec4(const glm::vec3& v) { return glm::vec4(v, 0.f); }
+static glm::vec4 toVec4(const glm::vec4& v) { return v; }
+
+// count vectors, stride apart, in one of vector formats; vec3 sources get w = 0
+template <typename Vec>
+static void packVectors(const Vec* src, uint32_t count, MeshAttribFormat format, uint32_t stride, uint8_t* dst)
 {
+    switch (format) {
+    case MeshAttribFormat::Float3:
+        for (uint32_t i = 0; i < count; ++i, dst += stride)
+            *(glm::vec3*)dst = glm::vec3(src[i]);
+        break;
+    case MeshAttribFormat::Float4:
+        for (uint32_t i = 0; i < count; ++i, dst += stride)
+            *(glm::vec4*)dst = toVec4(src[i]);
+        break;
+    case MeshAttribFormat::Half4:
+        for (uint32_t i = 0; i < count; ++i, dst += stride)
+            *(uint64_t*)dst = packHalf4x16(toVec4(src[i]));
+        break;
+    case MeshAttribFormat::Unorm8x4: // colors
+        for (uint32_t i = 0; i < count; ++i, dst += stride)
+            *(uint32_t*)dst = glm::packUnorm4x8(toVec4(src[i]));
+        break;
+    default:
+        assert(false); // unsupported
+    }
+}
 
+// vertices [first, first + count), dst points to where vertex first goes
+static void packPlainVertices(const MeshData& meshData, const VertexAttribData& attribData, uint32_t first, uint32_t count, uint8_t* dst)
+{
+    assert(first + count <= meshData.getNumVertices());
     const uint32_t attribStrideSize = attribData.strideSize;
-    ByteArray byteArray(vertArraySize * attribStrideSize, 0);
 
     uint32_t currentAttribOffset = 0;
     for (uint32_t i_attr = 0; i_attr < attribData.attributes.size(); ++i_attr) {
 
         const auto& currentAttrib = attribData.attributes[i_attr];
+        uint8_t* currentByteArrayPos = dst + currentAttribOffset;
 
-        assert(currentAttrib.type <= VertexAttribute::Type::Normal); // only vertices and normals supported
-
-        const glm::vec3* p_currentVector {};
-        switch (currentAttrib.type) {
-        case VertexAttribute::Type::Position:
-            p_currentVector = positions;
-            break;
-        case VertexAttribute::Type::Normal:
-            p_currentVector = normals;
-            break;
-        default:
-            assert(false); // unsupported
-        }
+        if (currentAttrib.type == VertexAttribute::Type::Joints) {
 
-        uint8_t* currentByteArrayPos = byteArray.data() + currentAttribOffset;
-
-        if (currentAttrib.parameters.format == MeshAttribFormat::Float3) {
-
-            assert(sizeof(glm::vec3) == currentAttrib.parameters.sizeInBytes);
-            for (uint32_t i_vert = 0; i_vert < vertArraySize; ++i_vert) {
-                *(glm::vec3*)currentByteArrayPos = p_currentVector[i_vert];
+            assert(meshData.hasSkin() && currentAttrib.parameters.format == MeshAttribFormat::Uint8x4);
+            const glm::uvec4* joints = meshData.getJointsPtr() + first;
+            for (uint32_t i_vert = 0; i_vert < count; ++i_vert) {
+                *(glm::u8vec4*)currentByteArrayPos = glm::u8vec4(joints[i_vert]);
                 currentByteArrayPos += attribStrideSize;
             }
+            currentAttribOffset += currentAttrib.parameters.sizeInBytes;
+            continue;
+        }
 
-        } else if (currentAttrib.parameters.format == MeshAttribFormat::Half4) {
+        if (currentAttrib.type == VertexAttribute::Type::Weights) {
 
-            for (uint32_t i_vert = 0; i_vert < vertArraySize; ++i_vert) {
-                auto packedVec4 = packHalf4x16(glm::vec4(p_currentVector[i_vert], 0.f));
-                *(uint64_t*)currentByteArrayPos = packedVec4;
+            assert(meshData.hasSkin() && currentAttrib.parameters.format == MeshAttribFormat::Unorm8x4);
+            const glm::vec4* weights = meshData.getWeightsPtr() + first;
+            for (uint32_t i_vert = 0; i_vert < count; ++i_vert) {
+                *(uint32_t*)currentByteArrayPos = glm::packUnorm4x8(weights[i_vert]);
                 currentByteArrayPos += attribStrideSize;
             }
+            currentAttribOffset += currentAttrib.parameters.sizeInBytes;
+            continue;
+        }
 
-        } else
+        const MeshAttribFormat format = currentAttrib.parameters.format;
+        switch (currentAttrib.type) {
+        case VertexAttribute::Type::Position:
+            packVectors(meshData.getPositionsPtr() + first, count, format, attribStrideSize, currentByteArrayPos);
+            break;
+        case VertexAttribute::Type::Normal:
+            packVectors(meshData.getNormalsPtr() + first, count, format, attribStrideSize, currentByteArrayPos);
+            break;
+        case VertexAttribute::Type::Tan:
+            assert(meshData.hasTangents()); // MeshData::generateTangents()
+            packVectors(meshData.getTangentsPtr() + first, count, format, attribStrideSize, currentByteArrayPos);
+            break;
+        case VertexAttribute::Type::BiTan: {
+            assert(meshData.hasTangents());
+            ScratchScope scratch;
+            glm::vec3* bitangents = scratch.getArena().allocate<glm::vec3>(count);
+            for (uint32_t i_vert = 0; i_vert < count; ++i_vert)
+                bitangents[i_vert] = getBitangent(meshData.getNormalsPtr()[first + i_vert], meshData.getTangentsPtr()[first + i_vert]);
+            packVectors(bitangents, count, format, attribStrideSize, currentByteArrayPos);
+        } break;
+        case VertexAttribute::Type::Color:
+            assert(meshData.hasColors());
+            packVectors(meshData.getColorsPtr() + first, count, format, attribStrideSize, currentByteArrayPos);
+            break;
+        default:
             assert(false); // unsupported
+        }
 
         currentAttribOffset += currentAttrib.parameters.sizeInBytes;
     }
-    return byteArray;
 }
 
-static ByteArray makePlainIndexByteArray(const VertIndex* vertIndices, size_t indArraySize, IndexAttribData indexAttribute)
+static ByteArray makePlainIndexByteArray(const VertIndex* vertIndices, size_t indArraySize, const IndexAttribData& indexAttribute, LinearArena& arena)
 {
-    ByteArray byteArray;
+    const ArenaAllocator<uint8_t> allocator(arena);
+    ByteArray byteArray(allocator);
 
     switch (indexAttribute.parameters.format) {
 
@@ -124,18 +184,34 @@ static ByteArray makePlainIndexByteArray(const VertIndex* vertIndices, size_t in
     return byteArray;
 }
 
-GL_Mesh::GL_Mesh(const MeshData& meshData, VertexAttribData vertAttribData, IndexAttribData indexAttributes)
+// replaces the range when size changes; true if it did, so bindings are stale
+static bool uploadAllocation(GL_BufferAllocation& allocation, const void* data, size_t size)
+{
+    const bool reallocated = allocation.getSize() != size;
+    if (reallocated)
+        allocation = getBufferAllocator().allocate(size);
+    if (allocation) // empty if over the memory budget
+        allocation.upload(data, size);
+    return reallocated;
+}
+
+GL_Mesh::GL_Mesh(const MeshData& meshData, const VertexAttribData& vertAttribData, const IndexAttribData& indexAttributes, PackVertices packVertices)
     : m_GL_IndexFormatType(indexAttributes.parameters.openGLTypeFormat)
+    , m_VAO(GL_VertexArray::create())
+    , m_vertexAttribData(vertAttribData)
+    , m_indexAttribData(indexAttributes)
+    , m_packVertices(packVertices)
 {
     m_meshElementArraySize = meshData.getNumIndices();
-    glGenVertexArrays(1, &m_VAO);
-    glGenBuffers(1, &m_VBO);
-    glGenBuffers(1, &m_EBO);
+    m_boundingSphere = meshData.getBoundingSphere();
     glBindVertexArray(m_VAO);
 
+    ScratchScope scratch;
     auto numVertices = meshData.getNumVertices();
-    const ByteArray vertexByteArray = makePlainVertexByteArray(
-        meshData.getPositionsPtr(), meshData.getNormalsPtr(), numVertices, vertAttribData);
+    ByteArray vertexByteArray(numVertices * vertAttribData.strideSize, 0, ArenaAllocator<uint8_t>(scratch.getArena()));
+    this->packVertices(meshData, 0, numVertices, vertexByteArray.data());
+    m_numVertices = m_vertexCapacity = numVertices;
+    m_indexCapacity = m_meshElementArraySize;
 
     if ((indexAttributes.parameters.format == MeshAttribFormat::Uint8 && numVertices > 255)
         || (indexAttributes.parameters.format == MeshAttribFormat::Uint16 && numVertices > 65535)) {
@@ -143,87 +219,381 @@ GL_Mesh::GL_Mesh(const MeshData& meshData, VertexAttribData vertAttribData, Inde
     }
 
     const ByteArray indexByteArray = makePlainIndexByteArray(
-        meshData.getIndicesPtr(), meshData.getNumIndices(), indexAttributes);
+        meshData.getIndicesPtr(), meshData.getNumIndices(), indexAttributes, scratch.getArena());
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertexByteArray.size(), vertexByteArray.data(), GL_STATIC_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexByteArray.size(), indexByteArray.data(), GL_STATIC_DRAW);
+    uploadAllocation(m_VBO, vertexByteArray.data(), vertexByteArray.size());
+    uploadAllocation(m_EBO, indexByteArray.data(), indexByteArray.size());
 
     createVertexPointerAttrbutes(vertAttribData.attributes);
-
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 }
 
-GL_Mesh::~GL_Mesh()
+void GL_Mesh::packVertices(const MeshData& data, uint32_t first, uint32_t count, uint8_t* dst) const
+{
+    // vertices are independent, big ranges are packed in chunks on the job system
+    getJobSystem().parallelFor(count, 16 * 1024, [&](uint32_t chunkFirst, uint32_t chunkEnd) {
+        uint8_t* chunkDst = dst + (size_t)chunkFirst * m_vertexAttribData.strideSize;
+        if (m_packVertices)
+            m_packVertices(data, first + chunkFirst, chunkEnd - chunkFirst, chunkDst);
+        else
+            packPlainVertices(data, m_vertexAttribData, first + chunkFirst, chunkEnd - chunkFirst, chunkDst);
+    });
+}
+
+void GL_Mesh::uploadVertices(const MeshData& data, uint32_t first, uint32_t count)
 {
-    if (m_VAO) {
-        glDeleteBuffers(1, &m_VBO);
-        glDeleteBuffers(1, &m_EBO);
-        glDeleteVertexArrays(1, &m_VAO);
-        m_VAO = 0;
+    assert(first + count <= m_vertexCapacity);
+    ScratchScope scratch;
+    const uint32_t stride = m_vertexAttribData.strideSize;
+    uint8_t* bytes = scratch.getArena().allocate<uint8_t>(count * stride);
+    packVertices(data, first, count, bytes);
+    if (m_VBO)
+        m_VBO.upload(bytes, size_t(count) * stride, size_t(first) * stride);
+}
+
+void GL_Mesh::uploadIndices(const MeshData& data, uint32_t first, uint32_t count)
+{
+    assert(first + count <= m_indexCapacity);
+    ScratchScope scratch;
+    const ByteArray bytes = makePlainIndexByteArray(data.getIndicesPtr() + first, count, m_indexAttribData, scratch.getArena());
+    if (m_EBO)
+        m_EBO.upload(bytes.data(), bytes.size(), size_t(first) * m_indexAttribData.parameters.sizeInBytes);
+}
+
+// moves too small buffers to bigger ranges and refills them from data, the old ranges
+// are freed once frames in flight are done, bindings are refreshed by the next draw
+void GL_Mesh::growBuffers(const MeshData& data, uint32_t vertexCapacity, uint32_t indexCapacity, MeshUpdateStats& stats)
+{
+    if (vertexCapacity > m_vertexCapacity) {
+        m_vertexCapacity = vertexCapacity;
+        m_VBO = getBufferAllocator().allocate(size_t(m_vertexCapacity) * m_vertexAttribData.strideSize);
+        m_bindingGeneration = s_unbound;
+        uploadVertices(data, 0, data.getNumVertices());
+        stats.reallocations++, stats.uploads++;
+        stats.uploadedBytes += data.getNumVertices() * m_vertexAttribData.strideSize;
+    }
+    if (indexCapacity > m_indexCapacity) {
+        m_indexCapacity = indexCapacity;
+        m_EBO = getBufferAllocator().allocate(size_t(m_indexCapacity) * m_indexAttribData.parameters.sizeInBytes);
+        m_bindingGeneration = s_unbound;
+        uploadIndices(data, 0, data.getNumIndices());
+        stats.reallocations++, stats.uploads++;
+        stats.uploadedBytes += data.getNumIndices() * m_indexAttribData.parameters.sizeInBytes;
     }
 }
 
-void GL_Mesh::draw()
+void GL_Mesh::reserve(const MeshData& data, uint32_t numVertices, uint32_t numIndices)
+{
+    MeshUpdateStats stats;
+    growBuffers(data, numVertices, numIndices, stats);
+}
+
+MeshUpdateStats GL_Mesh::update(MeshData& data)
+{
+    MeshUpdateStats stats;
+    const uint32_t numVertices = data.getNumVertices(), numIndices = data.getNumIndices();
+    assert(numVertices >= m_numVertices); // vertices are never removed
+    assert(!(m_indexAttribData.parameters.format == MeshAttribFormat::Uint8 && numVertices > 255)
+        && !(m_indexAttribData.parameters.format == MeshAttribFormat::Uint16 && numVertices > 65535)); // too many vertices for index format
+
+    // a grown buffer is refilled whole, its ranges need no upload
+    const bool vertexGrowth = numVertices > m_vertexCapacity, indexGrowth = numIndices > m_indexCapacity;
+    growBuffers(data,
+        vertexGrowth ? std::max(numVertices, m_vertexCapacity * 2) : m_vertexCapacity,
+        indexGrowth ? std::max(numIndices, m_indexCapacity * 2) : m_indexCapacity, stats);
+
+    for (const auto& range : data.getDirtyVertices()) {
+        // bounding sphere only grows, so culling stays conservative without a full pass
+        const Vec3* positions = data.getPositionsPtr();
+        for (uint32_t i = range.first; i < range.end; ++i) {
+            const float distance = glm::distance(glm::vec3(m_boundingSphere), positions[i]);
+            if (distance > m_boundingSphere.w) { // shift to cover both old sphere and the point
+                const float radius = (m_boundingSphere.w + distance) * 0.5f;
+                const glm::vec3 center = glm::vec3(m_boundingSphere)
+                    + (positions[i] - glm::vec3(m_boundingSphere)) * ((radius - m_boundingSphere.w) / distance);
+                m_boundingSphere = glm::vec4(center, radius);
+            }
+        }
+        if (vertexGrowth)
+            continue;
+        uploadVertices(data, range.first, range.end - range.first);
+        stats.uploads++;
+        stats.uploadedBytes += (range.end - range.first) * m_vertexAttribData.strideSize;
+    }
+    if (!indexGrowth)
+        for (const auto& range : data.getDirtyIndices()) {
+            uploadIndices(data, range.first, range.end - range.first);
+            stats.uploads++;
+            stats.uploadedBytes += (range.end - range.first) * m_indexAttribData.parameters.sizeInBytes;
+        }
+
+    m_numVertices = numVertices;
+    m_meshElementArraySize = numIndices;
+    data.clearDirty();
+    return stats;
+}
+
+void GL_Mesh::bindVertexArray()
 {
     if (m_VAO != s_currentlyBindedVAO)
         glBindVertexArray(m_VAO);
-    glDrawElements(GL_TRIANGLES, m_meshElementArraySize, m_GL_IndexFormatType, 0);
+    // ranges reallocated or moved by defragmentation since the last draw
+    const uint32_t generation = getBufferAllocator().getGeneration();
+    if (m_bindingGeneration != generation) {
+        bindBuffers();
+        m_bindingGeneration = generation;
+    }
 }
 
-GL_InstancedMesh::GL_InstancedMesh(const MeshData& data, VertexAttribData vertexAttributes, IndexAttribData indexAttributes, InstanceAttribData instanceAttributes)
-    : GL_Mesh(data, vertexAttributes, indexAttributes)
-    , m_instanceAttribData(instanceAttributes)
+void GL_Mesh::bindBuffers()
+{
+    glBindVertexBuffer(s_vertexBindingIndex, m_VBO.getBuffer(), m_VBO.getOffset(), m_vertexAttribData.strideSize);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO.getBuffer()); // VAO state, offset goes to draws
+}
+
+void GL_Mesh::draw()
 {
-    glGenBuffers(1, &m_IBO);
-    glBindBuffer(GL_ARRAY_BUFFER, m_IBO);
+    bindVertexArray();
+    glDrawElements(GL_TRIANGLES, m_meshElementArraySize, m_GL_IndexFormatType, (const void*)m_EBO.getOffset());
+}
 
+GL_InstancedMesh::GL_InstancedMesh(const MeshData& data, const VertexAttribData& vertexAttributes,
+    const IndexAttribData& indexAttributes, const InstanceAttribData& instanceAttributes, PackVertices packVertices)
+    : GL_Mesh(data, vertexAttributes, indexAttributes, packVertices)
+    , m_instanceAttribData(instanceAttributes)
+{
+    // instance matrix goes through separate binding point,
+    // so the source buffer can be swapped without touching attribute formats
     glBindVertexArray(m_VAO);
     size_t vec4Size = sizeof(glm::vec4);
-    glEnableVertexAttribArray(3);
-    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)0);
-    glEnableVertexAttribArray(4);
-    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)(vec4Size));
-    glEnableVertexAttribArray(5);
-    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)(2 * vec4Size));
-    glEnableVertexAttribArray(6);
-    glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, 4 * vec4Size, (void*)(3 * vec4Size));
+    const uint32_t matrixLocation = InstanceAttribData::s_matrixLocation;
+    for (int i = 0; i < 4; ++i) {
+        glEnableVertexAttribArray(matrixLocation + i);
+        glVertexAttribFormat(matrixLocation + i, 4, GL_FLOAT, GL_FALSE, i * vec4Size);
+        glVertexAttribBinding(matrixLocation + i, s_instanceBindingIndex);
+    }
+    glVertexBindingDivisor(s_instanceBindingIndex, 1);
 
-    glVertexAttribDivisor(3, 1);
-    glVertexAttribDivisor(4, 1);
-    glVertexAttribDivisor(5, 1);
-    glVertexAttribDivisor(6, 1);
+    // enabled by setInstanceMaterials, disabled array reads as material 0
+    glVertexAttribIFormat(InstanceAttribData::s_materialLocation, 1, GL_UNSIGNED_INT, 0);
+    glVertexAttribBinding(InstanceAttribData::s_materialLocation, s_materialBindingIndex);
+    glVertexBindingDivisor(s_materialBindingIndex, 1);
+
+    // enabled by setInstanceAnimations
+    glVertexAttribFormat(InstanceAttribData::s_animationLocation, 2, GL_FLOAT, GL_FALSE, 0);
+    glVertexAttribBinding(InstanceAttribData::s_animationLocation, s_animationBindingIndex);
+    glVertexBindingDivisor(s_animationBindingIndex, 1);
+    glBindVertexArray(0);
 }
 
-GL_InstancedMesh::~GL_InstancedMesh()
+void GL_InstancedMesh::bindBuffers()
 {
-    if (m_IBO)
-        glDeleteBuffers(1, &m_IBO);
+    GL_Mesh::bindBuffers();
+    glBindVertexBuffer(s_instanceBindingIndex, m_IBO.getBuffer(), m_IBO.getOffset(), sizeof(glm::mat4));
+    glBindVertexBuffer(s_materialBindingIndex, m_MBO.getBuffer(), m_MBO.getOffset(), sizeof(uint32_t));
+    glBindVertexBuffer(s_animationBindingIndex, m_ABO.getBuffer(), m_ABO.getOffset(), sizeof(glm::vec2));
+}
+
+// uploads optional per-instance stream and toggles its attribute when it appears or disappears;
+// true if the stream got a new range
+template <typename T>
+static bool setInstanceStream(uint32_t VAO, GL_BufferAllocation& allocation, uint32_t location, std::vector<T>& stream, const std::vector<T>& values)
+{
+    const bool hadValues = !stream.empty();
+    stream = values;
+    const bool reallocated = uploadAllocation(allocation, stream.data(), stream.size() * sizeof(T));
+
+    if (hadValues != !stream.empty()) {
+        glBindVertexArray(VAO);
+        if (!stream.empty())
+            glEnableVertexAttribArray(location);
+        else
+            glDisableVertexAttribArray(location);
+        glBindVertexArray(0);
+    }
+    return reallocated;
+}
+
+void GL_InstancedMesh::setInstanceMaterials(const std::vector<uint32_t>& materialIndices)
+{
+    assert(materialIndices.empty() || materialIndices.size() == m_instanceTransforms.size()); // one per instance
+    if (setInstanceStream(m_VAO, m_MBO, InstanceAttribData::s_materialLocation, m_instanceMaterials, materialIndices))
+        m_bindingGeneration = s_unbound;
+}
+
+void GL_InstancedMesh::setInstanceAnimations(const std::vector<glm::vec2>& animations)
+{
+    assert(animations.empty() || animations.size() == m_instanceTransforms.size()); // one per instance
+    if (setInstanceStream(m_VAO, m_ABO, InstanceAttribData::s_animationLocation, m_instanceAnimations, animations))
+        m_bindingGeneration = s_unbound;
 }
 
 void GL_InstancedMesh::setInstanceTransforms(const std::vector<glm::mat4>& matrices)
 {
-    glBindBuffer(GL_ARRAY_BUFFER, m_IBO);
-    if (m_instanceArraySize != matrices.size()) {
-        m_instanceArraySize = matrices.size();
-        glBufferData(GL_ARRAY_BUFFER, m_instanceArraySize * sizeof(glm::mat4), matrices.data(), GL_STATIC_DRAW);
-    } else {
-        glBufferSubData(GL_ARRAY_BUFFER, 0, m_instanceArraySize * sizeof(glm::mat4), matrices.data());
+    m_instanceTransforms = matrices;
+    m_instanceArraySize = matrices.size();
+    m_sortValid = false;
+    if (uploadAllocation(m_IBO, matrices.data(), m_instanceArraySize * sizeof(glm::mat4)))
+        m_bindingGeneration = s_unbound;
+}
+
+float GL_InstancedMesh::sortInstancesFrontToBack(const glm::vec3& viewPos)
+{
+    if (m_instanceTransforms.empty())
+        return 0.f;
+
+    auto distanceSq = [&viewPos](const glm::mat4& m) {
+        glm::vec3 d = glm::vec3(m[3]) - viewPos;
+        return glm::dot(d, d);
+    };
+    auto closer = [&](const glm::mat4& a, const glm::mat4& b) { return distanceSq(a) < distanceSq(b); };
+
+    // nothing to reorder or upload while the camera stands still or the order holds
+    const bool unchanged = (m_sortValid && viewPos == m_sortedViewPos) || std::is_sorted(RANGE(m_instanceTransforms), closer);
+    m_sortValid = true;
+    m_sortedViewPos = viewPos;
+    if (unchanged)
+        return sqrtf(distanceSq(m_instanceTransforms.front()));
+
+    if (!hasInstanceMaterials() && !hasInstanceAnimations()) {
+        std::sort(RANGE(m_instanceTransforms), closer);
+    } else { // other per-instance streams follow their transforms
+        m_sortOrder.resize(m_instanceArraySize);
+        for (uint32_t i = 0; i < m_instanceArraySize; ++i)
+            m_sortOrder[i] = i;
+        std::sort(RANGE(m_sortOrder), [&](uint32_t a, uint32_t b) {
+            return distanceSq(m_instanceTransforms[a]) < distanceSq(m_instanceTransforms[b]);
+        });
+        for (uint32_t i = 0; i < m_instanceArraySize; ++i) { // apply permutation in place, cycle by cycle
+            uint32_t current = i;
+            while (m_sortOrder[current] != i) {
+                uint32_t next = m_sortOrder[current];
+                std::swap(m_instanceTransforms[current], m_instanceTransforms[next]);
+                if (hasInstanceMaterials())
+                    std::swap(m_instanceMaterials[current], m_instanceMaterials[next]);
+                if (hasInstanceAnimations())
+                    std::swap(m_instanceAnimations[current], m_instanceAnimations[next]);
+                m_sortOrder[current] = current;
+                current = next;
+            }
+            m_sortOrder[current] = current;
+        }
+
+        if (hasInstanceMaterials())
+            uploadAllocation(m_MBO, m_instanceMaterials.data(), m_instanceArraySize * sizeof(uint32_t));
+        if (hasInstanceAnimations())
+            uploadAllocation(m_ABO, m_instanceAnimations.data(), m_instanceArraySize * sizeof(glm::vec2));
     }
 
-    glBindVertexArray(0);
+    uploadAllocation(m_IBO, m_instanceTransforms.data(), m_instanceArraySize * sizeof(glm::mat4));
+
+    return sqrtf(distanceSq(m_instanceTransforms.front()));
+}
+
+void GL_InstancedMesh::setInstanceDivisor(uint32_t divisor)
+{
+    if (m_instanceDivisor == divisor)
+        return;
+    glVertexBindingDivisor(s_instanceBindingIndex, divisor);
+    glVertexBindingDivisor(s_materialBindingIndex, divisor);
+    glVertexBindingDivisor(s_animationBindingIndex, divisor);
+    m_instanceDivisor = divisor;
+}
+
+void GL_InstancedMesh::drawInstances(uint32_t numViews)
+{
+    bindVertexArray();
+    setInstanceDivisor(numViews);
+    if (m_sphereImpostors) {
+        glVertexAttrib4fv(InstanceAttribData::s_impostorSphereLocation, &m_boundingSphere[0]);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, m_instanceArraySize * numViews);
+        return;
+    }
+    glDrawElementsInstanced(GL_TRIANGLES, m_meshElementArraySize, m_GL_IndexFormatType, (const void*)m_EBO.getOffset(),
+        m_instanceArraySize * numViews);
 }
 
 void GL_InstancedMesh::draw()
 {
-    if (m_VAO != s_currentlyBindedVAO)
-        glBindVertexArray(m_VAO);
-    glDrawElementsInstanced(GL_TRIANGLES, m_meshElementArraySize, m_GL_IndexFormatType, 0, m_instanceArraySize);
+    drawInstances(1);
+}
+
+void GL_InstancedMesh::drawMultiView(uint32_t numViews)
+{
+    drawInstances(numViews);
+}
+
+void GL_InstancedMesh::drawSelected(const std::vector<uint32_t>& instances)
+{
+    if (instances.empty())
+        return;
+    ScratchScope scratch;
+    uint32_t* sorted = scratch.getArena().allocate<uint32_t>(instances.size());
+    std::copy(instances.begin(), instances.end(), sorted);
+    std::sort(sorted, sorted + instances.size());
+
+    // DrawElementsIndirectCommand {count, instanceCount, firstIndex, baseVertex, baseInstance}
+    // or DrawArraysIndirectCommand {count, instanceCount, first, baseInstance}, one per run
+    // of consecutive instances
+    const uint32_t commandSize = m_sphereImpostors ? 4 : 5;
+    uint32_t* commands = scratch.getArena().allocate<uint32_t>(instances.size() * commandSize);
+    uint32_t numCommands = 0;
+    for (size_t i = 0; i < instances.size(); ++i) {
+        if (numCommands && sorted[i] == sorted[i - 1] + 1) {
+            commands[(numCommands - 1) * commandSize + 1]++;
+            continue;
+        }
+        uint32_t* command = commands + numCommands++ * commandSize;
+        command[0] = getNumDrawVertices();
+        command[1] = 1;
+        command[2] = m_sphereImpostors ? 0 : getFirstIndex();
+        command[3] = m_sphereImpostors ? sorted[i] : 0;
+        if (!m_sphereImpostors)
+            command[4] = sorted[i];
+    }
+
+    const uint32_t size = numCommands * commandSize * sizeof(uint32_t);
+    if (!m_selectionCommands)
+        m_selectionCommands = GL_Buffer::create();
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_selectionCommands);
+    if (size > m_selectionCapacity) {
+        m_selectionCapacity = std::max(size, 2 * m_selectionCapacity);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, m_selectionCapacity, nullptr, GL_DYNAMIC_DRAW);
+    }
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, size, commands);
+
+    bindVertexArray();
+    setInstanceDivisor(1);
+    if (m_sphereImpostors) {
+        glVertexAttrib4fv(InstanceAttribData::s_impostorSphereLocation, &m_boundingSphere[0]);
+        glMultiDrawArraysIndirect(GL_TRIANGLE_STRIP, nullptr, numCommands, 0);
+    } else
+        glMultiDrawElementsIndirect(GL_TRIANGLES, m_GL_IndexFormatType, nullptr, numCommands, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void GL_InstancedMesh::drawIndirect(const InstanceBuffers& instances, uint32_t commandBuffer, intptr_t commandOffset)
+{
+    bindVertexArray();
+    setInstanceDivisor(1);
+    glBindVertexBuffer(s_instanceBindingIndex, instances.transforms, 0, sizeof(glm::mat4));
+    if (hasInstanceMaterials())
+        glBindVertexBuffer(s_materialBindingIndex, instances.materials, 0, sizeof(uint32_t));
+    if (hasInstanceAnimations())
+        glBindVertexBuffer(s_animationBindingIndex, instances.animations, 0, sizeof(glm::vec2));
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    if (m_sphereImpostors) {
+        glVertexAttrib4fv(InstanceAttribData::s_impostorSphereLocation, &m_boundingSphere[0]);
+        glDrawArraysIndirect(GL_TRIANGLE_STRIP, (const void*)commandOffset);
+    } else
+        glDrawElementsIndirect(GL_TRIANGLES, m_GL_IndexFormatType, (const void*)commandOffset);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    bindBuffers(); // own instance ranges back
 }
 
 static_assert(std::is_same<uint32_t, VertIndex>(), "");
 static_assert(std::is_same<uint32_t, GLuint>(), "");
 static_assert(std::is_same<uint16_t, GLushort>(), "");
+static_assert(std::is_move_assignable<GL_Mesh>() && std::is_move_assignable<GL_InstancedMesh>(), "meshes go in vectors");
@@ -1,6 +1,9 @@
 #ifndef MESH_H
 #define MESH_H
+#include "buffer_allocator.h"
+#include "gl_handle.h"
 #include "mesh_attributes.h"
+#include "vertex_layout.h"
 
 #include <cstdint> // uintXX_t
 #include <glm/glm.hpp>
@@ -8,36 +11,153 @@
 
 class MeshData;
 
+struct MeshUpdateStats {
+    uint32_t uploads {}; // buffer sub-ranges written
+    uint32_t uploadedBytes {};
+    uint32_t reallocations {}; // buffers grown, re-uploaded whole
+};
+
+// move-only, GL objects are released through the deletion queue; vertices, indices and
+// instances live in ranges of getBufferAllocator() arenas
 class GL_Mesh { // max 21845 vert (65536/3) vertices;
 public:
+    // fills interleaved vertices [first, first + count), dst points to vertex first;
+    // must match the VertexAttribData it's passed with
+    typedef void (*PackVertices)(const MeshData& data, uint32_t first, uint32_t count, uint8_t* dst);
+
+    // packVertices == nullptr: generic runtime packing
     GL_Mesh(const MeshData& data,
-        VertexAttribData vertexAttributes,
-        IndexAttribData indexAttributes);
-    virtual ~GL_Mesh();
+        const VertexAttribData& vertexAttributes,
+        const IndexAttribData& indexAttributes,
+        PackVertices packVertices = nullptr);
+    template <typename... Attrs>
+    GL_Mesh(const MeshData& data, VertexLayout<Attrs...> layout, const IndexAttribData& indexAttributes)
+        : GL_Mesh(data, layout.getAttribData(), indexAttributes, &VertexLayout<Attrs...>::packRange)
+    {
+    }
+    GL_Mesh(GL_Mesh&&) = default;
+    GL_Mesh& operator=(GL_Mesh&&) = default;
+    virtual ~GL_Mesh() = default;
 
     virtual void draw();
 
+    // uploads vertices and indices of data edited since the last update, clears its
+    // dirty ranges; data must be the MeshData the mesh was created from. Buffers that
+    // are too small for appended elements grow twice and are re-uploaded whole
+    MeshUpdateStats update(MeshData& data);
+    // over-allocates buffers so appending up to these counts doesn't reallocate
+    void reserve(const MeshData& data, uint32_t numVertices, uint32_t numIndices);
+
+    const glm::vec4& getBoundingSphere() const { return m_boundingSphere; } // in mesh space
+    void setBoundingSphere(const glm::vec4& sphere) { m_boundingSphere = sphere; } // e.g. to cover animation
+    uint32_t getNumIndices() const { return m_meshElementArraySize; }
+    // of the index range in its arena buffer, firstIndex of indirect draw commands
+    uint32_t getFirstIndex() const { return m_EBO.getOffset() / m_indexAttribData.parameters.sizeInBytes; }
+
 protected:
+    void packVertices(const MeshData& data, uint32_t first, uint32_t count, uint8_t* dst) const;
+    void uploadVertices(const MeshData& data, uint32_t first, uint32_t count); // within capacity
+    void uploadIndices(const MeshData& data, uint32_t first, uint32_t count);
+    void growBuffers(const MeshData& data, uint32_t vertexCapacity, uint32_t indexCapacity, MeshUpdateStats& stats);
+    void bindVertexArray(); // and buffers, when ranges moved since they were bound
+    virtual void bindBuffers(); // current ranges to VAO bindings, VAO bound
+
+    static constexpr uint32_t s_unbound = ~0u;
     static uint32_t s_currentlyBindedVAO;
-    const int m_GL_IndexFormatType;
-    uint32_t m_VBO {}, m_EBO {}, m_VAO {};
+    int m_GL_IndexFormatType;
+    GL_BufferAllocation m_VBO, m_EBO;
+    GL_VertexArray m_VAO;
+    uint32_t m_bindingGeneration = s_unbound; // GL_BufferAllocator::getGeneration() of bound ranges
     uint32_t m_meshElementArraySize {}; // num of indices
+    glm::vec4 m_boundingSphere {};
+
+    // kept for update()
+    VertexAttribData m_vertexAttribData;
+    IndexAttribData m_indexAttribData;
+    PackVertices m_packVertices;
+    uint32_t m_numVertices {};
+    uint32_t m_vertexCapacity {}, m_indexCapacity {}; // in elements
 };
 
 class GL_InstancedMesh : public GL_Mesh {
 public:
     GL_InstancedMesh(const MeshData& data,
-        VertexAttribData vertexAttributes,
-        IndexAttribData indexAttributes,
-        InstanceAttribData instanceAttributes);
-    virtual ~GL_InstancedMesh();
+        const VertexAttribData& vertexAttributes,
+        const IndexAttribData& indexAttributes,
+        const InstanceAttribData& instanceAttributes,
+        PackVertices packVertices = nullptr);
+    template <typename... Attrs>
+    GL_InstancedMesh(const MeshData& data, VertexLayout<Attrs...> layout,
+        const IndexAttribData& indexAttributes, const InstanceAttribData& instanceAttributes)
+        : GL_InstancedMesh(data, layout.getAttribData(), indexAttributes, instanceAttributes, &VertexLayout<Attrs...>::packRange)
+    {
+    }
+    GL_InstancedMesh(GL_InstancedMesh&&) = default;
+    GL_InstancedMesh& operator=(GL_InstancedMesh&&) = default;
 
     void setInstanceTransforms(const std::vector<glm::mat4>& matrices);
+    const std::vector<glm::mat4>& getInstanceTransforms() const { return m_instanceTransforms; }
+
+    // optional index into MaterialTable per instance, one per transform
+    void setInstanceMaterials(const std::vector<uint32_t>& materialIndices);
+    const std::vector<uint32_t>& getInstanceMaterials() const { return m_instanceMaterials; }
+    bool hasInstanceMaterials() const { return !m_instanceMaterials.empty(); }
+
+    // optional AnimationPalette playback per instance: x - time offset (s), y - rate, one per transform
+    void setInstanceAnimations(const std::vector<glm::vec2>& animations);
+    const std::vector<glm::vec2>& getInstanceAnimations() const { return m_instanceAnimations; }
+    bool hasInstanceAnimations() const { return !m_instanceAnimations.empty(); }
+
+    // reorders and re-uploads instances by distance to viewPos, so early-Z rejects
+    // hidden fragments; returns distance to the nearest instance (for sorting meshes).
+    // Does nothing if viewPos hasn't moved since the last call or the order still holds
+    float sortInstancesFrontToBack(const glm::vec3& viewPos);
     virtual void draw();
+    // every instance once per view of MultiView, for programs with ShaderFeature::MultiView
+    void drawMultiView(uint32_t numViews);
+
+    // draws every instance as its bounding sphere, a 4 vertex quad ray traced by programs
+    // with ShaderFeature::SphereImpostor, instead of the triangles
+    void setSphereImpostors(bool impostors) { m_sphereImpostors = impostors; }
+    bool isSphereImpostors() const { return m_sphereImpostors; }
+    uint32_t getNumDrawVertices() const { return m_sphereImpostors ? 4 : m_meshElementArraySize; } // per instance
+
+    struct InstanceBuffers {
+        uint32_t transforms {}, materials {}, animations {}; // unused streams are ignored
+    };
 
-    uint32_t m_IBO {}; // instance buffer object
+    // draws only the listed instances, e.g. the ones a CPU frustum query found visible;
+    // one indirect command per run of consecutive indices, baseInstance picks the run
+    // from the own buffers
+    void drawSelected(const std::vector<uint32_t>& instances);
+
+    // draws instances taken from other buffers of the same layout (e.g. culling output),
+    // instance count is read by GPU from DrawElementsIndirectCommand at commandOffset,
+    // its firstIndex must be getFirstIndex(); sphere impostors read it as
+    // DrawArraysIndirectCommand {count, instanceCount, first, baseInstance}, which
+    // matches while firstIndex and baseVertex are 0
+    void drawIndirect(const InstanceBuffers& instances, uint32_t commandBuffer, intptr_t commandOffset = 0);
+
+    GL_BufferAllocation m_IBO; // instance buffer object
+    GL_BufferAllocation m_MBO; // instance material index buffer object
+    GL_BufferAllocation m_ABO; // instance animation buffer object
     uint32_t m_instanceArraySize {}; // num of instances
+    std::vector<glm::mat4> m_instanceTransforms; // CPU copy of instance buffer
+    std::vector<uint32_t> m_instanceMaterials; // CPU copy of material index buffer
+    std::vector<glm::vec2> m_instanceAnimations; // CPU copy of animation buffer
+    std::vector<uint32_t> m_sortOrder; // scratch for sortInstancesFrontToBack
+    glm::vec3 m_sortedViewPos {}; // of the last sortInstancesFrontToBack, valid until the transforms are set
+    bool m_sortValid {};
+    bool m_sphereImpostors {};
+    GL_Buffer m_selectionCommands; // of drawSelected(), grown when too small
+    uint32_t m_selectionCapacity {}; // bytes
+    uint32_t m_instanceDivisor { 1 }; // instances advance every numViews in multi-view draws
 
-    const InstanceAttribData m_instanceAttribData;
+    InstanceAttribData m_instanceAttribData;
+
+protected:
+    void bindBuffers() override;
+    void setInstanceDivisor(uint32_t divisor); // VAO bound
+    void drawInstances(uint32_t numViews);
 };
 #endif // MESH_H
@@ -5,11 +5,12 @@
 
 #include <cassert>
 
-bool MeshAttribParameters::isFloatVector()
+bool MeshAttribParameters::isFloatVector() const
 {
     return (format >= MeshAttribFormat::Float1 && format <= MeshAttribFormat::Float4);
 }
-bool MeshAttribParameters::isHalfVector() { return format >= MeshAttribFormat::Half1 && format <= MeshAttribFormat::Half4; }
+bool MeshAttribParameters::isHalfVector() const { return format >= MeshAttribFormat::Half1 && format <= MeshAttribFormat::Half4; }
+bool MeshAttribParameters::isIntegerVector() const { return format == MeshAttribFormat::Uint8x4; }
 
 static MeshAttribParameters calcMeshAttribParameters(MeshAttribFormat format)
 {
@@ -42,6 +43,12 @@ static MeshAttribParameters calcMeshAttribParameters(MeshAttribFormat format)
         dataSize = sizeof(uint32_t);
         params.vectorSize = 1;
 
+    } else if (format == MeshAttribFormat::Uint8x4 || format == MeshAttribFormat::Unorm8x4) {
+        params.openGLTypeFormat = GL_UNSIGNED_BYTE;
+        dataSize = sizeof(uint8_t);
+        params.vectorSize = 4;
+        params.normalized = format == MeshAttribFormat::Unorm8x4;
+
     } else if (format == MeshAttribFormat::Mat4x4) {
         params.openGLTypeFormat = GL_FLOAT;
         dataSize = sizeof(float);
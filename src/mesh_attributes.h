@@ -11,46 +11,105 @@ enum class MeshAttribFormat : uint8_t {
      Half1,  Half2,  Half3,  Half4,
     Mat4x4,
     Uint8, Uint16, Uint32,
+    Uint8x4, Unorm8x4, // skinning joints and weights
 }; // clang-format on
 
 struct MeshAttribParameters {
     // MeshAttribParameters(const MeshAttribParameters& other) = default;
     MeshAttribParameters(MeshAttribFormat format);
-    const MeshAttribFormat format {};
+    MeshAttribFormat format {};
     const char* shaderName {};
     int openGLTypeFormat {};
     uint32_t sizeInBytes {};
     uint8_t vectorSize {};
     bool normalized {};
-    bool isFloatVector();
-    bool isHalfVector();
+    bool isFloatVector() const;
+    bool isHalfVector() const;
+    bool isIntegerVector() const; // read as uvec in shaders
 };
 
 struct VertexAttribute {
     // clang-format off
-    enum class Type : uint8_t { Position, Normal, Tan, BiTan, Color };
+    enum class Type : uint8_t { Position, Normal, Tan, BiTan, Color, Joints, Weights };
     // clang-format on
 
     VertexAttribute(Type type, MeshAttribFormat format);
-    const MeshAttribParameters parameters;
-    const Type type;
+    MeshAttribParameters parameters;
+    Type type;
 };
 
+// clang-format off
+// shared by runtime and compile-time (VertexLayout) shader generation
+constexpr const char* getAttribShaderName(VertexAttribute::Type type)
+{
+    switch (type) {
+    case VertexAttribute::Type::Position: return "vertexPosition";
+    case VertexAttribute::Type::Normal: return "vertexNormal";
+    case VertexAttribute::Type::Tan: return "vertexTangent";
+    case VertexAttribute::Type::BiTan: return "vertexBitangent";
+    case VertexAttribute::Type::Color: return "vertexColor";
+    case VertexAttribute::Type::Joints: return "vertexJoints";
+    case VertexAttribute::Type::Weights: return "vertexWeights";
+    }
+    return nullptr;
+}
+
+// GLSL type the attribute is read as, nullptr if it can't be a vertex attribute
+constexpr const char* getAttribShaderType(MeshAttribFormat format)
+{
+    switch (format) {
+    case MeshAttribFormat::Float1: case MeshAttribFormat::Half1: return "float";
+    case MeshAttribFormat::Float2: case MeshAttribFormat::Half2: return "vec2";
+    case MeshAttribFormat::Float3: case MeshAttribFormat::Half3: return "vec3";
+    case MeshAttribFormat::Float4: case MeshAttribFormat::Half4: case MeshAttribFormat::Unorm8x4: return "vec4";
+    case MeshAttribFormat::Uint8x4: return "uvec4";
+    default: return nullptr;
+    }
+}
+
+constexpr uint32_t getAttribSize(MeshAttribFormat format)
+{
+    switch (format) {
+    case MeshAttribFormat::Float1: return 4;
+    case MeshAttribFormat::Float2: return 8;
+    case MeshAttribFormat::Float3: return 12;
+    case MeshAttribFormat::Float4: return 16;
+    case MeshAttribFormat::Half1: return 2;
+    case MeshAttribFormat::Half2: return 4;
+    case MeshAttribFormat::Half3: return 6;
+    case MeshAttribFormat::Half4: return 8;
+    case MeshAttribFormat::Mat4x4: return 64;
+    case MeshAttribFormat::Uint8: return 1;
+    case MeshAttribFormat::Uint16: return 2;
+    case MeshAttribFormat::Uint32: return 4;
+    case MeshAttribFormat::Uint8x4: case MeshAttribFormat::Unorm8x4: return 4;
+    default: return 0;
+    }
+}
+// clang-format on
+
 struct VertexAttribData {
     VertexAttribData(const std::vector<VertexAttribute>& attribs);
     VertexAttribData(std::initializer_list<VertexAttribute> attribList);
-    const std::vector<VertexAttribute> attributes;
-    const uint32_t strideSize;
+    std::vector<VertexAttribute> attributes;
+    uint32_t strideSize;
 };
 
 struct IndexAttribData {
     IndexAttribData(MeshAttribFormat format);
-    const MeshAttribParameters parameters;
+    MeshAttribParameters parameters;
 };
 
 struct InstanceAttribData {
+    // vertex attributes take locations from 0, per-instance data goes above them
+    static constexpr uint32_t s_maxVertexAttribs = 8;
+    static constexpr uint32_t s_matrixLocation = 8; // 4 locations
+    static constexpr uint32_t s_materialLocation = 12;
+    static constexpr uint32_t s_animationLocation = 13;
+    static constexpr uint32_t s_impostorSphereLocation = 14; // constant attribute, no array
+
     InstanceAttribData(MeshAttribFormat format);
-    const MeshAttribParameters parameters;
+    MeshAttribParameters parameters;
 };
 
 #endif // MESH_ATTRIBUTES_H
@@ -0,0 +1,348 @@
+#include "mesh_codec.h"
+
+#include "allocators.h"
+#include "byte_stream.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+
+namespace MeshCodec {
+
+static constexpr uint32_t s_groupSize = 16; // deltas packed at one width
+static constexpr uint32_t s_fifoSize = 16;
+static constexpr uint32_t s_noEdge = 15; // edge nibble of triangles coded vertex by vertex
+static constexpr uint32_t s_explicitVertex = 15; // vertex nibble followed by a delta from the last one
+
+static void setU32(uint8_t* dst, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        dst[i] = uint8_t(value >> (i * 8));
+}
+
+static uint32_t getU32(const uint8_t* src)
+{
+    return src[0] | uint32_t(src[1]) << 8 | uint32_t(src[2]) << 16 | uint32_t(src[3]) << 24;
+}
+
+// reads the offset table of a stream: header of numHeader u32, then numBlocks offsets
+static bool readBlockTable(const uint8_t* data, size_t size, uint32_t numHeader, uint32_t numBlocks)
+{
+    const size_t tableEnd = (numHeader + size_t(numBlocks)) * 4;
+    if (size < tableEnd)
+        return false;
+    uint32_t previous = tableEnd;
+    for (uint32_t i = 0; i < numBlocks; ++i) {
+        const uint32_t offset = getU32(data + (numHeader + i) * 4);
+        if (offset < previous || offset > size)
+            return false;
+        previous = offset;
+    }
+    return true;
+}
+
+// vertices
+
+static uint8_t zigzag(uint8_t delta) { return uint8_t(delta << 1) ^ uint8_t(int8_t(delta) >> 7); }
+static uint8_t unzigzag(uint8_t value) { return uint8_t(value >> 1) ^ uint8_t(-(value & 1)); }
+
+static void encodeVertexBlock(const uint8_t* vertices, uint32_t count, uint32_t stride, std::vector<uint8_t>& out)
+{
+    const uint32_t numGroups = (count + s_groupSize - 1) / s_groupSize;
+    uint8_t plane[s_vertexBlockSize] = {}; // padded to whole groups with zero deltas
+    for (uint32_t k = 0; k < stride; ++k) {
+        uint8_t previous = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            const uint8_t value = vertices[i * stride + k];
+            plane[i] = zigzag(value - previous);
+            previous = value;
+        }
+        std::fill(plane + count, plane + numGroups * s_groupSize, 0);
+
+        const size_t header = out.size();
+        out.resize(out.size() + (numGroups * 2 + 7) / 8, 0);
+        for (uint32_t g = 0; g < numGroups; ++g) {
+            const uint8_t* group = plane + g * s_groupSize;
+            const uint8_t maxValue = *std::max_element(group, group + s_groupSize);
+            const uint32_t mode = maxValue == 0 ? 0 : maxValue < 4 ? 1 : maxValue < 16 ? 2 : 3;
+            out[header + g / 4] |= uint8_t(mode << (g % 4 * 2));
+            if (mode == 3) {
+                out.insert(out.end(), group, group + s_groupSize);
+            } else if (mode) {
+                const uint32_t bits = mode * 2, perByte = 8 / bits;
+                for (uint32_t i = 0; i < s_groupSize; i += perByte) {
+                    uint8_t byte = 0;
+                    for (uint32_t j = 0; j < perByte; ++j)
+                        byte |= group[i + j] << (j * bits);
+                    out.push_back(byte);
+                }
+            }
+        }
+    }
+}
+
+// transposed deltas of every plane to scratch[i * stride + k], then one running sum
+// over the interleaved vertices, which compilers vectorize across the stride
+static bool decodeVertexBlock(ByteReader& reader, uint8_t* dst, uint32_t count, uint32_t stride, uint8_t* scratch)
+{
+    const uint32_t numGroups = (count + s_groupSize - 1) / s_groupSize;
+    const uint32_t headerSize = (numGroups * 2 + 7) / 8;
+    for (uint32_t k = 0; k < stride; ++k) {
+        if (size_t(reader.end - reader.pos) < headerSize)
+            return false;
+        const uint8_t* header = reader.pos;
+        reader.pos += headerSize;
+        for (uint32_t g = 0; g < numGroups; ++g) {
+            const uint32_t mode = header[g / 4] >> (g % 4 * 2) & 3;
+            uint8_t* group = scratch + g * s_groupSize * stride + k;
+            if (mode == 0) {
+                for (uint32_t i = 0; i < s_groupSize; ++i)
+                    group[i * stride] = 0;
+                continue;
+            }
+            const uint32_t bits = mode == 3 ? 8 : mode * 2;
+            const uint32_t perByte = 8 / bits, mask = (1u << bits) - 1;
+            if (size_t(reader.end - reader.pos) < s_groupSize / perByte)
+                return false;
+            for (uint32_t i = 0; i < s_groupSize; ++i)
+                group[i * stride] = reader.pos[i / perByte] >> (i % perByte * bits) & mask;
+            reader.pos += s_groupSize / perByte;
+        }
+    }
+
+    uint8_t sum[256] = {}; // stride is at most 256
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t* deltas = scratch + i * stride;
+        uint8_t* vertex = dst + i * stride;
+        for (uint32_t k = 0; k < stride; ++k) {
+            sum[k] += unzigzag(deltas[k]);
+            vertex[k] = sum[k];
+        }
+    }
+    return true;
+}
+
+std::vector<uint8_t> encodeVertices(const void* vertices, uint32_t numVertices, uint32_t stride)
+{
+    assert(stride > 0 && stride <= 256);
+    const uint32_t numBlocks = (numVertices + s_vertexBlockSize - 1) / s_vertexBlockSize;
+    std::vector<uint8_t> out;
+    putU32(out, numVertices);
+    putU32(out, stride);
+    putU32(out, numBlocks);
+    out.resize(out.size() + numBlocks * 4);
+
+    for (uint32_t b = 0; b < numBlocks; ++b) {
+        setU32(out.data() + (3 + b) * 4, out.size());
+        const uint32_t first = b * s_vertexBlockSize;
+        const uint32_t count = std::min(numVertices - first, s_vertexBlockSize);
+        encodeVertexBlock((const uint8_t*)vertices + size_t(first) * stride, count, stride, out);
+    }
+    return out;
+}
+
+bool decodeVertices(const uint8_t* data, size_t size, void* dst, uint32_t numVertices, uint32_t stride)
+{
+    if (size < 12 || getU32(data) != numVertices || getU32(data + 4) != stride || stride == 0 || stride > 256)
+        return false;
+    const uint32_t numBlocks = getU32(data + 8);
+    if (numBlocks != (numVertices + s_vertexBlockSize - 1) / s_vertexBlockSize || !readBlockTable(data, size, 3, numBlocks))
+        return false;
+
+    std::atomic<bool> failed { false };
+    getJobSystem().parallelFor(numBlocks, 16, [&](uint32_t firstBlock, uint32_t endBlock) {
+        ScratchScope scratch;
+        uint8_t* deltas = scratch.getArena().allocate<uint8_t>(s_vertexBlockSize * stride);
+        for (uint32_t b = firstBlock; b < endBlock; ++b) {
+            const uint32_t begin = getU32(data + (3 + b) * 4);
+            const uint32_t end = b + 1 < numBlocks ? getU32(data + (4 + b) * 4) : size;
+            ByteReader reader { data + begin, data + end };
+            const uint32_t first = b * s_vertexBlockSize;
+            const uint32_t count = std::min(numVertices - first, s_vertexBlockSize);
+            if (!decodeVertexBlock(reader, (uint8_t*)dst + size_t(first) * stride, count, stride, deltas))
+                failed = true;
+        }
+    });
+    return !failed;
+}
+
+// indices
+
+// recent edges and vertices both sides track identically, age 0 is the newest
+struct IndexFifos {
+    uint32_t edges[s_fifoSize][2];
+    uint32_t vertices[s_fifoSize];
+    uint32_t edgeHead {}, vertexHead {};
+    uint32_t next {}; // expected new vertex, meshes mostly reference vertices in order
+    uint32_t last {}; // explicit deltas are relative to it
+
+    explicit IndexFifos(uint32_t first)
+        : next(first)
+        , last(first)
+    {
+        memset(edges, 0xFF, sizeof(edges));
+        memset(vertices, 0xFF, sizeof(vertices));
+    }
+    const uint32_t* edge(uint32_t age) const { return edges[(edgeHead - 1 - age) % s_fifoSize]; }
+    uint32_t vertex(uint32_t age) const { return vertices[(vertexHead - 1 - age) % s_fifoSize]; }
+
+    void pushEdge(uint32_t a, uint32_t b)
+    {
+        edges[edgeHead % s_fifoSize][0] = a;
+        edges[edgeHead % s_fifoSize][1] = b;
+        ++edgeHead;
+    }
+    // after coding v with mode: 0 - next, 1..14 - vertex(mode - 1), 15 - explicit
+    void pushVertex(uint32_t v, uint32_t mode)
+    {
+        if (mode == 0)
+            ++next;
+        else if (mode == s_explicitVertex)
+            last = v;
+        if (mode == 0 || mode == s_explicitVertex)
+            vertices[vertexHead++ % s_fifoSize] = v;
+    }
+    // edges of (a, b, c) as a neighbour with the same winding sees them
+    void pushTriangle(uint32_t a, uint32_t b, uint32_t c)
+    {
+        pushEdge(b, a);
+        pushEdge(c, b);
+        pushEdge(a, c);
+    }
+};
+
+static uint32_t encodeVertex(IndexFifos& fifos, uint32_t v, std::vector<uint8_t>& deltas)
+{
+    uint32_t mode = s_explicitVertex;
+    if (v == fifos.next) {
+        mode = 0;
+    } else {
+        for (uint32_t age = 0; age < s_explicitVertex - 1; ++age)
+            if (fifos.vertex(age) == v) {
+                mode = age + 1;
+                break;
+            }
+    }
+    if (mode == s_explicitVertex)
+        putSigned(deltas, int32_t(v - fifos.last));
+    fifos.pushVertex(v, mode);
+    return mode;
+}
+
+static uint32_t decodeVertex(IndexFifos& fifos, uint32_t mode, ByteReader& reader)
+{
+    const uint32_t v = mode == 0 ? fifos.next
+        : mode == s_explicitVertex ? fifos.last + uint32_t(reader.signedVarint())
+                                   : fifos.vertex(mode - 1);
+    fifos.pushVertex(v, mode);
+    return v;
+}
+
+static void encodeIndexChunk(const VertIndex* indices, uint32_t numTriangles, std::vector<uint8_t>& out)
+{
+    IndexFifos fifos(indices[0]);
+    putVarint(out, indices[0]);
+    std::vector<uint8_t> deltas;
+    for (uint32_t t = 0; t < numTriangles; ++t) {
+        const VertIndex* tri = indices + t * 3;
+        uint32_t edgeAge = s_noEdge, rotation = 0;
+        for (uint32_t age = 0; age < s_noEdge && edgeAge == s_noEdge; ++age)
+            for (uint32_t r = 0; r < 3; ++r)
+                if (fifos.edge(age)[0] == tri[r] && fifos.edge(age)[1] == tri[(r + 1) % 3]) {
+                    edgeAge = age;
+                    rotation = r;
+                    break;
+                }
+
+        deltas.clear();
+        const uint32_t a = tri[rotation], b = tri[(rotation + 1) % 3], c = tri[(rotation + 2) % 3];
+        if (edgeAge != s_noEdge) {
+            out.push_back(uint8_t(edgeAge << 4 | encodeVertex(fifos, c, deltas)));
+        } else {
+            const uint32_t modeA = encodeVertex(fifos, a, deltas);
+            const uint32_t modeB = encodeVertex(fifos, b, deltas);
+            const uint32_t modeC = encodeVertex(fifos, c, deltas);
+            out.push_back(uint8_t(s_noEdge << 4 | modeA));
+            out.push_back(uint8_t(modeB << 4 | modeC));
+        }
+        out.insert(out.end(), deltas.begin(), deltas.end());
+        fifos.pushTriangle(a, b, c);
+    }
+}
+
+template <typename Index>
+static bool decodeIndexChunk(ByteReader& reader, Index* dst, uint32_t numTriangles)
+{
+    IndexFifos fifos(reader.varint());
+    for (uint32_t t = 0; t < numTriangles && !reader.failed; ++t) {
+        const uint8_t code = reader.byte();
+        const uint32_t edgeAge = code >> 4;
+        uint32_t a, b, c;
+        if (edgeAge != s_noEdge) {
+            a = fifos.edge(edgeAge)[0];
+            b = fifos.edge(edgeAge)[1];
+            c = decodeVertex(fifos, code & 15, reader);
+        } else {
+            const uint8_t modes = reader.byte();
+            a = decodeVertex(fifos, code & 15, reader);
+            b = decodeVertex(fifos, modes >> 4, reader);
+            c = decodeVertex(fifos, modes & 15, reader);
+        }
+        if (sizeof(Index) < 4 && (a | b | c) > 0xFFFF)
+            return false;
+        fifos.pushTriangle(a, b, c);
+        dst[t * 3] = Index(a);
+        dst[t * 3 + 1] = Index(b);
+        dst[t * 3 + 2] = Index(c);
+    }
+    return !reader.failed;
+}
+
+std::vector<uint8_t> encodeIndices(const VertIndex* indices, uint32_t numIndices)
+{
+    assert(numIndices % 3 == 0);
+    const uint32_t numTriangles = numIndices / 3;
+    const uint32_t numChunks = (numTriangles + s_indexChunkSize - 1) / s_indexChunkSize;
+    std::vector<uint8_t> out;
+    putU32(out, numIndices);
+    putU32(out, numChunks);
+    out.resize(out.size() + numChunks * 4);
+
+    for (uint32_t c = 0; c < numChunks; ++c) {
+        setU32(out.data() + (2 + c) * 4, out.size());
+        const uint32_t first = c * s_indexChunkSize;
+        encodeIndexChunk(indices + first * 3, std::min(numTriangles - first, s_indexChunkSize), out);
+    }
+    return out;
+}
+
+bool decodeIndices(const uint8_t* data, size_t size, void* dst, uint32_t numIndices, uint32_t indexSize)
+{
+    assert(indexSize == 2 || indexSize == 4);
+    if (size < 8 || getU32(data) != numIndices || numIndices % 3)
+        return false;
+    const uint32_t numTriangles = numIndices / 3;
+    const uint32_t numChunks = getU32(data + 4);
+    if (numChunks != (numTriangles + s_indexChunkSize - 1) / s_indexChunkSize || !readBlockTable(data, size, 2, numChunks))
+        return false;
+
+    std::atomic<bool> failed { false };
+    getJobSystem().parallelFor(numChunks, 1, [&](uint32_t firstChunk, uint32_t endChunk) {
+        for (uint32_t c = firstChunk; c < endChunk; ++c) {
+            const uint32_t begin = getU32(data + (2 + c) * 4);
+            const uint32_t end = c + 1 < numChunks ? getU32(data + (3 + c) * 4) : size;
+            ByteReader reader { data + begin, data + end };
+            const uint32_t first = c * s_indexChunkSize;
+            const uint32_t count = std::min(numTriangles - first, s_indexChunkSize);
+            const bool decoded = indexSize == 2
+                ? decodeIndexChunk(reader, (uint16_t*)dst + first * 3, count)
+                : decodeIndexChunk(reader, (uint32_t*)dst + first * 3, count);
+            if (!decoded)
+                failed = true;
+        }
+    });
+    return !failed;
+}
+}
@@ -0,0 +1,36 @@
+#ifndef MESH_CODEC_H
+#define MESH_CODEC_H
+
+#include "meshdata.h"
+
+#include <cstddef>
+#include <cstdint> // uintXX_t
+#include <vector>
+
+// Lossless compression of vertex and index buffers for storage and streaming.
+// Streams are split into independent blocks behind an offset table, decoding
+// runs them in parallel on the job system straight into the destination, e.g.
+// a mapped upload buffer.
+//
+// Vertices: any interleaved layout, MeshData streams or buffers packed by a
+// VertexLayout. Per block of s_vertexBlockSize vertices every byte of the
+// stride is a plane of byte deltas between consecutive vertices, zigzag coded
+// and bit-packed in groups of 16 at 0, 2, 4 or 8 bits.
+//
+// Indices: triangles are coded against FIFOs of recent edges and vertices, one
+// sharing an edge with a recent triangle whose third vertex is new or recent
+// takes a single byte. Triangles may come back rotated, with the same winding.
+namespace MeshCodec {
+static constexpr uint32_t s_vertexBlockSize = 256;
+static constexpr uint32_t s_indexChunkSize = 8192; // triangles
+
+std::vector<uint8_t> encodeVertices(const void* vertices, uint32_t numVertices, uint32_t stride);
+// false if data is corrupt or was encoded with other counts
+bool decodeVertices(const uint8_t* data, size_t size, void* dst, uint32_t numVertices, uint32_t stride);
+
+std::vector<uint8_t> encodeIndices(const VertIndex* indices, uint32_t numIndices);
+// indexSize - bytes per index in dst, 2 or 4 as the GL index format
+bool decodeIndices(const uint8_t* data, size_t size, void* dst, uint32_t numIndices, uint32_t indexSize = 4);
+}
+
+#endif // MESH_CODEC_H
@@ -0,0 +1,148 @@
+#include "mesh_pool.h"
+#include "allocators.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <cassert>
+#include <cstring>
+
+// bindings must match getVertexPullingDeclarations() in shader.cpp
+static constexpr uint32_t s_verticesBinding = 14;
+static constexpr uint32_t s_indicesBinding = 15;
+static constexpr uint32_t s_meshesBinding = 16;
+static constexpr uint32_t s_transformsBinding = 17;
+static constexpr uint32_t s_materialsBinding = 18;
+// past the last vertex, misaligned and half attributes read up to two words further
+static constexpr uint32_t s_vertexPadding = 8;
+
+struct DrawArraysIndirectCommand {
+    uint32_t count, instanceCount, first, baseInstance;
+};
+
+// offset and format of the first attribute of type, 0 if there is none
+static uint32_t getPulledAttribute(const VertexAttribData& attribData, VertexAttribute::Type type)
+{
+    uint32_t offset = 0;
+    for (const auto& attrib : attribData.attributes) {
+        const MeshAttribFormat format = attrib.parameters.format;
+        if (attrib.type == type) {
+            assert((format >= MeshAttribFormat::Float1 && format <= MeshAttribFormat::Half4)
+                || format == MeshAttribFormat::Unorm8x4); // decoded by pullAttribute()
+            assert(offset <= 0xFFFF);
+            return offset | uint32_t(format) << 16;
+        }
+        offset += attrib.parameters.sizeInBytes;
+    }
+    return 0;
+}
+
+static void uploadBuffer(uint32_t buffer, const void* data, size_t size)
+{
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_DRAW);
+}
+
+GL_MeshPool::GL_MeshPool()
+    : m_vertexBuffer(GL_Buffer::create())
+    , m_indexBuffer(GL_Buffer::create())
+    , m_meshBuffer(GL_Buffer::create())
+    , m_transformBuffer(GL_Buffer::create())
+    , m_materialBuffer(GL_Buffer::create())
+    , m_commandBuffer(GL_Buffer::create())
+    , m_emptyVAO(GL_VertexArray::create())
+{
+}
+
+uint32_t GL_MeshPool::addMesh(const void* vertices, uint32_t numVertices, const VertexAttribData& vertexAttributes,
+    const VertIndex* indices, uint32_t numIndices)
+{
+    Mesh mesh;
+    mesh.pulled.vertexBase = m_vertices.size();
+    mesh.pulled.stride = vertexAttributes.strideSize;
+    mesh.pulled.position = getPulledAttribute(vertexAttributes, VertexAttribute::Type::Position);
+    mesh.pulled.normal = getPulledAttribute(vertexAttributes, VertexAttribute::Type::Normal);
+    assert(mesh.pulled.position); // nothing to draw
+    mesh.firstIndex = m_indices.size();
+    mesh.numIndices = numIndices;
+
+    const size_t size = size_t(numVertices) * vertexAttributes.strideSize;
+    m_vertices.resize(m_vertices.size() + (size + 3) / 4 * 4); // next mesh starts word aligned
+    memcpy(m_vertices.data() + mesh.pulled.vertexBase, vertices, size);
+    for (uint32_t i = 0; i < numIndices; ++i) {
+        assert(indices[i] < numVertices);
+        m_indices.push_back(indices[i]);
+    }
+
+    m_meshes.push_back(std::move(mesh));
+    m_geometryDirty = m_instancesDirty = true;
+    return m_meshes.size() - 1;
+}
+
+void GL_MeshPool::setInstances(uint32_t mesh, const std::vector<glm::mat4>& transforms, const std::vector<uint32_t>& materials)
+{
+    assert(mesh < m_meshes.size());
+    assert(materials.empty() || materials.size() == transforms.size()); // one per instance
+    m_meshes[mesh].transforms = transforms;
+    m_meshes[mesh].materials = materials;
+    m_instancesDirty = true;
+}
+
+void GL_MeshPool::upload()
+{
+    if (m_geometryDirty) {
+        uploadBuffer(m_vertexBuffer, nullptr, m_vertices.size() + s_vertexPadding);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, m_vertices.size(), m_vertices.data());
+        uploadBuffer(m_indexBuffer, m_indices.data(), m_indices.size() * sizeof(uint32_t));
+
+        ScratchScope scratch;
+        PulledMesh* pulled = scratch.getArena().allocate<PulledMesh>(m_meshes.size());
+        for (size_t i = 0; i < m_meshes.size(); ++i)
+            pulled[i] = m_meshes[i].pulled;
+        uploadBuffer(m_meshBuffer, pulled, m_meshes.size() * sizeof(PulledMesh));
+        m_geometryDirty = false;
+    }
+
+    if (m_instancesDirty) {
+        // indices are fetched by gl_VertexID, so first is the mesh's first index
+        ScratchScope scratch;
+        DrawArraysIndirectCommand* commands = scratch.getArena().allocate<DrawArraysIndirectCommand>(m_meshes.size());
+        m_transforms.clear();
+        m_materials.clear();
+        for (size_t i = 0; i < m_meshes.size(); ++i) {
+            const Mesh& mesh = m_meshes[i];
+            commands[i] = { mesh.numIndices, (uint32_t)mesh.transforms.size(), mesh.firstIndex, (uint32_t)m_transforms.size() };
+            m_transforms.insert(m_transforms.end(), mesh.transforms.begin(), mesh.transforms.end());
+            if (mesh.materials.empty())
+                m_materials.resize(m_transforms.size(), 0);
+            else
+                m_materials.insert(m_materials.end(), mesh.materials.begin(), mesh.materials.end());
+        }
+        uploadBuffer(m_transformBuffer, m_transforms.data(), m_transforms.size() * sizeof(glm::mat4));
+        uploadBuffer(m_materialBuffer, m_materials.data(), m_materials.size() * sizeof(uint32_t));
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, m_meshes.size() * sizeof(DrawArraysIndirectCommand), commands, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        m_instancesDirty = false;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GL_MeshPool::draw()
+{
+    upload();
+    if (m_transforms.empty())
+        return;
+
+    glBindVertexArray(m_emptyVAO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, s_verticesBinding, m_vertexBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, s_indicesBinding, m_indexBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, s_meshesBinding, m_meshBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, s_transformsBinding, m_transformBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, s_materialsBinding, m_materialBuffer);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+    glMultiDrawArraysIndirect(GL_TRIANGLES, nullptr, m_meshes.size(), 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+}
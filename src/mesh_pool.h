@@ -0,0 +1,70 @@
+#ifndef MESH_POOL_H
+#define MESH_POOL_H
+#include "gl_handle.h"
+#include "mesh_attributes.h"
+#include "meshdata.h"
+#include "vertex_layout.h"
+
+#include <cstdint> // uintXX_t
+#include <glm/glm.hpp>
+#include <vector>
+
+// Vertex pulling: vertices, indices and instances of meshes in any VertexAttribData
+// share storage buffers. Programs with ShaderFeature::VertexPulling fetch and decode
+// attributes by gl_DrawID, gl_VertexID and gl_InstanceID, so every mesh is drawn from
+// one empty VAO by a single glMultiDrawArraysIndirect. Position and normal are pulled
+// in Float1-4, Half1-4 or Unorm8x4; skinning and sphere impostors stay on GL_Mesh.
+class GL_MeshPool {
+public:
+    GL_MeshPool();
+    GL_MeshPool(GL_MeshPool&&) = default;
+    GL_MeshPool& operator=(GL_MeshPool&&) = default;
+
+    // vertices interleaved as vertexAttributes describe, indices into them;
+    // returns the mesh index, meshes without instances aren't drawn
+    uint32_t addMesh(const void* vertices, uint32_t numVertices, const VertexAttribData& vertexAttributes,
+        const VertIndex* indices, uint32_t numIndices);
+    template <typename... Attrs>
+    uint32_t addMesh(const MeshData& data, VertexLayout<Attrs...> layout)
+    {
+        std::vector<uint8_t> vertices(size_t(data.getNumVertices()) * layout.s_stride);
+        layout.pack(data, vertices.data());
+        return addMesh(vertices.data(), data.getNumVertices(), layout.getAttribData(), data.getIndicesPtr(), data.getNumIndices());
+    }
+    uint32_t getNumMeshes() const { return m_meshes.size(); }
+
+    // materials - optional MaterialTable index per instance, one per transform
+    void setInstances(uint32_t mesh, const std::vector<glm::mat4>& transforms, const std::vector<uint32_t>& materials = {});
+
+    void draw(); // uploads what changed since the last draw
+
+private:
+    struct PulledMesh { // std430, matches shader.cpp
+        uint32_t vertexBase {}; // bytes
+        uint32_t stride {};
+        uint32_t position {}, normal {}; // byte offset | MeshAttribFormat << 16, 0 - absent
+    };
+    struct Mesh {
+        PulledMesh pulled;
+        uint32_t firstIndex {}, numIndices {};
+        std::vector<glm::mat4> transforms;
+        std::vector<uint32_t> materials;
+    };
+
+    void upload();
+
+    std::vector<Mesh> m_meshes;
+    // CPU copies, buffers are refilled whole when meshes are added
+    std::vector<uint8_t> m_vertices;
+    std::vector<uint32_t> m_indices;
+    // instances of all meshes by mesh, scratch for upload()
+    std::vector<glm::mat4> m_transforms;
+    std::vector<uint32_t> m_materials;
+    bool m_geometryDirty {}, m_instancesDirty {};
+
+    GL_Buffer m_vertexBuffer, m_indexBuffer, m_meshBuffer;
+    GL_Buffer m_transformBuffer, m_materialBuffer, m_commandBuffer;
+    GL_VertexArray m_emptyVAO;
+};
+
+#endif // MESH_POOL_H
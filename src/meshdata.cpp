@@ -1,30 +1,45 @@
 #include "meshdata.h"
+#include "allocators.h"
+#include "job_system.h"
 
 #include <algorithm>
+#include <cassert>
 
 static float boolToSignedF(bool b) { return b ? 1.f : -1.f; };
-static void addQuad(TriArray& triangles, uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3)
+static void addQuad(IndexArray& indices, uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3)
 {
-    triangles.insert(triangles.end(), { { p0, p1, p2 }, { p2, p1, p3 } });
+    indices.insert(indices.end(), { p0, p1, p2, p2, p1, p3 });
 };
 
-static void triArraytoPlainI32Array(const TriArray& from, IndexArray& to)
-{
-    to.resize(from.size() * 3);
-    for (int i = 0; i < from.size(); ++i)
-        ((TriIndex*)to.data())[i] = from[i];
-}
-
 //////////// PRIMITIVES /////////////
 
-static void createPlaneZ(VertArray& a_vertices, VertArray& a_normals, IndexArray& a_indices)
+// [-1, 1] square grid of resolution x resolution quads, rows along x
+static void createPlaneZ(VertArray& a_vertices, VertArray& a_normals, IndexArray& a_indices, std::vector<glm::vec2>& a_texCoords, uint resolution)
 {
-    a_vertices = { { -1, -1, 0 }, { 1, -1, 0 }, { -1, 1, 0 }, { 1, 1, 0 } };
-    a_normals = { { 0, 0, 1 }, { 0, 0, 1 }, { 0, 0, 1 }, { 0, 0, 1 } };
-    a_indices = { 0, 1, 2, 2, 1, 3 };
+    assert(resolution >= 1);
+    const uint numSide = resolution + 1;
+    a_vertices.clear();
+    a_vertices.reserve(numSide * numSide);
+    a_texCoords.clear();
+    a_texCoords.reserve(numSide * numSide);
+    for (uint j = 0; j < numSide; j++)
+        for (uint i = 0; i < numSide; i++) {
+            const glm::vec2 uv(float(i) / resolution, float(j) / resolution);
+            a_vertices.emplace_back(uv * 2.f - 1.f, 0.f);
+            a_texCoords.push_back(uv);
+        }
+    a_normals.assign(a_vertices.size(), glm::vec3(0, 0, 1));
+
+    a_indices.clear();
+    a_indices.reserve(resolution * resolution * 6);
+    for (uint j = 0; j < resolution; j++)
+        for (uint i = 0; i < resolution; i++) {
+            const uint first = j * numSide + i;
+            addQuad(a_indices, first, first + 1, first + numSide, first + numSide + 1);
+        }
 }
 
-static void createSphere(VertArray& a_vertices, VertArray& a_normals, IndexArray& a_indices, uint resolution)
+static void createSphere(VertArray& a_vertices, VertArray& a_normals, IndexArray& a_indices, std::vector<glm::vec2>& a_texCoords, uint resolution)
 {
 #define F(x) static_cast<float>(x)
 
@@ -34,11 +49,14 @@ static void createSphere(VertArray& a_vertices, VertArray& a_normals, IndexArray
     float parralelDivider = 2.0f * F(M_PI) / numMeridian;
     float meridianDivider = F(M_PI) / numParallel * .9999f;
 
-    std::vector<glm::vec2> parallel(numMeridian + 1);
+    // built straight into outputs, only the circle is a temporary
+    ScratchScope scratch;
+    glm::vec2* parallel = scratch.getArena().allocate<glm::vec2>(numMeridian + 1);
     for (uint i = 0; i <= numMeridian; i++)
         parallel[i] = glm::vec2(cos(F(i) * parralelDivider), sin(F(i) * parralelDivider)) * radius; // zero circle
 
-    std::vector<glm::vec3> positions, normals;
+    VertArray& positions = a_vertices;
+    positions.clear();
     positions.reserve((numParallel + 1) * (numMeridian + 1));
     for (uint j = 0; j <= numParallel; j++)
         for (uint i = 0; i <= numMeridian; i++) {
@@ -46,9 +64,11 @@ static void createSphere(VertArray& a_vertices, VertArray& a_normals, IndexArray
             positions.emplace_back(p, radius * cos(F(j) * meridianDivider));
         }
 
-    normals = positions;
+    a_normals = positions;
 
-    std::vector<uint> indices;
+    IndexArray& indices = a_indices;
+    indices.clear();
+    indices.reserve(numParallel * numMeridian * 6);
     for (uint i = 0; i < numParallel; i++)
         for (uint j = 0; j < numMeridian; j++) {
             auto offset__ = (i + 0) * (numMeridian + 1) + j + 0;
@@ -59,39 +79,30 @@ static void createSphere(VertArray& a_vertices, VertArray& a_normals, IndexArray
             indices.insert(indices.end(), { offset_j, offset_i, offsetij });
         }
 
-    // no texcoord supported
-    //    std::vector<glm::vec2> texCoords(positions.size());
-    //    for (uint i = 0; i <= numMeridian; i++)
-    //        for (uint j = 0; j <= numParallel; j++) {
-    //            texCoords[j * (numMeridian + 1) + i] = { F(i) / F(numMeridian), F(j) / F(numParallel) };
-    //        }
-
-    a_vertices = std::move(positions);
-    a_normals = std::move(normals);
-    // data.m_uvs = std::move(texCoords);
-    a_indices = std::move(indices);
+    a_texCoords.resize(positions.size());
+    for (uint i = 0; i <= numMeridian; i++)
+        for (uint j = 0; j <= numParallel; j++) {
+            a_texCoords[j * (numMeridian + 1) + i] = { F(i) / F(numMeridian), F(j) / F(numParallel) };
+        }
 }
 
 static void createCylindricalNormalCube(VertArray& a_vertices, VertArray& a_normals, IndexArray& a_indices)
 {
-    std::vector<glm::vec3> vertices(8);
+    a_vertices.resize(8);
     for (int i = 0; i < 8; ++i)
-        vertices[i] = glm::vec3(boolToSignedF(i & 4), boolToSignedF(i & 2), boolToSignedF(i & 1));
+        a_vertices[i] = glm::vec3(boolToSignedF(i & 4), boolToSignedF(i & 2), boolToSignedF(i & 1));
 
-    std::vector<glm::vec3> normals = vertices;
-    for (int i = 0; i < vertices.size(); ++i) {
-        auto& v = vertices[i];
-        normals[i] = glm::normalize(glm::vec3(v.x, v.y, v.z * 0.01f));
+    a_normals.resize(a_vertices.size());
+    for (int i = 0; i < a_vertices.size(); ++i) {
+        auto& v = a_vertices[i];
+        a_normals[i] = glm::normalize(glm::vec3(v.x, v.y, v.z * 0.01f));
     }
 
-    std::vector<glm::uvec3> triangles;
-    addQuad(triangles, 0, 1, 4, 5), addQuad(triangles, 1, 3, 5, 7);
-    addQuad(triangles, 3, 2, 7, 6), addQuad(triangles, 2, 0, 6, 4);
-    addQuad(triangles, 4, 5, 6, 7), addQuad(triangles, 0, 1, 2, 3); /* top/bottom */
-
-    a_vertices = std::move(vertices);
-    a_normals = std::move(normals);
-    triArraytoPlainI32Array(triangles, a_indices);
+    a_indices.clear();
+    a_indices.reserve(6 * 6);
+    addQuad(a_indices, 0, 1, 4, 5), addQuad(a_indices, 1, 3, 5, 7);
+    addQuad(a_indices, 3, 2, 7, 6), addQuad(a_indices, 2, 0, 6, 4);
+    addQuad(a_indices, 4, 5, 6, 7), addQuad(a_indices, 0, 1, 2, 3); /* top/bottom */
 }
 
 /////////////////////////////////////////////
@@ -100,7 +111,7 @@ MeshData::MeshData(ParametricType type, uint8_t resolution)
 {
     switch (type) {
     case MeshData::ParametricType::PlaneZ: {
-        createPlaneZ(m_positons, m_normals, m_indices);
+        createPlaneZ(m_positons, m_normals, m_indices, m_texCoords, resolution);
     } break;
 
     case MeshData::ParametricType::CylindricalNormalCube: {
@@ -108,7 +119,312 @@ MeshData::MeshData(ParametricType type, uint8_t resolution)
     } break;
 
     case MeshData::ParametricType::Sphere: {
-        createSphere(m_positons, m_normals, m_indices, resolution);
+        createSphere(m_positons, m_normals, m_indices, m_texCoords, resolution);
     } break;
     };
 }
+
+glm::vec4 MeshData::getBoundingSphere() const
+{
+    if (m_positons.empty())
+        return glm::vec4(0);
+
+    glm::vec3 min = m_positons[0], max = m_positons[0];
+    for (const auto& p : m_positons)
+        min = glm::min(min, p), max = glm::max(max, p);
+
+    const glm::vec3 center = (min + max) * 0.5f;
+    float radiusSq = 0.f;
+    for (const auto& p : m_positons) {
+        glm::vec3 d = p - center;
+        radiusSq = std::max(radiusSq, glm::dot(d, d));
+    }
+    return glm::vec4(center, sqrtf(radiusSq));
+}
+
+std::vector<Vec3> MeshData::generateChainSkin(uint32_t numJoints)
+{
+    assert(numJoints >= 1 && numJoints <= 256); // packed as Uint8x4
+
+    float minZ = 0.f, maxZ = 0.f;
+    glm::vec2 center(0);
+    if (!m_positons.empty()) {
+        glm::vec3 min = m_positons[0], max = m_positons[0];
+        for (const auto& p : m_positons)
+            min = glm::min(min, p), max = glm::max(max, p);
+        minZ = min.z, maxZ = max.z;
+        center = (glm::vec2(min) + glm::vec2(max)) * 0.5f;
+    }
+    const float jointLength = std::max(maxZ - minZ, 1e-6f) / numJoints;
+
+    std::vector<Vec3> pivots(numJoints);
+    for (uint32_t j = 0; j < numJoints; ++j)
+        pivots[j] = Vec3(center, minZ + j * jointLength);
+
+    m_joints.resize(m_positons.size());
+    m_weights.resize(m_positons.size());
+    for (size_t i = 0; i < m_positons.size(); ++i) {
+        // blend across the middle of each joint
+        const float t = (m_positons[i].z - minZ) / jointLength - 0.5f;
+        const uint32_t j0 = (uint32_t)std::clamp((int)floorf(t), 0, (int)numJoints - 1);
+        const uint32_t j1 = std::min(j0 + 1, numJoints - 1);
+        const float w = std::clamp(t - j0, 0.f, 1.f);
+        m_joints[i] = glm::uvec4(j0, j1, 0, 0);
+        m_weights[i] = glm::vec4(1.f - w, w, 0.f, 0.f);
+    }
+    return pivots;
+}
+
+void DirtyRanges::add(uint32_t first, uint32_t count)
+{
+    if (!count)
+        return;
+    uint32_t end = first + count;
+
+    // ranges before the new one, not even touching it
+    uint32_t i = 0;
+    while (i < m_numRanges && m_ranges[i].end < first)
+        ++i;
+    // ranges absorbed by the new one
+    uint32_t j = i;
+    while (j < m_numRanges && m_ranges[j].first <= end) {
+        first = std::min(first, m_ranges[j].first);
+        end = std::max(end, m_ranges[j].end);
+        ++j;
+    }
+
+    if (j > i) { // [i, j) collapse into i
+        m_ranges[i] = { first, end };
+        std::copy(m_ranges + j, m_ranges + m_numRanges, m_ranges + i + 1);
+        m_numRanges -= j - i - 1;
+        return;
+    }
+
+    std::copy_backward(m_ranges + i, m_ranges + m_numRanges, m_ranges + m_numRanges + 1);
+    m_ranges[i] = { first, end };
+    if (++m_numRanges <= s_maxRanges)
+        return;
+
+    // over budget: join the two ranges with the smallest gap
+    uint32_t closest = 0;
+    for (uint32_t k = 1; k + 1 < m_numRanges; ++k)
+        if (m_ranges[k + 1].first - m_ranges[k].end < m_ranges[closest + 1].first - m_ranges[closest].end)
+            closest = k;
+    m_ranges[closest].end = m_ranges[closest + 1].end;
+    std::copy(m_ranges + closest + 2, m_ranges + m_numRanges, m_ranges + closest + 1);
+    m_numRanges--;
+}
+
+Vec3* MeshData::editPositions(uint32_t first, uint32_t count)
+{
+    assert(first + count <= m_positons.size());
+    m_dirtyVertices.add(first, count);
+    return m_positons.data() + first;
+}
+
+Vec3* MeshData::editNormals(uint32_t first, uint32_t count)
+{
+    assert(first + count <= m_normals.size());
+    m_dirtyVertices.add(first, count);
+    return m_normals.data() + first;
+}
+
+VertIndex* MeshData::editIndices(uint32_t first, uint32_t count)
+{
+    assert(first + count <= m_indices.size());
+    m_dirtyIndices.add(first, count);
+    return m_indices.data() + first;
+}
+
+uint32_t MeshData::appendVertices(const Vec3* positions, const Vec3* normals, uint32_t count)
+{
+    const uint32_t first = m_positons.size();
+    m_positons.insert(m_positons.end(), positions, positions + count);
+    m_normals.insert(m_normals.end(), normals, normals + count);
+    if (hasSkin()) {
+        m_joints.resize(m_positons.size(), glm::uvec4(0));
+        m_weights.resize(m_positons.size(), glm::vec4(1, 0, 0, 0));
+    }
+    if (hasTexCoords())
+        m_texCoords.resize(m_positons.size(), glm::vec2(0));
+    if (hasTangents())
+        m_tangents.resize(m_positons.size(), glm::vec4(1, 0, 0, 1));
+    if (hasColors())
+        m_colors.resize(m_positons.size(), glm::vec4(1));
+    m_dirtyVertices.add(first, count);
+    return first;
+}
+
+void MeshData::appendIndices(const VertIndex* indices, uint32_t count)
+{
+    const uint32_t first = m_indices.size();
+    m_indices.insert(m_indices.end(), indices, indices + count);
+    m_dirtyIndices.add(first, count);
+}
+
+void MeshData::setTexCoords(const std::vector<glm::vec2>& texCoords)
+{
+    assert(texCoords.empty() || texCoords.size() == m_positons.size()); // one per vertex
+    m_texCoords = texCoords;
+}
+
+void MeshData::setColors(const std::vector<glm::vec4>& colors)
+{
+    assert(colors.empty() || colors.size() == m_positons.size()); // one per vertex
+    m_colors = colors;
+    m_dirtyVertices.add(0, m_colors.size());
+}
+
+///////////// NORMALS & TANGENTS //////////////
+
+// calls func(first, end) on chunks of [0, count) on the job system;
+// small inputs run inline, splitting isn't worth it for them
+template <typename Func>
+static void parallelFor(uint32_t count, const Func& func)
+{
+    getJobSystem().parallelFor(count, 8 * 1024, func);
+}
+
+// triangle corners around each vertex, CSR: corners of vertex v are
+// corners[offsets[v]..offsets[v + 1]), a corner is a position in the index array
+struct VertexCorners {
+    uint32_t* offsets;
+    uint32_t* corners;
+};
+
+static VertexCorners buildVertexCorners(const IndexArray& indices, uint32_t numVertices, LinearArena& arena)
+{
+    VertexCorners result { arena.allocate<uint32_t>(numVertices + 1), arena.allocate<uint32_t>(indices.size()) };
+    std::fill(result.offsets, result.offsets + numVertices + 1, 0);
+    for (VertIndex index : indices)
+        result.offsets[index + 1]++;
+    for (uint32_t v = 0; v < numVertices; ++v)
+        result.offsets[v + 1] += result.offsets[v];
+
+    uint32_t* cursors = arena.allocate<uint32_t>(numVertices);
+    std::copy(result.offsets, result.offsets + numVertices, cursors);
+    for (uint32_t c = 0; c < indices.size(); ++c)
+        result.corners[cursors[indices[c]]++] = c;
+    return result;
+}
+
+// interior angles of triangle (a, b, c) at its corners
+static glm::vec3 cornerAngles(const Vec3& a, const Vec3& b, const Vec3& c)
+{
+    auto angle = [](const Vec3& u, const Vec3& v) {
+        const float lengths = sqrtf(glm::dot(u, u) * glm::dot(v, v));
+        return lengths > 0.f ? acosf(std::clamp(glm::dot(u, v) / lengths, -1.f, 1.f)) : 0.f;
+    };
+    return { angle(b - a, c - a), angle(a - b, c - b), angle(a - c, b - c) };
+}
+
+static Vec3 anyOrthogonal(const Vec3& n)
+{
+    return glm::normalize(glm::cross(fabsf(n.x) < 0.9f ? Vec3(1, 0, 0) : Vec3(0, 1, 0), n));
+}
+
+// Both passes are scatter-free: per-triangle work writes weighted vectors into
+// its own corners, then every vertex sums its corners through the adjacency, so
+// threads never write to shared memory and results don't depend on thread count.
+void MeshData::generateNormals(NormalWeighting weighting)
+{
+    assert(m_indices.size() % 3 == 0);
+    const uint32_t numVertices = m_positons.size(), numTriangles = m_indices.size() / 3;
+
+    ScratchScope scratch;
+    const VertexCorners adjacency = buildVertexCorners(m_indices, numVertices, scratch.getArena());
+    Vec3* cornerNormals = scratch.getArena().allocate<Vec3>(m_indices.size());
+
+    parallelFor(numTriangles, [&](uint32_t first, uint32_t end) {
+        for (uint32_t t = first; t < end; ++t) {
+            const VertIndex* tri = &m_indices[t * 3];
+            const Vec3 &a = m_positons[tri[0]], &b = m_positons[tri[1]], &c = m_positons[tri[2]];
+            const Vec3 cross = glm::cross(b - a, c - a); // length is twice the area
+            if (weighting == NormalWeighting::Area) {
+                cornerNormals[t * 3 + 0] = cornerNormals[t * 3 + 1] = cornerNormals[t * 3 + 2] = cross;
+                continue;
+            }
+            const float length = glm::length(cross);
+            const Vec3 normal = length > 0.f ? cross / length : Vec3(0);
+            const glm::vec3 angles = cornerAngles(a, b, c);
+            for (int i = 0; i < 3; ++i)
+                cornerNormals[t * 3 + i] = normal * angles[i];
+        }
+    });
+
+    m_normals.resize(numVertices);
+    parallelFor(numVertices, [&](uint32_t first, uint32_t end) {
+        for (uint32_t v = first; v < end; ++v) {
+            Vec3 sum(0);
+            for (uint32_t k = adjacency.offsets[v]; k < adjacency.offsets[v + 1]; ++k)
+                sum += cornerNormals[adjacency.corners[k]];
+            const float length = glm::length(sum);
+            m_normals[v] = length > 0.f ? sum / length : Vec3(0, 0, 1); // unreferenced or degenerate
+        }
+    });
+    m_dirtyVertices.add(0, numVertices);
+}
+
+void MeshData::generateTangents()
+{
+    assert(m_indices.size() % 3 == 0);
+    const uint32_t numVertices = m_positons.size(), numTriangles = m_indices.size() / 3;
+    m_tangents.resize(numVertices);
+
+    if (!hasTexCoords()) {
+        parallelFor(numVertices, [&](uint32_t first, uint32_t end) {
+            for (uint32_t v = first; v < end; ++v)
+                m_tangents[v] = glm::vec4(anyOrthogonal(m_normals[v]), 1.f);
+        });
+        m_dirtyVertices.add(0, numVertices);
+        return;
+    }
+
+    ScratchScope scratch;
+    const VertexCorners adjacency = buildVertexCorners(m_indices, numVertices, scratch.getArena());
+    Vec3* cornerTangents = scratch.getArena().allocate<Vec3>(m_indices.size());
+    Vec3* cornerBitangents = scratch.getArena().allocate<Vec3>(m_indices.size());
+
+    // per face tangent and bitangent are normalized before weighting, as in MikkTSpace
+    parallelFor(numTriangles, [&](uint32_t first, uint32_t end) {
+        for (uint32_t t = first; t < end; ++t) {
+            const VertIndex* tri = &m_indices[t * 3];
+            const Vec3 &a = m_positons[tri[0]], &b = m_positons[tri[1]], &c = m_positons[tri[2]];
+            const glm::vec2 uv1 = m_texCoords[tri[1]] - m_texCoords[tri[0]], uv2 = m_texCoords[tri[2]] - m_texCoords[tri[0]];
+            const Vec3 e1 = b - a, e2 = c - a;
+
+            Vec3 tangent(0), bitangent(0);
+            const float det = uv1.x * uv2.y - uv2.x * uv1.y;
+            if (fabsf(det) > 1e-12f) { // degenerate mapping contributes nothing
+                tangent = (e1 * uv2.y - e2 * uv1.y) / det;
+                bitangent = (e2 * uv1.x - e1 * uv2.x) / det;
+                const float tLength = glm::length(tangent), bLength = glm::length(bitangent);
+                tangent = tLength > 0.f ? tangent / tLength : Vec3(0);
+                bitangent = bLength > 0.f ? bitangent / bLength : Vec3(0);
+            }
+            const glm::vec3 angles = cornerAngles(a, b, c);
+            for (int i = 0; i < 3; ++i) {
+                cornerTangents[t * 3 + i] = tangent * angles[i];
+                cornerBitangents[t * 3 + i] = bitangent * angles[i];
+            }
+        }
+    });
+
+    parallelFor(numVertices, [&](uint32_t first, uint32_t end) {
+        for (uint32_t v = first; v < end; ++v) {
+            Vec3 tangent(0), bitangent(0);
+            for (uint32_t k = adjacency.offsets[v]; k < adjacency.offsets[v + 1]; ++k) {
+                tangent += cornerTangents[adjacency.corners[k]];
+                bitangent += cornerBitangents[adjacency.corners[k]];
+            }
+            // Gram-Schmidt against the normal, handedness from the accumulated bitangent
+            const Vec3& n = m_normals[v];
+            tangent -= n * glm::dot(n, tangent);
+            const float length = glm::length(tangent);
+            tangent = length > 1e-6f ? tangent / length : anyOrthogonal(n);
+            const float sign = glm::dot(glm::cross(n, tangent), bitangent) < 0.f ? -1.f : 1.f;
+            m_tangents[v] = glm::vec4(tangent, sign);
+        }
+    });
+    m_dirtyVertices.add(0, numVertices);
+}
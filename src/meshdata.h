@@ -12,6 +12,28 @@ typedef std::vector<Vec3> VertArray;
 typedef std::vector<TriIndex> TriArray;
 typedef std::vector<VertIndex> IndexArray;
 
+// sorted, disjoint [first, end) element ranges touched by edits; overlapping
+// and adjacent ranges are merged, over s_maxRanges the closest two are joined,
+// so tracking never allocates and uploads stay few
+class DirtyRanges {
+public:
+    static constexpr uint32_t s_maxRanges = 16;
+    struct Range {
+        uint32_t first, end;
+    };
+
+    void add(uint32_t first, uint32_t count);
+    void clear() { m_numRanges = 0; }
+    bool empty() const { return !m_numRanges; }
+    uint32_t size() const { return m_numRanges; }
+    const Range* begin() const { return m_ranges; }
+    const Range* end() const { return m_ranges + m_numRanges; }
+
+private:
+    Range m_ranges[s_maxRanges + 1] {}; // one spare for insertion before merging
+    uint32_t m_numRanges {};
+};
+
 struct MeshData {
     enum class ParametricType {
         PlaneZ,
@@ -29,13 +51,67 @@ struct MeshData {
     const Vec3* getPositionsPtr() const { return m_positons.data(); }
     const Vec3* getNormalsPtr() const { return m_normals.data(); }
 
+    // optional streams, empty or one per vertex
+    bool hasTexCoords() const { return !m_texCoords.empty(); }
+    const glm::vec2* getTexCoordsPtr() const { return m_texCoords.data(); }
+    void setTexCoords(const std::vector<glm::vec2>& texCoords);
+    bool hasTangents() const { return !m_tangents.empty(); }
+    const glm::vec4* getTangentsPtr() const { return m_tangents.data(); } // w - bitangent sign
+    bool hasColors() const { return !m_colors.empty(); }
+    const glm::vec4* getColorsPtr() const { return m_colors.data(); }
+    void setColors(const std::vector<glm::vec4>& colors);
+
+    enum class NormalWeighting {
+        Area, // face normals weighted by triangle area
+        Angle // by corner angle, independent of tessellation
+    };
+    // smooth normals of indexed triangles, vertices are gathered in parallel
+    void generateNormals(NormalWeighting weighting = NormalWeighting::Angle);
+    // tangent frames in MikkTSpace convention (bitangent = sign * cross(normal, tangent)),
+    // angle weighted; vertices without texture coordinates get any frame around the normal
+    void generateTangents();
+
     VertIndex getNumIndices() const { return m_indices.size(); }
     const VertIndex* getIndicesPtr() const { return m_indices.data(); }
 
+    glm::vec4 getBoundingSphere() const; // xyz - center, w - radius
+
+    // skinning, up to 4 joints per vertex
+    bool hasSkin() const { return !m_joints.empty(); }
+    const glm::uvec4* getJointsPtr() const { return m_joints.data(); }
+    const glm::vec4* getWeightsPtr() const { return m_weights.data(); }
+    // splits mesh along Z into a chain of joints, vertices are blended between two
+    // neighbours; returns joint pivots (bind pose), joint 0 at the bottom
+    std::vector<Vec3> generateChainSkin(uint32_t numJoints);
+
+    // editing, touched ranges are recorded for GL_Mesh::update(); returned
+    // pointers are valid until the next append
+    Vec3* editPositions(uint32_t first, uint32_t count);
+    Vec3* editNormals(uint32_t first, uint32_t count);
+    VertIndex* editIndices(uint32_t first, uint32_t count);
+    // returns index of the first new vertex; skinned meshes bind new vertices to joint 0,
+    // optional streams are padded with defaults
+    uint32_t appendVertices(const Vec3* positions, const Vec3* normals, uint32_t count);
+    void appendIndices(const VertIndex* indices, uint32_t count);
+
+    const DirtyRanges& getDirtyVertices() const { return m_dirtyVertices; }
+    const DirtyRanges& getDirtyIndices() const { return m_dirtyIndices; }
+    void clearDirty() { m_dirtyVertices.clear(), m_dirtyIndices.clear(); }
+
 private:
     VertArray m_positons;
     VertArray m_normals;
     IndexArray m_indices;
+    std::vector<glm::uvec4> m_joints;
+    std::vector<glm::vec4> m_weights;
+    std::vector<glm::vec2> m_texCoords;
+    std::vector<glm::vec4> m_tangents;
+    std::vector<glm::vec4> m_colors;
+    DirtyRanges m_dirtyVertices; // all vertex streams share interleaved vertices
+    DirtyRanges m_dirtyIndices;
 };
 
+// bitangent of a MeshData tangent frame
+inline Vec3 getBitangent(const Vec3& normal, const glm::vec4& tangent) { return glm::cross(normal, Vec3(tangent)) * tangent.w; }
+
 #endif // MESHDATA_H
@@ -0,0 +1,73 @@
+#include "multi_view.h"
+#include "camera.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <cassert>
+#include <glm/gtc/matrix_transform.hpp>
+
+// binding point, must match getMultiViewDeclarations() in shader.cpp
+static constexpr uint32_t s_viewsBinding = 2; // uniform block
+
+MultiView::MultiView()
+    : m_viewsUBO(GL_Buffer::create())
+{
+    static_assert(sizeof(View) == 2 * sizeof(glm::mat4) + sizeof(glm::vec4), "View must match std140 layout");
+    glBindBuffer(GL_UNIFORM_BUFFER, m_viewsUBO);
+    // std140: View views[s_maxViews], uvec4 params (num views, layered)
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(m_views) + sizeof(glm::uvec4), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void MultiView::setView(uint32_t index, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& position,
+    const glm::vec4& viewport)
+{
+    assert(index < s_maxViews);
+    m_views[index] = { view, projection, glm::vec4(position, 1.f) };
+    m_viewports[index] = viewport;
+    m_dirty = true;
+}
+
+void MultiView::setStereo(const Camera& camera, float separation, const glm::ivec2& size)
+{
+    // parallel eyes, each with the camera's field of view over half the width
+    const glm::mat4 projection = glm::perspective(camera.getFOV(), 0.5f * size.x / size.y, camera.getNear(), camera.getFar());
+    const glm::vec3 right = glm::vec3(glm::inverse(camera.getView())[0]);
+    const float halfWidth = 0.5f * size.x;
+    for (uint32_t eye = 0; eye < 2; ++eye) {
+        const float offset = (eye ? 0.5f : -0.5f) * separation;
+        const glm::mat4 view = glm::translate(glm::mat4(1), glm::vec3(-offset, 0, 0)) * camera.getView();
+        setView(eye, view, projection, camera.getPos() + right * offset, glm::vec4(eye * halfWidth, 0, halfWidth, size.y));
+    }
+    setNumViews(2);
+}
+
+void MultiView::setNumViews(uint32_t numViews)
+{
+    assert(numViews >= 1 && numViews <= s_maxViews);
+    m_dirty |= numViews != m_numViews;
+    m_numViews = numViews;
+}
+
+void MultiView::setLayered(bool layered)
+{
+    m_dirty |= layered != m_layered;
+    m_layered = layered;
+}
+
+void MultiView::bind()
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, s_viewsBinding, m_viewsUBO);
+    if (m_dirty) {
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(m_views), m_views);
+        const glm::uvec4 params(m_numViews, m_layered ? 1 : 0, 0, 0);
+        glBufferSubData(GL_UNIFORM_BUFFER, sizeof(m_views), sizeof(params), &params);
+        m_dirty = false;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    if (!m_layered)
+        for (uint32_t i = 0; i < m_numViews; ++i)
+            glViewportIndexedfv(i, &m_viewports[i][0]);
+}
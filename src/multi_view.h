@@ -0,0 +1,56 @@
+#ifndef MULTI_VIEW_H
+#define MULTI_VIEW_H
+
+#include "gl_handle.h"
+
+#include <cstdint> // uintXX_t
+#include <glm/glm.hpp>
+
+class Camera;
+
+// Single-pass multi-view rendering (stereo, split screen): one submission draws
+// every view. GL_InstancedMesh::drawMultiView() repeats each instance numViews
+// times in a row, programs with ShaderFeature::MultiView take view and projection
+// of view gl_InstanceID % numViews from this uniform block and route the triangle
+// to viewport gl_ViewportIndex of the viewport array, or to layer gl_Layer of a
+// layered framebuffer (GL_ARB_shader_viewport_layer_array).
+class MultiView {
+public:
+    static constexpr uint32_t s_maxViews = 4; // matches shader.cpp
+
+    MultiView();
+    MultiView(const MultiView&) = delete;
+    MultiView& operator=(const MultiView&) = delete;
+
+    // viewport: x, y, width, height in pixels, unused when layered
+    void setView(uint32_t index, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& position,
+        const glm::vec4& viewport = glm::vec4(0));
+    // side-by-side pair of camera eyes, separation apart, in left and right halves of size
+    void setStereo(const Camera& camera, float separation, const glm::ivec2& size);
+    void setNumViews(uint32_t numViews);
+    uint32_t getNumViews() const { return m_numViews; }
+    // view i goes to layer i of the bound framebuffer instead of viewport i
+    void setLayered(bool layered);
+    bool isLayered() const { return m_layered; }
+
+    // uploads changed views and sets the viewport array, before drawing with
+    // ShaderFeature::MultiView; glViewport() resets all viewports afterwards
+    void bind();
+
+private:
+    struct View { // std140, mirrored in shader.cpp
+        glm::mat4 view { 1 };
+        glm::mat4 projection { 1 };
+        glm::vec4 position {};
+    };
+
+    View m_views[s_maxViews];
+    glm::vec4 m_viewports[s_maxViews] {};
+    uint32_t m_numViews { 1 };
+    bool m_layered {};
+    bool m_dirty { true };
+
+    GL_Buffer m_viewsUBO;
+};
+
+#endif // MULTI_VIEW_H
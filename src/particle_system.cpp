@@ -0,0 +1,358 @@
+#include "particle_system.h"
+#include "mesh.h"
+#include "profiler.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <vector>
+
+static constexpr uint32_t s_groupSize = 64;
+static constexpr uint32_t s_particleSize = 2 * sizeof(glm::vec4);
+
+// uint words of the counters buffer, mirrored in s_commonSource
+static constexpr uint32_t s_commandOffset = 0; // DrawElementsIndirectCommand
+static constexpr uint32_t s_dispatchOffset = 5 * sizeof(uint32_t); // simulation pass
+static constexpr uint32_t s_countersSize = 12 * sizeof(uint32_t);
+struct ParticleCounters {
+    uint32_t command[5];
+    uint32_t dispatch[3];
+    int32_t numDead;
+    uint32_t numAlive; // simulated this frame
+    uint32_t emitted, died;
+};
+static_assert(sizeof(ParticleCounters) == s_countersSize, "ParticleCounters must match std430 layout");
+
+static const std::string s_commonSource = R"(
+#version 460 core
+layout(local_size_x = 64) in;
+
+struct Particle {
+    vec4 positionAge;
+    vec4 velocityLifetime;
+};
+
+layout(std430, binding = 0) buffer Particles { Particle particles[]; };
+layout(std430, binding = 1) buffer DeadList { uint deadList[]; };
+layout(std430, binding = 2) readonly buffer AliveIn { uint aliveIn[]; };
+layout(std430, binding = 3) writeonly buffer AliveOut { uint aliveOut[]; };
+layout(std430, binding = 4) writeonly buffer Transforms { mat4 transforms[]; };
+layout(std430, binding = 9) buffer Counters {
+    uint command[5]; // count, instanceCount - alive particles appended this frame, firstIndex, baseVertex, baseInstance
+    uint dispatchSize[3];
+    int numDead;
+    uint numAlive;
+    uint emitted, died;
+};
+
+uniform float size;
+
+void append(uint index, Particle p)
+{
+    uint slot = atomicAdd(command[1], 1u);
+    aliveOut[slot] = index;
+    float s = size * max(1.0 - p.positionAge.w / p.velocityLifetime.w, 0.0);
+    transforms[slot] = mat4(vec4(s, 0.0, 0.0, 0.0), vec4(0.0, s, 0.0, 0.0), vec4(0.0, 0.0, s, 0.0), vec4(p.positionAge.xyz, 1.0));
+}
+)";
+
+// single invocation, last frame's appended particles become this frame's input
+static const std::string s_prepareSource = R"(
+#version 460 core
+layout(local_size_x = 1) in;
+
+layout(std430, binding = 9) buffer Counters {
+    uint command[5];
+    uint dispatchSize[3];
+    int numDead;
+    uint numAlive;
+    uint emitted, died;
+};
+
+void main()
+{
+    numAlive = command[1];
+    dispatchSize[0] = (numAlive + 63u) / 64u;
+    dispatchSize[1] = 1u;
+    dispatchSize[2] = 1u;
+    command[1] = 0u;
+    emitted = 0u;
+    died = 0u;
+}
+)";
+
+static const std::string s_simulateSource = s_commonSource + R"(
+uniform float deltaTime;
+uniform vec3 gravity;
+uniform float drag;
+uniform vec2 ground; // height, restitution
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= numAlive)
+        return;
+
+    uint index = aliveIn[i];
+    Particle p = particles[index];
+    p.positionAge.w += deltaTime;
+    if (p.positionAge.w >= p.velocityLifetime.w) {
+        deadList[atomicAdd(numDead, 1)] = index;
+        atomicAdd(died, 1u);
+        return;
+    }
+
+    vec3 velocity = (p.velocityLifetime.xyz + gravity * deltaTime) * exp(-drag * deltaTime);
+    vec3 position = p.positionAge.xyz + velocity * deltaTime;
+    if (position.z < ground.x && velocity.z < 0.0) {
+        position.z = ground.x;
+        velocity.z *= -ground.y;
+    }
+    p.positionAge.xyz = position;
+    p.velocityLifetime.xyz = velocity;
+    particles[index] = p;
+    append(index, p);
+}
+)";
+
+static const std::string s_emitSource = s_commonSource + R"(
+uniform uint emitCount;
+uniform uint seed;
+uniform vec4 emitter; // position, radius
+uniform vec4 velocity; // base, spread
+uniform vec2 lifetime; // min, max
+
+uint hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float random(inout uint state)
+{
+    state = hash(state);
+    return float(state >> 8) * (1.0 / 16777216.0);
+}
+
+vec3 randomInBall(inout uint state)
+{
+    float z = random(state) * 2.0 - 1.0;
+    float phi = random(state) * 6.28318531;
+    float r = pow(random(state), 1.0 / 3.0);
+    return r * vec3(sqrt(1.0 - z * z) * vec2(cos(phi), sin(phi)), z);
+}
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= emitCount)
+        return;
+
+    // pop a free index; the ones finding the list empty put their decrement back
+    int top = atomicAdd(numDead, -1);
+    if (top <= 0) {
+        atomicAdd(numDead, 1);
+        return;
+    }
+    uint index = deadList[top - 1];
+
+    uint state = hash(i ^ hash(seed));
+    Particle p;
+    p.positionAge = vec4(emitter.xyz + randomInBall(state) * emitter.w, 0.0);
+    p.velocityLifetime = vec4(velocity.xyz + randomInBall(state) * velocity.w, mix(lifetime.x, lifetime.y, random(state)));
+    particles[index] = p;
+    atomicAdd(emitted, 1u);
+    append(index, p);
+}
+)";
+
+ParticleSystem::ParticleSystem(const ParticleConfig& config)
+    : m_config(config)
+    , m_prepareShader(s_prepareSource)
+    , m_simulateShader(s_simulateSource)
+    , m_emitShader(s_emitSource)
+    , m_simulateDeltaTime(m_simulateShader.getVariable("deltaTime"))
+    , m_simulateGravity(m_simulateShader.getVariable("gravity"))
+    , m_simulateDrag(m_simulateShader.getVariable("drag"))
+    , m_simulateGround(m_simulateShader.getVariable("ground"))
+    , m_simulateSize(m_simulateShader.getVariable("size"))
+    , m_emitCount(m_emitShader.getVariable("emitCount"))
+    , m_emitSeed(m_emitShader.getVariable("seed"))
+    , m_emitPosition(m_emitShader.getVariable("emitter"))
+    , m_emitVelocity(m_emitShader.getVariable("velocity"))
+    , m_emitLifetime(m_emitShader.getVariable("lifetime"))
+    , m_emitSize(m_emitShader.getVariable("size"))
+{
+    for (uint32_t i = 0; i < s_statsLatency; ++i) {
+        m_statsBuffers[i] = GL_Buffer::create();
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_statsBuffers[i]);
+        glBufferData(GL_COPY_WRITE_BUFFER, s_countersSize, nullptr, GL_DYNAMIC_READ);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    allocate();
+}
+
+ParticleSystem::~ParticleSystem()
+{
+    for (uint32_t i = 0; i < s_statsLatency; ++i)
+        if (m_statsFences[i])
+            glDeleteSync((GLsync)m_statsFences[i]);
+}
+
+void ParticleSystem::setConfig(const ParticleConfig& config)
+{
+    m_config = config;
+    if (config.capacity != m_capacity)
+        allocate();
+}
+
+void ParticleSystem::allocate()
+{
+    assert(m_config.capacity > 0 && m_config.capacity < (1u << 31));
+    m_capacity = m_config.capacity;
+    auto createBuffer = [](GL_Buffer& buffer, size_t size) {
+        buffer = GL_Buffer::create();
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_DRAW);
+    };
+    createBuffer(m_particles, size_t(m_capacity) * s_particleSize);
+    createBuffer(m_deadList, size_t(m_capacity) * sizeof(uint32_t));
+    createBuffer(m_aliveLists[0], size_t(m_capacity) * sizeof(uint32_t));
+    createBuffer(m_aliveLists[1], size_t(m_capacity) * sizeof(uint32_t));
+    createBuffer(m_transforms, size_t(m_capacity) * sizeof(glm::mat4));
+    createBuffer(m_counters, s_countersSize);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    reset();
+}
+
+void ParticleSystem::reset()
+{
+    // every index free, the only CPU upload besides the draw command
+    std::vector<uint32_t> indices(m_capacity);
+    std::iota(indices.rbegin(), indices.rend(), 0u); // index 0 is popped first
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_deadList);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, indices.size() * sizeof(uint32_t), indices.data());
+
+    ParticleCounters counters {};
+    counters.numDead = m_capacity;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counters);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), &counters);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    m_emitDebt = 0.f;
+}
+
+void ParticleSystem::readStats(uint32_t slot)
+{
+    if (!m_statsFences[slot])
+        return;
+    if (glClientWaitSync((GLsync)m_statsFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+        return;
+
+    glDeleteSync((GLsync)m_statsFences[slot]);
+    m_statsFences[slot] = nullptr;
+    ParticleCounters counters;
+    glBindBuffer(GL_COPY_READ_BUFFER, m_statsBuffers[slot]);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(counters), &counters);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    m_lastStats = { counters.command[1], counters.emitted, counters.died, (uint32_t)std::max(counters.numDead, 0) };
+}
+
+ParticleStats ParticleSystem::getStats(bool wait)
+{
+    const uint32_t newestSlot = (m_frame + s_statsLatency - 1) % s_statsLatency;
+    if (wait && m_statsFences[newestSlot])
+        glClientWaitSync((GLsync)m_statsFences[newestSlot], GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+
+    for (uint32_t age = s_statsLatency; age > 0; --age) // oldest first
+        readStats((m_frame + s_statsLatency - age) % s_statsLatency);
+    return m_lastStats;
+}
+
+void ParticleSystem::update(float dt, Profiler* profiler)
+{
+    m_emitDebt += m_config.emitRate * dt;
+    const uint32_t emitCount = (uint32_t)std::min(m_emitDebt, (float)m_capacity);
+    m_emitDebt = std::min(m_emitDebt - emitCount, 1.f);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_particles);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_deadList);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_aliveLists[m_current]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_aliveLists[1 - m_current]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_transforms);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, m_counters);
+
+    if (profiler)
+        profiler->begin("particle prepare", Profiler::Type::TimeElapsed);
+    m_prepareShader.dispatch(1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+    if (profiler) {
+        profiler->end("particle prepare");
+        profiler->begin("particle simulate", Profiler::Type::TimeElapsed);
+    }
+
+    m_simulateShader.bind();
+    m_simulateDeltaTime.set(dt);
+    m_simulateGravity.set(m_config.gravity);
+    m_simulateDrag.set(m_config.drag);
+    m_simulateGround.set(glm::vec2(m_config.groundHeight, m_config.restitution));
+    m_simulateSize.set(m_config.size);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_counters);
+    glDispatchComputeIndirect(s_dispatchOffset);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    if (profiler) {
+        profiler->end("particle simulate");
+        profiler->begin("particle emit", Profiler::Type::TimeElapsed);
+    }
+
+    if (emitCount) {
+        m_emitShader.bind();
+        m_emitCount.set(emitCount);
+        m_emitSeed.set(m_frame);
+        m_emitPosition.set(glm::vec4(m_config.emitterPosition, m_config.emitterRadius));
+        m_emitVelocity.set(glm::vec4(m_config.emitVelocity, m_config.velocitySpread));
+        m_emitLifetime.set(glm::vec2(m_config.minLifetime, m_config.maxLifetime));
+        m_emitSize.set(m_config.size);
+        m_emitShader.dispatch((emitCount + s_groupSize - 1) / s_groupSize);
+    }
+    // appended instances feed the draw: command, attributes and the stats copy
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+        | GL_BUFFER_UPDATE_BARRIER_BIT);
+    if (profiler)
+        profiler->end("particle emit");
+
+    const uint32_t slot = m_frame % s_statsLatency;
+    if (m_statsFences[slot]) // s_statsLatency frames old, normally doesn't wait
+        glClientWaitSync((GLsync)m_statsFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+    readStats(slot);
+    glBindBuffer(GL_COPY_READ_BUFFER, m_counters);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_statsBuffers[slot]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, s_countersSize);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    m_statsFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    m_current = 1 - m_current;
+    m_frame++;
+}
+
+void ParticleSystem::draw(GL_InstancedMesh& mesh)
+{
+    // instanceCount stays as the GPU appended it; impostors read the command as
+    // DrawArraysIndirectCommand, which matches while firstIndex and baseVertex are 0
+    const uint32_t count = mesh.getNumDrawVertices();
+    const uint32_t rest[3] = { mesh.isSphereImpostors() ? 0 : mesh.getFirstIndex(), 0, 0 };
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_counters);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, s_commandOffset, sizeof(count), &count);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, s_commandOffset + 2 * sizeof(uint32_t), sizeof(rest), rest);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    mesh.drawIndirect({ m_transforms, 0, 0 }, m_counters, s_commandOffset);
+}
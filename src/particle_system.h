@@ -0,0 +1,93 @@
+#ifndef PARTICLE_SYSTEM_H
+#define PARTICLE_SYSTEM_H
+
+#include "gl_handle.h"
+#include "shader.h"
+
+#include <cstdint> // uintXX_t
+#include <glm/glm.hpp>
+
+class GL_InstancedMesh;
+class Profiler;
+
+struct ParticleConfig {
+    uint32_t capacity = 1 << 18; // particles alive at most, buffers are sized for it
+    float emitRate = 50000.f; // per second, emission waits while every particle is alive
+    glm::vec3 emitterPosition { 0.f, 0.f, -1.f };
+    float emitterRadius = 0.2f;
+    glm::vec3 emitVelocity { 0.f, 0.f, 5.f };
+    float velocitySpread = 1.5f; // radius of the random velocity added to emitVelocity
+    float minLifetime = 2.f, maxLifetime = 4.f; // s
+    glm::vec3 gravity { 0.f, 0.f, -9.81f };
+    float drag = 0.2f; // velocity lost per second, relative
+    float groundHeight = -3.f, restitution = 0.5f; // particles bounce off z = groundHeight
+    float size = 0.03f; // radius at birth, shrinks to 0 at the end of life
+};
+
+struct ParticleStats { // of one frame
+    uint32_t alive {};
+    uint32_t emitted {};
+    uint32_t died {};
+    uint32_t free {}; // on the dead list
+};
+
+// GPU particles: emission, integration and compaction run in compute shaders over
+// storage buffers, nothing is read back to simulate or draw. Free particle indices
+// sit on a dead list; per frame the simulation pass walks last frame's alive list,
+// pushes expired particles on the dead list and appends survivors to the other
+// alive list, then the emission pass pops the dead list and appends newborns to it.
+// Appending writes the instance matrix at the same slot and counts the instances of
+// a DrawElementsIndirectCommand, so draw() hands compacted instances to
+// GL_InstancedMesh::drawIndirect(), as mesh geometry or sphere impostors. The
+// simulation pass is sized from the GPU count by glDispatchComputeIndirect.
+// update() binds compute programs, rebind the draw shader after it.
+class ParticleSystem {
+public:
+    ParticleSystem(const ParticleConfig& config = {});
+    ParticleSystem(const ParticleSystem&) = delete;
+    ParticleSystem& operator=(const ParticleSystem&) = delete;
+    ~ParticleSystem();
+
+    // a new capacity reallocates the buffers and starts over without particles
+    void setConfig(const ParticleConfig& config);
+    const ParticleConfig& getConfig() const { return m_config; }
+    void reset(); // every particle dies
+
+    // advances dt seconds: "particle prepare", "particle simulate" and "particle emit"
+    // GPU sections go to the profiler
+    void update(float dt, Profiler* profiler = nullptr);
+    // alive particles as instances of mesh, with the program bound by the caller
+    void draw(GL_InstancedMesh& mesh);
+
+    // read back asynchronously, a few frames late, no stalls;
+    // wait = true blocks until the latest update() is available (headless tests)
+    ParticleStats getStats(bool wait = false);
+
+private:
+    static constexpr uint32_t s_statsLatency = 3;
+
+    void allocate();
+    void readStats(uint32_t slot);
+
+    ParticleConfig m_config;
+    uint32_t m_capacity {}; // of the buffers
+    float m_emitDebt {}; // fraction of a particle left by the last update()
+    uint32_t m_current {}; // alive list simulated next
+    uint32_t m_frame {};
+
+    ComputeShader m_prepareShader, m_simulateShader, m_emitShader;
+    Shader::ShaderVariable m_simulateDeltaTime, m_simulateGravity, m_simulateDrag, m_simulateGround, m_simulateSize;
+    Shader::ShaderVariable m_emitCount, m_emitSeed, m_emitPosition, m_emitVelocity, m_emitLifetime, m_emitSize;
+
+    GL_Buffer m_particles; // position and age, velocity and lifetime
+    GL_Buffer m_deadList;
+    GL_Buffer m_aliveLists[2]; // particle indices, ping-pong
+    GL_Buffer m_transforms; // instance matrices, in alive list order
+    GL_Buffer m_counters; // draw command, dispatch size, list counts, frame stats
+
+    GL_Buffer m_statsBuffers[s_statsLatency];
+    void* m_statsFences[s_statsLatency] {};
+    ParticleStats m_lastStats {};
+};
+
+#endif // PARTICLE_SYSTEM_H
@@ -0,0 +1,334 @@
+#include "point_cloud.h"
+#include "allocators.h"
+#include "camera.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+
+static_assert(sizeof(PointCloudPoint) == 16 && sizeof(PointCloudNode) == 64 && sizeof(PointCloudHeader) == 24, "");
+
+static constexpr uint32_t s_maxDepth = 24; // nodes this deep keep maxPointsPerNode points, drop the rest
+
+static const char* s_vertexSource = R"(#version 460 core
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 1) in vec4 vertexColor;
+uniform mat4 viewProjection;
+uniform float pointSize;
+out vec3 color;
+
+void main()
+{
+    color = pow(vertexColor.rgb, vec3(2.2));
+    gl_Position = viewProjection * vec4(vertexPosition, 1.0);
+    gl_PointSize = pointSize;
+}
+)";
+
+static const char* s_fragmentSource = R"(#version 460 core
+in vec3 color;
+layout(location = 0) out vec3 fragColor;
+
+void main()
+{
+    if (length(gl_PointCoord - 0.5) > 0.5)
+        discard;
+    fragColor = color;
+}
+)";
+
+namespace {
+struct BuildContext {
+    std::vector<PointCloudPoint>& points;
+    std::vector<PointCloudPoint> scratch; // octant buckets
+    std::vector<PointCloudNode> nodes;
+    uint32_t maxPointsPerNode;
+    uint32_t maxDepth;
+    uint64_t numPoints;
+};
+}
+
+// points[first, last) are in the cube, in random order; pre-order, so the points of a
+// node are followed by the ranges of its children and node offsets grow with the index
+static int32_t buildNode(BuildContext& context, size_t first, size_t last, const glm::vec3& center, float halfSize, uint32_t depth)
+{
+    const size_t count = last - first;
+    const int32_t index = context.nodes.size();
+    PointCloudNode node;
+    node.center = center;
+    node.halfSize = halfSize;
+    std::fill(std::begin(node.children), std::end(node.children), -1);
+    node.numPoints = std::min(count, size_t(context.maxPointsPerNode));
+    node.depth = depth;
+    node.offset = first; // in points until the file layout is known
+    context.nodes.push_back(node);
+    context.maxDepth = std::max(context.maxDepth, depth);
+    context.numPoints += node.numPoints;
+    if (count <= context.maxPointsPerNode || depth == s_maxDepth)
+        return index;
+
+    auto getOctant = [&](const glm::vec3& p) {
+        return uint32_t(p.x >= center.x) | uint32_t(p.y >= center.y) << 1 | uint32_t(p.z >= center.z) << 2;
+    };
+    const size_t rest = first + node.numPoints;
+    size_t starts[9] {};
+    for (size_t i = rest; i < last; ++i)
+        starts[getOctant(context.points[i].position) + 1]++;
+    starts[0] = rest;
+    for (uint32_t i = 1; i < 9; ++i)
+        starts[i] += starts[i - 1];
+    size_t offsets[8];
+    std::copy(starts, starts + 8, offsets);
+    for (size_t i = rest; i < last; ++i) // stable, buckets stay in random order
+        context.scratch[offsets[getOctant(context.points[i].position)]++] = context.points[i];
+    std::copy(context.scratch.begin() + rest, context.scratch.begin() + last, context.points.begin() + rest);
+
+    for (uint32_t i = 0; i < 8; ++i) {
+        if (starts[i] == starts[i + 1])
+            continue;
+        const glm::vec3 offset(i & 1 ? 0.5f : -0.5f, i & 2 ? 0.5f : -0.5f, i & 4 ? 0.5f : -0.5f);
+        const int32_t child = buildNode(context, starts[i], starts[i + 1], center + offset * halfSize, 0.5f * halfSize, depth + 1);
+        context.nodes[index].children[i] = child;
+    }
+    return index;
+}
+
+bool writePointCloud(const std::string& path, std::vector<PointCloudPoint> points, uint32_t maxPointsPerNode)
+{
+    assert(maxPointsPerNode > 0);
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    glm::vec3 min(std::numeric_limits<float>::max()), max(-std::numeric_limits<float>::max());
+    for (const PointCloudPoint& point : points) {
+        min = glm::min(min, point.position);
+        max = glm::max(max, point.position);
+    }
+    if (points.empty())
+        min = max = glm::vec3(0);
+    const glm::vec3 extent = 0.5f * (max - min);
+    const float halfSize = std::max({ extent.x, extent.y, extent.z }) * 1.001f + 1e-6f;
+
+    // the first points of any range are a uniform subset of it
+    std::shuffle(points.begin(), points.end(), std::mt19937(1));
+    BuildContext context { points, std::vector<PointCloudPoint>(points.size()), {}, maxPointsPerNode, 0, 0 };
+    buildNode(context, 0, points.size(), 0.5f * (min + max), halfSize, 0);
+    context.scratch = {};
+
+    PointCloudHeader header;
+    header.numNodes = context.nodes.size();
+    header.maxPointsPerNode = maxPointsPerNode;
+    header.maxDepth = context.maxDepth;
+    header.numPoints = context.numPoints;
+    const size_t pointsOffset = sizeof(header) + context.nodes.size() * sizeof(PointCloudNode);
+    for (PointCloudNode& node : context.nodes)
+        node.offset = pointsOffset + node.offset * sizeof(PointCloudPoint);
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)context.nodes.data(), context.nodes.size() * sizeof(PointCloudNode));
+    file.write((const char*)points.data(), points.size() * sizeof(PointCloudPoint)); // dropped ones too
+    return (bool)file;
+}
+
+PointCloud::PointCloud(const PointCloudConfig& config)
+    : m_config(config)
+    , m_shader(s_vertexSource, s_fragmentSource)
+    , m_viewProjection(m_shader.getVariable("viewProjection"))
+    , m_pointSize(m_shader.getVariable("pointSize"))
+{
+    assert(config.maxScreenError > 0.f && config.uploadsPerFrame > 0 && config.pointSize > 0.f);
+}
+
+bool PointCloud::open(const std::string& path)
+{
+    assert(!isOpen());
+    m_file.open(path, std::ios::binary);
+    PointCloudHeader header;
+    header.magic[0] = 0;
+    m_file.read((char*)&header, sizeof(header));
+    m_file.seekg(0, std::ios::end);
+    const size_t fileSize = m_file ? size_t(m_file.tellg()) : 0;
+    std::vector<PointCloudNode> nodes;
+    if (!memcmp(header.magic, PointCloudHeader().magic, sizeof(header.magic)) && header.numNodes > 0
+        && header.numNodes <= (1u << 26) && header.maxPointsPerNode > 0 && header.maxPointsPerNode <= (1u << 24)
+        && fileSize >= sizeof(header) + size_t(header.numNodes) * sizeof(PointCloudNode)) {
+        nodes.resize(header.numNodes);
+        m_file.seekg(sizeof(header));
+        m_file.read((char*)nodes.data(), nodes.size() * sizeof(PointCloudNode));
+    }
+    // children after their parent, so the hierarchy has no cycles
+    bool valid = !nodes.empty() && m_file;
+    for (uint32_t i = 0; valid && i < nodes.size(); ++i) {
+        const PointCloudNode& node = nodes[i];
+        valid = node.numPoints <= header.maxPointsPerNode && node.offset <= fileSize
+            && node.numPoints * sizeof(PointCloudPoint) <= fileSize - node.offset;
+        for (int32_t child : node.children)
+            valid &= child == -1 || (child > int32_t(i) && child < int32_t(nodes.size()));
+    }
+    if (!valid) {
+        std::cout << "PointCloud: can't read " << path << std::endl;
+        m_file.close();
+        return false;
+    }
+    const size_t slotBytes = size_t(header.maxPointsPerNode) * sizeof(PointCloudPoint);
+    const uint32_t numSlots = std::min(m_config.gpuBudget / slotBytes, nodes.size());
+    if (!numSlots) {
+        std::cout << "PointCloud: " << slotBytes << " bytes per node exceed the GPU budget" << std::endl;
+        m_file.close();
+        return false;
+    }
+    m_maxPointsPerNode = header.maxPointsPerNode;
+    m_nodes = std::move(nodes);
+
+    m_pointBuffer = GL_Buffer::create();
+    glBindBuffer(GL_ARRAY_BUFFER, m_pointBuffer);
+    glBufferData(GL_ARRAY_BUFFER, numSlots * slotBytes, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    m_vertexArray = GL_VertexArray::create();
+    glBindVertexArray(m_vertexArray);
+    glBindVertexBuffer(0, m_pointBuffer, 0, sizeof(PointCloudPoint));
+    glEnableVertexAttribArray(0);
+    glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, offsetof(PointCloudPoint, position));
+    glVertexAttribBinding(0, 0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribFormat(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(PointCloudPoint, color));
+    glVertexAttribBinding(1, 0);
+    glBindVertexArray(0);
+
+    m_stats.slots = numSlots;
+    std::cout << "PointCloud: " << header.numPoints << " points in " << header.numNodes << " nodes, depth "
+              << header.maxDepth << ", " << numSlots << " slots of " << slotBytes / 1024 << " KB" << std::endl;
+    m_streaming.start(
+        m_nodes.size(), numSlots,
+        [this](uint32_t node, std::vector<uint8_t>& points) { return loadNode(node, points); },
+        [this](uint32_t, uint32_t slot, const std::vector<uint8_t>& points) { uploadNode(slot, points); });
+    return true;
+}
+
+float PointCloud::getScreenError(const PointCloudNode& node, const glm::vec3& cameraPos, float pixelScale) const
+{
+    // maxPointsPerNode spread over a surface through the cube
+    const float spacing = 2.f * node.halfSize / std::sqrt(float(m_maxPointsPerNode));
+    const float distance = glm::length(glm::max(glm::abs(cameraPos - node.center) - node.halfSize, glm::vec3(0)));
+    return distance > 0.f ? spacing * pixelScale / distance : std::numeric_limits<float>::max();
+}
+
+void PointCloud::selectNodes(const Camera& camera, uint32_t viewportHeight)
+{
+    glm::vec4 planes[6];
+    extractFrustumPlanes(camera.getProjection() * camera.getView(), planes);
+    const glm::vec3 cameraPos = camera.getPos();
+    const float pixelScale = viewportHeight / (2.f * tanf(0.5f * camera.getFOV()));
+
+    ScratchScope scratch;
+    typedef std::pair<float, uint32_t> Candidate; // screen error, node
+    ArenaVector<Candidate> queue(ArenaAllocator<Candidate>(scratch.getArena())); // max heap
+    ArenaVector<Candidate> wanted(ArenaAllocator<Candidate>(scratch.getArena()));
+    queue.push_back({ getScreenError(m_nodes[0], cameraPos, pixelScale), 0 });
+    m_firsts.clear();
+    m_counts.clear();
+    m_stats.drawnPoints = m_stats.visitedNodes = 0;
+    while (!queue.empty()) {
+        std::pop_heap(queue.begin(), queue.end());
+        const Candidate candidate = queue.back();
+        queue.pop_back();
+        m_stats.visitedNodes++;
+
+        const PointCloudNode& node = m_nodes[candidate.second];
+        bool visible = true;
+        for (uint32_t i = 0; i < 6 && visible; ++i)
+            visible = glm::dot(glm::vec3(planes[i]), node.center) + planes[i].w
+                >= -node.halfSize * (fabsf(planes[i].x) + fabsf(planes[i].y) + fabsf(planes[i].z));
+        if (!visible)
+            continue;
+
+        const int32_t slot = m_streaming.use(candidate.second);
+        if (slot < 0) { // its children wait for it
+            if (!m_streaming.isPending(candidate.second) && !m_streaming.isFailed(candidate.second))
+                wanted.push_back(candidate);
+            continue;
+        }
+        if (m_stats.drawnPoints + node.numPoints > m_config.maxDrawnPoints)
+            continue;
+        m_firsts.push_back(slot * m_maxPointsPerNode);
+        m_counts.push_back(node.numPoints);
+        m_stats.drawnPoints += node.numPoints;
+
+        if (candidate.first <= m_config.maxScreenError)
+            continue;
+        for (int32_t child : node.children)
+            if (child >= 0) {
+                queue.push_back({ getScreenError(m_nodes[child], cameraPos, pixelScale), uint32_t(child) });
+                std::push_heap(queue.begin(), queue.end());
+            }
+    }
+    m_stats.drawnNodes = m_firsts.size();
+    std::sort(wanted.begin(), wanted.end(), [](const Candidate& a, const Candidate& b) { return a.first > b.first; });
+
+    ArenaVector<uint32_t> nodes(wanted.size(), ArenaAllocator<uint32_t>(scratch.getArena())); // most important first
+    for (size_t i = 0; i < wanted.size(); ++i)
+        nodes[i] = wanted[i].second;
+    m_streaming.request(nodes.data(), nodes.size());
+}
+
+void PointCloud::update(const Camera& camera, uint32_t viewportHeight)
+{
+    if (!isOpen())
+        return;
+    m_streaming.nextFrame();
+    selectNodes(camera, viewportHeight);
+    m_streaming.store(m_config.uploadsPerFrame);
+}
+
+void PointCloud::uploadNode(uint32_t slot, const std::vector<uint8_t>& points)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, m_pointBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, size_t(slot) * m_maxPointsPerNode * sizeof(PointCloudPoint), points.size(), points.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void PointCloud::draw(const Camera& camera)
+{
+    if (!isOpen() || m_firsts.empty())
+        return;
+    m_shader.bind();
+    m_viewProjection.set(camera.getProjection() * camera.getView());
+    m_pointSize.set(m_config.pointSize);
+
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    glBindVertexArray(m_vertexArray);
+    glMultiDrawArrays(GL_POINTS, m_firsts.data(), m_counts.data(), m_firsts.size());
+    glBindVertexArray(0);
+    glDisable(GL_PROGRAM_POINT_SIZE);
+}
+
+PointCloudStats PointCloud::getStats() const
+{
+    PointCloudStats stats = m_stats;
+    stats.residentNodes = m_streaming.getNumResident();
+    stats.pendingNodes = m_streaming.getNumPending();
+    stats.loadedNodes = m_streaming.getNumLoaded();
+    stats.evictedNodes = m_streaming.getNumEvicted();
+    return stats;
+}
+
+bool PointCloud::loadNode(uint32_t node, std::vector<uint8_t>& points)
+{
+    points.resize(m_nodes[node].numPoints * sizeof(PointCloudPoint));
+    m_file.clear();
+    m_file.seekg(m_nodes[node].offset);
+    if (!m_file.read((char*)points.data(), points.size())) {
+        std::cout << "PointCloud: can't read node " << node << std::endl;
+        return false;
+    }
+    return true;
+}
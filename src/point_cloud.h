@@ -0,0 +1,114 @@
+#ifndef POINT_CLOUD_H
+#define POINT_CLOUD_H
+
+#include "gl_handle.h"
+#include "shader.h"
+#include "streaming_cache.h"
+
+#include <cstdint> // uintXX_t
+#include <fstream>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+class Camera;
+
+struct PointCloudConfig {
+    size_t gpuBudget = size_t(256) << 20; // bytes of resident points, split into node slots
+    float maxScreenError = 2.f; // pixels between points, coarser nodes are refined
+    uint32_t maxDrawnPoints = 8 << 20; // per frame, most important nodes first
+    uint32_t uploadsPerFrame = 4; // nodes copied to the GPU by update()
+    float pointSize = 2.f; // pixels
+};
+
+struct PointCloudStats {
+    uint32_t drawnNodes {};
+    uint32_t drawnPoints {};
+    uint32_t visitedNodes {};
+    uint32_t residentNodes {}, slots {}; // node slots in use and within gpuBudget
+    uint32_t pendingNodes {}; // requested, loading or waiting for upload
+    uint64_t loadedNodes {}, evictedNodes {}; // since open()
+};
+
+struct PointCloudPoint {
+    glm::vec3 position;
+    uint32_t color; // rgba8, sRGB
+};
+
+// Point cloud file: PointCloudHeader, numNodes PointCloudNode with the root first, then
+// the points of every node at its offset. A node stores a random subset of the points in
+// its cube, at most maxPointsPerNode, its children the rest, so a node and all its
+// ancestors together are a denser sample of the cube than the node alone.
+struct PointCloudHeader {
+    char magic[4] = { 'P', 'C', 'L', 'D' };
+    uint32_t numNodes {};
+    uint32_t maxPointsPerNode {};
+    uint32_t maxDepth {};
+    uint64_t numPoints {};
+};
+
+struct PointCloudNode {
+    glm::vec3 center;
+    float halfSize; // of the cube
+    int32_t children[8]; // node index by octant (x, y, z bits), -1 if empty
+    uint32_t numPoints;
+    uint32_t depth;
+    uint64_t offset; // of the points in the file
+};
+
+// octree of the points, built in memory; false if the file can't be written
+bool writePointCloud(const std::string& path, std::vector<PointCloudPoint> points, uint32_t maxPointsPerNode);
+
+// Out-of-core point cloud: the node hierarchy stays in memory, node points stream from
+// disk on a worker thread into fixed slots of one GPU buffer, gpuBudget bytes in total,
+// least recently used nodes are evicted. Every frame update() walks the octree from the
+// root in order of screen-space error, the node's point spacing projected at its
+// distance, and refines nodes coarser than maxScreenError. Nodes are drawn only if their
+// parent is, so the cut grows from the root while data streams in and never shows holes
+// where children are missing. At most uploadsPerFrame nodes and maxDrawnPoints points
+// per frame keep the frame time bounded, the whole cut is one glMultiDrawArrays of
+// GL_POINTS.
+class PointCloud {
+public:
+    PointCloud(const PointCloudConfig& config = {});
+    PointCloud(const PointCloud&) = delete;
+    PointCloud& operator=(const PointCloud&) = delete;
+
+    const PointCloudConfig& getConfig() const { return m_config; }
+
+    bool open(const std::string& path); // false if the file can't be read or a node exceeds the budget
+    bool isOpen() const { return !m_nodes.empty(); }
+
+    // selects nodes for a viewport viewportHeight pixels high, requests missing ones and uploads loaded ones
+    void update(const Camera& camera, uint32_t viewportHeight);
+    // into the bound target, depth tested, radiance out (ShaderFeature::LinearOutput)
+    void draw(const Camera& camera);
+
+    PointCloudStats getStats() const;
+
+private:
+    // pixels between the points of the node and its ancestors, pixelScale per unit at distance 1
+    float getScreenError(const PointCloudNode& node, const glm::vec3& cameraPos, float pixelScale) const;
+    // fills the draw ranges and requests the most important missing nodes
+    void selectNodes(const Camera& camera, uint32_t viewportHeight);
+    bool loadNode(uint32_t node, std::vector<uint8_t>& points); // worker thread
+    void uploadNode(uint32_t slot, const std::vector<uint8_t>& points);
+
+    PointCloudConfig m_config;
+    uint32_t m_maxPointsPerNode {};
+    std::vector<PointCloudNode> m_nodes;
+
+    std::vector<int32_t> m_firsts; // drawn this frame, in points
+    std::vector<int32_t> m_counts;
+    PointCloudStats m_stats;
+
+    Shader m_shader;
+    Shader::ShaderVariable m_viewProjection, m_pointSize;
+    GL_Buffer m_pointBuffer;
+    GL_VertexArray m_vertexArray;
+
+    std::ifstream m_file; // worker thread only
+    StreamingCache m_streaming; // nodes in slots of m_pointBuffer; last, its worker reads m_file
+};
+
+#endif // POINT_CLOUD_H
@@ -0,0 +1,105 @@
+#include "profiler.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <cassert>
+#include <iostream>
+
+static GLenum toGLTarget(Profiler::Type type)
+{
+    switch (type) {
+    case Profiler::Type::SamplesPassed:
+        return GL_SAMPLES_PASSED;
+    case Profiler::Type::TimeElapsed:
+        return GL_TIME_ELAPSED;
+    case Profiler::Type::Timestamps:
+        return GL_TIMESTAMP;
+    }
+    assert(false); // unknown query type
+    return 0;
+}
+
+void Profiler::resolve(Section& section, uint32_t slot, bool wait)
+{
+    if (!section.pending[slot])
+        return;
+
+    const bool timestamps = section.type == Type::Timestamps;
+    if (!wait) { // end timestamp is available after the begin one
+        GLint available = 0;
+        glGetQueryObjectiv(timestamps ? section.endQueries[slot] : section.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+    }
+    GLuint64 result = 0;
+    glGetQueryObjectui64v(section.queries[slot], GL_QUERY_RESULT, &result);
+    if (timestamps) {
+        GLuint64 endResult = 0;
+        glGetQueryObjectui64v(section.endQueries[slot], GL_QUERY_RESULT, &endResult);
+        result = endResult - result;
+    }
+    section.lastValue = result;
+    section.pending[slot] = false;
+}
+
+void Profiler::begin(const char* name, Type type)
+{
+    auto it = m_sections.find(name);
+    if (it == m_sections.end()) { // new section, the only allocation
+        it = m_sections.try_emplace(name).first;
+        Section& section = it->second;
+        section.type = type;
+        for (auto& query : section.queries)
+            query = GL_Query::create();
+        if (type == Type::Timestamps)
+            for (auto& query : section.endQueries)
+                query = GL_Query::create();
+    }
+    Section& section = it->second;
+    assert(section.type == type); // same name used with different query type
+
+    const uint32_t slot = m_frame % s_queryLatency;
+    resolve(section, slot, true); // issued s_queryLatency frames ago, normally ready
+
+    if (type == Type::Timestamps)
+        glQueryCounter(section.queries[slot], GL_TIMESTAMP);
+    else
+        glBeginQuery(toGLTarget(type), section.queries[slot]);
+    section.pending[slot] = true;
+}
+
+void Profiler::end(const char* name)
+{
+    auto it = m_sections.find(name);
+    assert(it != m_sections.end()); // end() without begin()
+    if (it->second.type == Type::Timestamps)
+        glQueryCounter(it->second.endQueries[m_frame % s_queryLatency], GL_TIMESTAMP);
+    else
+        glEndQuery(toGLTarget(it->second.type));
+}
+
+void Profiler::nextFrame()
+{
+    for (auto& it : m_sections)
+        for (uint32_t slot = 0; slot < s_queryLatency; ++slot)
+            resolve(it.second, slot, false);
+    m_frame++;
+}
+
+uint64_t Profiler::getValue(const char* name) const
+{
+    auto it = m_sections.find(name);
+    return it != m_sections.end() ? it->second.lastValue : 0;
+}
+
+void Profiler::print() const
+{
+    for (const auto& it : m_sections) {
+        const Section& section = it.second;
+        if (section.type != Type::SamplesPassed)
+            std::cout << it.first << ": " << section.lastValue / 1e6 << " ms" << std::endl;
+        else
+            std::cout << it.first << ": " << section.lastValue << " samples" << std::endl;
+    }
+}
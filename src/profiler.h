@@ -0,0 +1,50 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "gl_handle.h"
+
+#include <cstdint> // uintXX_t
+#include <functional>
+#include <map>
+#include <string>
+
+// GPU counters without pipeline stalls: every section keeps a small ring of
+// query objects and results are read back a few frames later.
+// Sections of the same type must not overlap (one active query per GL target),
+// except Timestamps, which are two timestamps and can enclose any other section.
+class Profiler {
+public:
+    // clang-format off
+    enum class Type : uint8_t { SamplesPassed, TimeElapsed, Timestamps };
+    // clang-format on
+
+    Profiler() = default;
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    void begin(const char* name, Type type);
+    void end(const char* name);
+    void nextFrame(); // call once per frame, after all sections are ended
+
+    // latest resolved value: samples count or nanoseconds
+    uint64_t getValue(const char* name) const;
+    void print() const;
+
+private:
+    static constexpr uint32_t s_queryLatency = 3; // frames in flight
+
+    struct Section {
+        Type type {};
+        GL_Query queries[s_queryLatency];
+        GL_Query endQueries[s_queryLatency]; // Timestamps only
+        bool pending[s_queryLatency] {};
+        uint64_t lastValue {};
+    };
+
+    void resolve(Section& section, uint32_t slot, bool wait);
+
+    std::map<std::string, Section, std::less<>> m_sections; // looked up by const char*, no key strings per call
+    uint32_t m_frame {};
+};
+
+#endif // PROFILER_H
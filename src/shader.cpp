@@ -1,161 +1,524 @@
 #include "shader.h"
+#include "multi_view.h"
 
 #define GL_GLEXT_PROTOTYPES
 #include <SDL2/SDL_opengl.h>
 #include <iostream>
 #include <string>
-#include <unordered_map>
 
-Shader::ShaderVariable::ShaderVariable(const Shader& parent, const char* name)
-    : parentShader(parent)
-    , location(glGetUniformLocation(parentShader.getProgram(), name))
+Shader::ShaderVariable::ShaderVariable(int program, const char* name)
+    : location(glGetUniformLocation(program, name))
 {
 }
 
 void Shader::ShaderVariable::set(float var) { glUniform1f(location, var); }
+void Shader::ShaderVariable::set(int var) { glUniform1i(location, var); }
+void Shader::ShaderVariable::set(uint32_t var) { glUniform1ui(location, var); }
 void Shader::ShaderVariable::set(const glm::vec2& var) { glUniform2fv(location, 1, &var[0]); }
 void Shader::ShaderVariable::set(const glm::vec3& var) { glUniform3fv(location, 1, &var[0]); }
 void Shader::ShaderVariable::set(const glm::vec4& var) { glUniform4fv(location, 1, &var[0]); }
+void Shader::ShaderVariable::set(const glm::ivec2& var) { glUniform2iv(location, 1, &var[0]); }
 void Shader::ShaderVariable::set(const glm::mat4& var) { glUniformMatrix4fv(location, 1, GL_FALSE, &var[0][0]); }
+void Shader::ShaderVariable::set(const glm::vec4* var, int count) { glUniform4fv(location, count, &var[0][0]); }
 
-static const std::string s_version = "#version 460 core\n";
+static int createShader(const char* shaderSource, int shaderType);
+static int linkProgram(int program);
 
-static const std::string s_vsInOut
-    = "VS_OUT {   \n"
-      "  vec4 wp; \n" // world position
-      "  vec4 lp; \n" // local position
-      "  vec3 n;  \n" // normal
-      "} vs;      \n";
+static const std::string s_version = "#version 460 core\n";
 
-static std::unordered_map<VertexAttribute::Type, std::string> s_attribNames = {
-    { VertexAttribute::Type::Position, "vertexPosition" },
-    { VertexAttribute::Type::Normal, "vertexNormal" },
-};
+static std::string getVsInOut(ShaderFeature features)
+{
+    return std::string("VS_OUT {   \n"
+                       "  vec4 wp; \n" // world position
+                       "  vec4 lp; \n" // local position
+                       "  vec3 n;  \n") // normal
+        + (hasFeature(features, ShaderFeature::MaterialTable) ? "  flat uint material; \n" : "")
+        + "} vs;      \n";
+}
 
-// kinda: layout (location = 0) in vec3 vertexPosition;
-static std::string s_vecName = "vec"; // later: float, vec, mat
-static std::string generateVertexAtrtributes(const VertexAttribData& vertData)
+std::string getVertexAttributeDeclarations(const VertexAttribData& vertData, ShaderFeature features)
 {
+    const bool positionOnly = hasFeature(features, ShaderFeature::DepthOnly);
+    const bool skinning = hasFeature(features, ShaderFeature::Skinning);
     std::string result;
 
     for (int i_attrib = 0; i_attrib < vertData.attributes.size(); ++i_attrib) {
         const auto& currentAttrib = vertData.attributes[i_attrib];
+        const bool isSkin = currentAttrib.type == VertexAttribute::Type::Joints
+            || currentAttrib.type == VertexAttribute::Type::Weights;
+        if (isSkin ? !skinning : positionOnly && currentAttrib.type != VertexAttribute::Type::Position)
+            continue;
 
-        auto it = s_attribNames.find(currentAttrib.type);
-        if (it == s_attribNames.end())
-            assert(false); // unsupported name
-
-        const std::string& currentAttribName = it->second;
+        const char* typeName = getAttribShaderType(currentAttrib.parameters.format);
+        assert(typeName); // not a vertex attribute format
 
         result += "layout (location = " + std::to_string(i_attrib) + ") in "
-            + s_vecName + std::to_string(currentAttrib.parameters.vectorSize) + " "
-            + currentAttribName + ";\n";
+            + typeName + " " + getAttribShaderName(currentAttrib.type) + ";\n";
     }
     return result;
 }
 
-static std::string commonUniformBlock()
+// VertexPulling: replaces the attributes above with globals filled by pullVertex() from
+// GL_MeshPool buffers, bindings and PulledMesh must match mesh_pool.cpp. An attribute is
+// its byte offset | MeshAttribFormat << 16, formats without a decoder give the fallback
+static std::string getVertexPullingDeclarations(ShaderFeature features)
+{
+    const bool depthOnly = hasFeature(features, ShaderFeature::DepthOnly);
+    const bool material = hasFeature(features, ShaderFeature::MaterialTable) && !depthOnly;
+    auto format = [](MeshAttribFormat f) { return std::to_string((uint32_t)f) + "u"; };
+    return "struct PulledMesh { uint vertexBase; uint stride; uint position; uint normal; };\n"
+           "layout(std430, binding = 14) readonly buffer PulledVertices { uint pulledVertices[]; };\n"
+           "layout(std430, binding = 15) readonly buffer PulledIndices { uint pulledIndices[]; };\n"
+           "layout(std430, binding = 16) readonly buffer PulledMeshes { PulledMesh pulledMeshes[]; };\n"
+           "layout(std430, binding = 17) readonly buffer PulledTransforms { mat4 pulledTransforms[]; };\n"
+           "layout(std430, binding = 18) readonly buffer PulledMaterials { uint pulledMaterials[]; };\n"
+           "vec4 vertexPosition;   \n"
+           "vec4 vertexNormal;     \n"
+           "mat4 instanceMatrix;   \n"
+           "uint instanceMaterial; \n"
+
+           "uint pullWord(uint address)\n" // attributes are only 2 byte aligned after halves
+           "{\n"
+           "    uint i = address >> 2u, shift = (address & 3u) * 8u;\n"
+           "    return shift == 0u ? pulledVertices[i] : pulledVertices[i] >> shift | pulledVertices[i + 1u] << (32u - shift);\n"
+           "}\n"
+           "vec4 pullAttribute(uint base, uint attribute, vec4 fallback)\n"
+           "{\n"
+           "    uint address = base + (attribute & 0xFFFFu), format = attribute >> 16u;\n"
+           "    vec4 v = fallback;\n"
+           "    if (format >= " + format(MeshAttribFormat::Float1) + " && format <= " + format(MeshAttribFormat::Float4) + ") {\n"
+           "        for (uint k = 0u; k <= format - " + format(MeshAttribFormat::Float1) + "; ++k)\n"
+           "            v[k] = uintBitsToFloat(pullWord(address + 4u * k));\n"
+           "    } else if (format >= " + format(MeshAttribFormat::Half1) + " && format <= " + format(MeshAttribFormat::Half4) + ") {\n"
+           "        vec4 h = vec4(unpackHalf2x16(pullWord(address)), unpackHalf2x16(pullWord(address + 4u)));\n"
+           "        for (uint k = 0u; k <= format - " + format(MeshAttribFormat::Half1) + "; ++k)\n"
+           "            v[k] = h[k];\n"
+           "    } else if (format == " + format(MeshAttribFormat::Unorm8x4) + ")\n"
+           "        v = unpackUnorm4x8(pullWord(address));\n"
+           "    return v;\n"
+           "}\n"
+
+           "void pullVertex()\n" // non-indexed multi-draw, first vertex is the mesh's first index
+           "{\n"
+           "    PulledMesh mesh = pulledMeshes[gl_DrawID];\n"
+           "    uint base = mesh.vertexBase + pulledIndices[gl_VertexID] * mesh.stride;\n"
+           "    vertexPosition = pullAttribute(base, mesh.position, vec4(0, 0, 0, 1));\n"
+        + (depthOnly ? "" : "    vertexNormal = pullAttribute(base, mesh.normal, vec4(0, 0, 1, 0));\n")
+        + "    uint instance = gl_BaseInstance + gl_InstanceID;\n"
+          "    instanceMatrix = pulledTransforms[instance];\n"
+        + (material ? "    instanceMaterial = pulledMaterials[instance];\n" : "")
+        + "}\n";
+}
+
+// MultiView: view, projection and viewPos are globals set by selectView() from the
+// views of multi_view.cpp instead of uniforms, the rest of the code is shared
+static std::string commonUniformBlock(ShaderFeature features)
 {
+    if (!hasFeature(features, ShaderFeature::MultiView))
+        return "uniform mat4 model;      \n"
+               "uniform mat4 view;       \n"
+               "uniform mat4 projection; \n";
+
     return "uniform mat4 model;      \n"
-           "uniform mat4 view;       \n"
-           "uniform mat4 projection; \n";
+           "struct View { mat4 view; mat4 projection; vec4 position; };\n"
+           "layout(std140, binding = 2) uniform MultiViews {\n"
+           "    View views[" + std::to_string(MultiView::s_maxViews) + "];\n"
+           "    uvec4 multiViewParams;\n" // num views, layered
+           "};\n"
+           "mat4 view;       \n"
+           "mat4 projection; \n"
+           "vec3 viewPos;    \n"
+           "void selectView(uint index)\n"
+           "{\n"
+           "    view = views[index].view;\n"
+           "    projection = views[index].projection;\n"
+           "    viewPos = views[index].position.xyz;\n"
+           "}\n";
+}
+
+// MultiView vertex stage: consecutive instances of a draw are the views of one
+// instance (instance attributes advance every numViews), the view picks the layer
+// or viewport the primitive is rasterized to
+static const char* s_multiViewExtension = "#extension GL_ARB_shader_viewport_layer_array : require\n";
+static const std::string s_selectMultiView
+    = "void selectMultiView()\n"
+      "{\n"
+      "    uint index = uint(gl_InstanceID) % multiViewParams.x;\n"
+      "    selectView(index);\n"
+      "    if (multiViewParams.y != 0u)\n"
+      "        gl_Layer = int(index);\n"
+      "    else\n"
+      "        gl_ViewportIndex = int(index);\n"
+      "}\n";
+
+// binding must match animation_palette.cpp; frames are blended linearly,
+// skin is left for the normal transform
+static const std::string s_skinningDeclarations
+    = "layout(std430, binding = 11) readonly buffer AnimationPalette {\n"
+      "    vec4 paletteParams; \n" // num joints, num frames, frames per second
+      "    mat4 palette[];     \n"
+      "};\n"
+      "uniform float animationTime; \n"
+      "mat4 skin;                   \n"
+      "mat4 skinMatrix()\n"
+      "{\n"
+      "    uint numJoints = uint(paletteParams.x);\n"
+      "    float frame = mod((animationTime * instanceAnimation.y + instanceAnimation.x) * paletteParams.z, paletteParams.y);\n"
+      "    uint frame0 = min(uint(frame), uint(paletteParams.y) - 1u);\n"
+      "    uint frame1 = (frame0 + 1u) % uint(paletteParams.y);\n"
+      "    float blend = fract(frame);\n"
+      "    mat4 result = mat4(0);\n"
+      "    for (int i = 0; i < 4; ++i) {\n"
+      "        uint joint = min(vertexJoints[i], numJoints - 1u);\n"
+      "        result += vertexWeights[i] * (palette[frame0 * numJoints + joint] * (1.0 - blend)\n"
+      "                                    + palette[frame1 * numJoints + joint] * blend);\n"
+      "    }\n"
+      "    return result;\n"
+      "}\n";
+
+// shared by color and depth-only programs, so the depth pre-pass
+// produces bit-identical depth and GL_EQUAL test passes
+static std::string getPositionTransform(ShaderFeature features)
+{
+    return std::string("invariant gl_Position;                   \n"
+                       "void transformPosition(out vec4 lp, out vec4 wp) \n"
+                       "{\n")
+        + (hasFeature(features, ShaderFeature::Skinning)
+                ? "    skin = skinMatrix();                  \n"
+                  "    lp = skin * vec4(vertexPosition.xyz, 1.0f);  \n"
+                : "    lp = vec4(vertexPosition.xyz, 1.0f);  \n")
+        + "    wp = model * instanceMatrix * lp;     \n"
+          "    vec4 cp = view * wp;                  \n"
+          "    gl_Position  =  projection * cp;      \n"
+          "}\n";
+}
+
+// SphereImpostor: a quad per instance circumscribing the silhouette of the sphere
+// (the constant impostorSphere attribute in mesh space, uniformly scaled like normals)
+// in the plane through its center; view space rays go to the fragment shader. Inside
+// the sphere the quad covers the screen. gl_VertexID 0..3 is a triangle strip
+static std::string getImpostorVertexCode(ShaderFeature features)
+{
+    const bool material = hasFeature(features, ShaderFeature::MaterialTable) && !hasFeature(features, ShaderFeature::DepthOnly);
+    return std::string("layout (location = " + std::to_string(InstanceAttribData::s_impostorSphereLocation) + ") in vec4 impostorSphere;\n")
+        + "out IMPOSTOR_OUT {      \n"
+          "  vec3 rayOrigin;       \n" // view space
+          "  vec3 rayDir;          \n"
+          "  flat vec4 sphere;     \n" // view space center, radius
+        + (material ? "  flat uint material;   \n" : "")
+        + "} impostor;             \n"
+          "invariant gl_Position;  \n"
+
+          "void main()\n"
+          "{\n"
+        + (hasFeature(features, ShaderFeature::MultiView) ? "    selectMultiView();\n" : "")
+        + "    mat4 modelInstance = model * instanceMatrix;\n"
+          "    vec3 center = (view * modelInstance * vec4(impostorSphere.xyz, 1.0)).xyz;\n"
+          "    float radius = impostorSphere.w * length(modelInstance[0].xyz);\n"
+          "    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;\n"
+          "    bool orthographic = projection[3][3] == 1.0;\n" // shadow cascades
+          "    float distSq = dot(center, center);\n"
+          "    vec3 axis = orthographic ? vec3(0, 0, -1) : center / sqrt(distSq);\n"
+          "    vec3 right = normalize(cross(axis, abs(axis.y) < 0.99 ? vec3(0, 1, 0) : vec3(1, 0, 0)));\n"
+          "    vec3 up = cross(right, axis);\n"
+          "    float size = orthographic ? radius : radius * sqrt(distSq / (distSq - radius * radius));\n" // cone at center depth
+          "    vec3 p = center + (right * corner.x + up * corner.y) * size;\n"
+          "    if (!orthographic && distSq <= radius * radius) {\n"
+          "        p = vec3(corner.x / projection[0][0], corner.y / projection[1][1], -1.0);\n"
+          "        gl_Position = vec4(corner, 0.0, 1.0);\n"
+          "    } else\n"
+          "        gl_Position = projection * vec4(p, 1.0);\n"
+          "    impostor.rayOrigin = orthographic ? vec3(p.xy, center.z + radius) : vec3(0);\n"
+          "    impostor.rayDir = orthographic ? vec3(0, 0, -1) : p;\n"
+          "    impostor.sphere = vec4(center, radius);\n"
+        + (material ? "    impostor.material = instanceMaterial;\n" : "")
+        + "}\n";
 }
 
-static std::string getVertexCode(const VertexAttribData& vertData)
+static std::string getVertexCode(const VertexAttribData& vertData, ShaderFeature features)
 {
+    const bool depthOnly = hasFeature(features, ShaderFeature::DepthOnly);
+    const bool skinning = hasFeature(features, ShaderFeature::Skinning);
+    const bool pulling = hasFeature(features, ShaderFeature::VertexPulling);
+    const bool multiView = hasFeature(features, ShaderFeature::MultiView);
+    auto location = [](uint32_t l) { return "layout (location = " + std::to_string(l) + ") in "; };
+
     std::string result;
-    result = s_version
-        + generateVertexAtrtributes(vertData)
-        + "layout (location = 3) in mat4 instanceMatrix;\n"
+    if (pulling) {
+        assert(!skinning && !hasFeature(features, ShaderFeature::SphereImpostor)); // drawn by GL_Mesh only
+        assert(!multiView); // gl_InstanceID indexes pulled instances
+        result = s_version + getVertexPullingDeclarations(features) + commonUniformBlock(features);
+    } else {
+        result = s_version
+            + (multiView ? s_multiViewExtension : "")
+            + getVertexAttributeDeclarations(vertData, features)
+            + location(InstanceAttribData::s_matrixLocation) + "mat4 instanceMatrix;\n"
+            + (hasFeature(features, ShaderFeature::MaterialTable) && !depthOnly
+                    ? location(InstanceAttribData::s_materialLocation) + "uint instanceMaterial;\n"
+                    : "")
+            + (skinning ? location(InstanceAttribData::s_animationLocation) + "vec2 instanceAnimation;\n" : "")
+
+            + commonUniformBlock(features)
+            + (multiView ? s_selectMultiView : "");
+    }
+
+    if (hasFeature(features, ShaderFeature::SphereImpostor)) {
+        assert(!skinning); // a sphere has no joints
+        return result + getImpostorVertexCode(features);
+    }
 
-        + commonUniformBlock()
+    result += (skinning ? s_skinningDeclarations : "")
+        + getPositionTransform(features);
+
+    const char* pullVertex = pulling ? "    pullVertex();                \n"
+        : multiView                  ? "    selectMultiView();           \n"
+                                     : "";
+    if (depthOnly) {
+        result += std::string("void main()"
+                              "{\n")
+            + pullVertex
+            + "    vec4 lp, wp;                 \n"
+              "    transformPosition(lp, wp);   \n"
+              "}\0";
+        return result;
+    }
 
-        + "out " + s_vsInOut +
+    result += "out " + getVsInOut(features) +
 
         "void main()"
         "{\n"
-        "    vs.lp = vec4(vertexPosition.xyz, 1.0f); \n"
-        "    vs.wp = model * instanceMatrix * vs.lp;  \n"
-        "    vec4 cp = view * vs.wp;                  \n"
-        "    gl_Position  =  projection * cp;         \n"
-        "    vs.n = mat3(model) * vertexNormal.xyz;   \n"
-        "}\0";
+        + pullVertex
+        + "    transformPosition(vs.lp, vs.wp);         \n"
+        + (skinning ? "    vs.n = mat3(model) * mat3(skin) * vertexNormal.xyz;   \n"
+                    : "    vs.n = mat3(model) * vertexNormal.xyz;   \n");
+    if (hasFeature(features, ShaderFeature::MaterialTable))
+        result += "    vs.material = instanceMaterial;   \n";
+    result += "}\0";
     // std::cout << result << std::endl;
     return result;
 }
 
+static const char* s_tonemapFunction = "vec3 tonemap(vec3 hdr)\n"
+                                       "{\n"
+                                       "    vec3 c = hdr / (hdr + vec3(1.0));\n"
+                                       "    return vec3(1) - pow(vec3(1) - c, vec3(4));\n"
+                                       "}\n";
+
+const char* getTonemapFunction() { return s_tonemapFunction; }
+
 static std::string s_fresnelShlickFunction = "float fresnelSchlick(float cosTheta, float f)"
                                              "{"
                                              "    return f + (1.0 - f) * pow(1.0 - cosTheta, 5.0);"
                                              "}";
 
-static std::string getFragmentCode()
+// binding must match material.cpp, fields are written in main() before any use
+static std::string s_materialTableDeclarations
+    = "struct Material { vec4 diffuseSpecular; };                                    \n"
+      "layout(std430, binding = 8) readonly buffer Materials { Material materials[]; };\n"
+      "vec3 diffuseColor;      \n"
+      "float specularStrength; \n";
+
+// bindings must match clustered_lighting.cpp
+static std::string s_clusteredLightsDeclarations
+    = "struct PointLight { vec4 positionRadius; vec4 colorIntensity; };                  \n"
+      "layout(std430, binding = 5) readonly buffer PointLights { PointLight pointLights[]; };\n"
+      "layout(std430, binding = 6) readonly buffer LightClusters { uvec2 lightClusters[]; };\n" // offset, count
+      "layout(std430, binding = 7) readonly buffer LightIndices { uint lightIndices[]; };   \n"
+      "layout(std140, binding = 0) uniform ClusterParams {                                 \n"
+      "    uvec4 clusterGrid;  \n" // x, y, z slices
+      "    vec4 clusterDepth;  \n" // slice scale, slice bias, viewport size
+      "};\n"
+
+      "vec3 clusteredLighting(vec3 nn, vec3 viewDir)\n"
+      "{\n"
+      "    float viewZ = -(view * vs.wp).z;\n"
+      "    uvec3 cell = uvec3(uvec2(gl_FragCoord.xy / clusterDepth.zw * vec2(clusterGrid.xy)),\n"
+      "        uint(max(log(viewZ) * clusterDepth.x + clusterDepth.y, 0.0)));\n"
+      "    cell = min(cell, clusterGrid.xyz - 1u);\n"
+      "    uvec2 cluster = lightClusters[(cell.z * clusterGrid.y + cell.y) * clusterGrid.x + cell.x];\n"
+      "    vec3 result = vec3(0);\n"
+      "    for (uint i = 0u; i < cluster.y; ++i) {\n"
+      "        PointLight light = pointLights[lightIndices[cluster.x + i]];\n"
+      "        vec3 toLight = light.positionRadius.xyz - vs.wp.xyz;\n"
+      "        float dist = length(toLight);\n"
+      "        float window = clamp(1.0 - pow(dist / light.positionRadius.w, 4.0), 0.0, 1.0);\n"
+      "        float attenuation = window * window / (dist * dist + 1.0);\n"
+      "        vec3 l = toLight / max(dist, 1e-4);\n"
+      "        float nDotL = clamp(dot(nn, l), 0.0, 1.0);\n"
+      "        float spec = pow(clamp(dot(reflect(-l, nn), viewDir), 0.0, 1.0), 32.0);\n"
+      "        result += (diffuseColor * nDotL + 0.04 * spec) * light.colorIntensity.rgb * (light.colorIntensity.a * attenuation);\n"
+      "    }\n"
+      "    return result;\n"
+      "}\n";
+
+// bindings must match shadow_map.cpp
+static std::string s_shadowDeclarations
+    = "layout(std140, binding = 1) uniform ShadowParams {  \n"
+      "    mat4 cascadeViewProjection[8];                  \n"
+      "    vec4 cascadeSplits[2];                          \n" // view depth far bound per cascade
+      "    vec4 shadowParams;                              \n" // num cascades, texel size
+      "};\n"
+      "layout(binding = 8) uniform sampler2DArrayShadow shadowMap;\n"
+
+      "float shadowFactor(vec3 nn)\n"
+      "{\n"
+      "    float viewZ = -(view * vs.wp).z;\n"
+      "    int numCascades = int(shadowParams.x);\n"
+      "    int cascade = 0;\n"
+      "    while (cascade < numCascades && viewZ > cascadeSplits[cascade / 4][cascade % 4])\n"
+      "        cascade++;\n"
+      "    if (cascade == numCascades)\n"
+      "        return 1.0;\n"
+      "    vec4 p = cascadeViewProjection[cascade] * vs.wp;\n" // orthographic, w == 1
+      "    p.xyz = p.xyz * 0.5 + 0.5;\n"
+      "    float bias = 0.0005 * (1.0 - abs(dot(nn, normalize(lightDir))));\n"
+      "    float texel = shadowParams.y;\n"
+      "    float lit = 0.0;\n"
+      "    for (int y = -1; y <= 1; ++y)\n" // 3x3 PCF on top of hardware 2x2
+      "        for (int x = -1; x <= 1; ++x)\n"
+      "            lit += texture(shadowMap, vec4(p.xy + vec2(x, y) * texel, cascade, p.z - bias));\n"
+      "    return lit / 9.0;\n"
+      "}\n";
+
+// SphereImpostor: fills vs as the vertex shader would for a mesh, so the shading
+// below is shared, and writes the depth of the hit. Color and depth-only programs
+// run the same code, so the depth pre-pass GL_EQUAL test passes. Inside the sphere
+// the back side is hit, as the two-sided mesh shows it
+static std::string getImpostorFragmentCode(ShaderFeature features)
 {
-    return s_version
-
-        + commonUniformBlock()
+    const bool material = hasFeature(features, ShaderFeature::MaterialTable) && !hasFeature(features, ShaderFeature::DepthOnly);
+    return std::string("in IMPOSTOR_OUT {      \n"
+                       "  vec3 rayOrigin;       \n"
+                       "  vec3 rayDir;          \n"
+                       "  flat vec4 sphere;     \n")
+        + (material ? "  flat uint material;   \n" : "")
+        + "} impostor;             \n"
+          "struct ImpostorSurface { vec4 wp; vec3 n; uint material; };\n"
+          "ImpostorSurface vs;\n"
+
+          "void traceImpostor()\n"
+          "{\n"
+          "    vec3 dir = normalize(impostor.rayDir);\n"
+          "    vec3 oc = impostor.rayOrigin - impostor.sphere.xyz;\n"
+          "    float b = dot(oc, dir);\n"
+          "    float h = b * b - dot(oc, oc) + impostor.sphere.w * impostor.sphere.w;\n"
+          "    if (h < 0.0)\n"
+          "        discard;\n"
+          "    float t = -b - sqrt(h);\n"
+          "    if (t < 0.0)\n"
+          "        t = -b + sqrt(h);\n"
+          "    vec3 p = impostor.rayOrigin + dir * t;\n"
+          "    vec4 clip = projection * vec4(p, 1.0);\n"
+          "    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;\n"
+          "    mat3 invRotation = transpose(mat3(view));\n" // rigid view
+          "    vs.wp = vec4(invRotation * (p - view[3].xyz), 1.0);\n"
+          "    vs.n = invRotation * (p - impostor.sphere.xyz);\n"
+        + (material ? "    vs.material = impostor.material;\n" : "")
+        + "}\n";
+}
 
-        + "uniform vec3 viewPos;   \n"
-          "uniform vec3 lightDir = vec3(0, 1, 1);   \n"
-          "uniform vec3 diffuseColor;   \n"
+static std::string getFragmentCode(ShaderFeature features)
+{
+    const bool impostor = hasFeature(features, ShaderFeature::SphereImpostor);
+    const bool multiView = hasFeature(features, ShaderFeature::MultiView);
+    // fragments know their view by the layer or viewport they were routed to
+    const std::string selectView = multiView ? "    selectView(uint(multiViewParams.y != 0u ? gl_Layer : gl_ViewportIndex));\n" : "";
+    if (hasFeature(features, ShaderFeature::DepthOnly))
+        return impostor ? s_version + commonUniformBlock(features) + getImpostorFragmentCode(features) + "void main(){\n" + selectView + "    traceImpostor(); }\n"
+                        : s_version + "void main(){}\n";
 
-        + "in " + s_vsInOut +
+    const bool clusteredLights = hasFeature(features, ShaderFeature::ClusteredLights);
+    assert(!(clusteredLights && multiView)); // froxels are built for one camera
+    const bool shadows = hasFeature(features, ShaderFeature::Shadows);
+    const bool materialTable = hasFeature(features, ShaderFeature::MaterialTable);
+    const bool linearOutput = hasFeature(features, ShaderFeature::LinearOutput);
 
-        "layout(location = 0) out vec3 fragColor;   \n"
+    std::string result = s_version
 
-        + s_fresnelShlickFunction +
+        + commonUniformBlock(features)
 
-        "void main(){"
-        "    vec3 nn = normalize(vs.n);   \n"
-        "    vec3 viewDir = normalize(viewPos - vs.wp.xyz);   \n"
-        "    vec3 lDir = normalize(lightDir.rgb);   \n"
-        "    float lightDot = clamp(dot(lDir, nn), 0, 1);\n"
-        "    float viewDot = abs(dot(viewDir, nn));\n"
-        "    float spec = -dot(reflect(viewDir, nn), lDir);\n"
-        "    vec3 skyDir = vec3(0, 0, 1);\n"
+        + (multiView ? "" : "uniform vec3 viewPos;   \n")
+        + "uniform vec3 lightDir = vec3(0, 1, 1);   \n"
 
-        "    float skyReflection = dot(reflect(viewDir, nn), -skyDir);\n"
-        "    float skyDot = -dot(skyDir, nn);\n\n"
+        + (materialTable ? s_materialTableDeclarations
+                         : "uniform vec3 diffuseColor;   \n"
+                           "const float specularStrength = 0.01;   \n")
 
-        "    float fresnel = fresnelSchlick(viewDot, 0.04);\n"
-        "    float lightness =  /*shadow **/ lightDot;\n"
+        + (impostor ? getImpostorFragmentCode(features) : "in " + getVsInOut(features)) +
 
-        "    vec3 diffuse = lightness * diffuseColor;\n"
-        "    vec3 specular = 0.01 * lightness * vec3(1/(1-clamp(spec, 0,1))) * fresnel;\n"
-        "    float ambMultiplier = (1 - viewDot) * (1 - lightness) * 0 + pow(0.5 - skyDot * 0.5, 3);\n"
-        "    vec3 ambient = diffuseColor * (ambMultiplier * 0.1 + 0.1);\n"
-        "    vec3 skyColor = fract(clamp(1 - skyReflection, -0.5, 1.0)) * fresnel * vec3(0.7, 0.7, 1.0);\n"
-        "    fragColor = diffuse + specular + ambient + skyColor;\n"
+        "layout(location = 0) out vec3 fragColor;   \n"
 
-        "    fragColor = fragColor / (fragColor + vec3(1.0));\n"
-        "    fragColor = vec3(1) - pow(vec3(1) - fragColor, vec3(4));\n"
-        "}\n";
+        + s_fresnelShlickFunction;
+
+    if (clusteredLights)
+        result += s_clusteredLightsDeclarations;
+    if (shadows)
+        result += s_shadowDeclarations;
+    if (!linearOutput)
+        result += s_tonemapFunction;
+
+    result += "void main(){" + selectView;
+    if (impostor)
+        result += "    traceImpostor();   \n";
+    if (materialTable)
+        result += "    diffuseColor = materials[vs.material].diffuseSpecular.rgb;   \n"
+                  "    specularStrength = materials[vs.material].diffuseSpecular.a;   \n";
+    result += "    vec3 nn = normalize(vs.n);   \n"
+              "    vec3 viewDir = normalize(viewPos - vs.wp.xyz);   \n"
+              "    vec3 lDir = normalize(lightDir.rgb);   \n"
+              "    float lightDot = clamp(dot(lDir, nn), 0, 1);\n"
+              "    float viewDot = abs(dot(viewDir, nn));\n"
+              "    float spec = -dot(reflect(viewDir, nn), lDir);\n"
+              "    vec3 skyDir = vec3(0, 0, 1);\n"
+
+              "    float skyReflection = dot(reflect(viewDir, nn), -skyDir);\n"
+              "    float skyDot = -dot(skyDir, nn);\n\n"
+
+              "    float fresnel = fresnelSchlick(viewDot, 0.04);\n";
+
+    result += shadows ? "    float lightness = shadowFactor(nn) * lightDot;\n"
+                      : "    float lightness =  /*shadow **/ lightDot;\n";
+
+    result += "    vec3 diffuse = lightness * diffuseColor;\n"
+              "    vec3 specular = specularStrength * lightness * vec3(1/(1-clamp(spec, 0,1))) * fresnel;\n"
+              "    float ambMultiplier = (1 - viewDot) * (1 - lightness) * 0 + pow(0.5 - skyDot * 0.5, 3);\n"
+              "    vec3 ambient = diffuseColor * (ambMultiplier * 0.1 + 0.1);\n"
+              "    vec3 skyColor = fract(clamp(1 - skyReflection, -0.5, 1.0)) * fresnel * vec3(0.7, 0.7, 1.0);\n"
+              "    fragColor = diffuse + specular + ambient + skyColor;\n";
+
+    if (clusteredLights)
+        result += "    fragColor += clusteredLighting(nn, viewDir);\n";
+
+    if (!linearOutput)
+        result += "    fragColor = tonemap(fragColor);\n";
+    result += "}\n";
+    return result;
 }
 
-Shader::Shader(const VertexAttribData& vertData)
+Shader::Shader(const VertexAttribData& vertData, ShaderFeature features)
+    : m_shaderProgram(GL_Program::create())
+    , m_features(features)
 {
-    m_shaderProgram = glCreateProgram();
-    int vs = createShader(getVertexCode(vertData).c_str(), GL_VERTEX_SHADER);
-    int fs = createShader(getFragmentCode().c_str(), GL_FRAGMENT_SHADER);
+    int vs = createShader(getVertexCode(vertData, features).c_str(), GL_VERTEX_SHADER);
+    int fs = createShader(getFragmentCode(features).c_str(), GL_FRAGMENT_SHADER);
     glAttachShader(m_shaderProgram, vs);
     glAttachShader(m_shaderProgram, fs);
-    glLinkProgram(m_shaderProgram);
-
-    int success;
-    char infoLog[512];
-    glGetProgramiv(m_shaderProgram, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(m_shaderProgram, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
-                  << infoLog << std::endl;
-    }
+    linkProgram(m_shaderProgram);
     glDeleteShader(vs);
     glDeleteShader(fs);
 }
 
-Shader::~Shader()
+Shader::Shader(const std::string& vertexSource, const std::string& fragmentSource)
+    : m_shaderProgram(GL_Program::create())
+    , m_features(ShaderFeature::None)
 {
-    glDeleteProgram(m_shaderProgram);
+    int vs = createShader(vertexSource.c_str(), GL_VERTEX_SHADER);
+    int fs = createShader(fragmentSource.c_str(), GL_FRAGMENT_SHADER);
+    glAttachShader(m_shaderProgram, vs);
+    glAttachShader(m_shaderProgram, fs);
+    linkProgram(m_shaderProgram);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
 }
 
 void Shader::bind()
@@ -163,7 +526,42 @@ void Shader::bind()
     glUseProgram(m_shaderProgram);
 }
 
-int Shader::createShader(const char* shaderSource, int shaderType)
+ComputeShader::ComputeShader(const std::string& source)
+    : m_shaderProgram(GL_Program::create())
+{
+    int cs = createShader(source.c_str(), GL_COMPUTE_SHADER);
+    glAttachShader(m_shaderProgram, cs);
+    linkProgram(m_shaderProgram);
+    glDeleteShader(cs);
+}
+
+void ComputeShader::bind()
+{
+    glUseProgram(m_shaderProgram);
+}
+
+void ComputeShader::dispatch(uint32_t x, uint32_t y, uint32_t z)
+{
+    glUseProgram(m_shaderProgram);
+    glDispatchCompute(x, y, z);
+}
+
+static int linkProgram(int program)
+{
+    glLinkProgram(program);
+
+    int success;
+    char infoLog[512];
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n"
+                  << infoLog << std::endl;
+    }
+    return success;
+}
+
+static int createShader(const char* shaderSource, int shaderType)
 {
     int sh = glCreateShader(shaderType);
     glShaderSource(sh, 1, &shaderSource, NULL);
@@ -172,7 +570,9 @@ int Shader::createShader(const char* shaderSource, int shaderType)
     glGetShaderiv(sh, GL_COMPILE_STATUS, &success);
     if (!success) {
         char infoLog[512];
-        std::string shaderTypeName = shaderType == GL_VERTEX_SHADER ? "VERTEX" : "FRAGMENT";
+        std::string shaderTypeName = shaderType == GL_VERTEX_SHADER ? "VERTEX"
+            : shaderType == GL_FRAGMENT_SHADER                      ? "FRAGMENT"
+                                                                    : "COMPUTE";
         glGetShaderInfoLog(sh, 512, NULL, infoLog);
         std::cout << shaderSource << std::endl;
         std::cout << "ERROR::SHADER::" << shaderTypeName << "::COMPILATION_FAILED\n"
@@ -1,32 +1,74 @@
 #ifndef SHADER_H
 #define SHADER_H
+#include "gl_handle.h"
 #include "mesh_attributes.h"
 #include <glm/glm.hpp>
+#include <string>
+
+// clang-format off
+enum class ShaderFeature : uint32_t {
+    None            = 0,
+    DepthOnly       = 1 << 0, // position-only program, no fragment shading (depth pre-pass)
+    ClusteredLights = 1 << 1, // point lights from ClusteredLighting froxel lists
+    Shadows         = 1 << 2, // lightDir shadowed by CascadedShadowMap
+    MaterialTable   = 1 << 3, // diffuseColor from MaterialTable by per-instance index, not uniform
+    Skinning        = 1 << 4, // joints/weights attributes posed by AnimationPalette at animationTime
+    LinearOutput    = 1 << 5, // HDR radiance out, tonemapped later by DynamicResolution::present
+    SphereImpostor  = 1 << 6, // ray traced bounding sphere per instance, GL_InstancedMesh::setSphereImpostors
+    VertexPulling   = 1 << 7, // attributes fetched from GL_MeshPool storage buffers, any vertex layout
+    MultiView       = 1 << 8, // view of gl_InstanceID % numViews from MultiView, GL_InstancedMesh::drawMultiView
+}; // clang-format on
+
+// GLSL "vec3 tonemap(vec3 hdr)", inlined by programs without ShaderFeature::LinearOutput
+const char* getTonemapFunction();
+
+inline ShaderFeature operator|(ShaderFeature a, ShaderFeature b) { return ShaderFeature((uint32_t)a | (uint32_t)b); }
+inline bool hasFeature(ShaderFeature features, ShaderFeature f) { return ((uint32_t)features & (uint32_t)f) != 0; }
+
+// "layout (location = 0) in vec3 vertexPosition;\n..." for the attributes the features
+// read; VertexLayout::getShaderDeclarations() must give the same text for its layout
+std::string getVertexAttributeDeclarations(const VertexAttribData& vertData, ShaderFeature features = ShaderFeature::None);
 
 class Shader {
 public:
     struct ShaderVariable {
-        ShaderVariable(const Shader& parent, const char* name);
+        ShaderVariable(int program, const char* name);
         void set(float var);
+        void set(int var);
+        void set(uint32_t var);
         void set(const glm::vec2& var);
         void set(const glm::vec3& var);
         void set(const glm::vec4& var);
+        void set(const glm::ivec2& var);
         void set(const glm::mat4& var);
+        void set(const glm::vec4* var, int count);
 
     private:
-        const Shader& parentShader;
         int location {};
     };
 
-    Shader(const VertexAttribData& vertData);
-    ~Shader();
-    ShaderVariable getVariable(const char* varName) const { return ShaderVariable(*this, varName); }
+    Shader(const VertexAttribData& vertData, ShaderFeature features = ShaderFeature::None);
+    Shader(const std::string& vertexSource, const std::string& fragmentSource); // hand-written programs
+    ShaderVariable getVariable(const char* varName) const { return ShaderVariable(m_shaderProgram, varName); }
+    int getProgram() const { return m_shaderProgram; }
+    ShaderFeature getFeatures() const { return m_features; }
+    void bind();
+
+private:
+    GL_Program m_shaderProgram;
+    const ShaderFeature m_features;
+};
+
+class ComputeShader {
+public:
+    ComputeShader(const std::string& source);
+    Shader::ShaderVariable getVariable(const char* varName) const { return Shader::ShaderVariable(m_shaderProgram, varName); }
     int getProgram() const { return m_shaderProgram; }
     void bind();
+    void dispatch(uint32_t x, uint32_t y = 1, uint32_t z = 1); // in work groups, binds program
 
 private:
-    int m_shaderProgram = -1;
-    int createShader(const char* shaderSource, int shaderType);
+    GL_Program m_shaderProgram;
 };
 
 #endif // SHADER_H
@@ -0,0 +1,184 @@
+#include "shadow_map.h"
+#include "camera.h"
+#include "profiler.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+// must match s_shadowDeclarations in shader.cpp
+static constexpr uint32_t s_paramsBinding = 1; // uniform block
+static constexpr uint32_t s_textureUnit = 8;
+
+static constexpr float s_cacheMargin = 0.5f; // cached cascades are rendered this much bigger
+
+struct ShadowParams { // std140
+    glm::mat4 viewProjection[CascadedShadowMap::s_maxCascades];
+    float splits[CascadedShadowMap::s_maxCascades]; // packed as vec4[2]
+    glm::vec4 params; // num cascades, texel size
+};
+
+static const char* s_cascadeNames[CascadedShadowMap::s_maxCascades] = {
+    "shadow 0", "shadow 1", "shadow 2", "shadow 3", "shadow 4", "shadow 5", "shadow 6", "shadow 7"
+};
+
+CascadedShadowMap::CascadedShadowMap(const ShadowConfig& config)
+    : m_FBO(GL_Framebuffer::create())
+    , m_paramsUBO(GL_Buffer::create())
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, m_paramsUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ShadowParams), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    setConfig(config);
+}
+
+void CascadedShadowMap::setConfig(const ShadowConfig& config)
+{
+    assert(config.numCascades >= 1 && config.numCascades <= s_maxCascades);
+    assert(config.numCachedCascades < config.numCascades); // nearest cascade is always dynamic
+    m_config = config;
+    createTargets();
+}
+
+void CascadedShadowMap::createTargets()
+{
+    m_depthTexture = GL_Texture::create();
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_depthTexture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, m_config.resolution, m_config.resolution, m_config.numCascades);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    const float border[4] = { 1.f, 1.f, 1.f, 1.f };
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    for (auto& cascade : m_cascades)
+        cascade.valid = false;
+}
+
+void CascadedShadowMap::render(const Camera& camera, const glm::vec3& lightDir, const DrawCasters& drawCasters, Profiler* profiler)
+{
+    const glm::vec3 dir = glm::normalize(lightDir);
+    if (dir != m_lightDir) {
+        m_lightDir = dir;
+        for (auto& cascade : m_cascades)
+            cascade.valid = false;
+    }
+    if (m_staticDirty) {
+        for (auto& cascade : m_cascades)
+            cascade.valid = false;
+        m_staticDirty = false;
+    }
+
+    const uint32_t numCascades = m_config.numCascades;
+    const float near = camera.getNear();
+    const float far = std::min(camera.getFar(), m_config.maxDistance);
+    const float tanY = tanf(camera.getFOV() * 0.5f), tanX = tanY * camera.getAR();
+    const glm::mat4 invView = glm::inverse(camera.getView());
+
+    // rotation only, translation is applied after texel snapping
+    const glm::vec3 up = fabsf(dir.z) > 0.99f ? glm::vec3(0, 1, 0) : glm::vec3(0, 0, 1);
+    const glm::mat4 lightRotation = glm::lookAt(glm::vec3(0), -dir, up);
+
+    GLint prevViewport[4] {}, prevFramebuffer {};
+    glGetIntegerv(GL_VIEWPORT, prevViewport);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevFramebuffer);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_FBO);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glViewport(0, 0, m_config.resolution, m_config.resolution);
+    glEnable(GL_DEPTH_CLAMP); // casters in front of the cascade are flattened onto near plane
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.f, 4.f);
+
+    ShadowParams params {};
+    float sliceNear = near;
+    m_numRendered = 0;
+    for (uint32_t i = 0; i < numCascades; ++i) {
+        Cascade& cascade = m_cascades[i];
+        const float t = float(i + 1) / numCascades;
+        const float sliceFar = glm::mix(near + (far - near) * t, near * powf(far / near, t), m_config.splitLambda);
+
+        // bounding sphere of the frustum slice
+        glm::vec3 corners[8];
+        glm::vec3 center(0);
+        for (int c = 0; c < 8; ++c) {
+            float z = (c & 4) ? sliceFar : sliceNear;
+            glm::vec4 viewCorner((c & 1 ? 1.f : -1.f) * z * tanX, (c & 2 ? 1.f : -1.f) * z * tanY, -z, 1.f);
+            corners[c] = glm::vec3(invView * viewCorner);
+            center += corners[c] / 8.f;
+        }
+        float radius = 0.f;
+        for (const auto& corner : corners)
+            radius = std::max(radius, glm::distance(corner, center));
+        radius = ceilf(radius * 16.f) / 16.f; // keeps texel size constant while camera rotates
+
+        const bool isCached = i >= numCascades - m_config.numCachedCascades;
+        if (isCached) {
+            // reused while this frame's slice stays inside the sphere the map was rendered for,
+            // a slice grown by resize, FOV or near/far change is rendered again
+            if (cascade.valid && glm::distance(center, cascade.cachedCenter) + radius <= cascade.cachedRadius) {
+                params.viewProjection[i] = cascade.viewProjection;
+                params.splits[i] = cascade.farDepth = sliceFar;
+                sliceNear = sliceFar;
+                continue;
+            }
+            radius *= 1.f + s_cacheMargin;
+            cascade.cachedCenter = center;
+            cascade.cachedRadius = radius;
+        }
+
+        // snap to texels in light space
+        const float texelSize = 2.f * radius / m_config.resolution;
+        glm::vec3 lightCenter = glm::vec3(lightRotation * glm::vec4(center, 1.f));
+        lightCenter.x = floorf(lightCenter.x / texelSize) * texelSize;
+        lightCenter.y = floorf(lightCenter.y / texelSize) * texelSize;
+
+        const glm::mat4 projection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius,
+            lightCenter.y - radius, lightCenter.y + radius, -lightCenter.z - radius, -lightCenter.z + radius);
+
+        cascade.viewProjection = projection * lightRotation;
+        cascade.farDepth = sliceFar;
+        cascade.valid = true;
+        params.viewProjection[i] = cascade.viewProjection;
+        params.splits[i] = sliceFar;
+        sliceNear = sliceFar;
+
+        if (profiler)
+            profiler->begin(s_cascadeNames[i], Profiler::Type::TimeElapsed);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_depthTexture, 0, i);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        drawCasters(lightRotation, projection, isCached);
+        if (profiler)
+            profiler->end(s_cascadeNames[i]);
+        m_numRendered++;
+    }
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glDisable(GL_DEPTH_CLAMP);
+    glBindFramebuffer(GL_FRAMEBUFFER, prevFramebuffer);
+    glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+
+    params.params = glm::vec4((float)numCascades, 1.f / m_config.resolution, 0.f, 0.f);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_paramsUBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(params), &params);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void CascadedShadowMap::bind() const
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, s_paramsBinding, m_paramsUBO);
+    glActiveTexture(GL_TEXTURE0 + s_textureUnit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_depthTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
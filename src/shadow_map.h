@@ -0,0 +1,69 @@
+#ifndef SHADOW_MAP_H
+#define SHADOW_MAP_H
+
+#include "gl_handle.h"
+
+#include <cstdint> // uintXX_t
+#include <functional>
+#include <glm/glm.hpp>
+
+class Camera;
+class Profiler;
+
+struct ShadowConfig {
+    uint32_t resolution = 2048; // per cascade
+    uint32_t numCascades = 4; // up to CascadedShadowMap::s_maxCascades
+    uint32_t numCachedCascades = 2; // farthest cascades, re-rendered only when invalidated
+    float maxDistance = 60.f; // shadowed range from camera
+    float splitLambda = 0.75f; // 0 - uniform, 1 - logarithmic splits
+};
+
+// Cascaded shadow map for a directional light, cascades are bounding spheres
+// of camera frustum slices, snapped to shadow texels so they don't shimmer.
+// Cached cascades are rendered with a margin and kept while the slice stays
+// inside it, the light doesn't turn and static geometry isn't marked dirty.
+class CascadedShadowMap {
+public:
+    static constexpr uint32_t s_maxCascades = 8;
+
+    // draws shadow casters with a depth-only program; cached == true means the
+    // result is kept for next frames, so only static geometry should be drawn
+    typedef std::function<void(const glm::mat4& view, const glm::mat4& projection, bool cached)> DrawCasters;
+
+    CascadedShadowMap(const ShadowConfig& config = {});
+    CascadedShadowMap(const CascadedShadowMap&) = delete;
+    CascadedShadowMap& operator=(const CascadedShadowMap&) = delete;
+
+    void setConfig(const ShadowConfig& config);
+    const ShadowConfig& getConfig() const { return m_config; }
+    void markStaticGeometryDirty() { m_staticDirty = true; }
+
+    // lightDir points towards the light; profiler gets "shadow N" timings
+    void render(const Camera& camera, const glm::vec3& lightDir, const DrawCasters& drawCasters, Profiler* profiler = nullptr);
+    void bind() const; // before drawing with ShaderFeature::Shadows
+
+    uint32_t getNumRenderedCascades() const { return m_numRendered; } // during last render()
+
+private:
+    struct Cascade {
+        glm::mat4 viewProjection { 1 };
+        glm::vec3 cachedCenter {};
+        float cachedRadius {}; // inflated, the map covers slices within it
+        float farDepth {}; // view space split
+        bool valid {};
+    };
+
+    void createTargets();
+
+    ShadowConfig m_config;
+    Cascade m_cascades[s_maxCascades];
+    glm::vec3 m_lightDir {};
+    bool m_staticDirty = true;
+    uint32_t m_numRendered {};
+
+    GL_Texture m_depthTexture;
+    GL_Framebuffer m_FBO;
+    GL_Buffer m_paramsUBO;
+};
+
+#endif // SHADOW_MAP_H
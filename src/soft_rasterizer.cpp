@@ -0,0 +1,320 @@
+#include "soft_rasterizer.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+
+static constexpr uint32_t s_noTriangle = ~0u;
+static constexpr uint32_t s_triangleBits = 24; // tile buffers store part << 24 | triangle
+
+void SoftRasterizer::resize(const glm::ivec2& size)
+{
+    if (size == m_size)
+        return;
+    assert(size.x > 0 && size.y > 0);
+    m_size = size;
+    m_numTiles = (size + glm::ivec2(s_tileSize - 1)) / glm::ivec2(s_tileSize);
+    m_pixels.assign((size_t)size.x * size.y, 0);
+    for (BinPart& part : m_parts)
+        part.bins.resize(m_numTiles.x * m_numTiles.y);
+}
+
+void SoftRasterizer::setCamera(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos)
+{
+    m_viewProjection = projection * view;
+    m_viewPos = viewPos;
+}
+
+void SoftRasterizer::draw(const MeshData& mesh, const std::vector<glm::mat4>& instances,
+    const std::vector<Material>& materials, const glm::mat4& model)
+{
+    assert(materials.size() == 1 || materials.size() == instances.size());
+    assert(mesh.getNumIndices() % 3 == 0);
+    m_draws.push_back({ &mesh, &instances, &materials, model, m_numVertices, m_numTriangles });
+    m_numVertices += mesh.getNumVertices() * instances.size();
+    m_numTriangles += mesh.getNumIndices() / 3 * instances.size();
+}
+
+void SoftRasterizer::transformVertices(const Draw& draw)
+{
+    const uint32_t numVertices = draw.mesh->getNumVertices();
+    const Vec3* positions = draw.mesh->getPositionsPtr();
+    const Vec3* normals = draw.mesh->getNormalsPtr();
+    const glm::mat3 normalMatrix(draw.model); // as the vertex shader, instance matrices are uniformly scaled
+
+    getJobSystem().parallelFor(numVertices * draw.instances->size(), 4 * 1024, [&](uint32_t first, uint32_t end) {
+        for (uint32_t i = first; i < end;) { // runs of one instance
+            const uint32_t instance = i / numVertices, firstVertex = i % numVertices;
+            const uint32_t count = std::min(end - i, numVertices - firstVertex);
+            const glm::mat4 world = draw.model * (*draw.instances)[instance];
+            const glm::mat4 clip = m_viewProjection * world;
+            const Vec3* p = positions + firstVertex;
+            const Vec3* n = normals + firstVertex;
+
+            // one output array per matrix row, the loop vectorizes over vertices
+            const uint32_t out = draw.firstVertex + i;
+            float *x = &m_clipX[out], *y = &m_clipY[out], *z = &m_clipZ[out], *w = &m_clipW[out];
+            for (uint32_t v = 0; v < count; ++v) {
+                x[v] = clip[0][0] * p[v].x + clip[1][0] * p[v].y + clip[2][0] * p[v].z + clip[3][0];
+                y[v] = clip[0][1] * p[v].x + clip[1][1] * p[v].y + clip[2][1] * p[v].z + clip[3][1];
+                z[v] = clip[0][2] * p[v].x + clip[1][2] * p[v].y + clip[2][2] * p[v].z + clip[3][2];
+                w[v] = clip[0][3] * p[v].x + clip[1][3] * p[v].y + clip[2][3] * p[v].z + clip[3][3];
+            }
+            glm::vec3* worldPos = &m_world[out];
+            glm::vec3* worldNormal = &m_normals[out];
+            for (uint32_t v = 0; v < count; ++v) {
+                worldPos[v] = glm::vec3(world * glm::vec4(p[v], 1.f));
+                worldNormal[v] = normalMatrix * n[v];
+            }
+            i += count;
+        }
+    });
+}
+
+void SoftRasterizer::setupTriangle(BinPart& part, const ClipVertex* v, const Material* material)
+{
+    glm::vec2 screen[3];
+    Triangle tri;
+    for (int i = 0; i < 3; ++i) {
+        const float invW = 1.f / v[i].clip.w;
+        screen[i] = glm::vec2(v[i].clip.x * invW * 0.5f + 0.5f, 0.5f - v[i].clip.y * invW * 0.5f) * glm::vec2(m_size);
+        tri.depth[i] = v[i].clip.z * invW * 0.5f + 0.5f;
+        tri.invW[i] = invW;
+        tri.world[i] = v[i].world;
+        tri.normal[i] = v[i].normal;
+    }
+
+    float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) - (screen[1].y - screen[0].y) * (screen[2].x - screen[0].x);
+    if (!(fabsf(area) > 1e-8f)) // degenerate, or NaN
+        return;
+    if (area < 0.f) { // no face culling, as the GL path; make the winding positive
+        std::swap(screen[1], screen[2]);
+        std::swap(tri.depth[1], tri.depth[2]);
+        std::swap(tri.invW[1], tri.invW[2]);
+        std::swap(tri.world[1], tri.world[2]);
+        std::swap(tri.normal[1], tri.normal[2]);
+        area = -area;
+    }
+
+    const glm::vec2 minPos = glm::min(screen[0], glm::min(screen[1], screen[2]));
+    const glm::vec2 maxPos = glm::max(screen[0], glm::max(screen[1], screen[2]));
+    // pixels whose centers are in the bounds, clamped to the screen before the int conversion
+    tri.minX = (int32_t)ceilf(glm::clamp(minPos.x - 0.5f, 0.f, (float)m_size.x));
+    tri.minY = (int32_t)ceilf(glm::clamp(minPos.y - 0.5f, 0.f, (float)m_size.y));
+    tri.maxX = (int32_t)floorf(glm::clamp(maxPos.x - 0.5f, -1.f, m_size.x - 1.f));
+    tri.maxY = (int32_t)floorf(glm::clamp(maxPos.y - 0.5f, -1.f, m_size.y - 1.f));
+    if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+        return;
+
+    for (int i = 0; i < 3; ++i) { // edge opposite to vertex i, normalized so it's 1 at the vertex
+        const glm::vec2 a = screen[(i + 1) % 3], b = screen[(i + 2) % 3];
+        tri.edges[i] = glm::vec3(a.y - b.y, b.x - a.x, (b.y - a.y) * a.x - (b.x - a.x) * a.y) / area;
+    }
+    tri.material = material;
+
+    const uint32_t index = part.triangles.size();
+    assert(index < (1u << s_triangleBits));
+    part.triangles.push_back(tri);
+    for (int32_t ty = tri.minY / s_tileSize; ty <= tri.maxY / (int32_t)s_tileSize; ++ty)
+        for (int32_t tx = tri.minX / s_tileSize; tx <= tri.maxX / (int32_t)s_tileSize; ++tx)
+            part.bins[ty * m_numTiles.x + tx].push_back(index);
+}
+
+void SoftRasterizer::binTriangles(BinPart& part, uint32_t first, uint32_t end)
+{
+    part.triangles.clear();
+    for (auto& bin : part.bins)
+        bin.clear();
+    if (first == end)
+        return;
+
+    uint32_t d = std::upper_bound(m_draws.begin(), m_draws.end(), first,
+                     [](uint32_t triangle, const Draw& draw) { return triangle < draw.firstTriangle; })
+        - m_draws.begin() - 1;
+    for (uint32_t g = first; g < end; ++g) {
+        while (d + 1 < m_draws.size() && g >= m_draws[d + 1].firstTriangle)
+            d++;
+        const Draw& draw = m_draws[d];
+        const uint32_t numTriangles = draw.mesh->getNumIndices() / 3;
+        const uint32_t instance = (g - draw.firstTriangle) / numTriangles;
+        const VertIndex* indices = draw.mesh->getIndicesPtr() + (g - draw.firstTriangle) % numTriangles * 3;
+        const uint32_t base = draw.firstVertex + instance * draw.mesh->getNumVertices();
+
+        ClipVertex v[3];
+        uint32_t outside[6] {}; // vertices beyond -x, +x, -y, +y, -z (near), +z (far)
+        for (int i = 0; i < 3; ++i) {
+            const uint32_t k = base + indices[i];
+            v[i] = { glm::vec4(m_clipX[k], m_clipY[k], m_clipZ[k], m_clipW[k]), m_world[k], m_normals[k] };
+            const glm::vec4& c = v[i].clip;
+            outside[0] += c.x < -c.w, outside[1] += c.x > c.w;
+            outside[2] += c.y < -c.w, outside[3] += c.y > c.w;
+            outside[4] += c.z < -c.w, outside[5] += c.z > c.w;
+        }
+        if (std::find(outside, outside + 6, 3u) != outside + 6)
+            continue; // all vertices beyond one plane
+
+        const Material* material = &(*draw.materials)[draw.materials->size() == 1 ? 0 : instance];
+        if (!outside[4]) {
+            setupTriangle(part, v, material);
+            continue;
+        }
+
+        // near plane clipping (z + w >= 0), one or two triangles remain
+        ClipVertex polygon[4];
+        uint32_t numPolygon = 0;
+        for (int i = 0; i < 3; ++i) {
+            const ClipVertex &a = v[i], &b = v[(i + 1) % 3];
+            const float da = a.clip.z + a.clip.w, db = b.clip.z + b.clip.w;
+            if (da >= 0.f)
+                polygon[numPolygon++] = a;
+            if ((da >= 0.f) != (db >= 0.f)) { // attributes are linear in clip space
+                const float t = da / (da - db);
+                polygon[numPolygon++] = { glm::mix(a.clip, b.clip, t), glm::mix(a.world, b.world, t), glm::mix(a.normal, b.normal, t) };
+            }
+        }
+        for (uint32_t i = 2; i < numPolygon; ++i) {
+            const ClipVertex fan[3] = { polygon[0], polygon[i - 1], polygon[i] };
+            setupTriangle(part, fan, material);
+        }
+    }
+}
+
+glm::vec3 SoftRasterizer::shade(const glm::vec3& world, const glm::vec3& normal, const Material& material) const
+{
+    // port of the fragment shader in shader.cpp without clustered lights and shadows
+    const glm::vec3 nn = glm::normalize(normal);
+    const glm::vec3 viewDir = glm::normalize(m_viewPos - world);
+    const float lightDot = glm::clamp(glm::dot(m_lightDir, nn), 0.f, 1.f);
+    const float viewDot = fabsf(glm::dot(viewDir, nn));
+    const glm::vec3 reflected = glm::reflect(viewDir, nn);
+    const float spec = -glm::dot(reflected, m_lightDir);
+    const glm::vec3 skyDir(0, 0, 1);
+    const float skyReflection = glm::dot(reflected, -skyDir);
+    const float skyDot = -glm::dot(skyDir, nn);
+    const float fresnel = 0.04f + 0.96f * powf(1.f - viewDot, 5.f);
+
+    const float lightness = lightDot;
+    const glm::vec3 diffuse = lightness * material.diffuseColor;
+    const float specular = material.specular * lightness / (1.f - glm::clamp(spec, 0.f, 0.999f)) * fresnel; // GLSL: inf at 1
+    const float ambMultiplier = powf(0.5f - skyDot * 0.5f, 3.f);
+    const glm::vec3 ambient = material.diffuseColor * (ambMultiplier * 0.1f + 0.1f);
+    const glm::vec3 skyColor = glm::fract(glm::clamp(1.f - skyReflection, -0.5f, 1.f)) * fresnel * glm::vec3(0.7f, 0.7f, 1.f);
+    const glm::vec3 hdr = diffuse + glm::vec3(specular) + ambient + skyColor;
+
+    const glm::vec3 c = hdr / (hdr + 1.f); // tonemap() of shader.cpp
+    const glm::vec3 inverse = 1.f - c;
+    return 1.f - inverse * inverse * inverse * inverse;
+}
+
+static uint32_t packColor(const glm::vec3& color)
+{
+    const glm::uvec3 c(glm::clamp(color, 0.f, 1.f) * 255.f + 0.5f);
+    return 0xFF000000u | c.x << 16 | c.y << 8 | c.z;
+}
+
+uint32_t SoftRasterizer::rasterizeTile(uint32_t tile)
+{
+    const int32_t tileX = tile % m_numTiles.x * s_tileSize, tileY = tile / m_numTiles.x * s_tileSize;
+    const int32_t tileEndX = std::min<int32_t>(tileX + s_tileSize, m_size.x), tileEndY = std::min<int32_t>(tileY + s_tileSize, m_size.y);
+
+    float depth[s_tileSize * s_tileSize];
+    uint32_t ids[s_tileSize * s_tileSize];
+    std::fill(depth, depth + s_tileSize * s_tileSize, 1.f); // far plane
+    std::fill(ids, ids + s_tileSize * s_tileSize, s_noTriangle);
+
+    // visibility: nearest triangle per pixel, parts in order keep it deterministic
+    for (uint32_t p = 0; p < s_numBinParts; ++p) {
+        const BinPart& part = m_parts[p];
+        for (uint32_t index : part.bins[tile]) {
+            const Triangle& tri = part.triangles[index];
+            const uint32_t id = p << s_triangleBits | index;
+            const int32_t x0 = std::max(tri.minX, tileX), x1 = std::min(tri.maxX + 1, tileEndX);
+            const int32_t y0 = std::max(tri.minY, tileY), y1 = std::min(tri.maxY + 1, tileEndY);
+            for (int32_t y = y0; y < y1; ++y) {
+                const float py = y + 0.5f;
+                const float r0 = tri.edges[0].y * py + tri.edges[0].z;
+                const float r1 = tri.edges[1].y * py + tri.edges[1].z;
+                const float r2 = tri.edges[2].y * py + tri.edges[2].z;
+                float* rowDepth = depth + (y - tileY) * s_tileSize - tileX;
+                uint32_t* rowIds = ids + (y - tileY) * s_tileSize - tileX;
+                for (int32_t x = x0; x < x1; ++x) { // branchless, vectorizes
+                    const float px = x + 0.5f;
+                    const float l0 = tri.edges[0].x * px + r0, l1 = tri.edges[1].x * px + r1, l2 = tri.edges[2].x * px + r2;
+                    const float z = l0 * tri.depth[0] + l1 * tri.depth[1] + l2 * tri.depth[2];
+                    const bool pass = (l0 >= 0.f) & (l1 >= 0.f) & (l2 >= 0.f) & (z >= 0.f) & (z < rowDepth[x]);
+                    rowDepth[x] = pass ? z : rowDepth[x];
+                    rowIds[x] = pass ? id : rowIds[x];
+                }
+            }
+        }
+    }
+
+    // shading, once per covered pixel
+    const uint32_t clearColor = packColor(m_clearColor);
+    uint32_t shaded = 0;
+    for (int32_t y = tileY; y < tileEndY; ++y) {
+        const uint32_t* rowIds = ids + (y - tileY) * s_tileSize - tileX;
+        uint32_t* pixels = m_pixels.data() + (size_t)y * m_size.x;
+        for (int32_t x = tileX; x < tileEndX; ++x) {
+            if (rowIds[x] == s_noTriangle) {
+                pixels[x] = clearColor;
+                continue;
+            }
+            const Triangle& tri = m_parts[rowIds[x] >> s_triangleBits].triangles[rowIds[x] & ((1u << s_triangleBits) - 1)];
+            const glm::vec3 pixel(x + 0.5f, y + 0.5f, 1.f);
+            // perspective correct barycentrics
+            glm::vec3 b = glm::vec3(glm::dot(tri.edges[0], pixel), glm::dot(tri.edges[1], pixel), glm::dot(tri.edges[2], pixel)) * tri.invW;
+            b /= b.x + b.y + b.z;
+            const glm::vec3 world = b.x * tri.world[0] + b.y * tri.world[1] + b.z * tri.world[2];
+            const glm::vec3 normal = b.x * tri.normal[0] + b.y * tri.normal[1] + b.z * tri.normal[2];
+            pixels[x] = packColor(shade(world, normal, *tri.material));
+            shaded++;
+        }
+    }
+    return shaded;
+}
+
+void SoftRasterizer::finish()
+{
+    typedef std::chrono::steady_clock Clock;
+    auto elapsedMs = [](Clock::time_point start) { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); };
+    JobSystem& jobs = getJobSystem();
+
+    auto start = Clock::now();
+    for (auto* array : { &m_clipX, &m_clipY, &m_clipZ, &m_clipW })
+        array->resize(m_numVertices);
+    m_world.resize(m_numVertices);
+    m_normals.resize(m_numVertices);
+    for (const Draw& draw : m_draws)
+        transformVertices(draw);
+    m_stats.vertexTime += elapsedMs(start);
+
+    start = Clock::now();
+    jobs.parallelFor(s_numBinParts, 1, [&](uint32_t first, uint32_t end) {
+        for (uint32_t p = first; p < end; ++p)
+            binTriangles(m_parts[p], (uint64_t)m_numTriangles * p / s_numBinParts, (uint64_t)m_numTriangles * (p + 1) / s_numBinParts);
+    });
+    m_stats.binTime += elapsedMs(start);
+
+    start = Clock::now();
+    std::atomic<uint64_t> shaded {};
+    jobs.parallelFor(m_numTiles.x * m_numTiles.y, 1, [&](uint32_t first, uint32_t end) {
+        uint64_t count = 0;
+        for (uint32_t tile = first; tile < end; ++tile)
+            count += rasterizeTile(tile);
+        shaded += count;
+    });
+    m_stats.rasterTime += elapsedMs(start);
+
+    m_stats.frames++;
+    m_stats.triangles += m_numTriangles;
+    for (const BinPart& part : m_parts)
+        m_stats.rasterTriangles += part.triangles.size();
+    m_stats.shadedPixels += shaded;
+
+    m_draws.clear();
+    m_numVertices = m_numTriangles = 0;
+}
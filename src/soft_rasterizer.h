@@ -0,0 +1,106 @@
+#ifndef SOFT_RASTERIZER_H
+#define SOFT_RASTERIZER_H
+
+#include "material.h"
+#include "meshdata.h"
+
+#include <cstdint> // uintXX_t
+#include <glm/glm.hpp>
+#include <vector>
+
+struct SoftRasterizerStats {
+    uint64_t frames {};
+    uint64_t triangles {}; // submitted
+    uint64_t rasterTriangles {}; // after clipping and culling
+    uint64_t shadedPixels {};
+    double vertexTime {}, binTime {}, rasterTime {}; // ms, summed over frames
+};
+
+// CPU backend for machines without a GPU, draws the same MeshData and instance
+// matrices as GL_InstancedMesh with the default program's shading (directional
+// light, Fresnel sky reflection, tonemap) into a memory framebuffer.
+// finish() runs the frame on the job system in three parallel passes:
+// vertices are transformed per instance into SoA arrays, triangles are
+// clipped against the near plane, set up and binned into screen tiles, then
+// every tile is rasterized into a tile-local depth and triangle id buffer and
+// each covered pixel is shaded once.
+class SoftRasterizer {
+public:
+    static constexpr uint32_t s_tileSize = 64;
+    static constexpr uint32_t s_numBinParts = 32; // binning jobs, each with own tile bins
+
+    SoftRasterizer() = default;
+    SoftRasterizer(const SoftRasterizer&) = delete;
+    SoftRasterizer& operator=(const SoftRasterizer&) = delete;
+
+    void resize(const glm::ivec2& size);
+    void setClearColor(const glm::vec3& color) { m_clearColor = color; }
+    void setCamera(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos);
+    void setLightDir(const glm::vec3& lightDir) { m_lightDir = glm::normalize(lightDir); }
+
+    // materials - one for all instances or one per instance; mesh, instances and
+    // materials are referenced until finish()
+    void draw(const MeshData& mesh, const std::vector<glm::mat4>& instances,
+        const std::vector<Material>& materials, const glm::mat4& model = glm::mat4(1));
+    void finish(); // renders queued draws
+
+    const uint32_t* getPixels() const { return m_pixels.data(); } // 0xAARRGGBB, rows top to bottom
+    glm::ivec2 getSize() const { return m_size; }
+
+    const SoftRasterizerStats& getStats() const { return m_stats; }
+    void resetStats() { m_stats = {}; }
+
+private:
+    struct Draw {
+        const MeshData* mesh;
+        const std::vector<glm::mat4>* instances;
+        const std::vector<Material>* materials;
+        glm::mat4 model;
+        uint32_t firstVertex, firstTriangle; // in the frame
+    };
+
+    struct ClipVertex {
+        glm::vec4 clip;
+        glm::vec3 world, normal;
+    };
+
+    struct Triangle {
+        glm::vec3 edges[3]; // barycentric i = dot(edges[i], (x, y, 1)) at pixel centers
+        glm::vec3 depth; // ndc, [0, 1]
+        glm::vec3 invW;
+        glm::vec3 world[3], normal[3];
+        const Material* material;
+        int32_t minX, minY, maxX, maxY; // pixels, inclusive
+    };
+
+    struct BinPart {
+        std::vector<Triangle> triangles;
+        std::vector<std::vector<uint32_t>> bins; // per tile, into triangles
+    };
+
+    void transformVertices(const Draw& draw);
+    void binTriangles(BinPart& part, uint32_t first, uint32_t end);
+    void setupTriangle(BinPart& part, const ClipVertex* v, const Material* material);
+    uint32_t rasterizeTile(uint32_t tile); // returns shaded pixels
+    glm::vec3 shade(const glm::vec3& world, const glm::vec3& normal, const Material& material) const;
+
+    glm::ivec2 m_size {}, m_numTiles {};
+    std::vector<uint32_t> m_pixels;
+    glm::vec3 m_clearColor { 0.08f, 0.08f, 0.1f };
+
+    glm::mat4 m_viewProjection { 1 };
+    glm::vec3 m_viewPos {};
+    glm::vec3 m_lightDir = glm::normalize(glm::vec3(0, 1, 1)); // default of "lightDir" in shader
+
+    std::vector<Draw> m_draws;
+    uint32_t m_numVertices {}, m_numTriangles {};
+
+    // transformed vertices of the frame, SoA
+    std::vector<float> m_clipX, m_clipY, m_clipZ, m_clipW;
+    std::vector<glm::vec3> m_world, m_normals;
+
+    BinPart m_parts[s_numBinParts];
+    SoftRasterizerStats m_stats;
+};
+
+#endif // SOFT_RASTERIZER_H
@@ -0,0 +1,147 @@
+#include "streaming_cache.h"
+
+#include <algorithm>
+#include <cassert>
+
+void StreamingCache::start(uint32_t numItems, uint32_t numSlots, Load load, Store store, Evict evict)
+{
+    assert(!m_worker.joinable() && numSlots > 0 && load && store);
+    m_load = std::move(load);
+    m_store = std::move(store);
+    m_evict = std::move(evict);
+    m_items.assign(numItems, ItemState());
+    m_slotItems.assign(numSlots, -1);
+    m_numFailed = 0;
+    m_quit = false;
+    m_worker = std::thread(&StreamingCache::workerLoop, this);
+}
+
+void StreamingCache::stop()
+{
+    if (!m_worker.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_requestReady.notify_one();
+    m_worker.join();
+}
+
+void StreamingCache::nextFrame()
+{
+    m_frame++;
+}
+
+int32_t StreamingCache::use(uint32_t item)
+{
+    ItemState& state = m_items[item];
+    state.lastUsed = m_frame;
+    return state.slot;
+}
+
+void StreamingCache::request(const uint32_t* items, uint32_t count)
+{
+    uint32_t maxRequests = 0;
+    for (int32_t item : m_slotItems)
+        maxRequests += item < 0 || m_items[item].lastUsed != m_frame;
+    maxRequests = std::min(maxRequests, s_maxRequests);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (uint32_t item : m_requests) // not started yet, superseded
+            m_items[item].pending = false;
+        m_requests.clear();
+        for (uint32_t i = 0; i < count && m_requests.size() < maxRequests; ++i) {
+            ItemState& state = m_items[items[i]];
+            if (state.slot >= 0 || state.pending || state.failed)
+                continue;
+            m_requests.push_back(items[i]);
+            state.pending = true;
+        }
+    }
+    m_requestReady.notify_one();
+}
+
+int32_t StreamingCache::acquireSlot()
+{
+    int32_t lru = -1;
+    for (uint32_t slot = 0; slot < m_slotItems.size(); ++slot) {
+        const int32_t item = m_slotItems[slot];
+        if (item < 0)
+            return slot;
+        const uint32_t lastUsed = m_items[item].lastUsed;
+        if (lastUsed != m_frame && (lru < 0 || lastUsed < m_items[m_slotItems[lru]].lastUsed))
+            lru = slot;
+    }
+    if (lru >= 0) {
+        const uint32_t item = m_slotItems[lru];
+        m_items[item].slot = -1;
+        m_slotItems[lru] = -1;
+        if (m_evict)
+            m_evict(item, lru);
+        m_numEvicted++;
+    }
+    return lru;
+}
+
+void StreamingCache::store(uint32_t maxStores)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (LoadedItem& loaded : m_loaded) {
+            ItemState& state = m_items[loaded.item];
+            state.pending = false;
+            if (loaded.failed) { // a broken item would be requested every frame
+                state.failed = true;
+                m_numFailed++;
+                continue;
+            }
+            m_stores.push_back(std::move(loaded));
+        }
+        m_loaded.clear();
+    }
+
+    for (uint32_t stored = 0; stored < maxStores && !m_stores.empty();) {
+        const LoadedItem loaded = std::move(m_stores.front());
+        m_stores.pop_front();
+        ItemState& state = m_items[loaded.item];
+        if (state.slot >= 0 || state.lastUsed != m_frame)
+            continue; // not needed anymore, requested again when it is
+        const int32_t slot = acquireSlot();
+        if (slot < 0)
+            continue; // every slot holds an item of this frame
+        m_store(loaded.item, slot, loaded.data);
+        m_slotItems[slot] = loaded.item;
+        state.slot = slot;
+        m_numLoaded++;
+        stored++;
+    }
+}
+
+uint32_t StreamingCache::getNumResident() const
+{
+    return m_slotItems.size() - std::count(m_slotItems.begin(), m_slotItems.end(), -1);
+}
+
+uint32_t StreamingCache::getNumPending() const
+{
+    return m_stores.size() + std::count_if(m_items.begin(), m_items.end(), [](const ItemState& state) { return state.pending; });
+}
+
+void StreamingCache::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_requestReady.wait(lock, [&]() { return m_quit || !m_requests.empty(); });
+        if (m_quit)
+            return;
+        LoadedItem loaded { m_requests.front(), {}, false };
+        m_requests.pop_front();
+
+        lock.unlock();
+        loaded.failed = !m_load(loaded.item, loaded.data);
+        lock.lock();
+
+        m_loaded.push_back(std::move(loaded));
+    }
+}
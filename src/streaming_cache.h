@@ -0,0 +1,90 @@
+#ifndef STREAMING_CACHE_H
+#define STREAMING_CACHE_H
+
+#include <condition_variable>
+#include <cstdint> // uintXX_t
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Streams items (terrain tiles, point cloud nodes) from disk into a fixed number of GPU
+// slots. A worker thread loads requested items, the owner's thread stores them into free
+// slots or ones of the least recently used items, a few per frame. Every frame the owner
+// marks the items it needs with use() and requests the missing ones, most important
+// first; items needed by the current frame are never evicted. Items that fail to load
+// aren't requested again until the next start().
+class StreamingCache {
+public:
+    // worker thread, false if the item can't be read
+    typedef std::function<bool(uint32_t item, std::vector<uint8_t>& data)> Load;
+    // owner's thread, e.g. uploads data to the slot
+    typedef std::function<void(uint32_t item, uint32_t slot, const std::vector<uint8_t>& data)> Store;
+    typedef std::function<void(uint32_t item, uint32_t slot)> Evict;
+
+    StreamingCache() = default;
+    StreamingCache(const StreamingCache&) = delete;
+    StreamingCache& operator=(const StreamingCache&) = delete;
+    ~StreamingCache() { stop(); }
+
+    void start(uint32_t numItems, uint32_t numSlots, Load load, Store store, Evict evict = {});
+    void stop(); // joins the worker, call before what load() reads goes away
+
+    void nextFrame();
+    // marks the item needed this frame, returns its slot, -1 if not resident
+    int32_t use(uint32_t item);
+    bool isUsed(uint32_t item) const { return m_items[item].lastUsed == m_frame; } // this frame
+    bool isPending(uint32_t item) const { return m_items[item].pending; } // requested or loading
+    bool isFailed(uint32_t item) const { return m_items[item].failed; } // load() returned false
+
+    // replaces the queued requests, no more than fit into free slots and ones of items
+    // not used this frame; items already resident, pending or failed are skipped
+    void request(const uint32_t* items, uint32_t count);
+    // stores up to maxStores loaded items still used this frame
+    void store(uint32_t maxStores);
+
+    uint32_t getNumSlots() const { return m_slotItems.size(); }
+    uint32_t getNumResident() const;
+    uint32_t getNumPending() const; // requested, loading or waiting for store()
+    uint64_t getNumLoaded() const { return m_numLoaded; } // since start()
+    uint64_t getNumEvicted() const { return m_numEvicted; }
+    uint32_t getNumFailed() const { return m_numFailed; }
+
+private:
+    static constexpr uint32_t s_maxRequests = 16; // queued for the worker
+
+    struct ItemState {
+        int32_t slot = -1; // -1 if not resident
+        uint32_t lastUsed {}; // frame
+        bool pending {};
+        bool failed {};
+    };
+    struct LoadedItem {
+        uint32_t item;
+        std::vector<uint8_t> data;
+        bool failed;
+    };
+
+    int32_t acquireSlot(); // free or least recently used slot, -1 if all are used this frame
+    void workerLoop();
+
+    Load m_load;
+    Store m_store;
+    Evict m_evict;
+    std::vector<ItemState> m_items;
+    std::vector<int32_t> m_slotItems; // item of each slot, -1 if free
+    std::deque<LoadedItem> m_stores; // loaded, waiting for store()
+    uint32_t m_frame {};
+    uint64_t m_numLoaded {}, m_numEvicted {};
+    uint32_t m_numFailed {};
+
+    std::mutex m_mutex;
+    std::condition_variable m_requestReady;
+    std::deque<uint32_t> m_requests; // guarded by m_mutex, most important first
+    std::vector<LoadedItem> m_loaded; // guarded by m_mutex
+    bool m_quit {}; // guarded by m_mutex
+    std::thread m_worker;
+};
+
+#endif // STREAMING_CACHE_H
@@ -0,0 +1,427 @@
+#include "terrain.h"
+#include "allocators.h"
+#include "camera.h"
+#include "job_system.h"
+#include "meshdata.h"
+#include "vertex_layout.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+
+typedef VertexLayout<Attr<VertexAttribute::Type::Position, MeshAttribFormat::Float3>> PatchLayout;
+
+// texture units, above CascadedShadowMap's
+static constexpr uint32_t s_overviewUnit = 10;
+static constexpr uint32_t s_tileArrayUnit = 11;
+static constexpr uint32_t s_pageTableUnit = 12;
+
+static constexpr float s_boundsPadding = 0.05f; // of heightScale, tiles go beyond the overview
+
+static const char* s_vertexSource = R"(#version 460 core
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 8) in mat4 instanceMatrix;
+layout(binding = 10) uniform sampler2D overview;
+layout(binding = 11) uniform sampler2DArray tiles;
+layout(binding = 12) uniform usampler2D pageTable; // slot + 1 of resident tiles, 0 otherwise
+uniform mat4 viewProjection;
+uniform vec3 cameraPos;
+uniform float heightDistance; // of the camera above or below the height range
+uniform vec4 terrain; // min corner xy, size, finest patch size
+uniform vec4 heights; // base height, height scale, overview samples, tile quads per side
+uniform vec4 lods; // patch quads per side, number of lods, morph end of lod 0, morph ratio
+out vec3 worldPos;
+out vec3 normal;
+
+float sampleHeight(vec2 g) // from the min corner
+{
+    vec2 uv = clamp(g / terrain.z, 0.0, 1.0);
+    ivec2 numTiles = textureSize(pageTable, 0);
+    vec2 tileCoord = uv * vec2(numTiles);
+    ivec2 tile = min(ivec2(tileCoord), numTiles - 1);
+    uint page = texelFetch(pageTable, tile, 0).r;
+    float h;
+    if (page > 0u) {
+        vec2 local = (tileCoord - vec2(tile)) * heights.w;
+        h = textureLod(tiles, vec3((local + 0.5) / (heights.w + 1.0), float(page - 1u)), 0.0).r;
+    } else {
+        h = textureLod(overview, (uv * (heights.z - 1.0) + 0.5) / heights.z, 0.0).r;
+    }
+    return heights.x + h * heights.y;
+}
+
+void main()
+{
+    float patchSize = 2.0 * instanceMatrix[0][0];
+    int lod = int(round(log2(patchSize / terrain.w)));
+    float spacing = patchSize / lods.x;
+    float morphEnd = lods.z * exp2(float(lod));
+    vec2 g = (instanceMatrix * vec4(vertexPosition, 1.0)).xy - terrain.xy;
+
+    // odd vertices slide onto their even neighbour, fully morphed ones go on with the
+    // next level; the result depends on the position only, so shared edges agree
+    for (int l = lod; l < int(lods.y) - 1; l++) {
+        float d = length(vec3(g + terrain.xy - cameraPos.xy, heightDistance));
+        float k = clamp((d - morphEnd * (1.0 - lods.w)) / (morphEnd * lods.w), 0.0, 1.0);
+        g -= mod(round(g / spacing), 2.0) * spacing * k;
+        if (k < 1.0)
+            break;
+        spacing *= 2.0;
+        morphEnd *= 2.0;
+    }
+
+    float h = sampleHeight(g);
+    vec2 dx = vec2(spacing, 0.0), dy = vec2(0.0, spacing);
+    vec2 slope = vec2(sampleHeight(g + dx) - sampleHeight(g - dx), sampleHeight(g + dy) - sampleHeight(g - dy));
+    normal = normalize(vec3(-slope, 2.0 * spacing));
+    worldPos = vec3(g + terrain.xy, h);
+    gl_Position = viewProjection * vec4(worldPos, 1.0);
+}
+)";
+
+static const char* s_fragmentSource = R"(#version 460 core
+uniform vec3 lightDir;
+uniform vec4 heights;
+in vec3 worldPos;
+in vec3 normal;
+layout(location = 0) out vec3 fragColor;
+
+void main()
+{
+    vec3 n = normalize(normal);
+    float steepness = 1.0 - n.z;
+    float height = (worldPos.z - heights.x) / heights.y;
+    vec3 albedo = mix(vec3(0.18, 0.3, 0.08), vec3(0.3, 0.27, 0.24), smoothstep(0.15, 0.35, steepness));
+    albedo = mix(albedo, vec3(0.9), smoothstep(0.7, 0.8, height) * (1.0 - smoothstep(0.3, 0.5, steepness)));
+    fragColor = albedo * (0.15 + 0.85 * max(dot(n, normalize(lightDir)), 0.0));
+}
+)";
+
+bool writeHeightmap(const std::string& path, uint32_t tiles, uint32_t tileSize, uint32_t overviewSize,
+    const std::function<float(float u, float v)>& height)
+{
+    assert(tiles > 0 && tileSize > 0 && overviewSize > 1);
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+    HeightmapHeader header;
+    header.tiles = tiles;
+    header.tileSize = tileSize;
+    header.overviewSize = overviewSize;
+    file.write((const char*)&header, sizeof(header));
+
+    auto sampleRows = [&](std::vector<uint16_t>& samples, uint32_t side, const glm::vec2& origin, float step) {
+        samples.resize(size_t(side) * side);
+        getJobSystem().parallelFor(side, 8, [&](uint32_t first, uint32_t end) {
+            for (uint32_t y = first; y < end; ++y)
+                for (uint32_t x = 0; x < side; ++x) {
+                    const float h = height(std::min(origin.x + x * step, 1.f), std::min(origin.y + y * step, 1.f));
+                    samples[size_t(y) * side + x] = uint16_t(std::clamp(h, 0.f, 1.f) * 65535.f + 0.5f);
+                }
+        });
+        file.write((const char*)samples.data(), samples.size() * sizeof(uint16_t));
+    };
+
+    std::vector<uint16_t> samples;
+    sampleRows(samples, overviewSize, glm::vec2(0), 1.f / (overviewSize - 1));
+    const float step = 1.f / (tiles * tileSize);
+    for (uint32_t y = 0; y < tiles; ++y)
+        for (uint32_t x = 0; x < tiles; ++x)
+            sampleRows(samples, tileSize + 1, glm::vec2(x, y) / float(tiles), step);
+    return (bool)file;
+}
+
+// runs in the initializer list, before patchResolution is narrowed to the uint8_t of MeshData
+static const TerrainConfig& checkConfig(const TerrainConfig& config)
+{
+    // even, so patch edges are even vertices; uint8_t of MeshData and Uint16 indices
+    assert(config.patchResolution >= 2 && config.patchResolution % 2 == 0 && config.patchResolution <= 254);
+    assert(config.numLods >= 1 && config.numLods <= 16);
+    assert(config.lodRange > 0.f && config.morphRatio > 0.f && config.morphRatio <= 1.f);
+    assert(config.residentTiles >= 1 && config.residentTiles < 65535);
+    return config;
+}
+
+Terrain::Terrain(const TerrainConfig& config)
+    : m_config(checkConfig(config))
+    , m_patchMesh(MeshData(MeshData::ParametricType::PlaneZ, uint8_t(m_config.patchResolution)), PatchLayout(),
+          MeshAttribFormat::Uint16, MeshAttribFormat::Mat4x4)
+    , m_shader(s_vertexSource, s_fragmentSource)
+    , m_viewProjection(m_shader.getVariable("viewProjection"))
+    , m_cameraPos(m_shader.getVariable("cameraPos"))
+    , m_heightDistance(m_shader.getVariable("heightDistance"))
+    , m_lightDir(m_shader.getVariable("lightDir"))
+    , m_terrainParams(m_shader.getVariable("terrain"))
+    , m_heightParams(m_shader.getVariable("heights"))
+    , m_lodParams(m_shader.getVariable("lods"))
+{
+}
+
+bool Terrain::open(const std::string& path)
+{
+    assert(!isOpen());
+    m_file.open(path, std::ios::binary);
+    HeightmapHeader header;
+    header.magic[0] = 0;
+    m_file.read((char*)&header, sizeof(header));
+    m_file.seekg(0, std::ios::end);
+    const size_t fileSize = m_file ? size_t(m_file.tellg()) : 0;
+    const size_t tileBytes = size_t(header.tileSize + 1) * (header.tileSize + 1) * sizeof(uint16_t);
+    m_tilesOffset = sizeof(header) + size_t(header.overviewSize) * header.overviewSize * sizeof(uint16_t);
+    std::vector<uint16_t> overview;
+    if (!memcmp(header.magic, HeightmapHeader().magic, sizeof(header.magic)) && header.tiles > 0 && header.tiles <= 4096
+        && header.tileSize > 0 && header.tileSize <= 4096 && header.overviewSize > 1 && header.overviewSize <= 16384
+        && fileSize >= m_tilesOffset + size_t(header.tiles) * header.tiles * tileBytes) {
+        overview.resize(size_t(header.overviewSize) * header.overviewSize);
+        m_file.seekg(sizeof(header));
+        m_file.read((char*)overview.data(), overview.size() * sizeof(uint16_t));
+    }
+    if (overview.empty() || !m_file) {
+        std::cout << "Terrain: can't read heightmap " << path << std::endl;
+        m_file.close();
+        return false;
+    }
+    m_tiles = header.tiles;
+    m_tileSize = header.tileSize;
+    m_overviewSize = header.overviewSize;
+    buildNodes(overview);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2); // rows of uint16 samples
+    m_overviewTexture = GL_Texture::create();
+    glBindTexture(GL_TEXTURE_2D, m_overviewTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R16, m_overviewSize, m_overviewSize);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_overviewSize, m_overviewSize, GL_RED, GL_UNSIGNED_SHORT, overview.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    const std::vector<uint16_t> noPages(size_t(m_tiles) * m_tiles, 0);
+    m_pageTable = GL_Texture::create();
+    glBindTexture(GL_TEXTURE_2D, m_pageTable);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R16UI, m_tiles, m_tiles);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_tiles, m_tiles, GL_RED_INTEGER, GL_UNSIGNED_SHORT, noPages.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    m_tileArray = GL_Texture::create();
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_tileArray);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R16, m_tileSize + 1, m_tileSize + 1, m_config.residentTiles);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    m_streaming.start(
+        m_tiles * m_tiles, m_config.residentTiles,
+        [this](uint32_t tile, std::vector<uint8_t>& samples) { return loadTile(tile, samples); },
+        [this](uint32_t tile, uint32_t slot, const std::vector<uint8_t>& samples) { uploadTile(tile, slot, samples); },
+        [this](uint32_t tile, uint32_t) { setPage(tile, 0); });
+    return true;
+}
+
+void Terrain::buildNodes(const std::vector<uint16_t>& overview)
+{
+    // finest nodes bound the overview samples they cover, the rest merge their children
+    const uint32_t samples = m_overviewSize - 1; // intervals per side
+    const float padding = s_boundsPadding * m_config.heightScale;
+    m_nodes.resize(m_config.numLods);
+    uint32_t nodesPerSide = 1u << (m_config.numLods - 1);
+    m_nodes[0].resize(size_t(nodesPerSide) * nodesPerSide);
+    for (uint32_t y = 0; y < nodesPerSide; ++y)
+        for (uint32_t x = 0; x < nodesPerSide; ++x) {
+            uint16_t minSample = 65535, maxSample = 0;
+            for (uint32_t j = y * samples / nodesPerSide; j <= ((y + 1) * samples + nodesPerSide - 1) / nodesPerSide; ++j)
+                for (uint32_t i = x * samples / nodesPerSide; i <= ((x + 1) * samples + nodesPerSide - 1) / nodesPerSide; ++i) {
+                    const uint16_t sample = overview[size_t(j) * m_overviewSize + i];
+                    minSample = std::min(minSample, sample);
+                    maxSample = std::max(maxSample, sample);
+                }
+            m_nodes[0][y * nodesPerSide + x] = { m_config.baseHeight + minSample / 65535.f * m_config.heightScale - padding,
+                m_config.baseHeight + maxSample / 65535.f * m_config.heightScale + padding };
+        }
+    for (uint32_t lod = 1; lod < m_config.numLods; ++lod) {
+        const std::vector<Node>& children = m_nodes[lod - 1];
+        nodesPerSide /= 2;
+        m_nodes[lod].resize(size_t(nodesPerSide) * nodesPerSide);
+        for (uint32_t y = 0; y < nodesPerSide; ++y)
+            for (uint32_t x = 0; x < nodesPerSide; ++x) {
+                Node& node = m_nodes[lod][y * nodesPerSide + x];
+                node = children[(2 * y) * (2 * nodesPerSide) + 2 * x];
+                for (uint32_t i = 1; i < 4; ++i) {
+                    const Node& child = children[(2 * y + (i >> 1)) * (2 * nodesPerSide) + 2 * x + (i & 1)];
+                    node.minHeight = std::min(node.minHeight, child.minHeight);
+                    node.maxHeight = std::max(node.maxHeight, child.maxHeight);
+                }
+            }
+    }
+}
+
+float Terrain::getRange(uint32_t lod) const
+{
+    const float finestSize = m_config.size / (1u << (m_config.numLods - 1));
+    return m_config.lodRange * finestSize * float(1u << lod);
+}
+
+float Terrain::getHeightDistance(const glm::vec3& cameraPos) const
+{
+    const float minHeight = m_config.baseHeight, maxHeight = m_config.baseHeight + m_config.heightScale;
+    return std::max({ minHeight - cameraPos.z, cameraPos.z - maxHeight, 0.f });
+}
+
+float Terrain::getDistance(const glm::vec2& min, const glm::vec2& max, const glm::vec3& cameraPos) const
+{
+    const glm::vec2 p(cameraPos);
+    const glm::vec2 d = glm::max(glm::max(min - p, p - max), glm::vec2(0));
+    return glm::length(glm::vec3(d, getHeightDistance(cameraPos)));
+}
+
+void Terrain::selectNode(uint32_t lod, uint32_t x, uint32_t y, const glm::vec4 planes[6], const glm::vec3& cameraPos)
+{
+    m_stats.visitedNodes++;
+    const uint32_t nodesPerSide = 1u << (m_config.numLods - 1 - lod);
+    const float nodeSize = m_config.size / nodesPerSide;
+    const glm::vec2 min = glm::vec2(-0.5f * m_config.size) + glm::vec2(x, y) * nodeSize, max = min + nodeSize;
+    const Node& node = m_nodes[lod][y * nodesPerSide + x];
+    for (uint32_t i = 0; i < 6; ++i) { // corner furthest along the plane normal
+        const glm::vec3 corner(planes[i].x > 0.f ? max.x : min.x, planes[i].y > 0.f ? max.y : min.y,
+            planes[i].z > 0.f ? node.maxHeight : node.minHeight);
+        if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0.f)
+            return;
+    }
+
+    if (lod > 0 && getDistance(min, max, cameraPos) < getRange(lod - 1)) {
+        for (uint32_t i = 0; i < 4; ++i)
+            selectNode(lod - 1, 2 * x + (i & 1), 2 * y + (i >> 1), planes, cameraPos);
+        return;
+    }
+    const glm::mat4 translation = glm::translate(glm::mat4(1), glm::vec3(0.5f * (min + max), 0.f));
+    m_patches.push_back(glm::scale(translation, glm::vec3(0.5f * nodeSize, 0.5f * nodeSize, 1.f)));
+}
+
+void Terrain::update(const Camera& camera)
+{
+    if (!isOpen())
+        return;
+    m_streaming.nextFrame();
+
+    glm::vec4 planes[6];
+    extractFrustumPlanes(camera.getProjection() * camera.getView(), planes);
+    m_patches.clear();
+    m_stats.visitedNodes = 0;
+    selectNode(m_config.numLods - 1, 0, 0, planes, camera.getPos());
+    m_stats.patches = m_patches.size();
+    m_patchMesh.setInstanceTransforms(m_patches);
+
+    requestTiles(camera.getPos());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2); // rows of uint16 samples
+    m_streaming.store(m_config.uploadsPerFrame);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void Terrain::requestTiles(const glm::vec3& cameraPos)
+{
+    // patches denser than the overview need the tiles under them
+    const float overviewSpacing = m_config.size / (m_overviewSize - 1);
+    const float tileExtent = m_config.size / m_tiles;
+    ScratchScope scratch;
+    ArenaVector<std::pair<float, uint32_t>> wanted(ArenaAllocator<std::pair<float, uint32_t>>(scratch.getArena())); // distance, tile
+    for (const glm::mat4& patch : m_patches) {
+        const float half = patch[0][0];
+        if (2.f * half / m_config.patchResolution >= overviewSpacing)
+            continue;
+        const glm::vec2 min = (glm::vec2(patch[3]) - half) / m_config.size + 0.5f;
+        const glm::vec2 max = (glm::vec2(patch[3]) + half) / m_config.size + 0.5f;
+        const glm::ivec2 first = glm::clamp(glm::ivec2(glm::floor(min * float(m_tiles))), 0, int(m_tiles) - 1);
+        const glm::ivec2 last = glm::clamp(glm::ivec2(glm::ceil(max * float(m_tiles))) - 1, 0, int(m_tiles) - 1);
+        for (int y = first.y; y <= last.y; ++y)
+            for (int x = first.x; x <= last.x; ++x) {
+                const uint32_t tile = y * m_tiles + x;
+                if (m_streaming.isUsed(tile))
+                    continue;
+                if (m_streaming.use(tile) < 0 && !m_streaming.isPending(tile) && !m_streaming.isFailed(tile)) {
+                    const glm::vec2 tileMin = glm::vec2(-0.5f * m_config.size) + glm::vec2(x, y) * tileExtent;
+                    wanted.push_back({ getDistance(tileMin, tileMin + tileExtent, cameraPos), tile });
+                }
+            }
+    }
+    std::sort(wanted.begin(), wanted.end());
+
+    ArenaVector<uint32_t> tiles(wanted.size(), ArenaAllocator<uint32_t>(scratch.getArena())); // nearest first
+    for (size_t i = 0; i < wanted.size(); ++i)
+        tiles[i] = wanted[i].second;
+    m_streaming.request(tiles.data(), tiles.size());
+}
+
+void Terrain::setPage(uint32_t tile, uint16_t page)
+{
+    glBindTexture(GL_TEXTURE_2D, m_pageTable);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, tile % m_tiles, tile / m_tiles, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_SHORT, &page);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Terrain::uploadTile(uint32_t tile, uint32_t slot, const std::vector<uint8_t>& samples)
+{
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_tileArray);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, slot, m_tileSize + 1, m_tileSize + 1, 1, GL_RED, GL_UNSIGNED_SHORT,
+        samples.data());
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    setPage(tile, slot + 1);
+}
+
+void Terrain::draw(const Camera& camera, const glm::vec3& lightDir)
+{
+    if (!isOpen() || m_patches.empty())
+        return;
+    m_shader.bind();
+    m_viewProjection.set(camera.getProjection() * camera.getView());
+    m_cameraPos.set(camera.getPos());
+    m_heightDistance.set(getHeightDistance(camera.getPos()));
+    m_lightDir.set(lightDir);
+    const float finestSize = m_config.size / (1u << (m_config.numLods - 1));
+    m_terrainParams.set(glm::vec4(glm::vec2(-0.5f * m_config.size), m_config.size, finestSize));
+    m_heightParams.set(glm::vec4(m_config.baseHeight, m_config.heightScale, m_overviewSize, m_tileSize));
+    m_lodParams.set(glm::vec4(m_config.patchResolution, m_config.numLods, getRange(0), m_config.morphRatio));
+
+    glActiveTexture(GL_TEXTURE0 + s_overviewUnit);
+    glBindTexture(GL_TEXTURE_2D, m_overviewTexture);
+    glActiveTexture(GL_TEXTURE0 + s_tileArrayUnit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_tileArray);
+    glActiveTexture(GL_TEXTURE0 + s_pageTableUnit);
+    glBindTexture(GL_TEXTURE_2D, m_pageTable);
+    glActiveTexture(GL_TEXTURE0);
+
+    m_patchMesh.draw();
+}
+
+TerrainStats Terrain::getStats() const
+{
+    TerrainStats stats = m_stats;
+    stats.residentTiles = m_streaming.getNumResident();
+    stats.pendingTiles = m_streaming.getNumPending();
+    stats.loadedTiles = m_streaming.getNumLoaded();
+    stats.evictedTiles = m_streaming.getNumEvicted();
+    return stats;
+}
+
+bool Terrain::loadTile(uint32_t tile, std::vector<uint8_t>& samples)
+{
+    const size_t tileBytes = size_t(m_tileSize + 1) * (m_tileSize + 1) * sizeof(uint16_t);
+    samples.resize(tileBytes);
+    m_file.clear();
+    m_file.seekg(m_tilesOffset + tile * tileBytes);
+    if (!m_file.read((char*)samples.data(), tileBytes)) {
+        std::cout << "Terrain: can't read tile " << tile << std::endl;
+        return false;
+    }
+    return true;
+}
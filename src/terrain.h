@@ -0,0 +1,112 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include "gl_handle.h"
+#include "mesh.h"
+#include "shader.h"
+#include "streaming_cache.h"
+
+#include <cstdint> // uintXX_t
+#include <fstream>
+#include <functional>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+class Camera;
+
+struct TerrainConfig {
+    float size = 2048.f; // side of the square, centered at the origin
+    float baseHeight = -28.f, heightScale = 80.f; // height = baseHeight + sample * heightScale
+    uint32_t patchResolution = 32; // quads per patch side, every patch is one PlaneZ grid
+    uint32_t numLods = 7; // quadtree depth, the finest patch is size / 2^(numLods - 1)
+    float lodRange = 4.f; // view distance of the finest level in its patch sizes, doubles per level
+    float morphRatio = 0.3f; // last fraction of a level's range morphing into the next one
+    uint32_t residentTiles = 64; // heightmap tiles in the GPU tile array
+    uint32_t uploadsPerFrame = 4; // tiles copied to the GPU by update()
+};
+
+struct TerrainStats {
+    uint32_t patches {}; // drawn instances
+    uint32_t visitedNodes {};
+    uint32_t residentTiles {};
+    uint32_t pendingTiles {}; // requested, loading or waiting for upload
+    uint64_t loadedTiles {}, evictedTiles {}; // since open()
+};
+
+// Heightmap file: HeightmapHeader, a uint16 overview of overviewSize^2 samples covering
+// the whole terrain, then tiles x tiles tiles row by row, (tileSize + 1)^2 uint16
+// samples each; neighbour tiles share their border samples
+struct HeightmapHeader {
+    char magic[4] = { 'H', 'M', 'A', 'P' };
+    uint32_t tiles {}; // per side
+    uint32_t tileSize {}; // quads per tile side
+    uint32_t overviewSize {}; // samples per side
+};
+
+// height(u, v) in [0, 1] for u, v in [0, 1] is sampled in parallel, false if the file can't be written
+bool writeHeightmap(const std::string& path, uint32_t tiles, uint32_t tileSize, uint32_t overviewSize,
+    const std::function<float(float u, float v)>& height);
+
+// Chunked LOD terrain: a quadtree over the heightmap, selected against the camera every
+// frame. Nodes within the range of the next finer level split, the rest are drawn as
+// instances of a single PlaneZ grid patch, so a frame costs one draw call and a patch
+// count set by the ranges, not by the terrain size. Heights are fetched by the vertex
+// shader. Vertices past a level's morph start slide onto the grid of the next coarser
+// level, by distance to their position alone, so neighbour patches of different levels
+// meet without cracks or pops. Tiles under fine patches stream from disk on a worker
+// thread into a GPU tile array with LRU eviction; a page table points the shader to
+// resident tiles, the rest of the terrain samples the overview.
+class Terrain {
+public:
+    Terrain(const TerrainConfig& config = {});
+    Terrain(const Terrain&) = delete;
+    Terrain& operator=(const Terrain&) = delete;
+
+    const TerrainConfig& getConfig() const { return m_config; }
+
+    bool open(const std::string& path); // false if the heightmap can't be read
+    bool isOpen() const { return m_tiles > 0; }
+
+    // selects patches, requests tiles around the camera and uploads loaded ones
+    void update(const Camera& camera);
+    // into the bound target, depth tested, radiance out (ShaderFeature::LinearOutput)
+    void draw(const Camera& camera, const glm::vec3& lightDir);
+
+    TerrainStats getStats() const;
+
+private:
+    struct Node {
+        float minHeight, maxHeight;
+    };
+
+    void buildNodes(const std::vector<uint16_t>& overview);
+    void selectNode(uint32_t lod, uint32_t x, uint32_t y, const glm::vec4 planes[6], const glm::vec3& cameraPos);
+    float getRange(uint32_t lod) const; // split distance of lod + 1 nodes
+    // to the xy rectangle, with the camera height above or below the height range, as in the shader
+    float getDistance(const glm::vec2& min, const glm::vec2& max, const glm::vec3& cameraPos) const;
+    float getHeightDistance(const glm::vec3& cameraPos) const;
+    void requestTiles(const glm::vec3& cameraPos);
+    bool loadTile(uint32_t tile, std::vector<uint8_t>& samples); // worker thread
+    void uploadTile(uint32_t tile, uint32_t slot, const std::vector<uint8_t>& samples);
+    void setPage(uint32_t tile, uint16_t page); // page table texel, slot + 1 or 0
+
+    TerrainConfig m_config;
+    uint32_t m_tiles {}, m_tileSize {}, m_overviewSize {};
+    std::vector<std::vector<Node>> m_nodes; // per lod, row by row, lod 0 is the finest
+
+    std::vector<glm::mat4> m_patches; // selected this frame
+    TerrainStats m_stats;
+
+    GL_InstancedMesh m_patchMesh;
+    Shader m_shader;
+    Shader::ShaderVariable m_viewProjection, m_cameraPos, m_heightDistance, m_lightDir;
+    Shader::ShaderVariable m_terrainParams, m_heightParams, m_lodParams;
+    GL_Texture m_overviewTexture, m_tileArray, m_pageTable;
+
+    std::ifstream m_file; // worker thread only
+    size_t m_tilesOffset {}; // of the first tile in the file
+    StreamingCache m_streaming; // tiles in layers of m_tileArray; last, its worker reads m_file
+};
+
+#endif // TERRAIN_H
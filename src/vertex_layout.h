@@ -0,0 +1,168 @@
+#ifndef VERTEX_LAYOUT_H
+#define VERTEX_LAYOUT_H
+
+#include "mesh_attributes.h"
+#include "meshdata.h"
+
+#include <cassert>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <utility>
+
+template <VertexAttribute::Type T, MeshAttribFormat F>
+struct Attr {
+    static constexpr VertexAttribute::Type s_type = T;
+    static constexpr MeshAttribFormat s_format = F;
+    static constexpr uint32_t s_size = getAttribSize(F);
+
+    static_assert(getAttribShaderType(F), "format can't be a vertex attribute");
+
+    // writes attribute of vertex i, every branch is resolved at compile time
+    static void pack(const MeshData& data, uint32_t i, uint8_t* dst)
+    {
+        if constexpr (T == VertexAttribute::Type::Position) {
+            packVector(glm::vec4(data.getPositionsPtr()[i], 0.f), dst);
+        } else if constexpr (T == VertexAttribute::Type::Normal) {
+            packVector(glm::vec4(data.getNormalsPtr()[i], 0.f), dst);
+        } else if constexpr (T == VertexAttribute::Type::Tan) {
+            packVector(data.getTangentsPtr()[i], dst);
+        } else if constexpr (T == VertexAttribute::Type::BiTan) {
+            packVector(glm::vec4(getBitangent(data.getNormalsPtr()[i], data.getTangentsPtr()[i]), 0.f), dst);
+        } else if constexpr (T == VertexAttribute::Type::Color) {
+            packVector(data.getColorsPtr()[i], dst);
+        } else if constexpr (T == VertexAttribute::Type::Joints) {
+            static_assert(F == MeshAttribFormat::Uint8x4, "joints are Uint8x4");
+            const glm::u8vec4 joints(data.getJointsPtr()[i]);
+            memcpy(dst, &joints, sizeof(joints));
+        } else if constexpr (T == VertexAttribute::Type::Weights) {
+            static_assert(F == MeshAttribFormat::Unorm8x4, "weights are Unorm8x4");
+            const uint32_t packed = glm::packUnorm4x8(data.getWeightsPtr()[i]);
+            memcpy(dst, &packed, sizeof(packed));
+        } else {
+            static_assert(T == VertexAttribute::Type::Position, "MeshData has no source for this attribute");
+        }
+    }
+
+private:
+    // vector sources, vec3 ones come with w = 0
+    static void packVector(const glm::vec4& v, uint8_t* dst)
+    {
+        static_assert(F == MeshAttribFormat::Float3 || F == MeshAttribFormat::Float4 || F == MeshAttribFormat::Half4
+                || F == MeshAttribFormat::Unorm8x4,
+            "unsupported format for vector source");
+        if constexpr (F == MeshAttribFormat::Float3) {
+            memcpy(dst, &v, sizeof(glm::vec3));
+        } else if constexpr (F == MeshAttribFormat::Float4) {
+            memcpy(dst, &v, sizeof(glm::vec4));
+        } else if constexpr (F == MeshAttribFormat::Half4) {
+            const uint64_t packed = glm::packHalf4x16(v);
+            memcpy(dst, &packed, sizeof(packed));
+        } else {
+            const uint32_t packed = glm::packUnorm4x8(v);
+            memcpy(dst, &packed, sizeof(packed));
+        }
+    }
+};
+
+// constexpr string for generated shader code
+template <size_t N>
+struct FixedString {
+    char data[N] {};
+    size_t size {};
+
+    constexpr void append(const char* str)
+    {
+        while (*str) {
+            assert(size + 1 < N);
+            data[size++] = *str++;
+        }
+    }
+    constexpr void append(uint32_t value)
+    {
+        char digits[10] {};
+        int count = 0;
+        do {
+            digits[count++] = char('0' + value % 10);
+            value /= 10;
+        } while (value);
+        assert(size + count < N);
+        while (count)
+            data[size++] = digits[--count];
+    }
+    const char* c_str() const { return data; }
+};
+
+// Interleaved vertex layout fixed at compile time, attribute i goes to location i:
+//   typedef VertexLayout<Attr<Type::Position, Float3>, Attr<Type::Normal, Half4>> Layout;
+// Stride, offsets and GLSL declarations are constexpr, pack() is unrolled per
+// attribute without per-vertex branches. getAttribData() gives the runtime
+// description for code that works with VertexAttribData.
+template <typename... Attrs>
+class VertexLayout {
+public:
+    static constexpr uint32_t s_numAttribs = sizeof...(Attrs);
+    static constexpr uint32_t s_stride = (Attrs::s_size + ... + 0);
+
+    static_assert(s_numAttribs > 0 && s_numAttribs <= InstanceAttribData::s_maxVertexAttribs, "too many attributes");
+    static_assert(((Attrs::s_type == VertexAttribute::Type::Position) + ... + 0) == 1, "exactly one position attribute");
+
+    static constexpr uint32_t getOffset(uint32_t index)
+    {
+        constexpr uint32_t sizes[] = { Attrs::s_size... };
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < index; ++i)
+            offset += sizes[i];
+        return offset;
+    }
+
+    // "layout (location = 0) in vec3 vertexPosition;\n..." - same text as runtime
+    // getVertexAttributeDeclarations() with every attribute used, vertex_layout tests compare them
+    static constexpr auto getShaderDeclarations()
+    {
+        FixedString<64 * s_numAttribs + 1> result;
+        uint32_t location = 0;
+        ((result.append("layout (location = "), result.append(location++), result.append(") in "),
+             result.append(getAttribShaderType(Attrs::s_format)), result.append(" "),
+             result.append(getAttribShaderName(Attrs::s_type)), result.append(";\n")),
+            ...);
+        return result;
+    }
+
+    static VertexAttribData getAttribData() { return VertexAttribData({ VertexAttribute(Attrs::s_type, Attrs::s_format)... }); }
+
+    // dst must hold getNumVertices() * s_stride bytes
+    static void pack(const MeshData& data, uint8_t* dst) { packRange(data, 0, data.getNumVertices(), dst); }
+
+    // vertices [first, first + count), dst points to where vertex first goes
+    static void packRange(const MeshData& data, uint32_t first, uint32_t count, uint8_t* dst)
+    {
+        constexpr bool needsSkin = ((Attrs::s_type == VertexAttribute::Type::Joints
+                                       || Attrs::s_type == VertexAttribute::Type::Weights)
+            || ...);
+        constexpr bool needsTangents = ((Attrs::s_type == VertexAttribute::Type::Tan
+                                           || Attrs::s_type == VertexAttribute::Type::BiTan)
+            || ...);
+        constexpr bool needsColors = ((Attrs::s_type == VertexAttribute::Type::Color) || ...);
+        if constexpr (needsSkin)
+            assert(data.hasSkin());
+        if constexpr (needsTangents)
+            assert(data.hasTangents());
+        if constexpr (needsColors)
+            assert(data.hasColors());
+        assert(first + count <= data.getNumVertices());
+
+        for (uint32_t i = 0; i < count; ++i)
+            packVertex(data, first + i, dst + i * s_stride, std::index_sequence_for<Attrs...>());
+    }
+
+private:
+    template <size_t... Is>
+    static void packVertex(const MeshData& data, uint32_t i, uint8_t* dst, std::index_sequence<Is...>)
+    {
+        constexpr uint32_t offsets[] = { getOffset(Is)... };
+        (Attrs::pack(data, i, dst + offsets[Is]), ...);
+    }
+};
+
+#endif // VERTEX_LAYOUT_H
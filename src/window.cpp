@@ -1,10 +1,13 @@
 #include "window.h"
+#include "buffer_allocator.h"
+#include "gl_handle.h"
 
 #include <SDL2/SDL.h>
 #undef main
 //#include <GL/glew.h>
 #include <SDL2/SDL_opengl.h>
 
+#include <cassert>
 #include <iostream>
 #include <string>
 
@@ -14,59 +17,46 @@
 static int eventWatcher(void* userdata, SDL_Event* event)
 {
     Window* p_window = (Window*)userdata;
+    InputEvent input;
     switch (event->type) {
     case SDL_QUIT: {
         p_window->closeWindow();
     } break;
     case SDL_KEYDOWN:
     case SDL_KEYUP: {
-        if (true || !event->key.repeat) {
-            const auto& it = p_window->getKeyMap().find((SDL_KeyCode)event->key.keysym.sym,
-                (SDL_Keymod)event->key.keysym.mod, event->type == SDL_KEYDOWN);
-
-            if (it != p_window->getKeyMap().getKeyActions().end()) {
-                it->second();
-            }
-        }
+        input.type = event->type == SDL_KEYDOWN ? InputEvent::Type::KeyDown : InputEvent::Type::KeyUp;
+        input.code = event->key.keysym.sym;
+        input.mod = event->key.keysym.mod;
+        p_window->handleInput(input);
     } break;
 
-    case SDL_MOUSEBUTTONDOWN: {
-        // clang-format off
-        switch (event->button.button) {
-        case 1: { p_window->isLMBDown = true; } break;
-        case 2: { p_window->isMMBDown = true; } break;
-        case 3: { p_window->isRMBDown = true; } break;
-        }
-    } break;
+    case SDL_MOUSEBUTTONDOWN:
     case SDL_MOUSEBUTTONUP: {
-        switch (event->button.button) {
-        case 1: { p_window->isLMBDown = false; } break;
-        case 2: { p_window->isMMBDown = false; } break;
-        case 3: { p_window->isRMBDown = false; } break;
-        } // clang-format on
+        input.type = event->type == SDL_MOUSEBUTTONDOWN ? InputEvent::Type::ButtonDown : InputEvent::Type::ButtonUp;
+        input.code = event->button.button;
+        input.x = event->button.x;
+        input.y = event->button.y;
+        p_window->handleInput(input);
     } break;
     case SDL_MOUSEWHEEL: {
-        if (p_window->MouseScrollEvent)
-            p_window->MouseScrollEvent(event->wheel.preciseY);
-
+        input.type = InputEvent::Type::MouseWheel;
+        input.y = event->wheel.preciseY; // as MouseScrollEvent takes it
+        p_window->handleInput(input);
     } break;
 
     case SDL_MOUSEMOTION: {
-        // event->button.state
-        if (p_window->isLMBDown && p_window->LMBDragEvent)
-            p_window->LMBDragEvent(event->motion.xrel, event->motion.yrel);
-        if (p_window->isMMBDown && p_window->MMBDragEvent)
-            p_window->MMBDragEvent(event->motion.xrel, event->motion.yrel);
-        if (p_window->isRMBDown && p_window->RMBDragEvent)
-            p_window->RMBDragEvent(event->motion.xrel, event->motion.yrel);
-
+        input.type = InputEvent::Type::MouseMotion;
+        input.x = event->motion.xrel;
+        input.y = event->motion.yrel;
+        p_window->handleInput(input);
     } break;
     case SDL_WINDOWEVENT: {
         if (event->window.event == SDL_WINDOWEVENT_RESIZED) {
             SDL_Window* win = SDL_GetWindowFromID(event->window.windowID);
             int x {}, y {};
             SDL_GetWindowSize(win, &x, &y);
-            glViewport(0, 0, x, y);
+            if (p_window->getBackend() == RenderBackend::OpenGL)
+                glViewport(0, 0, x, y);
         }
     }
     case SDL_POLLSENTINEL: {
@@ -75,10 +65,95 @@ static int eventWatcher(void* userdata, SDL_Event* event)
     return 1;
 }
 
-Window::Window(int width /*= 800*/, int height /*= 600*/, uint8_t multiSampleLevel)
+void Window::handleInput(InputEvent event)
+{
+    if (m_replaying) // live input would break determinism
+        return;
+    event.frame = m_frameIndex - m_recordStart;
+    if (m_recording)
+        m_inputRecording.events.push_back(event);
+    dispatchInput(event);
+}
+
+void Window::dispatchInput(const InputEvent& event)
+{
+    switch (event.type) {
+    case InputEvent::Type::KeyDown:
+    case InputEvent::Type::KeyUp: {
+        const auto& it = getKeyMap().find((SDL_KeyCode)event.code, (SDL_Keymod)event.mod, event.type == InputEvent::Type::KeyDown);
+        if (it != getKeyMap().getKeyActions().end()) {
+            it->second();
+        }
+    } break;
+
+    case InputEvent::Type::ButtonDown: {
+        // clang-format off
+        switch (event.code) {
+        case 1: { isLMBDown = true; } break;
+        case 2: { isMMBDown = true; } break;
+        case 3: { isRMBDown = true; } break;
+        }
+        if (event.code == 1 && LMBClickEvent)
+            LMBClickEvent(event.x, event.y);
+    } break;
+    case InputEvent::Type::ButtonUp: {
+        switch (event.code) {
+        case 1: { isLMBDown = false; } break;
+        case 2: { isMMBDown = false; } break;
+        case 3: { isRMBDown = false; } break;
+        } // clang-format on
+    } break;
+    case InputEvent::Type::MouseWheel: {
+        if (MouseScrollEvent)
+            MouseScrollEvent(event.y);
+    } break;
+
+    case InputEvent::Type::MouseMotion: {
+        if (isLMBDown && LMBDragEvent)
+            LMBDragEvent(event.x, event.y);
+        if (isMMBDown && MMBDragEvent)
+            MMBDragEvent(event.x, event.y);
+        if (isRMBDown && RMBDragEvent)
+            RMBDragEvent(event.x, event.y);
+    } break;
+    default:
+        break;
+    }
+}
+
+void Window::startRecording()
+{
+    m_inputRecording = {};
+    m_recordStart = m_frameIndex;
+    m_recording = true;
+}
+
+InputRecording Window::stopRecording()
+{
+    m_recording = false;
+    m_inputRecording.numFrames = m_frameIndex - m_recordStart;
+    return std::move(m_inputRecording);
+}
+
+void Window::startReplay(const InputRecording& recording)
+{
+    m_recording = false;
+    m_inputRecording = recording;
+    m_recordStart = m_frameIndex; // event frames are relative to it
+    m_replayPos = 0;
+    m_replaying = true;
+    isLMBDown = isMMBDown = isRMBDown = false;
+}
+
+Window::Window(int width /*= 800*/, int height /*= 600*/, uint8_t multiSampleLevel, bool headless, RenderBackend backend)
     : m_width(width)
     , m_height(height)
+    , m_headless(headless)
+    , m_backend(backend)
 {
+    if (headless && !getenv("DISPLAY") && !getenv("WAYLAND_DISPLAY"))
+        SDL_SetHint(SDL_HINT_VIDEODRIVER, "offscreen");
+
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_GAMECONTROLLER) != 0) {
         std::cerr << "SDL2 video subsystem couldn't be initialized. Error: " << SDL_GetError() << std::endl;
         exit(1);
@@ -88,13 +163,15 @@ Window::Window(int width /*= 800*/, int height /*= 600*/, uint8_t multiSampleLev
         SDL_GL_SetAttribute(SDL_GL_MULTISAMPLESAMPLES, multiSampleLevel);
     }
 
+    const bool isOpenGL = backend == RenderBackend::OpenGL;
     m_window = SDL_CreateWindow("Glad Sample", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-        m_width, m_height, SDL_WINDOW_SHOWN | SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
+        m_width, m_height, (headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN) | (isOpenGL ? SDL_WINDOW_OPENGL : 0) | SDL_WINDOW_RESIZABLE);
 
-    gl_context = SDL_GL_CreateContext(m_window);
+    gl_context = isOpenGL ? SDL_GL_CreateContext(m_window) : nullptr;
 
+    // the Software backend measures the rasterizer, no vsync there
     m_renderer = SDL_CreateRenderer(m_window, -1,
-        SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC); // VSYNC HERE!
+        isOpenGL ? SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC : 0); // VSYNC HERE!
 
     if (m_renderer == nullptr) {
         std::cerr << "SDL2 Renderer couldn't be created. Error: " << SDL_GetError() << std::endl;
@@ -105,11 +182,13 @@ Window::Window(int width /*= 800*/, int height /*= 600*/, uint8_t multiSampleLev
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
 
     initGamepad();
-    SDL_GL_MakeCurrent(m_window, gl_context);
-
     SDL_AddEventWatch(eventWatcher, this);
 
     NOW = LAST = SDL_GetPerformanceCounter();
+    if (!isOpenGL)
+        return;
+
+    SDL_GL_MakeCurrent(m_window, gl_context);
 
     // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     glClearColor(0.08, 0.08, 0.1, 1);
@@ -149,15 +228,31 @@ void Window::initGamepad()
 }
 void Window::clear()
 {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (m_backend == RenderBackend::OpenGL)
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void Window::present(const uint32_t* pixels, const glm::ivec2& size)
+{
+    assert(m_backend == RenderBackend::Software);
+    if (size != m_textureSize) {
+        if (m_texture)
+            SDL_DestroyTexture(m_texture);
+        m_texture = SDL_CreateTexture(m_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, size.x, size.y);
+        assert(m_texture);
+        m_textureSize = size;
+    }
+    SDL_UpdateTexture(m_texture, nullptr, pixels, size.x * sizeof(uint32_t));
+    SDL_RenderCopy(m_renderer, m_texture, nullptr, nullptr); // stretched to the window
 }
 
 bool Window::update()
 {
     NOW = SDL_GetPerformanceCounter();
-    m_deltaTime = (float)((NOW - LAST) / (double)SDL_GetPerformanceFrequency());
+    m_frameTime = (float)((NOW - LAST) / (double)SDL_GetPerformanceFrequency());
+    m_deltaTime = m_replaying ? m_inputRecording.timestep : m_frameTime;
 
-    m_secondFract += m_deltaTime;
+    m_secondFract += m_frameTime;
     m_framePerSecCounter++;
 
     if (m_secondFract > 1.f) {
@@ -171,12 +266,26 @@ bool Window::update()
 
     LAST = NOW;
 
-    SDL_GL_SwapWindow(m_window);
+    if (m_backend == RenderBackend::OpenGL) {
+        SDL_GL_SwapWindow(m_window);
+        getBufferAllocator().nextFrame();
+        getDeletionQueue().nextFrame();
+    } else
+        SDL_RenderPresent(m_renderer);
     SDL_Event event;
     while (SDL_PollEvent(&event)) { // poll until all events are handled!
         // decide what to do with this event.
     }
 
+    if (m_replaying) { // recorded events at the point of the frame live ones come in
+        const uint32_t frame = m_frameIndex - m_recordStart;
+        const auto& events = m_inputRecording.events;
+        for (; m_replayPos < events.size() && events[m_replayPos].frame <= frame; ++m_replayPos)
+            dispatchInput(events[m_replayPos]);
+        m_replaying = frame < m_inputRecording.numFrames;
+    }
+    m_frameIndex++;
+
     return m_isRendering;
 }
 
@@ -190,9 +299,21 @@ bool Window::getWindowFullScreen()
     return SDL_GetWindowFlags(m_window) & SDL_WINDOW_FULLSCREEN_DESKTOP;
 }
 
+glm::ivec2 Window::getSize() const
+{
+    glm::ivec2 size {};
+    SDL_GetWindowSize(m_window, &size.x, &size.y);
+    return size;
+}
+
 Window::~Window()
 {
-    SDL_GL_DeleteContext(gl_context);
+    if (m_backend == RenderBackend::OpenGL) {
+        getDeletionQueue().flush();
+        SDL_GL_DeleteContext(gl_context);
+    }
+    if (m_texture)
+        SDL_DestroyTexture(m_texture);
     SDL_DestroyRenderer(m_renderer);
     SDL_DestroyWindow(m_window);
 
@@ -1,55 +1,93 @@
 #ifndef WINDOW_H
 #define WINDOW_H
 
+#include "input_recording.h"
 #include "keymap.h"
 #include <glm/glm.hpp>
 
 typedef void* SDL_GLContext;
 struct _SDL_Joystick;
+struct SDL_Texture;
 
 struct GameControllerData {
     int16_t slx_value {}, sly_value {}, srx_value {}, sry_value {};
     int16_t tl_value {}, tr_value {};
 };
 
+enum class RenderBackend {
+    OpenGL,
+    Software, // no GL context, frames come from memory through present()
+};
+
 class Window {
 public:
-    Window(int width = 800, int height = 600, uint8_t multiSampleLevel = 1);
+    // headless: hidden window (offscreen video driver if there is no display), for tests and batch runs
+    Window(int width = 800, int height = 600, uint8_t multiSampleLevel = 1, bool headless = false,
+        RenderBackend backend = RenderBackend::OpenGL);
     void initGamepad();
 
     bool update();
     void clear();
+    void present(const uint32_t* pixels, const glm::ivec2& size); // Software backend, 0xAARRGGBB rows top to bottom
 
-    float getDeltaTime() { return m_deltaTime; }
+    float getDeltaTime() { return m_deltaTime; } // fixed timestep while replaying
+    float getFrameTime() const { return m_frameTime; } // s, measured, also while replaying
+    uint32_t getFrameIndex() const { return m_frameIndex; } // update() calls
     // glm::vec2 getMousePos();
+    glm::ivec2 getSize() const; // in mouse event coordinates
 
     void closeWindow() { m_isRendering = false; }
     void setWindowFullScreen(bool fullscreen);
     bool getWindowFullScreen();
     KeyMap& getKeyMap() { return m_keyMap; }
+    bool isHeadless() const { return m_headless; }
+    RenderBackend getBackend() const { return m_backend; }
     ~Window();
 
+    // Recording keeps input events with the frame they came in. A replay dispatches
+    // them at the same frames instead of live input, with getDeltaTime() fixed to
+    // the recording timestep, so the session repeats the same on any machine
+    void startRecording();
+    InputRecording stopRecording();
+    bool isRecording() const { return m_recording; }
+    void startReplay(const InputRecording& recording);
+    bool isReplaying() const { return m_replaying; } // false once all recorded frames ran
+
+    void handleInput(InputEvent event); // from SDL: recorded, dropped while replaying
+    void dispatchInput(const InputEvent& event); // to KeyMap and mouse callbacks
+
     void ErrorMsg(const char* title, const char* msg);
     std::unordered_map<_SDL_Joystick*, GameControllerData> m_joysticks;
 
     bool isLMBDown {}, isMMBDown {}, isRMBDown {};
     std::function<void(int32_t, int32_t)> LMBDragEvent {}, MMBDragEvent {}, RMBDragEvent {};
+    std::function<void(int32_t, int32_t)> LMBClickEvent {}; // on press, x, y from top left
     std::function<void(int32_t)> MouseScrollEvent {};
 
 private:
     KeyMap m_keyMap;
     struct SDL_Window* m_window;
     struct SDL_Renderer* m_renderer;
+    SDL_Texture* m_texture {}; // Software backend
+    glm::ivec2 m_textureSize {};
 
     SDL_GLContext gl_context;
     int m_width, m_height;
 
     uint64_t NOW {}, LAST {};
-    float m_deltaTime {};
+    float m_deltaTime {}, m_frameTime {};
+    uint32_t m_frameIndex {};
+
+    InputRecording m_inputRecording; // being recorded or replayed
+    uint32_t m_recordStart {}; // frame index event frames are relative to
+    size_t m_replayPos {};
+    bool m_recording {}, m_replaying {};
 
     float m_secondFract {};
     uint32_t m_framePerSecCounter {};
 
     bool m_isRendering = true;
+    bool m_headless {};
+    RenderBackend m_backend {};
 };
 #endif // WINDOW_H
@@ -0,0 +1,198 @@
+#include "allocators.h"
+#include "test.h"
+
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <random>
+
+// every form of global operator new goes through the counter (new-expressions may be elided, calls may not)
+TEST(allocation_counters)
+{
+    const AllocationStats before = getAllocationStats();
+    void* plain = ::operator new(24);
+    void* array = ::operator new[](40);
+    void* aligned = ::operator new(64, std::align_val_t(64));
+    void* nothrow = ::operator new(8, std::nothrow);
+    void* nothrowArray = ::operator new[](8, std::nothrow);
+    void* nothrowAligned = ::operator new(64, std::align_val_t(64), std::nothrow);
+    const AllocationStats after = getAllocationStats();
+    CHECK(after.count - before.count == 6);
+    CHECK(after.bytes - before.bytes == 24 + 40 + 64 + 8 + 8 + 64);
+    CHECK((size_t)aligned % 64 == 0 && (size_t)nothrowAligned % 64 == 0);
+    ::operator delete(plain);
+    ::operator delete[](array);
+    ::operator delete(aligned, std::align_val_t(64));
+    ::operator delete(nothrow);
+    ::operator delete[](nothrowArray);
+    ::operator delete(nothrowAligned, std::align_val_t(64));
+
+    // C allocations as done by SDL and drivers, volatile so the calls aren't elided
+    if (isMallocCounted()) {
+        const AllocationStats start = getAllocationStats();
+        void* volatile memory = malloc(16);
+        memory = realloc(memory, 32);
+        void* volatile zeroed = calloc(4, 8);
+        void* volatile alignedMemory = aligned_alloc(64, 64);
+        CHECK(getAllocationStats().count - start.count == 4);
+        CHECK(getAllocationStats().bytes - start.bytes == 16 + 32 + 32 + 64);
+        CHECK((size_t)alignedMemory % 64 == 0);
+        free(memory);
+        free(zeroed);
+        free(alignedMemory);
+    }
+}
+
+TEST(pool_allocator)
+{
+    PoolAllocator pool(32, 4);
+    void* blocks[6];
+    for (void*& block : blocks)
+        block = pool.allocate();
+    CHECK(pool.getNumBlocks() == 8 && pool.getNumFree() == 2);
+    for (void* block : blocks)
+        pool.free(block);
+    CHECK(pool.getNumFree() == 8);
+
+    // freed blocks are reused, no more chunks
+    const AllocationStats before = getAllocationStats();
+    for (void*& block : blocks)
+        block = pool.allocate();
+    CHECK(getAllocationStats().count == before.count && pool.getNumBlocks() == 8);
+    for (uint32_t i = 0; i < 6; ++i)
+        for (uint32_t j = i + 1; j < 6; ++j)
+            CHECK(blocks[i] != blocks[j]);
+    for (void* block : blocks)
+        pool.free(block);
+}
+
+TEST(linear_arena)
+{
+    LinearArena arena(1024);
+    const LinearArena::Marker start = arena.getMarker();
+    uint8_t* small = arena.allocate<uint8_t>(3);
+    double* aligned = arena.allocate<double>(2);
+    CHECK((size_t)aligned % alignof(double) == 0 && (uint8_t*)aligned >= small + 3);
+    arena.allocate(4096); // larger than a block
+    CHECK(arena.getUsed() == 3 + 2 * sizeof(double) + 4096);
+    arena.rewind(start);
+    CHECK(arena.getUsed() == 0 && arena.getPeakUsed() >= 4096 + 3);
+
+    // after the first round blocks come from the arena's pool, not the heap
+    auto round = [&]() {
+        const LinearArena::Marker marker = arena.getMarker();
+        for (uint32_t i = 0; i < 100; ++i)
+            arena.allocate(100);
+        arena.rewind(marker);
+    };
+    round();
+    const AllocationStats before = getAllocationStats();
+    round();
+    CHECK(getAllocationStats().count == before.count);
+}
+
+TEST(scratch_scope)
+{
+    LinearArena& arena = getScratchArena();
+    const size_t used = arena.getUsed();
+    {
+        ScratchScope scratch;
+        ArenaVector<uint32_t> values(ArenaAllocator<uint32_t>(scratch.getArena()));
+        for (uint32_t i = 0; i < 1000; ++i)
+            values.push_back(i);
+        CHECK(values[999] == 999 && arena.getUsed() > used);
+    }
+    CHECK(arena.getUsed() == used);
+}
+
+// largest gap between the live ranges, free neighbours coalesce so it is one block
+static uint32_t getLargestGap(const std::map<uint32_t, uint32_t>& ranges, uint32_t capacity)
+{
+    uint32_t largest = 0, end = 0;
+    for (const auto& [offset, size] : ranges) {
+        largest = std::max(largest, offset - end);
+        end = offset + size;
+    }
+    return std::max(largest, capacity - end);
+}
+
+// random allocate/free against a map of the live ranges: in bounds, no overlaps,
+// used bytes and largest free block as the map says
+TEST(range_allocator_random)
+{
+    const uint32_t capacity = 100000;
+    RangeAllocator allocator(capacity);
+    std::map<uint32_t, uint32_t> ranges; // offset, size
+    std::vector<uint32_t> nodes;
+    std::mt19937 rng(3);
+    uint32_t used = 0;
+    bool overlaps = false, accounting = true;
+    for (int i = 0; i < 20000; ++i) {
+        if (nodes.empty() || rng() % 100 < 55) {
+            const uint32_t size = rng() % 10 ? 1 + rng() % 500 : 1 + rng() % 20000;
+            const uint32_t node = allocator.allocate(size);
+            if (node == RangeAllocator::s_invalid) {
+                accounting &= allocator.getLargestFree() < size;
+                continue;
+            }
+            const uint32_t offset = allocator.getOffset(node);
+            const auto next = ranges.lower_bound(offset);
+            overlaps |= offset + size > capacity || allocator.getSize(node) != size;
+            overlaps |= next != ranges.end() && next->first < offset + size;
+            overlaps |= next != ranges.begin() && std::prev(next)->first + std::prev(next)->second > offset;
+            ranges[offset] = size;
+            nodes.push_back(node);
+            used += size;
+        } else {
+            const size_t index = rng() % nodes.size();
+            ranges.erase(allocator.getOffset(nodes[index]));
+            used -= allocator.getSize(nodes[index]);
+            allocator.free(nodes[index]);
+            nodes[index] = nodes.back();
+            nodes.pop_back();
+        }
+        accounting &= allocator.getUsed() == used && allocator.getNumAllocations() == nodes.size();
+        accounting &= allocator.getLargestFree() == getLargestGap(ranges, capacity);
+    }
+    CHECK(!overlaps);
+    CHECK(accounting);
+    CHECK(nodes.size() > 10); // the run ended with a fragmented allocator
+
+    // freeing everything coalesces back to one block of the whole capacity
+    for (uint32_t node : nodes)
+        allocator.free(node);
+    CHECK(allocator.getUsed() == 0 && allocator.getNumAllocations() == 0);
+    CHECK(allocator.getLargestFree() == allocator.getCapacity());
+    const uint32_t whole = allocator.allocate(capacity);
+    CHECK(whole != RangeAllocator::s_invalid && allocator.getOffset(whole) == 0);
+    CHECK(allocator.getLargestFree() == 0 && allocator.allocate(1) == RangeAllocator::s_invalid);
+}
+
+TEST(range_allocator_coalescing)
+{
+    RangeAllocator allocator(1000);
+    uint32_t nodes[10];
+    for (uint32_t& node : nodes)
+        node = allocator.allocate(100);
+    CHECK(allocator.getUsed() == 1000 && allocator.getLargestFree() == 0);
+    CHECK(allocator.allocate(1) == RangeAllocator::s_invalid);
+
+    // neighbours of every other freed block are used, nothing merges
+    for (uint32_t i = 0; i < 10; i += 2)
+        allocator.free(nodes[i]);
+    CHECK(allocator.getUsed() == 500 && allocator.getLargestFree() == 100);
+    CHECK(allocator.allocate(101) == RangeAllocator::s_invalid);
+
+    // freeing 3 joins 2 and 4 with it, then 5 and 6 join the block
+    allocator.free(nodes[3]);
+    CHECK(allocator.getLargestFree() == 300);
+    allocator.free(nodes[5]);
+    CHECK(allocator.getLargestFree() == 500);
+    const uint32_t merged = allocator.allocate(500);
+    CHECK(merged != RangeAllocator::s_invalid && allocator.getOffset(merged) == 200);
+    allocator.free(merged);
+
+    for (uint32_t i : { 1u, 7u, 9u })
+        allocator.free(nodes[i]);
+    CHECK(allocator.getUsed() == 0 && allocator.getLargestFree() == 1000);
+}
@@ -0,0 +1,29 @@
+#include "buffer_allocator.h"
+#include "test.h"
+
+// allocations past the budget come back empty and are counted, the rest still fits
+TEST(buffer_allocator_budget)
+{
+    getTestWindow();
+    GL_BufferAllocator allocator;
+    BufferAllocatorConfig config;
+    config.budget = config.arenaSize = 1 << 20;
+    config.defragBytesPerFrame = 0;
+    allocator.setConfig(config);
+
+    GL_BufferAllocation first = allocator.allocate(768 << 10);
+    CHECK(first && first.getBuffer() && first.getSize() == 768 << 10);
+    CHECK(allocator.getStats().reserved == config.budget);
+
+    GL_BufferAllocation refused = allocator.allocate(512 << 10); // no room left, no budget for an arena
+    CHECK(!refused && !refused.getBuffer() && allocator.getStats().failed == 1);
+    GL_BufferAllocation tooBig = allocator.allocate(2 << 20);
+    CHECK(!tooBig && allocator.getStats().failed == 2);
+    CHECK(!allocator.allocate(0) && allocator.getStats().failed == 2); // empty, not refused
+
+    GL_BufferAllocation rest = allocator.allocate(256 << 10); // exactly the free space
+    CHECK(rest && rest.getBuffer() == first.getBuffer() && rest.getOffset() == 768 << 10);
+    const BufferAllocatorStats stats = allocator.getStats();
+    CHECK(stats.arenas == 1 && stats.allocations == 2 && stats.reserved == config.budget);
+    CHECK(stats.used == config.budget && stats.largestFree == 0);
+}
@@ -0,0 +1,65 @@
+#include "hiz_culler.h"
+#include "mesh.h"
+#include "meshdata.h"
+#include "test.h"
+#include "window.h"
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL2/SDL_opengl.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+typedef VertexLayout<Attr<VertexAttribute::Type::Position, MeshAttribFormat::Float3>> PositionLayout;
+
+// An occluder covering pixels x < 976 of the 1000x600 viewport, spheres behind it and
+// one sphere over pixels 977-983 next to its edge. At level 4 the pyramid is 62 texels
+// wide and that sphere belongs to its last texel (pixels 976-999), not to texel 60
+TEST(hiz_culler_occluder)
+{
+    Window& window = getTestWindow();
+    glViewport(0, 0, 1000, 600);
+    // world x is the pixel column, world y half the pixel row
+    const glm::mat4 projection = glm::ortho(0.f, 1000.f, 0.f, 300.f, 0.1f, 100.f);
+
+    GL_InstancedMesh occluder(MeshData(MeshData::ParametricType::CylindricalNormalCube), PositionLayout(),
+        MeshAttribFormat::Uint16, MeshAttribFormat::Mat4x4);
+    occluder.setInstanceTransforms({ glm::scale(glm::translate(glm::mat4(1), glm::vec3(488.f, 150.f, -1.f)), glm::vec3(488.f, 150.f, .5f)) });
+
+    GL_InstancedMesh spheres(MeshData(MeshData::ParametricType::Sphere, 16), PositionLayout(),
+        MeshAttribFormat::Uint16, MeshAttribFormat::Mat4x4);
+    const float radius = 3.5f / spheres.getBoundingSphere().w; // 7 pixels wide, 14 high
+    std::vector<glm::mat4> instances;
+    for (int i = 0; i < 10; ++i)
+        instances.push_back(glm::scale(glm::translate(glm::mat4(1), glm::vec3(100.f + 80.f * i, 150.f, -10.f)), glm::vec3(radius)));
+    instances.push_back(glm::scale(glm::translate(glm::mat4(1), glm::vec3(980.f, 150.f, -10.f)), glm::vec3(radius)));
+    spheres.setInstanceTransforms(instances);
+
+    Shader shader(PositionLayout::getAttribData(), ShaderFeature::DepthOnly);
+    HiZCuller culler;
+    OcclusionStats stats;
+    for (int frame = 0; frame < 2; ++frame) { // the first one has no pyramid, culls nothing
+        window.clear();
+        culler.beginFrame(projection);
+        for (HiZCuller::Phase phase : { HiZCuller::Phase::Main, HiZCuller::Phase::Retest }) {
+            if (phase == HiZCuller::Phase::Retest)
+                culler.buildPyramid();
+            culler.cull(occluder, phase);
+            culler.cull(spheres, phase);
+            shader.bind();
+            shader.getVariable("model").set(glm::mat4(1));
+            shader.getVariable("view").set(glm::mat4(1));
+            shader.getVariable("projection").set(projection);
+            culler.draw(occluder, phase);
+            culler.draw(spheres, phase);
+        }
+        culler.endFrame();
+        stats = culler.getStats(true);
+        if (frame == 0)
+            CHECK(stats.tested == 12 && stats.visible == 12 && stats.culled == 0);
+        window.update();
+    }
+    CHECK(stats.tested == 12);
+    CHECK(stats.visible == 2); // the occluder and the sphere next to it
+    CHECK(stats.culled == 10);
+    CHECK(stats.newlyVisible == 0);
+}
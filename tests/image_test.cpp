@@ -0,0 +1,103 @@
+#include "image.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+static Image getGradient(uint32_t width, uint32_t height)
+{
+    Image image;
+    image.resize(width, height);
+    for (uint32_t y = 0; y < height; ++y)
+        for (uint32_t x = 0; x < width; ++x) {
+            uint8_t* pixel = image.getRow(y) + x * 3;
+            pixel[0] = uint8_t(x * 255 / width), pixel[1] = uint8_t(y * 255 / height), pixel[2] = uint8_t(x ^ y);
+        }
+    return image;
+}
+
+static std::vector<uint8_t> readFile(const char* path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static uint32_t getBigEndian(const uint8_t* p)
+{
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+static uint32_t getCrc32(const uint8_t* data, size_t size)
+{
+    uint32_t crc = ~0u;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit)
+            crc = crc & 1 ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+    }
+    return ~crc;
+}
+
+TEST(image_ppm_round_trip)
+{
+    const char* path = "image_test.ppm";
+    const Image image = getGradient(37, 21); // rows of odd byte length
+    CHECK(writeImage(path, image));
+    Image read;
+    CHECK(readPPM(path, read));
+    CHECK(read.width == image.width && read.height == image.height && read.pixels == image.pixels);
+    std::remove(path);
+    CHECK(!readPPM("image_test_missing.ppm", read));
+}
+
+// signature, IHDR of the size, IDAT, IEND and every chunk CRC
+TEST(image_png_chunks)
+{
+    const char* path = "image_test.png";
+    CHECK(writeImage(path, getGradient(64, 48)));
+    const std::vector<uint8_t> png = readFile(path);
+    std::remove(path);
+    const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    CHECK(png.size() > sizeof(signature) && !memcmp(png.data(), signature, sizeof(signature)));
+
+    std::vector<std::string> chunks;
+    for (size_t pos = sizeof(signature); pos + 12 <= png.size();) {
+        const uint32_t length = getBigEndian(&png[pos]);
+        if (pos + 12 + length > png.size())
+            break;
+        chunks.emplace_back((const char*)&png[pos + 4], 4);
+        CHECK(getBigEndian(&png[pos + 8 + length]) == getCrc32(&png[pos + 4], length + 4));
+        if (chunks.back() == "IHDR")
+            CHECK(getBigEndian(&png[pos + 8]) == 64 && getBigEndian(&png[pos + 12]) == 48);
+        pos += 12 + length;
+    }
+    CHECK(chunks.size() >= 3 && chunks.front() == "IHDR" && chunks.back() == "IEND");
+    CHECK(std::find(chunks.begin(), chunks.end(), "IDAT") != chunks.end());
+}
+
+TEST(image_compare)
+{
+    const Image reference = getGradient(100, 100);
+    CHECK(compareImages(reference, reference).passed);
+
+    Image image = reference;
+    for (uint32_t i = 0; i < image.pixels.size(); i += 7) // within pixelTolerance
+        image.pixels[i] = image.pixels[i] < 128 ? image.pixels[i] + 2 : image.pixels[i] - 2;
+    ImageDiff diff = compareImages(image, reference);
+    CHECK(diff.passed && diff.numDifferent == 0 && diff.maxDifference == 2);
+
+    image = reference;
+    for (uint32_t y = 0; y < 10; ++y) // 10 pixels of 10000 are within maxDifferentFraction
+        image.getRow(y)[150] ^= 0x80;
+    diff = compareImages(image, reference);
+    CHECK(diff.passed && diff.numDifferent == 10 && diff.maxDifference == 128);
+    image.getRow(10)[150] ^= 0x80;
+    CHECK(!compareImages(image, reference).passed);
+
+    CHECK(!compareImages(getGradient(100, 99), reference).passed);
+}
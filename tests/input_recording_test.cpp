@@ -0,0 +1,69 @@
+#include "input_recording.h"
+#include "test.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+static std::vector<uint8_t> readFile(const char* path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+static void writeFile(const char* path, const std::vector<uint8_t>& data)
+{
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char*)data.data(), data.size());
+}
+
+static bool operator==(const InputEvent& a, const InputEvent& b)
+{
+    return a.frame == b.frame && a.type == b.type && a.mod == b.mod && a.code == b.code && a.x == b.x && a.y == b.y;
+}
+
+// one event of every type, only the fields the type saves are set
+TEST(input_recording_round_trip)
+{
+    InputRecording recording;
+    recording.timestep = 1.f / 30.f;
+    recording.numFrames = 100000;
+    recording.events = {
+        { 0, InputEvent::Type::KeyDown, 0x8003, 0x40000045 }, // F12, large SDL key code
+        { 0, InputEvent::Type::KeyUp, 0, 'a' },
+        { 3, InputEvent::Type::ButtonDown, 0, 1, 799, 0 },
+        { 200, InputEvent::Type::MouseMotion, 0, 0, -120, -1 },
+        { 200, InputEvent::Type::MouseMotion, 0, 0, 65536, INT32_MIN },
+        { 70000, InputEvent::Type::ButtonUp, 0, 3, 0, 599 },
+        { 99999, InputEvent::Type::MouseWheel, 0, 0, 0, -3 },
+    };
+    const char* path = "input_recording_test.inp";
+    CHECK(recording.save(path));
+
+    InputRecording loaded;
+    CHECK(loaded.load(path));
+    CHECK(loaded.timestep == recording.timestep && loaded.numFrames == recording.numFrames);
+    CHECK(loaded.events.size() == recording.events.size()
+        && std::equal(loaded.events.begin(), loaded.events.end(), recording.events.begin()));
+
+    // truncated anywhere: in the header, or in the last event
+    std::vector<uint8_t> data = readFile(path);
+    for (size_t size : { size_t(3), size_t(19), data.size() - 1 }) {
+        writeFile(path, std::vector<uint8_t>(data.begin(), data.begin() + size));
+        CHECK(!loaded.load(path));
+    }
+
+    // the type of the first event, after its 1 byte frame delta
+    data[21] = (uint8_t)InputEvent::Type::Count;
+    writeFile(path, data);
+    CHECK(!loaded.load(path));
+    data[21] = (uint8_t)InputEvent::Type::KeyDown;
+    data[0] = 'X';
+    writeFile(path, data);
+    CHECK(!loaded.load(path));
+
+    std::remove(path);
+    CHECK(!loaded.load("input_recording_test_missing.inp"));
+}
@@ -0,0 +1,128 @@
+#include "camera.h"
+#include "instance_bvh.h"
+#include "test.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+// enough spheres for the parallel build and query paths
+static std::vector<glm::vec4> getRandomSpheres(uint32_t count, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-20.f, 20.f), radius(0.05f, 0.5f);
+    std::vector<glm::vec4> spheres(count);
+    for (glm::vec4& sphere : spheres)
+        sphere = glm::vec4(position(rng), position(rng), position(rng), radius(rng));
+    return spheres;
+}
+
+static std::vector<uint32_t> sorted(std::vector<uint32_t> values)
+{
+    std::sort(values.begin(), values.end());
+    return values;
+}
+
+// same tests as the tree, against every sphere
+static bool hitsRay(const glm::vec4& sphere, const glm::vec3& origin, const glm::vec3& direction, float& distance)
+{
+    const glm::vec3 oc = origin - glm::vec3(sphere);
+    const float b = glm::dot(oc, direction);
+    const float discriminant = b * b - (glm::dot(oc, oc) - sphere.w * sphere.w);
+    if (discriminant < 0.f)
+        return false;
+    const float root = sqrtf(discriminant);
+    distance = -b - root >= 0.f ? -b - root : -b + root;
+    return distance >= 0.f;
+}
+
+static std::vector<uint32_t> bruteForceBox(const std::vector<glm::vec4>& spheres, const AABB& box)
+{
+    std::vector<uint32_t> result;
+    for (uint32_t i = 0; i < spheres.size(); ++i) {
+        const glm::vec3 d = glm::vec3(spheres[i]) - glm::clamp(glm::vec3(spheres[i]), box.min, box.max);
+        if (glm::dot(d, d) <= spheres[i].w * spheres[i].w)
+            result.push_back(i);
+    }
+    return result;
+}
+
+static std::vector<uint32_t> bruteForceFrustum(const std::vector<glm::vec4>& spheres, const glm::mat4& viewProjection)
+{
+    glm::vec4 planes[6];
+    extractFrustumPlanes(viewProjection, planes);
+    std::vector<uint32_t> result;
+    for (uint32_t i = 0; i < spheres.size(); ++i) {
+        bool visible = true;
+        for (int p = 0; p < 6 && visible; ++p)
+            visible = glm::dot(glm::vec3(planes[p]), glm::vec3(spheres[i])) + planes[p].w >= -spheres[i].w;
+        if (visible)
+            result.push_back(i);
+    }
+    return result;
+}
+
+static void checkQueries(const InstanceBVH& bvh, const std::vector<glm::vec4>& spheres, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+
+    for (int i = 0; i < 200; ++i) {
+        const glm::vec3 origin(30.f * uniform(rng), 30.f * uniform(rng), 30.f);
+        const glm::vec3 direction = glm::normalize(glm::vec3(15.f * uniform(rng), 15.f * uniform(rng), 0.f) - origin);
+        InstanceBVH::RayHit hit;
+        const bool found = bvh.rayCast(origin, direction, hit);
+        float nearest = FLT_MAX, distance;
+        for (const glm::vec4& sphere : spheres)
+            if (hitsRay(sphere, origin, direction, distance))
+                nearest = std::min(nearest, distance);
+        CHECK(found == (nearest < FLT_MAX));
+        CHECK(!found || fabsf(hit.distance - nearest) <= 1e-4f * nearest);
+    }
+
+    for (int i = 0; i < 50; ++i) {
+        AABB box;
+        box.grow(glm::vec3(uniform(rng), uniform(rng), uniform(rng)) * 20.f);
+        box.grow(glm::vec3(uniform(rng), uniform(rng), uniform(rng)) * 20.f);
+        std::vector<uint32_t> result;
+        bvh.queryBox(box, result);
+        CHECK(sorted(result) == bruteForceBox(spheres, box));
+    }
+
+    Camera camera;
+    for (int i = 0; i < 20; ++i) {
+        camera.setPos(glm::vec3(uniform(rng), uniform(rng), uniform(rng)) * 40.f);
+        camera.setAim(glm::vec3(uniform(rng), uniform(rng), uniform(rng)) * 5.f);
+        const glm::mat4 viewProjection = camera.getProjection() * camera.getView();
+        std::vector<uint32_t> result;
+        bvh.queryFrustum(viewProjection, result);
+        CHECK(sorted(result) == bruteForceFrustum(spheres, viewProjection));
+    }
+}
+
+TEST(instance_bvh_queries)
+{
+    for (uint32_t count : { 1u, 7u, 100u, 20000u }) {
+        const std::vector<glm::vec4> spheres = getRandomSpheres(count, count);
+        InstanceBVH bvh;
+        bvh.build(spheres);
+        CHECK(bvh.getNumInstances() == count);
+        checkQueries(bvh, spheres, count + 1);
+    }
+}
+
+TEST(instance_bvh_refit)
+{
+    std::vector<glm::vec4> spheres = getRandomSpheres(20000, 2);
+    InstanceBVH bvh;
+    bvh.build(spheres);
+    const uint32_t numNodes = bvh.getNumNodes();
+
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> offset(-2.f, 2.f);
+    for (glm::vec4& sphere : spheres)
+        sphere += glm::vec4(offset(rng), offset(rng), offset(rng), 0.f);
+    bvh.refit(spheres);
+    CHECK(bvh.getNumNodes() == numNodes);
+    checkQueries(bvh, spheres, 4);
+}
@@ -0,0 +1,61 @@
+#include "job_system.h"
+#include "test.h"
+
+// every index exactly once on pools of any size, in chunks of at most grain once there
+// are threads to split for (a single thread takes the whole range in one call)
+TEST(job_parallel_for)
+{
+    for (uint32_t numThreads : { 1u, 2u, 4u, 8u }) {
+        JobSystem jobs(numThreads);
+        const uint32_t count = 100000, grain = 64;
+        std::vector<std::atomic<uint32_t>> visits(count);
+        std::atomic<bool> oversized { false };
+        jobs.parallelFor(count, grain, [&](uint32_t first, uint32_t end) {
+            oversized = oversized || end - first > grain;
+            for (uint32_t i = first; i < end; ++i)
+                visits[i]++;
+        });
+        CHECK(numThreads == 1 || !oversized);
+        CHECK(std::all_of(visits.begin(), visits.end(), [](const std::atomic<uint32_t>& v) { return v == 1; }));
+    }
+}
+
+// jobs waiting for other jobs run queued work meanwhile instead of blocking their thread
+TEST(job_nested_wait)
+{
+    JobSystem jobs(4);
+    std::atomic<uint32_t> sum {};
+    jobs.parallelFor(64, 1, [&](uint32_t first, uint32_t end) {
+        for (uint32_t i = first; i < end; ++i)
+            jobs.parallelFor(1000, 10, [&](uint32_t innerFirst, uint32_t innerEnd) { sum += innerEnd - innerFirst; });
+    });
+    CHECK(sum == 64 * 1000);
+}
+
+TEST(job_continuations)
+{
+    JobSystem jobs(4);
+    JobCounter first, second;
+    std::atomic<uint32_t> done {};
+    std::atomic<bool> early { false };
+    auto work = [&]() { done++; };
+    for (int i = 0; i < 100; ++i)
+        jobs.run(first, work);
+
+    struct Context {
+        std::atomic<uint32_t>& done;
+        std::atomic<bool>& early;
+    } context { done, early };
+    Job after;
+    after.func = [](void* data, uint32_t, uint32_t) {
+        Context& context = *(Context*)data;
+        context.early = context.early || context.done != 100;
+    };
+    after.data = &context;
+    after.counter = &second;
+    jobs.runAfter(first, after);
+    jobs.wait(first);
+    jobs.wait(second);
+    CHECK(first.isDone() && second.isDone());
+    CHECK(done == 100 && !early);
+}
@@ -0,0 +1,101 @@
+#include "byte_stream.h"
+#include "mesh_codec.h"
+#include "test.h"
+
+#include <algorithm>
+#include <random>
+
+// same triangles, each possibly rotated, same winding
+static bool sameTriangles(const VertIndex* indices, const uint32_t* decoded, uint32_t numIndices)
+{
+    for (uint32_t t = 0; t < numIndices; t += 3) {
+        const VertIndex* tri = indices + t;
+        const uint32_t* out = decoded + t;
+        const uint32_t r = out[0] == tri[0] ? 0 : out[1] == tri[0] ? 1 : 2;
+        if (out[r] != tri[0] || out[(r + 1) % 3] != tri[1] || out[(r + 2) % 3] != tri[2])
+            return false;
+    }
+    return true;
+}
+
+TEST(mesh_codec_vertices)
+{
+    std::mt19937 rng(1);
+    // partial last block, odd strides, smooth and random bytes
+    for (uint32_t numVertices : { 1u, 255u, 256u, 1000u })
+        for (uint32_t stride : { 4u, 7u, 20u, 28u }) {
+            std::vector<uint8_t> vertices(numVertices * stride);
+            for (size_t i = 0; i < vertices.size(); ++i)
+                vertices[i] = i % 3 ? uint8_t(i / stride) : uint8_t(rng());
+            const std::vector<uint8_t> encoded = MeshCodec::encodeVertices(vertices.data(), numVertices, stride);
+            std::vector<uint8_t> decoded(vertices.size());
+            CHECK(MeshCodec::decodeVertices(encoded.data(), encoded.size(), decoded.data(), numVertices, stride));
+            CHECK(decoded == vertices);
+
+            CHECK(!MeshCodec::decodeVertices(encoded.data(), encoded.size() / 2, decoded.data(), numVertices, stride));
+            std::vector<uint8_t> larger((numVertices + 1) * stride);
+            CHECK(!MeshCodec::decodeVertices(encoded.data(), encoded.size(), larger.data(), numVertices + 1, stride));
+        }
+}
+
+TEST(mesh_codec_indices)
+{
+    const MeshData meshes[] = {
+        MeshData(MeshData::ParametricType::CylindricalNormalCube),
+        MeshData(MeshData::ParametricType::Sphere, 16),
+        MeshData(MeshData::ParametricType::PlaneZ, 255), // more than one chunk
+    };
+    for (const MeshData& data : meshes) {
+        const uint32_t numIndices = data.getNumIndices();
+        const std::vector<uint8_t> encoded = MeshCodec::encodeIndices(data.getIndicesPtr(), numIndices);
+        std::vector<uint32_t> decoded(numIndices);
+        CHECK(MeshCodec::decodeIndices(encoded.data(), encoded.size(), decoded.data(), numIndices));
+        CHECK(sameTriangles(data.getIndicesPtr(), decoded.data(), numIndices));
+        CHECK(encoded.size() < numIndices * sizeof(VertIndex) / 2);
+
+        std::vector<uint16_t> decoded16(numIndices);
+        CHECK(MeshCodec::decodeIndices(encoded.data(), encoded.size(), decoded16.data(), numIndices, 2));
+        CHECK(std::equal(decoded.begin(), decoded.end(), decoded16.begin()));
+
+        CHECK(!MeshCodec::decodeIndices(encoded.data(), encoded.size() - 1, decoded.data(), numIndices));
+    }
+
+    // random triangles share no edges, every vertex is coded in full
+    std::mt19937 rng(2);
+    std::vector<VertIndex> indices(3000);
+    for (VertIndex& index : indices)
+        index = rng() % 100000;
+    const std::vector<uint8_t> encoded = MeshCodec::encodeIndices(indices.data(), indices.size());
+    std::vector<uint32_t> decoded(indices.size());
+    CHECK(MeshCodec::decodeIndices(encoded.data(), encoded.size(), decoded.data(), decoded.size()));
+    CHECK(sameTriangles(indices.data(), decoded.data(), indices.size()));
+}
+
+TEST(byte_stream_varints)
+{
+    const uint32_t values[] = { 0, 1, 127, 128, 16383, 16384, 0xFFFFFFFFu };
+    const int32_t signedValues[] = { 0, -1, 1, -64, 64, INT32_MIN, INT32_MAX };
+    std::vector<uint8_t> bytes;
+    for (uint32_t value : values) {
+        putVarint(bytes, value);
+        putU32(bytes, value);
+    }
+    for (int32_t value : signedValues)
+        putSigned(bytes, value);
+    CHECK(bytes[0] == 0 && bytes[5] == 1 && bytes[10] == 127 && bytes[15] == 0x80 && bytes[16] == 1);
+
+    ByteReader reader { bytes.data(), bytes.data() + bytes.size() };
+    for (uint32_t value : values) {
+        CHECK(reader.varint() == value);
+        CHECK(reader.u32() == value);
+    }
+    for (int32_t value : signedValues)
+        CHECK(reader.signedVarint() == value);
+    CHECK(!reader.failed && reader.pos == reader.end);
+    reader.byte();
+    CHECK(reader.failed);
+
+    const uint8_t unterminated[] = { 0x80, 0x80 };
+    ByteReader truncated { unterminated, unterminated + 2 };
+    CHECK(truncated.varint() == 0 && truncated.failed);
+}
@@ -0,0 +1,74 @@
+#include "mesh.h"
+#include "meshdata.h"
+#include "test.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+typedef VertexLayout<
+    Attr<VertexAttribute::Type::Position, MeshAttribFormat::Float3>,
+    Attr<VertexAttribute::Type::Normal, MeshAttribFormat::Half4>>
+    DemoLayout;
+
+// dirty ranges are uploaded one each, growth re-uploads the grown buffer whole
+TEST(mesh_update_stats)
+{
+    getTestWindow();
+    MeshData data(MeshData::ParametricType::PlaneZ, 8);
+    GL_Mesh mesh(data, DemoLayout(), MeshAttribFormat::Uint16);
+    data.clearDirty();
+    const uint32_t numVertices = data.getNumVertices();
+
+    data.editPositions(0, 2);
+    data.editPositions(10, 3);
+    data.editNormals(11, 4); // joins [10, 13)
+    data.editIndices(3, 3);
+    MeshUpdateStats stats = mesh.update(data);
+    CHECK(stats.uploads == 3 && stats.reallocations == 0);
+    CHECK(stats.uploadedBytes == (2 + 5) * DemoLayout::s_stride + 3 * sizeof(uint16_t));
+    CHECK(data.getDirtyVertices().empty() && data.getDirtyIndices().empty());
+
+    stats = mesh.update(data); // nothing edited
+    CHECK(stats.uploads == 0 && stats.uploadedBytes == 0 && stats.reallocations == 0);
+
+    const glm::vec3 position(0.f), normal(0.f, 0.f, 1.f);
+    data.appendVertices(&position, &normal, 1); // past the capacity, which doubles
+    data.editPositions(0, 1);
+    stats = mesh.update(data);
+    CHECK(stats.reallocations == 1 && stats.uploads == 1);
+    CHECK(stats.uploadedBytes == (numVertices + 1) * DemoLayout::s_stride);
+
+    data.appendVertices(&position, &normal, 1); // within it
+    stats = mesh.update(data);
+    CHECK(stats.reallocations == 0 && stats.uploads == 1 && stats.uploadedBytes == DemoLayout::s_stride);
+}
+
+// materials follow their transforms, sorting again from the same or a new position
+TEST(instanced_mesh_sort)
+{
+    getTestWindow();
+    GL_InstancedMesh mesh(MeshData(MeshData::ParametricType::Sphere, 4), DemoLayout(), MeshAttribFormat::Uint16,
+        MeshAttribFormat::Mat4x4);
+    std::vector<glm::mat4> transforms;
+    for (float x : { 3.f, 1.f, 4.f, 2.f })
+        transforms.push_back(glm::translate(glm::mat4(1), glm::vec3(x, 0.f, 0.f)));
+    mesh.setInstanceTransforms(transforms);
+    mesh.setInstanceMaterials({ 3, 1, 4, 2 });
+
+    auto inOrder = [&mesh](std::initializer_list<uint32_t> order) {
+        uint32_t i = 0;
+        for (uint32_t x : order) {
+            if (mesh.getInstanceTransforms()[i][3].x != float(x) || mesh.getInstanceMaterials()[i] != x)
+                return false;
+            ++i;
+        }
+        return true;
+    };
+    CHECK(mesh.sortInstancesFrontToBack(glm::vec3(0.f)) == 1.f);
+    CHECK(inOrder({ 1, 2, 3, 4 }));
+    CHECK(mesh.sortInstancesFrontToBack(glm::vec3(0.f)) == 1.f); // unchanged
+    CHECK(inOrder({ 1, 2, 3, 4 }));
+    CHECK(mesh.sortInstancesFrontToBack(glm::vec3(0.5f, 0.f, 0.f)) == 0.5f); // moved, the order holds
+    CHECK(inOrder({ 1, 2, 3, 4 }));
+    CHECK(mesh.sortInstancesFrontToBack(glm::vec3(10.f, 0.f, 0.f)) == 6.f);
+    CHECK(inOrder({ 4, 3, 2, 1 }));
+}
@@ -0,0 +1,126 @@
+#include "job_system.h"
+#include "meshdata.h"
+#include "test.h"
+
+#include <algorithm>
+
+// generated normals of the unit sphere point away from its center, the plane's up
+TEST(meshdata_normals)
+{
+    for (auto weighting : { MeshData::NormalWeighting::Angle, MeshData::NormalWeighting::Area }) {
+        MeshData sphere(MeshData::ParametricType::Sphere, 16);
+        sphere.generateNormals(weighting);
+        float minDot = 1.f;
+        for (uint32_t v = 0; v < sphere.getNumVertices(); ++v)
+            minDot = std::min(minDot, glm::dot(sphere.getNormalsPtr()[v], glm::normalize(sphere.getPositionsPtr()[v])));
+        CHECK(minDot > 0.9f);
+
+        MeshData plane(MeshData::ParametricType::PlaneZ, 8);
+        plane.generateNormals(weighting);
+        for (uint32_t v = 0; v < plane.getNumVertices(); ++v)
+            CHECK(glm::dot(plane.getNormalsPtr()[v], glm::vec3(0, 0, 1)) > 0.999f);
+    }
+}
+
+// unit tangents perpendicular to the normals, bitangent sign in w
+TEST(meshdata_tangents)
+{
+    MeshData sphere(MeshData::ParametricType::Sphere, 16);
+    sphere.generateNormals();
+    sphere.generateTangents();
+    float maxError = 0.f;
+    for (uint32_t v = 0; v < sphere.getNumVertices(); ++v) {
+        const glm::vec4 tangent = sphere.getTangentsPtr()[v];
+        maxError = std::max(maxError, std::abs(glm::dot(glm::vec3(tangent), sphere.getNormalsPtr()[v])));
+        maxError = std::max(maxError, std::abs(glm::length(glm::vec3(tangent)) - 1.f));
+        CHECK(tangent.w == 1.f || tangent.w == -1.f);
+    }
+    CHECK(maxError < 1e-3f);
+}
+
+// vertices sum their corners in a fixed order, so the result doesn't depend on the threads
+TEST(meshdata_threads)
+{
+    JobSystem& jobs = getJobSystem();
+    const uint32_t numThreads = jobs.getNumThreads();
+    std::vector<float> results[2];
+    for (uint32_t i = 0; i < 2; ++i) {
+        jobs.setNumThreads(i ? 4 : 1);
+        MeshData data(MeshData::ParametricType::Sphere, 255);
+        data.generateNormals();
+        data.generateTangents();
+        const float* normals = &data.getNormalsPtr()->x;
+        const float* tangents = &data.getTangentsPtr()->x;
+        results[i].assign(normals, normals + data.getNumVertices() * 3);
+        results[i].insert(results[i].end(), tangents, tangents + data.getNumVertices() * 4);
+    }
+    jobs.setNumThreads(numThreads);
+    CHECK(results[0] == results[1]);
+}
+
+static bool hasRanges(const DirtyRanges& ranges, std::initializer_list<DirtyRanges::Range> expected)
+{
+    return ranges.size() == expected.size()
+        && std::equal(ranges.begin(), ranges.end(), expected.begin(), [](const DirtyRanges::Range& a, const DirtyRanges::Range& b) {
+               return a.first == b.first && a.end == b.end;
+           });
+}
+
+TEST(dirty_ranges_merge)
+{
+    DirtyRanges ranges;
+    ranges.add(5, 0);
+    CHECK(ranges.empty());
+
+    // adjacent ranges join, from either side
+    ranges.add(10, 5);
+    ranges.add(15, 5);
+    ranges.add(7, 3);
+    CHECK(hasRanges(ranges, { { 7, 20 } }));
+
+    // overlapping ones too, a range inside another changes nothing
+    ranges.add(18, 10);
+    ranges.add(9, 2);
+    CHECK(hasRanges(ranges, { { 7, 28 } }));
+
+    // disjoint ones stay sorted
+    ranges.add(40, 2);
+    ranges.add(0, 2);
+    ranges.add(32, 4);
+    CHECK(hasRanges(ranges, { { 0, 2 }, { 7, 28 }, { 32, 36 }, { 40, 42 } }));
+
+    // one range absorbs several, the ones around it stay
+    ranges.add(6, 31);
+    CHECK(hasRanges(ranges, { { 0, 2 }, { 6, 37 }, { 40, 42 } }));
+    ranges.add(1, 50);
+    CHECK(hasRanges(ranges, { { 0, 51 } }));
+
+    ranges.clear();
+    CHECK(ranges.empty());
+}
+
+// past s_maxRanges the two ranges with the smallest gap join, wherever the new one went
+TEST(dirty_ranges_limit)
+{
+    DirtyRanges ranges;
+    for (uint32_t i = 0; i < DirtyRanges::s_maxRanges; ++i)
+        ranges.add(i * 10, 1); // gaps of 9
+    CHECK(ranges.size() == DirtyRanges::s_maxRanges);
+
+    ranges.add(153, 1); // gap of 2 after [150, 151)
+    CHECK(ranges.size() == DirtyRanges::s_maxRanges);
+    CHECK(ranges.begin()[15].first == 150 && ranges.begin()[15].end == 154);
+
+    ranges.add(43, 1); // gap of 2 after [40, 41), the new range itself joins
+    CHECK(ranges.size() == DirtyRanges::s_maxRanges);
+    CHECK(ranges.begin()[4].first == 40 && ranges.begin()[4].end == 44);
+
+    ranges.add(45, 3); // 1 left of [40, 44), 3 right of [50, 51): the left gap closes
+    CHECK(ranges.size() == DirtyRanges::s_maxRanges);
+    CHECK(ranges.begin()[4].first == 40 && ranges.begin()[4].end == 48 && ranges.begin()[5].first == 50);
+
+    uint32_t covered = 0;
+    for (const DirtyRanges::Range& range : ranges)
+        covered += range.end - range.first;
+    CHECK(covered == 14 + 8 + 4); // joined gaps are dirty too
+}
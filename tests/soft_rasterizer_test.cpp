@@ -0,0 +1,58 @@
+#include "camera.h"
+#include "job_system.h"
+#include "soft_rasterizer.h"
+#include "test.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+static std::vector<uint32_t> render(SoftRasterizer& rasterizer, const MeshData& mesh, const std::vector<glm::mat4>& instances)
+{
+    const std::vector<Material> materials = { { { .8f, .3f, .3f } } };
+    Camera camera;
+    rasterizer.resize({ 200, 150 }); // not a multiple of s_tileSize
+    camera.setAR(200.f / 150.f);
+    rasterizer.setCamera(camera.getView(), camera.getProjection(), camera.getPos());
+    if (!instances.empty())
+        rasterizer.draw(mesh, instances, materials);
+    rasterizer.finish();
+    const glm::ivec2 size = rasterizer.getSize();
+    return std::vector<uint32_t>(rasterizer.getPixels(), rasterizer.getPixels() + size.x * size.y);
+}
+
+// the cube in front of the default camera covers the middle, not the corners
+TEST(soft_rasterizer_coverage)
+{
+    SoftRasterizer rasterizer;
+    const MeshData cube(MeshData::ParametricType::CylindricalNormalCube);
+    const std::vector<uint32_t> clear = render(rasterizer, cube, {});
+    const std::vector<uint32_t> pixels = render(rasterizer, cube, { glm::mat4(1) });
+    const uint32_t width = 200, height = 150;
+    CHECK(pixels[height / 2 * width + width / 2] != clear[height / 2 * width + width / 2]);
+    for (uint32_t corner : { 0u, width - 1, (height - 1) * width, height * width - 1 })
+        CHECK(pixels[corner] == clear[corner]);
+    CHECK(rasterizer.getStats().frames == 2 && rasterizer.getStats().rasterTriangles > 0);
+
+    // behind the camera nothing is drawn
+    const glm::mat4 behind = glm::translate(glm::mat4(1), glm::vec3(0.f, -20.f, 0.f));
+    CHECK(render(rasterizer, cube, { behind }) == clear);
+}
+
+// tiles and bins are merged in a fixed order, so the image doesn't depend on the threads
+TEST(soft_rasterizer_threads)
+{
+    const MeshData sphere(MeshData::ParametricType::Sphere, 16);
+    std::vector<glm::mat4> instances;
+    for (int i = 0; i < 50; ++i)
+        instances.push_back(glm::scale(glm::translate(glm::mat4(1), glm::vec3(i % 7 - 3.f, i % 5 * 0.5f, i % 3 - 1.f)), glm::vec3(.4f)));
+
+    JobSystem& jobs = getJobSystem();
+    const uint32_t numThreads = jobs.getNumThreads();
+    std::vector<uint32_t> images[3];
+    for (uint32_t i = 0; i < 3; ++i) {
+        jobs.setNumThreads(1u << (i * 2)); // 1, 4, 16
+        SoftRasterizer rasterizer;
+        images[i] = render(rasterizer, sphere, instances);
+    }
+    jobs.setNumThreads(numThreads);
+    CHECK(images[0] == images[1] && images[0] == images[2]);
+}
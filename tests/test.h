@@ -0,0 +1,33 @@
+#ifndef TEST_H
+#define TEST_H
+
+// Checks of the tests target: TEST(name) registers a function, CHECK(condition) reports
+// a failed condition with its location and carries on. `tests` runs every test, `tests
+// name` just one (CTest runs each on its own); the exit code is 1 if any check failed.
+
+typedef void (*TestFunc)();
+
+class Window;
+
+// hidden 1000x600 window with the GL context of the tests CTest labels `gpu`, created
+// on first use; deliberately not a power of two
+Window& getTestWindow();
+
+struct TestRegistration {
+    TestRegistration(const char* name, TestFunc func);
+};
+
+void reportFailure(const char* file, int line, const char* condition);
+
+#define TEST(name)                                                    \
+    static void test_##name();                                        \
+    static const TestRegistration s_##name##Test(#name, test_##name); \
+    static void test_##name()
+
+#define CHECK(condition)                                   \
+    do {                                                   \
+        if (!(condition))                                  \
+            reportFailure(__FILE__, __LINE__, #condition); \
+    } while (false)
+
+#endif // TEST_H
@@ -0,0 +1,51 @@
+#include "test.h"
+#include "window.h"
+
+#include <cstdint> // uintXX_t
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+static std::vector<std::pair<const char*, TestFunc>>& getTests()
+{
+    static std::vector<std::pair<const char*, TestFunc>> tests; // filled before main() by TEST()
+    return tests;
+}
+
+static uint32_t s_numFailures {};
+
+TestRegistration::TestRegistration(const char* name, TestFunc func)
+{
+    getTests().emplace_back(name, func);
+}
+
+Window& getTestWindow()
+{
+    static Window window(1000, 600, 1, true);
+    return window;
+}
+
+void reportFailure(const char* file, int line, const char* condition)
+{
+    std::cout << file << ":" << line << ": CHECK(" << condition << ") failed" << std::endl;
+    s_numFailures++;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t numRun = 0;
+    for (const auto& [name, func] : getTests()) {
+        if (argc > 1 && strcmp(argv[1], name))
+            continue;
+        const uint32_t failuresBefore = s_numFailures;
+        func();
+        std::cout << name << ": " << (s_numFailures == failuresBefore ? "passed" : "FAILED") << std::endl;
+        numRun++;
+    }
+    if (!numRun) {
+        std::cout << "no test " << argv[1] << std::endl;
+        return 1;
+    }
+    return s_numFailures ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+#include "shader.h"
+#include "test.h"
+#include "vertex_layout.h"
+
+#include <string>
+
+// the layouts of the demo and one with every other attribute MeshData can fill
+typedef VertexLayout<
+    Attr<VertexAttribute::Type::Position, MeshAttribFormat::Float3>,
+    Attr<VertexAttribute::Type::Normal, MeshAttribFormat::Half4>>
+    DemoLayout;
+typedef VertexLayout<
+    Attr<VertexAttribute::Type::Position, MeshAttribFormat::Float3>,
+    Attr<VertexAttribute::Type::Normal, MeshAttribFormat::Half4>,
+    Attr<VertexAttribute::Type::Joints, MeshAttribFormat::Uint8x4>,
+    Attr<VertexAttribute::Type::Weights, MeshAttribFormat::Unorm8x4>>
+    SkinnedLayout;
+typedef VertexLayout<
+    Attr<VertexAttribute::Type::Position, MeshAttribFormat::Float3>,
+    Attr<VertexAttribute::Type::Normal, MeshAttribFormat::Float3>>
+    FloatLayout;
+typedef VertexLayout<
+    Attr<VertexAttribute::Type::Color, MeshAttribFormat::Unorm8x4>,
+    Attr<VertexAttribute::Type::Tan, MeshAttribFormat::Half4>,
+    Attr<VertexAttribute::Type::BiTan, MeshAttribFormat::Float4>,
+    Attr<VertexAttribute::Type::Position, MeshAttribFormat::Float4>>
+    TangentLayout;
+
+template <typename Layout>
+static bool matchesRuntime(ShaderFeature features)
+{
+    constexpr auto declarations = Layout::getShaderDeclarations(); // evaluated at compile time
+    return declarations.c_str() == getVertexAttributeDeclarations(Layout::getAttribData(), features);
+}
+
+// compile-time declarations give the same text as the ones Shader generates at runtime
+TEST(vertex_layout_declarations)
+{
+    CHECK(matchesRuntime<DemoLayout>(ShaderFeature::None));
+    CHECK(matchesRuntime<SkinnedLayout>(ShaderFeature::Skinning));
+    CHECK(matchesRuntime<FloatLayout>(ShaderFeature::None));
+    CHECK(matchesRuntime<TangentLayout>(ShaderFeature::None));
+    CHECK(std::string(DemoLayout::getShaderDeclarations().c_str())
+        == "layout (location = 0) in vec3 vertexPosition;\n"
+           "layout (location = 1) in vec4 vertexNormal;\n");
+}